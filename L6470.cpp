@@ -120,8 +120,13 @@ L6470::L6470(uint8_t ss, uint8_t busy, std::function<uint8_t(int)> proc) :
      m_SS(ss), m_BUSY(busy),
      m_limitProc(proc), m_homeCompleted(false),
      m_status(0), m_alarmFlag(0), m_switchEvent(false), m_homingState(0),
-     m_homingDir(DIR_REVERSE), m_homingSpeed(10000), m_savedMaxSpeed(16)
+     m_homingDir(DIR_REVERSE), m_homingSpeed(10000), m_savedMaxSpeed(16),
+     m_stallDetection(true)
 {
+     for( int n = 0 ; n < 32 ; n++ )
+     {
+          m_writtenParam[n] = 0;
+     }
      pinMode(m_SS, OUTPUT);
      pinMode(m_BUSY, INPUT);
      initialize();
@@ -220,6 +225,7 @@ void L6470::setParam(uint8_t id, uint32_t val)
           return; 
      }
      transfer(PARAM_ADDR[id], PARAM_SIZE[id], val);
+     m_writtenParam[id] = val;
 }
 
 //------------------------------------------------------------------------------
@@ -253,7 +259,7 @@ void L6470::initialize()
                                              //   PRM_CONFIG の SW_MODE は必ず1にすること。
                                              //   デフォルトの0だと原点を遮光しただけで HardStop が実行される。
                                              //   (移動中であれば即時停止。励磁を切っている状態で信号が入力すると励磁してしまう)
-     // setParam(L6470::PRM_STALL_TH, 0x7F);
+     setParam(L6470::PRM_STALL_TH, STALL_TH_DEFAULT);   // [R, WR] ストール検出しきい値 (STEP_LOSS_A/B の判定に使われる)
      // setParam(L6470::PRM_K_THERM, 0x0F);
      // 電源投入直後は WRONG_CMD などのアラームビットが立っている可能性が
      // あるので、ここでクリアしておく
@@ -291,8 +297,13 @@ void L6470::execControl()
      // m_alarmFlag |= getAlarm_TH_WARN(m_status);
      m_alarmFlag |= getAlarm_TH_SD(m_status);
      m_alarmFlag |= getAlarm_OCD(m_status);
-     //m_alarmFlag |= getAlarm_STEP_LOSS_A(m_status);
-     //m_alarmFlag |= getAlarm_STEP_LOSS_B(m_status);
+     // STEP_LOSS は通常の移動中のみ判定する
+     // (停止中や原点復帰中の低速動作ではストール検出が安定しないため)
+     if( m_stallDetection && m_inMotion && m_homingState == 0 )
+     {
+          m_alarmFlag |= getAlarm_STEP_LOSS_A(m_status);
+          m_alarmFlag |= getAlarm_STEP_LOSS_B(m_status);
+     }
 
      if( m_homeCompleted == true && m_alarmFlag != 0 )
      {
@@ -599,7 +610,7 @@ bool L6470::isExtSwitchTriggered()
 //------------------------------------------------------------------------------
 bool L6470::isAlarmHappened()
 {
-     return (m_alarmFlag & 0x3F) != 0;
+     return m_alarmFlag != ALM_NONE;
 }
 
 //------------------------------------------------------------------------------
@@ -613,6 +624,7 @@ bool L6470::isAlarmHappened()
 //   bit4: OCD         (過電流検出)
 //   bit5: STEP_LOSS_A (A相ストール検出)
 //   bit6: STEP_LOSS_B (B相ストール検出)
+//   bit7: POSITION    (位置偏差。raiseAlarm() で設定される)
 //------------------------------------------------------------------------------
 uint8_t L6470::getAlarmFlag()
 {
@@ -628,6 +640,19 @@ void L6470::clearAlarm()
      m_alarmFlag = 0;
 }
 
+//------------------------------------------------------------------------------
+//   上位側で検出した異常をアラームとして設定する
+//   (クリアされるまで isAlarmHappened() が true となり，原点復帰完了も解除される)
+//------------------------------------------------------------------------------
+void L6470::raiseAlarm(uint8_t flag)
+{
+     m_alarmFlag |= flag;
+     if( m_alarmFlag != ALM_NONE )
+     {
+          m_homeCompleted = false;
+     }
+}
+
 //------------------------------------------------------------------------------
 //   エンドリミット入力信号の状態を取得
 //------------------------------------------------------------------------------
@@ -863,6 +888,16 @@ int32_t L6470::getAbsPos()
 {
      return m_position;
 }
+
+//------------------------------------------------------------------------------
+//   ABS_POS を読み直して返す (execControl() の周期を待たずに現在位置が要るとき)
+//------------------------------------------------------------------------------
+int32_t L6470::updateAbsPos()
+{
+     internalUpdatePosition();
+     return m_position;
+}
+
 void L6470::internalUpdatePosition()
 {
      uint32_t pos = getParam(PRM_ABS_POS);
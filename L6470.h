@@ -49,6 +49,8 @@ class L6470
           uint32_t  m_savedMaxSpeed;         // 原点復帰での低速動作時に元のMAX_SPEEDレジスタ値を退避するためのバッファ
           bool      m_homeCompleted;         // 電源投入後に原点復帰動作が正常に完了したらtrue
           bool      m_enableLimitInput;      // エンドリミット信号入力を扱う場合はtrue
+          bool      m_stallDetection;        // STEP_LOSS_A/B をアラームとして扱う場合はtrue
+          uint32_t  m_writtenParam[32];      // setParam で書き込んだ値の控え(SPI通信なしで参照するため)
 
           enum{HOMING_ABORT = 99};      // 原点復帰中に softStop, hardStop で停止させた場合、m_homingState がこの値になる
                                         // (softHIZ, hardHIZ で停止させた場合は execHoming() 内で -1 になる)
@@ -107,7 +109,11 @@ class L6470
                ALM_OCD         = 0x10,  // 過電流検出                 (L6470/L6480)
                ALM_STEP_LOSS_A = 0x20,  // A相ストール検出            (L6470/L6480)
                ALM_STEP_LOSS_B = 0x40,  // B相ストール検出            (L6470/L6480)
+               ALM_POSITION    = 0x80,  // 位置偏差(計画した速度プロファイルとの不一致。上位側で検出する)
+
+               ALM_STALL_MASK  = ALM_STEP_LOSS_A | ALM_STEP_LOSS_B | ALM_POSITION
           };
+          enum{ STALL_TH_DEFAULT = 0x40 };   // ストール検出しきい値 default 0x40 (7bit) (31.25*val+31.25[mA])
 
           // パラメータの識別子
           // この識別子の値は、パラメータの「アドレス」とは異なるので注意
@@ -172,6 +178,9 @@ class L6470
           int      getHomingState();
           bool     isHomeCompleted();
           void     clearAlarm();
+          void     raiseAlarm(uint8_t flag);
+          void     setStallDetection(bool enable){ m_stallDetection = enable; }
+          bool     isStallDetectionEnabled() const { return m_stallDetection; }
           void     startHoming(uint8_t dir, uint32_t spd);
           void     run(uint8_t dir, uint32_t spd);
           void     relativeMove(uint8_t dir, uint32_t distance);
@@ -187,9 +196,11 @@ class L6470
           void     softHIZ();
           void     hardHIZ();
           int32_t  getAbsPos();
+          int32_t  updateAbsPos();
           int32_t  getSpeed();
           uint32_t getParam(uint8_t id);
           void     setParam(uint8_t id, uint32_t val);
+          uint32_t getWrittenParam(uint8_t id) const { return (id < 32)? m_writtenParam[id] : 0; }
           bool     readParamFromEEPROM(int offset);
           void     writeParamToEEPROM(int offset);
 };
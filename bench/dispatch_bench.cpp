@@ -0,0 +1,357 @@
+//------------------------------------------------------------------------------
+//   dispatch_bench.cpp
+//
+//   コマンドの振り分けとリクエスト解析のベンチマーク
+//   同じリクエスト列 (Moveto, Move3D, WriteParam, Gripper, MoveXYZ) を
+//     map    : std::map<int, CommandObject *> で引き，readXXXData() で
+//              オフセットごとに読み出す (以前の CommandManager の方式)
+//     schema : ID で引く配列で引き，command_schema.h の SchemaLayout で解析する
+//              (SchemaCommand の方式)
+//   で処理し，１リクエストあたりの時間を比べる
+//   Robot は使わず，解析した値を合計するだけなので，振り分けと解析の分だけが出る
+//
+//   usage:
+//     dispatch_bench [リクエスト数 (百万)]
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "packet.h"
+#include "command_schema.h"
+
+typedef std::chrono::steady_clock Clock;
+
+enum{ NUM_MOTORS = 3 };
+enum{ STS_OK = 0, STS_INVALID = 2 };
+enum{ REPEAT = 5 };
+
+static int64_t g_sink;
+
+//==============================================================================
+//   以前の方式
+//==============================================================================
+class MapCommand
+{
+     public:
+          virtual ~MapCommand(){}
+          virtual uint8_t execute(Packet *request) = 0;
+};
+
+//------------------------------------------------------------------------------
+class MapMoveto : public MapCommand
+{
+     public:
+          uint8_t execute(Packet *request)
+          {
+               uint16_t motorID;
+               if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
+               {
+                    return STS_INVALID;
+               }
+               int32_t destpos;
+               if( !request->readInt32Data(2, &destpos) )
+               {
+                    return STS_INVALID;
+               }
+               uint8_t flag = 0;
+               request->readUInt8Data(6, &flag);
+               g_sink += motorID + destpos + flag;
+               return STS_OK;
+          }
+};
+
+//------------------------------------------------------------------------------
+class MapMove3D : public MapCommand
+{
+     public:
+          uint8_t execute(Packet *request)
+          {
+               int32_t destpos[3];
+               for( int axis = 0 ; axis < NUM_MOTORS ; axis++ )
+               {
+                    if( !request->readInt32Data(axis*4, &destpos[axis]) )
+                    {
+                         return STS_INVALID;
+                    }
+               }
+               uint8_t flag = 0;
+               request->readUInt8Data(12, &flag);
+               g_sink += destpos[0] + destpos[1] + destpos[2] + flag;
+               return STS_OK;
+          }
+};
+
+//------------------------------------------------------------------------------
+class MapWriteParam : public MapCommand
+{
+     public:
+          uint8_t execute(Packet *request)
+          {
+               uint16_t motorID, paramID;
+               uint32_t value;
+               if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
+               {
+                    return STS_INVALID;
+               }
+               if( !request->readUInt16Data(2, &paramID) || (paramID >= 32) )
+               {
+                    return STS_INVALID;
+               }
+               if( !request->readUInt32Data(4, &value) )
+               {
+                    return STS_INVALID;
+               }
+               g_sink += motorID + paramID + value;
+               return STS_OK;
+          }
+};
+
+//------------------------------------------------------------------------------
+class MapGripper : public MapCommand
+{
+     public:
+          uint8_t execute(Packet *request)
+          {
+               uint8_t value;
+               if( !request->readUInt8Data(0, &value) || (value > 100) )
+               {
+                    return STS_INVALID;
+               }
+               g_sink += value;
+               return STS_OK;
+          }
+};
+
+//------------------------------------------------------------------------------
+class MapMoveXYZ : public MapCommand
+{
+     public:
+          uint8_t execute(Packet *request)
+          {
+               int32_t pos[3];
+               uint32_t speed, accel;
+               for( int n = 0 ; n < 3 ; n++ )
+               {
+                    if( !request->readInt32Data(n*4, &pos[n]) )
+                    {
+                         return STS_INVALID;
+                    }
+               }
+               if( !request->readUInt32Data(12, &speed) || !request->readUInt32Data(16, &accel) )
+               {
+                    return STS_INVALID;
+               }
+               uint8_t flag = 0;
+               request->readUInt8Data(20, &flag);
+               g_sink += pos[0] + pos[1] + pos[2] + speed + accel + flag;
+               return STS_OK;
+          }
+};
+
+//==============================================================================
+//   スキーマの方式 (SchemaCommand と同じ流れ)
+//==============================================================================
+class TableCommand
+{
+     public:
+          virtual ~TableCommand(){}
+          virtual uint8_t execute(Packet *request) = 0;
+};
+
+//------------------------------------------------------------------------------
+template<typename SCHEMA>
+class TableSchemaCommand : public TableCommand
+{
+     protected:
+          typedef typename SCHEMA::Request Request;
+          virtual uint8_t perform(const Request& request) = 0;
+     public:
+          uint8_t execute(Packet *request)
+          {
+               Request req = Request();
+               if( !SCHEMA::RequestLayout::decode(request->getData(), request->getDataLength(), req) )
+               {
+                    return STS_INVALID;
+               }
+               return perform(req);
+          }
+};
+
+//------------------------------------------------------------------------------
+class TableMoveto : public TableSchemaCommand<MovetoSchema>
+{
+     protected:
+          uint8_t perform(const Request& r){ g_sink += r.motorID + r.position + r.completion; return STS_OK; }
+};
+
+class TableMove3D : public TableSchemaCommand<Move3DSchema>
+{
+     protected:
+          uint8_t perform(const Request& r){ g_sink += r.position[0] + r.position[1] + r.position[2] + r.completion; return STS_OK; }
+};
+
+class TableWriteParam : public TableSchemaCommand<WriteParamSchema>
+{
+     protected:
+          uint8_t perform(const Request& r){ g_sink += r.motorID + r.paramID + r.value; return STS_OK; }
+};
+
+class TableGripper : public TableSchemaCommand<GripperSchema>
+{
+     protected:
+          uint8_t perform(const Request& r){ g_sink += r.value; return STS_OK; }
+};
+
+class TableMoveXYZ : public TableSchemaCommand<MoveXYZSchema>
+{
+     protected:
+          uint8_t perform(const Request& r)
+          {
+               g_sink += r.position[0] + r.position[1] + r.position[2] + r.speed + r.accel + r.completion;
+               return STS_OK;
+          }
+};
+
+//------------------------------------------------------------------------------
+//   テスト用のリクエスト列 (受信したパケットと同じく，解析済みの Packet)
+//------------------------------------------------------------------------------
+static void makeRequests(std::vector<Packet *>& requests)
+{
+     std::srand(1);
+     for( int n = 0 ; n < 1000 ; n++ )
+     {
+          Packet *p = new Packet();
+          int32_t v = std::rand() % 20000 - 10000;
+          switch( n % 5 )
+          {
+               case 0:
+               {
+                    uint16_t motorID = n % 3;
+                    p->create(MovetoSchema::ID, (uint8_t)n);
+                    p->addPacketData(&motorID, 2);
+                    p->addPacketData(&v, 4);
+                    break;
+               }
+               case 1:
+               {
+                    int32_t pos[3] = { v, -v, v / 2 };
+                    uint8_t flag = 1;
+                    p->create(Move3DSchema::ID, (uint8_t)n);
+                    p->addPacketData(pos, sizeof(pos));
+                    p->addPacketData(&flag, 1);
+                    break;
+               }
+               case 2:
+               {
+                    uint16_t id[2] = { (uint16_t)(n % 3), (uint16_t)(n % 32) };
+                    uint32_t value = (uint32_t)v;
+                    p->create(WriteParamSchema::ID, (uint8_t)n);
+                    p->addPacketData(id, sizeof(id));
+                    p->addPacketData(&value, 4);
+                    break;
+               }
+               case 3:
+               {
+                    uint8_t value = n % 101;
+                    p->create(GripperSchema::ID, (uint8_t)n);
+                    p->addPacketData(&value, 1);
+                    break;
+               }
+               default:
+               {
+                    int32_t pos[3] = { 20000, v, 15000 };
+                    uint32_t param[2] = { 5000, 20000 };
+                    p->create(MoveXYZSchema::ID, (uint8_t)n);
+                    p->addPacketData(pos, sizeof(pos));
+                    p->addPacketData(param, sizeof(param));
+                    break;
+               }
+          }
+          requests.push_back(p);
+     }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     int64_t count = (argc > 1)? std::atoi(argv[1]) * 1000000LL : 10000000LL;
+
+     std::vector<Packet *> requests;
+     makeRequests(requests);
+
+     std::map<int, MapCommand *> map;
+     map[MovetoSchema::ID    ] = new MapMoveto();
+     map[Move3DSchema::ID    ] = new MapMove3D();
+     map[WriteParamSchema::ID] = new MapWriteParam();
+     map[GripperSchema::ID   ] = new MapGripper();
+     map[MoveXYZSchema::ID   ] = new MapMoveXYZ();
+     // 実際の表と同じ数だけ登録しておく (探索の深さを揃えるため)
+     int others[] = { EnableSchema::ID, ResetSchema::ID, StopSchema::ID, HomingSchema::ID, ReadParamSchema::ID,
+          SaveParamSchema::ID, StatusSchema::ID, FeedOverrideSchema::ID, MoveJointSchema::ID, SubscribeSchema::ID, WaypointsSchema::ID };
+     for( size_t n = 0 ; n < sizeof(others) / sizeof(others[0]) ; n++ )
+     {
+          map[others[n]] = NULL;
+     }
+
+     TableCommand *table[256] = { NULL };
+     table[MovetoSchema::ID    ] = new TableMoveto();
+     table[Move3DSchema::ID    ] = new TableMove3D();
+     table[WriteParamSchema::ID] = new TableWriteParam();
+     table[GripperSchema::ID   ] = new TableGripper();
+     table[MoveXYZSchema::ID   ] = new TableMoveXYZ();
+
+     std::printf("method   ns/request   requests/s   (checksum)\n");
+     for( int method = 0 ; method < 2 ; method++ )
+     {
+          double best = 1e9;
+          int64_t sum = 0;
+          for( int r = 0 ; r < REPEAT ; r++ )
+          {
+               g_sink = 0;
+               int failed = 0;
+               Clock::time_point t0 = Clock::now();
+               for( int64_t n = 0 ; n < count ; n++ )
+               {
+                    Packet *request = requests[n % requests.size()];
+                    int id = request->getID();
+                    if( method == 0 )
+                    {
+                         std::map<int, MapCommand *>::iterator f = map.find(id);
+                         if( f != map.end() && f->second != NULL )
+                         {
+                              failed += f->second->execute(request);
+                         }
+                    }
+                    else
+                    {
+                         TableCommand *command = table[id];
+                         if( command != NULL )
+                         {
+                              failed += command->execute(request);
+                         }
+                    }
+               }
+               best = std::min(best, std::chrono::duration<double>(Clock::now() - t0).count());
+               sum = g_sink + failed;
+          }
+          std::printf("%-8s %10.1f %12.0f   (%lld)\n", (method == 0)? "map" : "schema",
+               best / count * 1e9, count / best, (long long)sum);
+     }
+
+     for( size_t n = 0 ; n < requests.size() ; n++ )
+     {
+          delete requests[n];
+     }
+     for( std::map<int, MapCommand *>::iterator i = map.begin() ; i != map.end() ; ++i )
+     {
+          delete i->second;
+     }
+     for( int id = 0 ; id < 256 ; id++ )
+     {
+          delete table[id];
+     }
+     return 0;
+}
@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+//   jog_latency.cpp
+//
+//   UDP ジョグのループバック・レイテンシ測定
+//   JogServer をテスト用のポートで起動し，同じプロセスからジョグのデータグラムを送って，
+//   sendto() の直前から Robot::jog() が RUN コマンドを SPI に書き終えるまでの時間を測る
+//
+//   実機で動かすこと (BASE 軸を ±SPEED pulse/sec で交互にわずかに動かす)
+//   モータの励磁が入っていて，アラームのない状態で実行する
+//
+//   usage:
+//     jog_latency [データグラム数 [送信間隔 (us)]]
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <wiringPi.h>
+#include <wiringPiSPI.h>
+#include "robot.h"
+#include "jog_server.h"
+#include "command_client.h"
+
+typedef std::chrono::steady_clock Clock;
+
+enum{ TEST_PORT = 12470 };
+enum{ SPEED = 200 };
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     int count = (argc > 1)? std::atoi(argv[1]) : 2000;
+     int interval = (argc > 2)? std::atoi(argv[2]) : 5000;
+
+     wiringPiSetupGpio();
+     wiringPiSPISetupMode(L6470::SPI_CHANNEL, 1000000, 3);
+     Robot *robot = new Robot();
+     robot->initialize();
+
+     JogServer *server = new JogServer(robot, TEST_PORT);
+     if( server->getState() != JogServer::LISTENING )
+     {
+          return 1;
+     }
+
+     std::vector<Clock::time_point> sent(count);
+     std::vector<Clock::time_point> applied(count);
+     std::vector<bool> done(count, false);
+     server->setAppliedHook([&](uint32_t sequence){
+          if( sequence < (uint32_t)count )
+          {
+               applied[sequence] = Clock::now();
+               done[sequence] = true;
+          }
+     });
+
+     int fd = socket(AF_INET, SOCK_DGRAM, 0);
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+     addr.sin_port = htons(TEST_PORT);
+
+     Packet packet;
+     std::vector<uint8_t> raw;
+     for( int n = 0 ; n < count ; n++ )
+     {
+          // 毎回速度を変えて，必ず RUN コマンドが送られるようにする
+          JogSchema::Request request = { (uint32_t)n, { (n % 2)? -SPEED : SPEED, 0, 0 } };
+          makeRequest<JogSchema>(packet, (uint8_t)n, request);
+          packet.getRawBytes(raw);
+          sent[n] = Clock::now();
+          sendto(fd, raw.data(), raw.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
+          std::this_thread::sleep_for(std::chrono::microseconds(interval));
+     }
+     int32_t stop[3] = { 0, 0, 0 };
+     JogSchema::Request request = { (uint32_t)count, { stop[0], stop[1], stop[2] } };
+     makeRequest<JogSchema>(packet, 0, request);
+     packet.getRawBytes(raw);
+     sendto(fd, raw.data(), raw.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
+     std::this_thread::sleep_for(std::chrono::milliseconds(JogServer::DEADMAN_MS * 2));
+     close(fd);
+
+     server->setAppliedHook(nullptr);
+     std::vector<double> latency;
+     for( int n = 0 ; n < count ; n++ )
+     {
+          if( done[n] )
+          {
+               latency.push_back(std::chrono::duration<double, std::micro>(applied[n] - sent[n]).count());
+          }
+     }
+     JogServer::Stats stats;
+     server->getStats(&stats);
+     std::printf("received %llu  applied %llu  late %llu  superseded %llu  invalid %llu  refused %llu  deadman %llu\n",
+          (unsigned long long)stats.received, (unsigned long long)stats.applied, (unsigned long long)stats.late,
+          (unsigned long long)stats.superseded, (unsigned long long)stats.invalid, (unsigned long long)stats.refused,
+          (unsigned long long)stats.deadman);
+     if( latency.empty() )
+     {
+          std::printf("no jog was applied (motors disabled or alarm?)\n");
+     }
+     else
+     {
+          std::sort(latency.begin(), latency.end());
+          size_t n = latency.size();
+          std::printf("packet -> SPI RUN (us) : min %.1f  p50 %.1f  p99 %.1f  max %.1f  (%zu samples)\n",
+               latency[0], latency[n / 2], latency[std::min(n - 1, n * 99 / 100)], latency[n - 1], n);
+     }
+
+     delete server;
+     delete robot;
+     return 0;
+}
@@ -0,0 +1,310 @@
+//------------------------------------------------------------------------------
+//   load_gen.cpp
+//
+//   コマンドサーバの負荷試験
+//   CommandClient で指定したレートのリクエストを送り続け (応答を待たずに送る)，
+//   コマンドID ごとの往復時間の p50 / p99 / p999 を表示する
+//   送信時刻は前もって決めておき，遅れても詰めて送らない (遅れた分も往復時間に含まれない
+//   ので，late の数も確認すること)
+//
+//   負荷をかけてもロボットが動かないよう，読み出しだけのコマンドを使う
+//     6 : ReadParam (モータ 0 ～ 2 を順に)，9 : Status，13 : FeedOverride (取得のみ)
+//
+//   -l を付けると，同じプロセス内に応答を返すだけのサーバ (TcpServer) を起動してそこへ送る
+//   (実機なしでクライアントとネットワークの分を測る)
+//
+//   usage:
+//     load_gen [-h ホスト] [-p ポート] [-r リクエスト/sec] [-t 測定時間(sec)]
+//              [-c 接続数] [-i コマンドID,...] [-l]
+//------------------------------------------------------------------------------
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "packet.h"
+#include "event_server.h"
+#include "command_schema.h"
+#include "command_client.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int LOOPBACK_PORT = 12471;
+
+//------------------------------------------------------------------------------
+struct Sample
+{
+     uint8_t id;
+     std::future<CommandClient::Reply> reply;
+};
+
+struct IDResult
+{
+     long   sent;
+     long   statusError;       // ステータスが STS_OK 以外
+     long   timeout;
+     long   disconnected;
+     long   busy;
+     std::vector<double> rtt;  // us
+};
+
+//------------------------------------------------------------------------------
+//   ID ごとのリクエスト (読み出しだけのもの)
+//------------------------------------------------------------------------------
+static bool isSupported(int id)
+{
+     return id == ReadParamSchema::ID || id == StatusSchema::ID || id == FeedOverrideSchema::ID;
+}
+
+//------------------------------------------------------------------------------
+static std::future<CommandClient::Reply> sendRequest(CommandClient& client, uint8_t id, long count)
+{
+     if( id == ReadParamSchema::ID )
+     {
+          ReadParamSchema::Request request = { (uint16_t)(count % SCHEMA_NUM_MOTORS) };
+          return client.call<ReadParamSchema>(request);
+     }
+     if( id == FeedOverrideSchema::ID )
+     {
+          FeedOverrideSchema::Request request = { 0 };
+          return client.call<FeedOverrideSchema>(request);
+     }
+     return client.call<StatusSchema>(StatusSchema::Request());
+}
+
+//------------------------------------------------------------------------------
+//   -l のサーバの応答のデータ部 (ステータスの後) の長さ
+//------------------------------------------------------------------------------
+static int getResponseSize(uint8_t id)
+{
+     switch( id )
+     {
+          case ReadParamSchema::ID:     return ReadParamSchema::ResponseLayout::SIZE;
+          case StatusSchema::ID:        return StatusSchema::ResponseLayout::SIZE;
+          case FeedOverrideSchema::ID:  return FeedOverrideSchema::ResponseLayout::SIZE;
+     }
+     return 0;
+}
+
+//------------------------------------------------------------------------------
+//   １接続分の送信
+//   start + n / rate の時刻に n 番目のリクエストを送る
+//------------------------------------------------------------------------------
+static void runClient(CommandClient *client, const std::vector<uint8_t> *ids, double rate,
+     Clock::time_point start, Clock::time_point end, std::vector<Sample> *samples, long *late)
+{
+     *late = 0;
+     for( long n = 0 ; ; n++ )
+     {
+          Clock::time_point at = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(n / rate));
+          if( at >= end )
+          {
+               break;
+          }
+          Clock::time_point now = Clock::now();
+          if( now < at )
+          {
+               std::this_thread::sleep_until(at);
+          }
+          else if( now - at > std::chrono::milliseconds(1) )
+          {
+               (*late)++;
+          }
+          Sample sample;
+          sample.id = (*ids)[n % ids->size()];
+          sample.reply = sendRequest(*client, sample.id, n);
+          samples->push_back(std::move(sample));
+     }
+}
+
+//------------------------------------------------------------------------------
+static double percentile(const std::vector<double>& sorted, double q)
+{
+     size_t n = sorted.size();
+     return sorted[std::min(n - 1, (size_t)(n * q))];
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     const char *host = "127.0.0.1";
+     int port = TcpServer::PORT;
+     double rate = 200;
+     double seconds = 5;
+     int connections = 1;
+     const char *idList = "9";
+     bool loopback = false;
+
+     int opt;
+     while( (opt = getopt(argc, argv, "h:p:r:t:c:i:l")) != -1 )
+     {
+          switch( opt )
+          {
+               case 'h': host = optarg; break;
+               case 'p': port = std::atoi(optarg); break;
+               case 'r': rate = std::atof(optarg); break;
+               case 't': seconds = std::atof(optarg); break;
+               case 'c': connections = std::atoi(optarg); break;
+               case 'i': idList = optarg; break;
+               case 'l': loopback = true; break;
+               default:
+                    std::fprintf(stderr, "usage: load_gen [-h host] [-p port] [-r requests/s] [-t sec] [-c connections] [-i id,...] [-l]\n");
+                    return 1;
+          }
+     }
+     connections = std::max(1, std::min(connections, (int)TcpServer::MAX_SESSIONS));
+     if( rate <= 0 || seconds <= 0 )
+     {
+          std::fprintf(stderr, "[load_gen] rate and time must be positive\n");
+          return 1;
+     }
+
+     std::vector<uint8_t> ids;
+     for( const char *p = idList ; *p ; )
+     {
+          char *next;
+          long id = std::strtol(p, &next, 10);
+          if( next == p || !isSupported((int)id) )
+          {
+               std::fprintf(stderr, "[load_gen] unsupported command ID in \"%s\" (6, 9 and 13 only)\n", idList);
+               return 1;
+          }
+          ids.push_back((uint8_t)id);
+          p = (*next == ',')? next + 1 : next;
+     }
+
+     // 応答を返すだけのサーバ
+     TcpServer *server = NULL;
+     std::atomic<bool> terminated(false);
+     std::thread *responder = NULL;
+     if( loopback )
+     {
+          host = "127.0.0.1";
+          port = LOOPBACK_PORT;
+          server = new TcpServer(port);
+          if( server->getState() != TcpServer::LISTENING )
+          {
+               return 1;
+          }
+          responder = new std::thread([&](){
+               Packet response;
+               uint8_t data[Packet::MAX_DATA_LENGTH];
+               memset(data, 0, sizeof(data));
+               while( !terminated )
+               {
+                    uint32_t session;
+                    Packet *request = server->getRequest(&session, 100);
+                    if( request == NULL )
+                    {
+                         continue;
+                    }
+                    response.create(request->getID(), request->getSerialNo());
+                    response.addPacketData(data, 1 + getResponseSize(request->getID()));
+                    server->sendResponse(session, response);
+                    server->releaseRequest(request);
+               }
+          });
+     }
+
+     std::vector<CommandClient *> clients;
+     for( int n = 0 ; n < connections ; n++ )
+     {
+          CommandClient *client = new CommandClient(host, port);
+          if( !client->waitConnected(3000) )
+          {
+               std::fprintf(stderr, "[load_gen] cannot connect to %s:%d\n", host, port);
+               return 1;
+          }
+          clients.push_back(client);
+     }
+
+     std::printf("%s:%d  %d connection(s)  %.0f requests/s  %.1f sec  IDs %s\n\n",
+          host, port, connections, rate, seconds, idList);
+
+     std::vector<std::vector<Sample> > samples(connections);
+     std::vector<long> late(connections);
+     std::vector<std::thread *> threads;
+     Clock::time_point start = Clock::now() + std::chrono::milliseconds(10);
+     Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+     for( int n = 0 ; n < connections ; n++ )
+     {
+          // 接続ごとに送信時刻をずらす
+          Clock::time_point offset = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(n / rate));
+          threads.push_back(new std::thread(runClient, clients[n], &ids, rate / connections, offset, end, &samples[n], &late[n]));
+     }
+     for( size_t n = 0 ; n < threads.size() ; n++ )
+     {
+          threads[n]->join();
+          delete threads[n];
+     }
+
+     // 集計
+     IDResult results[256];
+     for( int n = 0 ; n < 256 ; n++ )
+     {
+          results[n].sent = results[n].statusError = results[n].timeout = results[n].disconnected = results[n].busy = 0;
+     }
+     long total = 0, totalLate = 0;
+     Clock::time_point last = start;
+     for( int c = 0 ; c < connections ; c++ )
+     {
+          totalLate += late[c];
+          for( size_t n = 0 ; n < samples[c].size() ; n++ )
+          {
+               CommandClient::Reply reply = samples[c][n].reply.get();
+               IDResult& r = results[samples[c][n].id];
+               r.sent++;
+               total++;
+               switch( reply.error )
+               {
+                    case CommandClient::REPLY_TIMEOUT:      r.timeout++; continue;
+                    case CommandClient::REPLY_DISCONNECTED: r.disconnected++; continue;
+                    case CommandClient::REPLY_BUSY:         r.busy++; continue;
+               }
+               if( reply.packet.getDataLength() < 1 || reply.packet.getData()[0] != 0 )
+               {
+                    r.statusError++;
+               }
+               r.rtt.push_back(std::chrono::duration<double, std::micro>(reply.received - reply.sent).count());
+               last = std::max(last, reply.received);
+          }
+     }
+     double elapsed = std::chrono::duration<double>(last - start).count();
+     std::printf("%ld requests in %.2f sec (%.0f replies/s), %ld sent more than 1 ms late\n\n",
+          total, elapsed, (elapsed > 0)? total / elapsed : 0.0, totalLate);
+     std::printf(" ID      sent   status  timeout   discon     busy    p50(us)    p99(us)   p999(us)    max(us)\n");
+     for( int id = 0 ; id < 256 ; id++ )
+     {
+          IDResult& r = results[id];
+          if( r.sent == 0 )
+          {
+               continue;
+          }
+          std::printf("%3d  %8ld %8ld %8ld %8ld %8ld", id, r.sent, r.statusError, r.timeout, r.disconnected, r.busy);
+          if( r.rtt.empty() )
+          {
+               std::printf("\n");
+               continue;
+          }
+          std::sort(r.rtt.begin(), r.rtt.end());
+          std::printf(" %10.1f %10.1f %10.1f %10.1f\n", percentile(r.rtt, 0.5), percentile(r.rtt, 0.99),
+               percentile(r.rtt, 0.999), r.rtt.back());
+     }
+
+     for( size_t n = 0 ; n < clients.size() ; n++ )
+     {
+          delete clients[n];
+     }
+     if( responder )
+     {
+          terminated = true;
+          responder->join();
+          delete responder;
+          delete server;
+     }
+     return 0;
+}
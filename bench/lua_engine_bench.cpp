@@ -0,0 +1,322 @@
+//------------------------------------------------------------------------------
+//   lua_engine_bench.cpp
+//
+//   スクリプトでよくある処理を Lua 5.1 と LuaJIT で実行して時間を比べる
+//   同じソースを lua_engine_bench (Lua 5.1) と lua_engine_bench_jit (LuaJIT,
+//   -DUSE_LUAJIT) の２つにビルドする
+//     palletize   : パレタイズの置き位置 (段・列・行，回転，アプローチ点) の計算
+//     path        : 円弧・直線の補間点と逆運動学 (三角関数，sqrt)
+//     teach_parse : 教示点の文字列を読んでテーブルにする
+//     robot_calls : get_position() / in_motion() / alarm_hapenned() を呼び続ける
+//   robot_calls は Script と同じ lua_CFunction (毎回 lua_getglobal() で self を
+//   引く) で実行し，LuaJIT では Script::FFI_BINDINGS と同じ FFI 版でも実行する
+//   ロボットは動かさない (位置を返すだけの偽物)
+//   各スクリプトは main() の戻り値 (チェックサム) を表示するので，エンジン間で
+//   結果が同じことも確認できる
+//
+//   usage:
+//     lua_engine_bench [回数]
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <lua.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *GLOBAL_NAME = "niwda_adwin";
+
+//------------------------------------------------------------------------------
+//   ベンチマークのスクリプト
+//------------------------------------------------------------------------------
+struct BenchScript
+{
+     const char *name;
+     const char *code;
+};
+
+static const BenchScript SCRIPTS[] =
+{
+     { "palletize",
+          "function main()\n"
+          "     local sum = 0\n"
+          "     for pass = 1, 50 do\n"
+          "          local places = {}\n"
+          "          for layer = 0, 7 do\n"
+          "               local rot = (layer % 2) * math.pi / 2\n"
+          "               local c, s = math.cos(rot), math.sin(rot)\n"
+          "               for i = 0, 5 do\n"
+          "                    for j = 0, 3 do\n"
+          "                         local u, v = i * 42.0 - 105, j * 56.0 - 84\n"
+          "                         local x = 220 + u * c - v * s\n"
+          "                         local y = u * s + v * c\n"
+          "                         local z = 20 + layer * 25\n"
+          "                         places[#places + 1] = { x = x, y = y, z = z, approach = z + 40 }\n"
+          "                    end\n"
+          "               end\n"
+          "          end\n"
+          "          for k = 1, #places do\n"
+          "               local p = places[k]\n"
+          "               sum = sum + p.x * 0.5 + p.y * 0.25 + p.approach\n"
+          "          end\n"
+          "     end\n"
+          "     return sum\n"
+          "end\n" },
+
+     { "path",
+          "local L1, L2 = 150, 150\n"
+          "local function ik(x, y, z)\n"
+          "     local r = math.sqrt(x * x + y * y)\n"
+          "     local d = math.sqrt(r * r + z * z)\n"
+          "     local a = math.acos((L1 * L1 + d * d - L2 * L2) / (2 * L1 * d))\n"
+          "     local b = math.acos((L1 * L1 + L2 * L2 - d * d) / (2 * L1 * L2))\n"
+          "     return math.atan2(y, x), math.atan2(z, r) + a, b\n"
+          "end\n"
+          "function main()\n"
+          "     local sum = 0\n"
+          "     for pass = 1, 20 do\n"
+          "          for n = 0, 9999 do\n"
+          "               local t = n / 10000\n"
+          "               local x, y, z\n"
+          "               if n % 2 == 0 then\n"
+          "                    x, y, z = 200 + 40 * math.cos(t * 2 * math.pi), 40 * math.sin(t * 2 * math.pi), 60\n"
+          "               else\n"
+          "                    x, y, z = 160 + 80 * t, -60 + 120 * t, 40 + 30 * t\n"
+          "               end\n"
+          "               local q1, q2, q3 = ik(x, y, z)\n"
+          "               sum = sum + q1 + q2 + q3\n"
+          "          end\n"
+          "     end\n"
+          "     return sum\n"
+          "end\n" },
+
+     { "teach_parse",
+          "function main()\n"
+          "     local lines = {}\n"
+          "     for n = 1, 400 do\n"
+          "          lines[n] = string.format(\"P%d, %.2f, %.2f, %.2f\", n, 150 + n * 0.1, -50 + n * 0.2, 30 + n % 7)\n"
+          "     end\n"
+          "     local text = table.concat(lines, \"\\n\")\n"
+          "     local sum = 0\n"
+          "     for pass = 1, 30 do\n"
+          "          local points = {}\n"
+          "          for name, x, y, z in string.gmatch(text, \"(%w+),%s*([%d%.%-]+),%s*([%d%.%-]+),%s*([%d%.%-]+)\") do\n"
+          "               points[name] = { x = tonumber(x), y = tonumber(y), z = tonumber(z) }\n"
+          "          end\n"
+          "          for name, p in pairs(points) do\n"
+          "               sum = sum + p.x + p.y + p.z\n"
+          "          end\n"
+          "     end\n"
+          "     return sum\n"
+          "end\n" },
+
+     { "robot_calls",
+          "function main()\n"
+          "     local sum = 0\n"
+          "     for n = 1, 200000 do\n"
+          "          local p = get_position()\n"
+          "          sum = sum + p.x + p.y + p.z\n"
+          "          if in_motion() then sum = sum + 1 end\n"
+          "          if alarm_hapenned() then sum = sum - 1 end\n"
+          "     end\n"
+          "     return sum\n"
+          "end\n" },
+};
+static const int NUM_SCRIPTS = sizeof(SCRIPTS) / sizeof(SCRIPTS[0]);
+
+//------------------------------------------------------------------------------
+//   位置を返すだけのロボット
+//------------------------------------------------------------------------------
+struct FakeRobot
+{
+     double   x, y, z;
+     unsigned polls;
+};
+
+static void fakeAdvance(FakeRobot *robot)
+{
+     robot->polls++;
+     robot->x = 200 + (robot->polls % 100) * 0.01;
+}
+
+//------------------------------------------------------------------------------
+//   lua_CFunction 版 (Script::inMotion() などと同じ引き方)
+//------------------------------------------------------------------------------
+static FakeRobot *getRobot(lua_State *L)
+{
+     lua_getglobal(L, GLOBAL_NAME);
+     FakeRobot *robot = (FakeRobot *)lua_touserdata(L, -1);
+     lua_pop(L, 1);
+     return robot;
+}
+
+static int inMotion(lua_State *L)
+{
+     FakeRobot *robot = getRobot(L);
+     fakeAdvance(robot);
+     lua_pushboolean(L, (robot->polls % 8) != 0);
+     return 1;
+}
+
+static int alarmHappened(lua_State *L)
+{
+     getRobot(L);
+     lua_pushboolean(L, 0);
+     return 1;
+}
+
+static int getPosition(lua_State *L)
+{
+     FakeRobot *robot = getRobot(L);
+     lua_newtable(L);
+     lua_pushstring(L, "x");
+     lua_pushnumber(L, robot->x);
+     lua_settable(L, -3);
+     lua_pushstring(L, "y");
+     lua_pushnumber(L, robot->y);
+     lua_settable(L, -3);
+     lua_pushstring(L, "z");
+     lua_pushnumber(L, robot->z);
+     lua_settable(L, -3);
+     return 1;
+}
+
+#ifdef USE_LUAJIT
+//------------------------------------------------------------------------------
+//   FFI 版 (Script::FFI_BINDINGS と同じ形)
+//------------------------------------------------------------------------------
+extern "C" int bench_in_motion(void *p)
+{
+     FakeRobot *robot = (FakeRobot *)p;
+     fakeAdvance(robot);
+     return (robot->polls % 8) != 0;
+}
+
+extern "C" int bench_alarm_happened(void *p)
+{
+     return 0;
+}
+
+extern "C" int bench_get_position(void *p, double *xyz)
+{
+     FakeRobot *robot = (FakeRobot *)p;
+     xyz[0] = robot->x;
+     xyz[1] = robot->y;
+     xyz[2] = robot->z;
+     return 0;
+}
+
+static const char *FFI_BINDINGS =
+     "local self = ...\n"
+     "local ffi = require(\"ffi\")\n"
+     "ffi.cdef[[\n"
+     "int bench_in_motion(void *p);\n"
+     "int bench_alarm_happened(void *p);\n"
+     "int bench_get_position(void *p, double *xyz);\n"
+     "]]\n"
+     "local C = ffi.C\n"
+     "local xyz = ffi.new(\"double[3]\")\n"
+     "local function check(r)\n"
+     "     if r < 0 then error(\"aborted.\", 3) end\n"
+     "     return r\n"
+     "end\n"
+     "in_motion = function() return check(C.bench_in_motion(self)) ~= 0 end\n"
+     "alarm_hapenned = function() return check(C.bench_alarm_happened(self)) ~= 0 end\n"
+     "get_position = function()\n"
+     "     check(C.bench_get_position(self, xyz))\n"
+     "     return { x = xyz[0], y = xyz[1], z = xyz[2] }\n"
+     "end\n"
+;
+#endif
+
+//------------------------------------------------------------------------------
+//   script を runs 回実行して，最短・平均の時間(ms)を表示する
+//   実行ごとに lua_State を作り直す (Script と同じ)。作る時間は含めない
+//------------------------------------------------------------------------------
+static bool run(const BenchScript& script, bool ffi, int runs)
+{
+     double best = 1e30, total = 0, result = 0;
+     for( int n = 0 ; n < runs ; n++ )
+     {
+          FakeRobot robot = { 200, 0, 50, 0 };
+          lua_State *L = luaL_newstate();
+          luaL_openlibs(L);
+          lua_pushlightuserdata(L, &robot);
+          lua_setglobal(L, GLOBAL_NAME);
+          lua_register(L, "in_motion", &inMotion);
+          lua_register(L, "alarm_hapenned", &alarmHappened);
+          lua_register(L, "get_position", &getPosition);
+#ifdef USE_LUAJIT
+          if( ffi )
+          {
+               if( luaL_loadstring(L, FFI_BINDINGS) == 0 )
+               {
+                    lua_pushlightuserdata(L, &robot);
+                    lua_pcall(L, 1, 0, 0);
+               }
+               if( lua_gettop(L) > 0 )
+               {
+                    std::printf("%-12s ffi bindings : %s\n", script.name, lua_tostring(L, -1));
+                    lua_close(L);
+                    return false;
+               }
+          }
+#endif
+          if( luaL_dostring(L, script.code) )
+          {
+               std::printf("%-12s error : %s\n", script.name, lua_tostring(L, -1));
+               lua_close(L);
+               return false;
+          }
+
+          lua_getglobal(L, "main");
+          Clock::time_point t0 = Clock::now();
+          int err = lua_pcall(L, 0, 1, 0);
+          double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+          if( err )
+          {
+               std::printf("%-12s error : %s\n", script.name, lua_tostring(L, -1));
+               lua_close(L);
+               return false;
+          }
+          result = lua_tonumber(L, -1);
+          lua_close(L);
+
+          best = (ms < best)? ms : best;
+          total += ms;
+     }
+     std::printf("%-12s %-8s %10.2f %10.2f   %.6g\n", script.name, ffi? "ffi" : "C API", best, total / runs, result);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     int runs = (argc > 1)? std::atoi(argv[1]) : 10;
+     if( runs <= 0 )
+     {
+          std::fprintf(stderr, "usage: lua_engine_bench [runs]\n");
+          return 1;
+     }
+
+#ifdef LUAJIT_VERSION
+     std::printf("%s, %d runs\n\n", LUAJIT_VERSION, runs);
+#else
+     std::printf("%s, %d runs\n\n", LUA_RELEASE, runs);
+#endif
+     std::printf("%-12s %-8s %10s %10s   %s\n", "script", "binding", "best(ms)", "mean(ms)", "result");
+     bool ok = true;
+     for( int n = 0 ; n < NUM_SCRIPTS ; n++ )
+     {
+          ok = run(SCRIPTS[n], false, runs) && ok;
+#ifdef USE_LUAJIT
+          if( std::strcmp(SCRIPTS[n].name, "robot_calls") == 0 )
+          {
+               ok = run(SCRIPTS[n], true, runs) && ok;
+          }
+#endif
+     }
+     return ok? 0 : 1;
+}
@@ -0,0 +1,191 @@
+//------------------------------------------------------------------------------
+//   parser_bench.cpp
+//
+//   受信フレーム解析のベンチマーク
+//   同じ受信データを
+//     push  : Packet::push() に１バイトずつ渡し，完成したら clone() する (以前の方式)
+//     scan  : リングバッファへ 4 KiB ずつ書き込み，Packet::scan() で切り出して
+//             プールのパケットへ assign() する (TcpServer の方式)
+//   で解析し，スループットと取り出せたフレーム数を比べる
+//
+//   データは次の３通り
+//     clean   : 正しいフレームのみ (通常形式 + 1 KiB の拡張形式を 1/8 の割合で)
+//     garbage : フレームの間にランダムなゴミ (STX / SOH を含む) を挟む
+//     corrupt : 1/8 のフレームのチェックサムを壊す (再同期が必要)
+//
+//   usage:
+//     parser_bench [フレーム数]
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "packet.h"
+#include "ring_buffer.h"
+
+typedef std::chrono::steady_clock Clock;
+
+enum{ CASE_CLEAN, CASE_GARBAGE, CASE_CORRUPT };
+enum{ CHUNK_SIZE = 4096 };
+enum{ REPEAT = 5 };
+
+//------------------------------------------------------------------------------
+//   テストデータを作る
+//   戻り値は正しいフレームの数
+//------------------------------------------------------------------------------
+static int makeStream(int testCase, int frames, std::vector<uint8_t>& stream)
+{
+     Packet packet;
+     std::vector<uint8_t> raw;
+     std::vector<uint8_t> payload(1024);
+     int valid = 0;
+
+     std::srand(1);
+     stream.clear();
+     for( int n = 0 ; n < frames ; n++ )
+     {
+          if( n % 8 == 7 )
+          {
+               for( size_t i = 0 ; i < payload.size() ; i++ )
+               {
+                    payload[i] = (uint8_t)std::rand();
+               }
+               packet.create(18, (uint8_t)n, Packet::FORMAT_EXTENDED);
+               packet.addPacketData(&payload[0], (int)payload.size());
+          }
+          else
+          {
+               int32_t pos[3] = { n, -n, 2*n };
+               packet.create(5, (uint8_t)n);
+               packet.addPacketData(pos, sizeof(pos));
+          }
+          packet.getRawBytes(raw);
+
+          if( testCase == CASE_CORRUPT && n % 8 == 3 )
+          {
+               raw[raw.size()-2] ^= 0x5A;         // チェックサムを壊す
+          }
+          else
+          {
+               valid++;
+          }
+          stream.insert(stream.end(), raw.begin(), raw.end());
+
+          if( testCase == CASE_GARBAGE )
+          {
+               int len = std::rand() % 16;
+               for( int i = 0 ; i < len ; i++ )
+               {
+                    int r = std::rand() % 8;
+                    stream.push_back((r == 0)? Packet::STX : (r == 1)? Packet::SOH : (uint8_t)std::rand());
+               }
+          }
+     }
+     return valid;
+}
+
+//------------------------------------------------------------------------------
+static int parseByPush(const std::vector<uint8_t>& stream)
+{
+     Packet packet;
+     int frames = 0;
+     for( size_t i = 0 ; i < stream.size() ; i++ )
+     {
+          if( packet.push(stream[i]) )
+          {
+               Packet *p = packet.clone();
+               frames++;
+               delete p;
+               packet.clear();
+          }
+     }
+     return frames;
+}
+
+//------------------------------------------------------------------------------
+static int parseByScan(const std::vector<uint8_t>& stream, RingBuffer& ring, std::vector<Packet *>& pool)
+{
+     int frames = 0;
+     size_t fed = 0;
+     ring.clear();
+     while( fed < stream.size() || !ring.empty() )
+     {
+          // recv() の代わりに 4 KiB ずつ書き込む
+          uint32_t len = (uint32_t)std::min((size_t)CHUNK_SIZE, stream.size() - fed);
+          len = std::min(len, ring.space());
+          ring.write(&stream[fed], len);
+          fed += len;
+
+          while( true )
+          {
+               struct iovec span[2];
+               int count = ring.getReadableSpans(span);
+               if( count == 0 )
+               {
+                    break;
+               }
+               int skip, frameSize;
+               int ret = Packet::scan((const uint8_t *)span[0].iov_base, (int)span[0].iov_len,
+                    (count > 1)? (const uint8_t *)span[1].iov_base : NULL, (count > 1)? (int)span[1].iov_len : 0, &skip, &frameSize);
+               ring.consume(skip);
+               if( ret != Packet::SCAN_FRAME )
+               {
+                    break;
+               }
+               count = ring.getReadableSpans(span);
+               Packet *p = pool.back();
+               pool.pop_back();
+               p->assign((const uint8_t *)span[0].iov_base, (int)span[0].iov_len,
+                    (count > 1)? (const uint8_t *)span[1].iov_base : NULL, (count > 1)? (int)span[1].iov_len : 0, frameSize);
+               ring.consume(frameSize);
+               frames++;
+               pool.push_back(p);
+          }
+          if( fed >= stream.size() )
+          {
+               break;
+          }
+     }
+     return frames;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     int frames = (argc > 1)? std::atoi(argv[1]) : 200000;
+     const char *caseName[] = { "clean", "garbage", "corrupt" };
+
+     RingBuffer ring(131072);
+     std::vector<Packet *> pool;
+     for( int n = 0 ; n < 64 ; n++ )
+     {
+          pool.push_back(new Packet());
+     }
+
+     std::printf("case     method    MB/s     frames/s     frames (valid)\n");
+     for( int testCase = CASE_CLEAN ; testCase <= CASE_CORRUPT ; testCase++ )
+     {
+          std::vector<uint8_t> stream;
+          int valid = makeStream(testCase, frames, stream);
+          for( int method = 0 ; method < 2 ; method++ )
+          {
+               int parsed = 0;
+               double best = 1e9;
+               for( int r = 0 ; r < REPEAT ; r++ )
+               {
+                    Clock::time_point t0 = Clock::now();
+                    parsed = (method == 0)? parseByPush(stream) : parseByScan(stream, ring, pool);
+                    best = std::min(best, std::chrono::duration<double>(Clock::now() - t0).count());
+               }
+               std::printf("%-8s %-6s %8.1f %12.0f   %8d (%d)\n", caseName[testCase], (method == 0)? "push" : "scan",
+                    stream.size() / best / 1e6, parsed / best, parsed, valid);
+          }
+     }
+
+     for( size_t n = 0 ; n < pool.size() ; n++ )
+     {
+          delete pool[n];
+     }
+     return 0;
+}
@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+//   script_hook_bench.cpp
+//
+//   Lua の中断確認フックによる速度の違いを測る
+//     old  : 以前の Script::hookProc (10 命令ごとに 5 ms 待つ)
+//     new  : 現在の Script::hookProc (Script::HOOK_COUNT 命令ごとにフラグを見るだけ)
+//     count: 命令数を数えるだけのフック (1000 命令ごと，フックなしに近い上限)
+//   同じスクリプトを最大 SEC 秒ずつ実行し，VM の命令数/sec を表示する
+//   (命令数はフックの呼び出し回数 × 間隔で数える)
+//
+//   usage:
+//     script_hook_bench [スクリプトファイル [SEC]]
+//     スクリプトは main() を定義すること (省略時は下の BENCH_CODE)
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <lua.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+//   グリッドの教示点を作って，オフセットを足す (スクリプトでよくある計算)
+static const char *BENCH_CODE =
+     "function main()\n"
+     "     local total = 0\n"
+     "     for pass = 1, 200 do\n"
+     "          local points = {}\n"
+     "          for i = 0, 19 do\n"
+     "               for j = 0, 19 do\n"
+     "                    points[#points + 1] = { x = 150 + i * 5, y = -50 + j * 5, z = 40 }\n"
+     "               end\n"
+     "          end\n"
+     "          for k = 1, #points do\n"
+     "               local p = points[k]\n"
+     "               p.x = p.x + math.sin(k * 0.01) * 2\n"
+     "               p.z = p.z + (k % 3)\n"
+     "               total = total + p.x + p.y + p.z\n"
+     "          end\n"
+     "     end\n"
+     "     return total\n"
+     "end\n";
+
+enum{ OLD_COUNT = 10, OLD_SLEEP_MS = 5 };
+enum{ NEW_COUNT = 10000 };                   // Script::HOOK_COUNT
+enum{ COUNT_ONLY = 1000 };
+
+//------------------------------------------------------------------------------
+struct Bench
+{
+     int      mode;
+     long     interval;
+     long     calls;
+     Clock::time_point deadline;
+     std::atomic<bool> aborted;
+};
+enum{ MODE_OLD, MODE_NEW, MODE_NONE };
+
+static Bench *g_bench;
+
+//------------------------------------------------------------------------------
+static void hookProc(lua_State *L, lua_Debug *ar)
+{
+     g_bench->calls++;
+     if( g_bench->mode == MODE_OLD )
+     {
+          std::this_thread::sleep_for(std::chrono::milliseconds(OLD_SLEEP_MS));
+     }
+     // 測定時間の上限は，スクリプトの中断と同じ経路で止める
+     if( (g_bench->calls & 0x0F) == 0 && Clock::now() >= g_bench->deadline )
+     {
+          g_bench->aborted = true;
+     }
+     if( g_bench->aborted )
+     {
+          luaL_error(L, "aborted.");
+     }
+}
+
+//------------------------------------------------------------------------------
+static void run(const std::string& code, int mode, double seconds)
+{
+     Bench bench;
+     bench.mode = mode;
+     bench.interval = (mode == MODE_OLD)? (long)OLD_COUNT : (mode == MODE_NEW)? (long)NEW_COUNT : (long)COUNT_ONLY;
+     bench.calls = 0;
+     bench.aborted = false;
+     g_bench = &bench;
+
+     lua_State *L = luaL_newstate();
+     luaL_openlibs(L);
+     lua_sethook(L, &hookProc, LUA_MASKCOUNT, bench.interval);
+     Clock::time_point t0 = Clock::now();
+     bench.deadline = t0 + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+     int err = luaL_dostring(L, (code + "\nmain()\n").c_str());
+     double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+     if( err && !bench.aborted )
+     {
+          std::printf("error: %s\n", lua_tostring(L, -1));
+     }
+     lua_close(L);
+
+     static const char *NAMES[] = { "old (5 ms / 10)", "new (flag / 10000)", "count (1000)" };
+     double instructions = (double)bench.calls * bench.interval;
+     std::printf("%-20s %12.0f instr/s  %8.3f sec  %s\n", NAMES[mode], instructions / elapsed, elapsed,
+          bench.aborted? "(time limit)" : "(completed)");
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     std::string code = BENCH_CODE;
+     if( argc > 1 )
+     {
+          std::ifstream ifs(argv[1]);
+          if( !ifs )
+          {
+               std::fprintf(stderr, "cannot open %s\n", argv[1]);
+               return 1;
+          }
+          std::ostringstream oss;
+          oss << ifs.rdbuf();
+          code = oss.str();
+     }
+     double seconds = (argc > 2)? std::atof(argv[2]) : 3.0;
+
+     run(code, MODE_OLD, seconds);
+     run(code, MODE_NEW, seconds);
+     run(code, MODE_NONE, seconds);
+     return 0;
+}
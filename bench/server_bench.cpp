@@ -0,0 +1,222 @@
+//------------------------------------------------------------------------------
+//   server_bench.cpp
+//
+//   コマンドサーバ(TcpServer)のベンチマーク
+//   同じプロセス内でサーバを起動し，ループバックで接続したクライアントから
+//   リクエストを送り続けて，接続数ごとのスループットと往復時間を測る
+//   (応答は CommandManager の代わりに，ステータスだけを返すスレッドが返す)
+//
+//   パイプライン段数を指定すると，各クライアントはその数のリクエストを
+//   まとめて送ってから応答を待つ (応答のシリアル番号が送信順と一致するか確認する)
+//
+//   usage:
+//     server_bench [最大接続数 [１段階あたりの測定時間(sec) [パイプライン段数]]]
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <string.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "packet.h"
+#include "event_server.h"
+
+static const int BENCH_PORT = 12469;
+static const uint8_t STATUS_ID = 9;
+
+typedef std::chrono::steady_clock Clock;
+
+//------------------------------------------------------------------------------
+struct ClientResult
+{
+     long   requests;
+     double totalRtt;           // 往復時間の合計(sec)
+     double maxRtt;
+};
+
+//------------------------------------------------------------------------------
+static int connectClient()
+{
+     int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+     if( fd < 0 )
+     {
+          perror("[server_bench] socket() failed");
+          return -1;
+     }
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+     addr.sin_port = htons(BENCH_PORT);
+     if( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+     {
+          perror("[server_bench] connect() failed");
+          close(fd);
+          return -1;
+     }
+     int opf = 1;
+     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opf, sizeof(opf));
+     return fd;
+}
+
+//------------------------------------------------------------------------------
+//   リクエストを depth 個送り，応答を depth 個受け取るのを繰り返す
+//   RTT は最初のリクエストを送ってから最後の応答を受け取るまで
+//------------------------------------------------------------------------------
+static void runClient(int fd, int depth, Clock::time_point deadline, ClientResult *result)
+{
+     Packet request, response;
+     std::vector<uint8_t> raw, burst;
+     uint8_t buf[4096];
+     uint8_t serial = 0;
+
+     result->requests = 0;
+     result->totalRtt = result->maxRtt = 0;
+     while( Clock::now() < deadline )
+     {
+          uint8_t first = serial;
+          burst.clear();
+          for( int n = 0 ; n < depth ; n++ )
+          {
+               request.create(STATUS_ID, serial++);
+               request.getRawBytes(raw);
+               burst.insert(burst.end(), raw.begin(), raw.end());
+          }
+          Clock::time_point t0 = Clock::now();
+          if( send(fd, &burst[0], burst.size(), MSG_NOSIGNAL) != (ssize_t)burst.size() )
+          {
+               perror("[server_bench] send() failed");
+               return;
+          }
+          int received = 0;
+          while( received < depth )
+          {
+               ssize_t n = recv(fd, buf, sizeof(buf), 0);
+               if( n <= 0 )
+               {
+                    std::fprintf(stderr, "[server_bench] connection closed\n");
+                    return;
+               }
+               for( ssize_t i = 0 ; i < n ; i++ )
+               {
+                    if( response.push(buf[i]) )
+                    {
+                         if( response.getSerialNo() != (uint8_t)(first + received) )
+                         {
+                              std::fprintf(stderr, "[server_bench] serial mismatch (%d, expected %d)\n",
+                                   response.getSerialNo(), (uint8_t)(first + received));
+                         }
+                         received++;
+                    }
+               }
+          }
+          double rtt = std::chrono::duration<double>(Clock::now() - t0).count();
+          result->requests += depth;
+          result->totalRtt += rtt;
+          result->maxRtt = std::max(result->maxRtt, rtt);
+     }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     int maxClients = (argc > 1)? std::atoi(argv[1]) : 16;
+     double seconds = (argc > 2)? std::atof(argv[2]) : 2.0;
+     int depth = (argc > 3)? std::atoi(argv[3]) : 1;
+     depth = std::max(1, std::min(depth, (int)TcpServer::MAX_PENDING));
+     maxClients = std::max(1, std::min(maxClients, (int)TcpServer::MAX_SESSIONS));
+
+     TcpServer server(BENCH_PORT);
+     if( server.getState() != TcpServer::LISTENING )
+     {
+          return 1;
+     }
+
+     // CommandManager の代わりに応答を返すスレッド
+     std::atomic<bool> terminated(false);
+     std::thread responder([&](){
+          Packet response;
+          uint8_t status = 0;
+          while( !terminated )
+          {
+               uint32_t session;
+               Packet *request = server.getRequest(&session, 100);
+               if( request == NULL )
+               {
+                    continue;
+               }
+               response.create(request->getID(), request->getSerialNo());
+               response.addPacketData(&status, 1);
+               server.sendResponse(session, response);
+               server.releaseRequest(request);
+          }
+     });
+
+     // 接続数
+     std::vector<int> clients;
+     Clock::time_point t0 = Clock::now();
+     for( int n = 0 ; n < maxClients ; n++ )
+     {
+          int fd = connectClient();
+          if( fd < 0 )
+          {
+               break;
+          }
+          clients.push_back(fd);
+     }
+     while( server.getNumSessions() < (int)clients.size() )
+     {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+     }
+     double connectTime = std::chrono::duration<double>(Clock::now() - t0).count();
+     std::printf("%d session(s) accepted in %.2f ms\n\n", (int)clients.size(), connectTime * 1000.0);
+
+     // 接続数を倍々に増やしてスループットを測る
+     std::vector<int> steps;
+     for( int active = 1 ; active < (int)clients.size() ; active *= 2 )
+     {
+          steps.push_back(active);
+     }
+     steps.push_back((int)clients.size());
+     std::printf("pipeline depth %d\n", depth);
+     std::printf("clients  requests/s   mean RTT(us)   max RTT(us)\n");
+     for( size_t step = 0 ; step < steps.size() ; step++ )
+     {
+          int active = steps[step];
+          std::vector<ClientResult> results(active);
+          std::vector<std::thread *> threads;
+          Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+          for( int n = 0 ; n < active ; n++ )
+          {
+               threads.push_back(new std::thread(runClient, clients[n], depth, deadline, &results[n]));
+          }
+          long requests = 0;
+          double totalRtt = 0, maxRtt = 0;
+          for( int n = 0 ; n < active ; n++ )
+          {
+               threads[n]->join();
+               delete threads[n];
+               requests += results[n].requests;
+               totalRtt += results[n].totalRtt;
+               maxRtt = std::max(maxRtt, results[n].maxRtt);
+          }
+          std::printf("%7d  %10.0f   %12.1f   %11.1f\n", active, requests / seconds,
+               (requests > 0)? totalRtt / requests * depth * 1e6 : 0.0, maxRtt * 1e6);
+     }
+
+     for( size_t n = 0 ; n < clients.size() ; n++ )
+     {
+          close(clients[n]);
+     }
+     terminated = true;
+     responder.join();
+     return 0;
+}
@@ -0,0 +1,70 @@
+//------------------------------------------------------------------------------
+//   calibrate.cpp
+//
+//   幾何モデルの校正ツール
+//
+//   usage:
+//     calibrate <samples.csv> [model file]
+//
+//   samples.csv は１行に「base,shoulder,elbow,x,y,z」
+//   (モータ軸位置(pulse)と，その時に実測したエンドエフェクタ位置(mm))
+//   model file (既定は ./kinematics.dat) があればそれを初期値とし，結果を上書きする
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <chrono>
+#include "kinematics.h"
+#include "calibration.h"
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     if( argc < 2 )
+     {
+          std::fprintf(stderr, "usage: calibrate <samples.csv> [model file]\n");
+          return 1;
+     }
+     const char *modelPath = (argc > 2)? argv[2] : KinematicModel::DEFAULT_PATH;
+
+     KinematicCalibration calibration;
+     if( !calibration.loadSamples(argv[1]) )
+     {
+          return 1;
+     }
+
+     KinematicModel model;
+     if( model.load(modelPath) )
+     {
+          std::printf("initial model : %s\n", modelPath);
+     }
+     else
+     {
+          std::printf("initial model : nominal\n");
+     }
+     KinematicModel initial = model;
+
+     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+     if( !calibration.fit(&model) )
+     {
+          return 1;
+     }
+     std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+
+     std::printf("samples       : %d\n", calibration.getNumSamples());
+     std::printf("iterations    : %d (%.3f sec)\n", calibration.getIterations(), elapsed.count());
+     std::printf("rms error     : %.3f mm -> %.3f mm\n", calibration.getInitialRms(), calibration.getFinalRms());
+     std::printf("max error     : %.3f mm -> %.3f mm\n", calibration.getMaxError(initial), calibration.getMaxError(model));
+     std::printf("\n");
+     for( int id = 0 ; id < KinematicModel::NUM_PARAMS ; id++ )
+     {
+          std::printf("%-16s %12.5f -> %12.5f%s\n", KinematicModel::PARAM_NAME[id], initial.get(id), model.get(id),
+               (calibration.getMask() & (1 << id))? "" : "  (fixed)");
+     }
+
+     if( !model.save(modelPath) )
+     {
+          perror("[calibrate] save failed");
+          return 1;
+     }
+     std::printf("\nsaved to %s\n", modelPath);
+     return 0;
+}
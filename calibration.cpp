@@ -0,0 +1,301 @@
+//------------------------------------------------------------------------------
+//   calibration.cpp
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include "calibration.h"
+
+const uint32_t KinematicCalibration::DEFAULT_MASK =
+     (1 << KinematicModel::PRM_A) | (1 << KinematicModel::PRM_B) | (1 << KinematicModel::PRM_C) |
+     (1 << KinematicModel::PRM_F) |
+     (1 << KinematicModel::PRM_H) | (1 << KinematicModel::PRM_L1) |
+     (1 << KinematicModel::PRM_M) | (1 << KinematicModel::PRM_N) |
+     (1 << KinematicModel::PRM_SHOULDER_OFS) | (1 << KinematicModel::PRM_ELBOW_OFS) |
+     (1 << KinematicModel::PRM_BASE_OFS);
+
+//------------------------------------------------------------------------------
+//   連立一次方程式 A x = b を解く (部分ピボット付きガウス消去，A と b は破壊される)
+//------------------------------------------------------------------------------
+static bool solve(int n, double *A, double *b, double *x)
+{
+     for( int col = 0 ; col < n ; col++ )
+     {
+          int pivot = col;
+          for( int row = col+1 ; row < n ; row++ )
+          {
+               if( std::fabs(A[row*n+col]) > std::fabs(A[pivot*n+col]) )
+               {
+                    pivot = row;
+               }
+          }
+          if( std::fabs(A[pivot*n+col]) < 1e-300 )
+          {
+               return false;
+          }
+          if( pivot != col )
+          {
+               for( int k = 0 ; k < n ; k++ )
+               {
+                    std::swap(A[col*n+k], A[pivot*n+k]);
+               }
+               std::swap(b[col], b[pivot]);
+          }
+          for( int row = col+1 ; row < n ; row++ )
+          {
+               double f = A[row*n+col] / A[col*n+col];
+               for( int k = col ; k < n ; k++ )
+               {
+                    A[row*n+k] -= f * A[col*n+k];
+               }
+               b[row] -= f * b[col];
+          }
+     }
+     for( int row = n-1 ; row >= 0 ; row-- )
+     {
+          double sum = b[row];
+          for( int k = row+1 ; k < n ; k++ )
+          {
+               sum -= A[row*n+k] * x[k];
+          }
+          x[row] = sum / A[row*n+row];
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+KinematicCalibration::KinematicCalibration()
+     : m_mask(DEFAULT_MASK), m_iterations(0), m_initialRms(0), m_finalRms(0)
+{
+}
+
+//------------------------------------------------------------------------------
+void KinematicCalibration::addSample(double base, double shoulder, double elbow, double x, double y, double z)
+{
+     Sample s = { base, shoulder, elbow, x, y, z };
+     m_samples.push_back(s);
+}
+
+//------------------------------------------------------------------------------
+//   CSV ファイルから測定データを読み込む
+//   １行に「base,shoulder,elbow,x,y,z」(pulse, mm)。数値でない行は読み飛ばす
+//------------------------------------------------------------------------------
+bool KinematicCalibration::loadSamples(const char *path)
+{
+     FILE *fp = fopen(path, "r");
+     if( !fp )
+     {
+          perror("[KinematicCalibration] fopen() failed");
+          return false;
+     }
+     char line[256];
+     Sample s;
+     while( fgets(line, sizeof(line), fp) )
+     {
+          if( sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf", &s.base, &s.shoulder, &s.elbow, &s.x, &s.y, &s.z) == 6 )
+          {
+               m_samples.push_back(s);
+          }
+     }
+     fclose(fp);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   推定対象のパラメータを取り出す (戻り値はパラメータ数)
+//------------------------------------------------------------------------------
+int KinematicCalibration::getParams(const KinematicModel& model, double *p) const
+{
+     int n = 0;
+     for( int id = 0 ; id < KinematicModel::NUM_PARAMS ; id++ )
+     {
+          if( m_mask & (1 << id) )
+          {
+               p[n++] = model.get(id);
+          }
+     }
+     return n;
+}
+
+//------------------------------------------------------------------------------
+void KinematicCalibration::setParams(KinematicModel *model, const double *p) const
+{
+     int n = 0;
+     for( int id = 0 ; id < KinematicModel::NUM_PARAMS ; id++ )
+     {
+          if( m_mask & (1 << id) )
+          {
+               model->set(id, p[n++]);
+          }
+     }
+}
+
+//------------------------------------------------------------------------------
+//   残差(FK の計算値 - 実測値)を求め，二乗和を返す
+//------------------------------------------------------------------------------
+double KinematicCalibration::evaluate(const KinematicModel& model, double *residual) const
+{
+     double sum = 0;
+     for( size_t n = 0 ; n < m_samples.size() ; n++ )
+     {
+          const Sample& s = m_samples[n];
+          double x, y, z;
+          model.forward(s.base, s.shoulder, s.elbow, &x, &y, &z);
+          residual[n*3+0] = x - s.x;
+          residual[n*3+1] = y - s.y;
+          residual[n*3+2] = z - s.z;
+          sum += residual[n*3+0]*residual[n*3+0] + residual[n*3+1]*residual[n*3+1] + residual[n*3+2]*residual[n*3+2];
+     }
+     return std::isfinite(sum)? sum : HUGE_VAL;
+}
+
+//------------------------------------------------------------------------------
+double KinematicCalibration::getRms(const KinematicModel& model) const
+{
+     if( m_samples.empty() )
+     {
+          return 0;
+     }
+     std::vector<double> residual(m_samples.size()*3);
+     return std::sqrt(evaluate(model, residual.data()) / m_samples.size());
+}
+
+//------------------------------------------------------------------------------
+double KinematicCalibration::getMaxError(const KinematicModel& model) const
+{
+     double maxError = 0;
+     for( size_t n = 0 ; n < m_samples.size() ; n++ )
+     {
+          const Sample& s = m_samples[n];
+          double x, y, z;
+          model.forward(s.base, s.shoulder, s.elbow, &x, &y, &z);
+          maxError = std::max(maxError, std::sqrt((x-s.x)*(x-s.x) + (y-s.y)*(y-s.y) + (z-s.z)*(z-s.z)));
+     }
+     return maxError;
+}
+
+//------------------------------------------------------------------------------
+//   Levenberg-Marquardt 法によるパラメータ推定
+//
+//   ヤコビアンは前進差分で求める。(J^T J + λ diag(J^T J)) δ = -J^T r を解き，
+//   残差が減れば採用して λ を小さく，増えれば棄却して λ を大きくする
+//   model には初期値を与えておくこと (通常は設計値か前回の校正結果)
+//------------------------------------------------------------------------------
+bool KinematicCalibration::fit(KinematicModel *model, int maxIterations)
+{
+     double p[KinematicModel::NUM_PARAMS];
+     int k = getParams(*model, p);
+     int m = (int)m_samples.size() * 3;
+     m_iterations = 0;
+     if( k == 0 || m < k )
+     {
+          std::printf("[KinematicCalibration] %d sample(s) are not enough for %d parameter(s).\n", (int)m_samples.size(), k);
+          return false;
+     }
+
+     std::vector<double> residual(m), trial(m), J(m*k);
+     std::vector<double> A(k*k), g(k), delta(k), work(k*k), rhs(k);
+     KinematicModel test = *model;
+
+     double cost = evaluate(*model, residual.data());
+     m_initialRms = std::sqrt(cost / m_samples.size());
+     if( cost == HUGE_VAL )
+     {
+          std::printf("[KinematicCalibration] initial model can not reach the samples.\n");
+          return false;
+     }
+
+     double lambda = 1e-3;
+     bool updated = true;
+     while( m_iterations < maxIterations )
+     {
+          m_iterations++;
+          if( updated )
+          {
+               // ヤコビアン
+               for( int j = 0 ; j < k ; j++ )
+               {
+                    double q[KinematicModel::NUM_PARAMS];
+                    std::copy(p, p+k, q);
+                    double h = 1e-6 * std::max(std::fabs(p[j]), 1.0);
+                    q[j] += h;
+                    setParams(&test, q);
+                    evaluate(test, trial.data());
+                    for( int i = 0 ; i < m ; i++ )
+                    {
+                         J[i*k+j] = (trial[i] - residual[i]) / h;
+                    }
+               }
+               // A = J^T J, g = J^T r
+               for( int a = 0 ; a < k ; a++ )
+               {
+                    for( int b = a ; b < k ; b++ )
+                    {
+                         double sum = 0;
+                         for( int i = 0 ; i < m ; i++ )
+                         {
+                              sum += J[i*k+a] * J[i*k+b];
+                         }
+                         A[a*k+b] = A[b*k+a] = sum;
+                    }
+                    double sum = 0;
+                    for( int i = 0 ; i < m ; i++ )
+                    {
+                         sum += J[i*k+a] * residual[i];
+                    }
+                    g[a] = sum;
+               }
+          }
+
+          work = A;
+          for( int j = 0 ; j < k ; j++ )
+          {
+               work[j*k+j] += lambda * (A[j*k+j] + 1e-9);
+               rhs[j] = -g[j];
+          }
+          if( !solve(k, work.data(), rhs.data(), delta.data()) )
+          {
+               lambda *= 10;
+               updated = false;
+               continue;
+          }
+
+          double q[KinematicModel::NUM_PARAMS];
+          double stepNorm = 0, paramNorm = 0;
+          for( int j = 0 ; j < k ; j++ )
+          {
+               q[j] = p[j] + delta[j];
+               stepNorm += delta[j]*delta[j];
+               paramNorm += p[j]*p[j];
+          }
+          setParams(&test, q);
+          double newCost = evaluate(test, trial.data());
+
+          if( newCost < cost )
+          {
+               bool converged = (cost - newCost) < 1e-12 * cost || stepNorm < 1e-20 * paramNorm;
+               std::copy(q, q+k, p);
+               residual.swap(trial);
+               cost = newCost;
+               lambda = std::max(lambda / 10, 1e-12);
+               updated = true;
+               if( converged )
+               {
+                    break;
+               }
+          }
+          else
+          {
+               lambda *= 10;
+               updated = false;
+               if( lambda > 1e12 )
+               {
+                    break;
+               }
+          }
+     }
+
+     setParams(model, p);
+     m_finalRms = std::sqrt(cost / m_samples.size());
+     return true;
+}
@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+//   calibration.h
+//
+//   幾何モデルの校正
+//   いくつかの関節位置について実測したエンドエフェクタ位置から，
+//   Levenberg-Marquardt 法でリンク寸法・原点角度を推定する
+//------------------------------------------------------------------------------
+#ifndef   CALIBRATION_H
+#define   CALIBRATION_H
+
+#include <vector>
+#include <cstdint>
+#include "kinematics.h"
+
+//------------------------------------------------------------------------------
+class KinematicCalibration
+{
+     public:
+          struct Sample
+          {
+               double base;             // モータ軸位置 (pulse)
+               double shoulder;
+               double elbow;
+               double x;                // 実測位置 (mm)
+               double y;
+               double z;
+          };
+          enum{ MAX_ITERATIONS = 200 };
+
+          // 既定で推定するパラメータ
+          // (h と l2 は差しか効かないので l2 は固定する。前腕の d, e は b や
+          //  ELBOW の原点角度とほぼ区別できないため，既定では設計値のままとする)
+          static const uint32_t DEFAULT_MASK;
+
+     private:
+          std::vector<Sample> m_samples;
+          uint32_t m_mask;
+          int      m_iterations;
+          double   m_initialRms;
+          double   m_finalRms;
+
+          int    getParams(const KinematicModel& model, double *p) const;
+          void   setParams(KinematicModel *model, const double *p) const;
+          double evaluate(const KinematicModel& model, double *residual) const;
+
+     public:
+          KinematicCalibration();
+          void clear(){ m_samples.clear(); }
+          void addSample(double base, double shoulder, double elbow, double x, double y, double z);
+          bool loadSamples(const char *path);
+          int  getNumSamples() const { return (int)m_samples.size(); }
+
+          void     setMask(uint32_t mask){ m_mask = mask; }
+          uint32_t getMask() const { return m_mask; }
+
+          bool   fit(KinematicModel *model, int maxIterations = MAX_ITERATIONS);
+          double getRms(const KinematicModel& model) const;
+          double getMaxError(const KinematicModel& model) const;
+          int    getIterations() const { return m_iterations; }
+          double getInitialRms() const { return m_initialRms; }
+          double getFinalRms() const { return m_finalRms; }
+};
+
+#endif
@@ -0,0 +1,525 @@
+//------------------------------------------------------------------------------
+//   command_client.cpp
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdio>
+#include <algorithm>
+#include "command_client.h"
+
+
+//==============================================================================
+//   CommandClient
+//==============================================================================
+//   コンストラクタ
+//   接続は受信スレッドが行う (waitConnected() で待てる)
+//------------------------------------------------------------------------------
+CommandClient::CommandClient(const char *host, int port, int timeoutMs)
+     : m_host(host), m_port(port), m_timeoutMs(timeoutMs), m_thread(NULL), m_socket(-1),
+       m_terminated(false), m_connected(false), m_connectCount(0), m_inFlight(0), m_nextSerial(0),
+       m_recvBuffer(RECV_BUFFER_SIZE), m_recvLength(0)
+{
+     for( int n = 0 ; n < NUM_SERIALS ; n++ )
+     {
+          m_pending[n].used = false;
+     }
+     m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+     if( m_wakeup < 0 )
+     {
+          perror("[CommandClient] eventfd() failed");
+          return;
+     }
+     m_thread = new std::thread([this](){ execute(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//   応答待ちのリクエストはすべて REPLY_DISCONNECTED になる
+//------------------------------------------------------------------------------
+CommandClient::~CommandClient()
+{
+     m_terminated = true;
+     if( m_thread )
+     {
+          wake();
+          m_thread->join();
+          delete m_thread;
+     }
+     disconnect(REPLY_DISCONNECTED);
+     if( m_wakeup >= 0 )
+     {
+          close(m_wakeup);
+     }
+}
+
+//------------------------------------------------------------------------------
+bool CommandClient::isConnected()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     return m_connected;
+}
+
+//------------------------------------------------------------------------------
+//   接続するまで最大 timeoutMs 待つ
+//------------------------------------------------------------------------------
+bool CommandClient::waitConnected(int timeoutMs)
+{
+     std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+     while( !isConnected() )
+     {
+          if( std::chrono::steady_clock::now() >= deadline )
+          {
+               return false;
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   接続した回数 (再接続を含む)
+//------------------------------------------------------------------------------
+int CommandClient::getConnectCount()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     return m_connectCount;
+}
+
+//------------------------------------------------------------------------------
+//   ステータス配信 (EVENT_ID) とスクリプトの配信 (SCRIPT_EVENT_ID) のフレームを受け取る
+//   関数を登録する (受信スレッドから呼ばれる。どちらかは packet.getID() で見分ける)
+//------------------------------------------------------------------------------
+void CommandClient::setEventHandler(EventHandler handler)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_eventHandler = handler;
+}
+
+//------------------------------------------------------------------------------
+//   リクエストを送る
+//   シリアル番号はクライアントが割り当てる
+//------------------------------------------------------------------------------
+std::future<CommandClient::Reply> CommandClient::send(uint8_t id, const void *data, int size,
+     int format, std::future<Reply> *completion)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     int error = REPLY_OK;
+     if( !m_connected )
+     {
+          error = REPLY_DISCONNECTED;
+     }
+     else if( m_inFlight >= MAX_IN_FLIGHT )
+     {
+          error = REPLY_BUSY;
+     }
+     if( error != REPLY_OK )
+     {
+          if( completion )
+          {
+               *completion = makeError(error);
+          }
+          return makeError(error);
+     }
+
+     // 空いているシリアル番号 (完了応答を待っているものは使えない)
+     while( m_pending[m_nextSerial].used )
+     {
+          m_nextSerial++;
+     }
+     uint8_t serialNo = m_nextSerial++;
+     Pending& pending = m_pending[serialNo];
+     pending.used = true;
+     pending.hasCompletion = (completion != NULL);
+     pending.waitCompletion = false;
+     pending.id = id;
+     pending.reply = std::promise<Reply>();
+     std::future<Reply> result = pending.reply.get_future();
+     if( completion )
+     {
+          pending.completion = std::promise<Reply>();
+          *completion = pending.completion.get_future();
+     }
+
+     Packet packet;
+     packet.create(id, serialNo, format);
+     packet.addPacketData(data, size);
+     packet.getRawBytes(m_rawRequest);
+
+     // 応答待ちがなかったときは，受信スレッドがタイムアウトを見るように起こす
+     bool idle = (m_inFlight == 0);
+     m_inFlight++;
+     pending.sent = std::chrono::steady_clock::now();
+     pending.deadline = pending.sent + std::chrono::milliseconds(m_timeoutMs);
+     size_t offset = 0;
+     if( m_sendBuffer.empty() )
+     {
+          ssize_t n = ::send(m_socket, m_rawRequest.data(), m_rawRequest.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+          offset = (n > 0)? (size_t)n : 0;
+     }
+     if( offset < m_rawRequest.size() )
+     {
+          m_sendBuffer.insert(m_sendBuffer.end(), m_rawRequest.begin() + offset, m_rawRequest.end());
+          idle = true;
+     }
+     if( idle )
+     {
+          wake();
+     }
+     return result;
+}
+
+//------------------------------------------------------------------------------
+std::future<CommandClient::Reply> CommandClient::makeError(int error)
+{
+     std::promise<Reply> promise;
+     Reply reply;
+     reply.error = error;
+     reply.sent = reply.received = std::chrono::steady_clock::now();
+     promise.set_value(reply);
+     return promise.get_future();
+}
+
+//------------------------------------------------------------------------------
+void CommandClient::wake()
+{
+     uint64_t one = 1;
+     if( write(m_wakeup, &one, sizeof(one)) < 0 )
+     {
+          perror("[CommandClient::wake] write() failed");
+     }
+}
+
+//------------------------------------------------------------------------------
+//   m_mutex をロックして呼ぶこと
+//------------------------------------------------------------------------------
+void CommandClient::release(Pending& pending)
+{
+     pending.used = false;
+     m_inFlight--;
+}
+
+//------------------------------------------------------------------------------
+//   受信スレッド
+//------------------------------------------------------------------------------
+void CommandClient::execute()
+{
+     int retryMs = RECONNECT_MIN_MS;
+     while( !m_terminated )
+     {
+          if( m_socket < 0 )
+          {
+               if( connectServer() )
+               {
+                    retryMs = RECONNECT_MIN_MS;
+               }
+               else
+               {
+                    struct pollfd fd = { m_wakeup, POLLIN, 0 };
+                    if( poll(&fd, 1, retryMs) > 0 )
+                    {
+                         uint64_t value;
+                         if( read(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN )
+                         {
+                              perror("[CommandClient] read() failed");
+                         }
+                    }
+                    retryMs = std::min(retryMs * 2, (int)RECONNECT_MAX_MS);
+               }
+               continue;
+          }
+
+          int timeout;
+          bool sending;
+          {
+               std::lock_guard<std::mutex> lock(m_mutex);
+               timeout = (m_inFlight > 0)? expire() : -1;
+               sending = !m_sendBuffer.empty();
+          }
+          if( timeout == 0 )
+          {
+               std::printf("[CommandClient] No response within %d ms, reconnecting.\n", m_timeoutMs);
+               disconnect(REPLY_TIMEOUT);
+               continue;
+          }
+
+          struct pollfd fds[2];
+          fds[0].fd = m_socket;
+          fds[0].events = POLLIN | (sending? POLLOUT : 0);
+          fds[1].fd = m_wakeup;
+          fds[1].events = POLLIN;
+          int n = poll(fds, 2, timeout);
+          if( n < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               perror("[CommandClient] poll() failed");
+               break;
+          }
+          if( fds[1].revents & POLLIN )
+          {
+               uint64_t value;
+               if( read(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN )
+               {
+                    perror("[CommandClient] read() failed");
+               }
+          }
+          if( (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) && !receive() )
+          {
+               std::printf("[CommandClient] Disconnected from %s:%d.\n", m_host.c_str(), m_port);
+               disconnect(REPLY_DISCONNECTED);
+               continue;
+          }
+          if( (fds[0].revents & POLLOUT) && !flush() )
+          {
+               disconnect(REPLY_DISCONNECTED);
+          }
+     }
+}
+
+//------------------------------------------------------------------------------
+//   最も早い期限までのミリ秒 (期限切れがあれば 0) を返す
+//   m_mutex をロックして呼ぶこと
+//------------------------------------------------------------------------------
+int CommandClient::expire()
+{
+     std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+     std::chrono::steady_clock::time_point nearest = std::chrono::steady_clock::time_point::max();
+     for( int n = 0 ; n < NUM_SERIALS ; n++ )
+     {
+          const Pending& pending = m_pending[n];
+          if( pending.used && !pending.waitCompletion )
+          {
+               nearest = std::min(nearest, pending.deadline);
+          }
+     }
+     if( nearest == std::chrono::steady_clock::time_point::max() )
+     {
+          return -1;          // 完了応答だけを待っている
+     }
+     if( nearest <= now )
+     {
+          return 0;
+     }
+     return (int)std::chrono::duration_cast<std::chrono::milliseconds>(nearest - now + std::chrono::microseconds(999)).count();
+}
+
+//------------------------------------------------------------------------------
+//   接続する (終了の通知があれば中断する)
+//------------------------------------------------------------------------------
+bool CommandClient::connectServer()
+{
+     struct addrinfo hints, *result;
+     memset(&hints, 0, sizeof(hints));
+     hints.ai_family = AF_INET;
+     hints.ai_socktype = SOCK_STREAM;
+     char port[16];
+     std::snprintf(port, sizeof(port), "%d", m_port);
+     if( getaddrinfo(m_host.c_str(), port, &hints, &result) != 0 )
+     {
+          return false;
+     }
+
+     int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+     if( fd < 0 )
+     {
+          freeaddrinfo(result);
+          perror("[CommandClient] socket() failed");
+          return false;
+     }
+     int ret = connect(fd, result->ai_addr, result->ai_addrlen);
+     freeaddrinfo(result);
+     if( ret < 0 && errno == EINPROGRESS )
+     {
+          struct pollfd fds[2];
+          fds[0].fd = fd;
+          fds[0].events = POLLOUT;
+          fds[1].fd = m_wakeup;
+          fds[1].events = POLLIN;
+          int error = ETIMEDOUT;
+          socklen_t len = sizeof(error);
+          if( poll(fds, 2, CONNECT_TIMEOUT_MS) > 0 && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)) )
+          {
+               getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+          }
+          ret = (error == 0)? 0 : -1;
+     }
+     if( ret < 0 )
+     {
+          close(fd);
+          return false;
+     }
+     int opt = 1;
+     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_socket = fd;
+     m_recvLength = 0;
+     m_sendBuffer.clear();
+     m_connected = true;
+     m_connectCount++;
+     std::printf("[CommandClient] Connected to %s:%d.\n", m_host.c_str(), m_port);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   切断して，応答待ちをすべて error で終える
+//   error が REPLY_TIMEOUT のときは，期限の切れたものだけ REPLY_TIMEOUT にする
+//------------------------------------------------------------------------------
+void CommandClient::disconnect(int error)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     if( m_socket >= 0 )
+     {
+          close(m_socket);
+          m_socket = -1;
+     }
+     m_connected = false;
+     m_sendBuffer.clear();
+
+     std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+     for( int n = 0 ; n < NUM_SERIALS ; n++ )
+     {
+          Pending& pending = m_pending[n];
+          if( !pending.used )
+          {
+               continue;
+          }
+          Reply reply;
+          reply.error = (error == REPLY_TIMEOUT && !pending.waitCompletion && pending.deadline <= now)? REPLY_TIMEOUT : REPLY_DISCONNECTED;
+          reply.sent = pending.sent;
+          reply.received = now;
+          if( !pending.waitCompletion )
+          {
+               pending.reply.set_value(reply);
+          }
+          if( pending.hasCompletion )
+          {
+               pending.completion.set_value(reply);
+          }
+          release(pending);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   届いているデータを読んで，フレームごとに dispatch() する
+//   切断されていれば false
+//------------------------------------------------------------------------------
+bool CommandClient::receive()
+{
+     while( true )
+     {
+          ssize_t n = recv(m_socket, &m_recvBuffer[m_recvLength], m_recvBuffer.size() - m_recvLength, MSG_DONTWAIT);
+          if( n == 0 )
+          {
+               return false;
+          }
+          if( n < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               return (errno == EAGAIN || errno == EWOULDBLOCK);
+          }
+          std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+          m_recvLength += (int)n;
+
+          Packet packet;
+          int offset = 0;
+          while( true )
+          {
+               int skip, frameSize;
+               int result = Packet::scan(&m_recvBuffer[offset], m_recvLength - offset, NULL, 0, &skip, &frameSize);
+               offset += skip;
+               if( result != Packet::SCAN_FRAME )
+               {
+                    break;
+               }
+               packet.assign(&m_recvBuffer[offset], frameSize, NULL, 0, frameSize);
+               offset += frameSize;
+               dispatch(packet, received);
+          }
+          m_recvLength -= offset;
+          memmove(&m_recvBuffer[0], &m_recvBuffer[offset], m_recvLength);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   応答をシリアル番号で応答待ちに対応付ける
+//------------------------------------------------------------------------------
+void CommandClient::dispatch(const Packet& packet, std::chrono::steady_clock::time_point received)
+{
+     std::unique_lock<std::mutex> lock(m_mutex);
+     if( packet.getID() == EVENT_ID || packet.getID() == SCRIPT_EVENT_ID )
+     {
+          EventHandler handler = m_eventHandler;
+          lock.unlock();
+          if( handler )
+          {
+               handler(packet);
+          }
+          return;
+     }
+
+     Pending& pending = m_pending[packet.getSerialNo()];
+     if( !pending.used || pending.id != packet.getID() )
+     {
+          std::printf("[CommandClient] Unexpected response (ID %d, serial %d).\n", packet.getID(), packet.getSerialNo());
+          return;
+     }
+     Reply reply;
+     reply.error = REPLY_OK;
+     reply.packet = packet;
+     reply.sent = pending.sent;
+     reply.received = received;
+     if( pending.waitCompletion )
+     {
+          pending.completion.set_value(reply);
+          release(pending);
+          return;
+     }
+     pending.reply.set_value(reply);
+     bool accepted = (packet.getDataLength() >= 1 && packet.getData()[0] == 0);
+     if( pending.hasCompletion && accepted )
+     {
+          pending.waitCompletion = true;
+          return;
+     }
+     if( pending.hasCompletion )
+     {
+          pending.completion.set_value(reply);
+     }
+     release(pending);
+}
+
+//------------------------------------------------------------------------------
+//   送りきれなかったバイト列を送る
+//------------------------------------------------------------------------------
+bool CommandClient::flush()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     while( !m_sendBuffer.empty() )
+     {
+          ssize_t n = ::send(m_socket, m_sendBuffer.data(), m_sendBuffer.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+          if( n < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               return (errno == EAGAIN || errno == EWOULDBLOCK);
+          }
+          m_sendBuffer.erase(m_sendBuffer.begin(), m_sendBuffer.begin() + n);
+     }
+     return true;
+}
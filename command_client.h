@@ -0,0 +1,196 @@
+//------------------------------------------------------------------------------
+//   command_client.h
+//
+//   クライアント側のリクエストの組み立てと応答の解析
+//   command_schema.h の定義をそのまま使うので，サーバと並びが食い違うことはない
+//
+//   例
+//     MovetoSchema::Request req = { 0, 12800, 1 };
+//     Packet packet;
+//     makeRequest<MovetoSchema>(packet, serialNo, req);
+//     ... 送信，応答を受信 ...
+//     uint8_t status;
+//     MovetoSchema::Response res;
+//     readResponse<MovetoSchema>(response, &status, &res);
+//
+//   CommandClient は上の関数を使う非同期のクライアント (command_client.cpp)
+//     CommandClient client("192.168.0.10");
+//     std::future<CommandClient::Reply> f = client.call<StatusSchema>(StatusSchema::Request());
+//     CommandClient::Reply reply = f.get();
+//     if( reply.error == CommandClient::REPLY_OK ) readResponse<StatusSchema>(reply.packet, ...);
+//------------------------------------------------------------------------------
+#ifndef   COMMAND_CLIENT_H
+#define   COMMAND_CLIENT_H
+
+#include <cstdint>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include "packet.h"
+#include "command_schema.h"
+
+//------------------------------------------------------------------------------
+//   リクエストを組み立てる (省略できるフィールドも含めて全フィールドを送る)
+//------------------------------------------------------------------------------
+template<typename SCHEMA>
+void makeRequest(Packet& packet, uint8_t serialNo, const typename SCHEMA::Request& request,
+     int format = Packet::FORMAT_BASIC)
+{
+     uint8_t data[SCHEMA::RequestLayout::SIZE + 1];
+     SCHEMA::RequestLayout::encode(data, request);
+     packet.create(SCHEMA::ID, serialNo, format);
+     packet.addPacketData(data, SCHEMA::RequestLayout::SIZE);
+}
+
+//------------------------------------------------------------------------------
+//   応答を解析する
+//   ID が違う，またはデータ部が足りなければ false
+//   ステータスが STS_OK (0) でなければ，status だけを返す
+//------------------------------------------------------------------------------
+template<typename SCHEMA>
+bool readResponse(const Packet& packet, uint8_t *status, typename SCHEMA::Response *response)
+{
+     if( packet.getID() != SCHEMA::ID || packet.getDataLength() < 1 )
+     {
+          return false;
+     }
+     const uint8_t *data = packet.getData();
+     *status = data[0];
+     if( *status != 0 )
+     {
+          return true;
+     }
+     return SCHEMA::ResponseLayout::decode(data + 1, packet.getDataLength() - 1, *response);
+}
+
+//------------------------------------------------------------------------------
+//   完了応答 (完了通知を指定した移動の，２回目の応答) を解析する
+//------------------------------------------------------------------------------
+inline bool readCompletion(const Packet& packet, uint8_t *status, CompletionSchema::Response *response)
+{
+     if( packet.getDataLength() < 1 )
+     {
+          return false;
+     }
+     const uint8_t *data = packet.getData();
+     *status = data[0];
+     return CompletionSchema::ResponseLayout::decode(data + 1, packet.getDataLength() - 1, *response);
+}
+
+//------------------------------------------------------------------------------
+//   コマンドサーバへの非同期クライアント
+//   送信は呼び出したスレッドでその場で行い (送りきれなければ受信スレッドが続きを送る)，
+//   応答は std::future で返す。応答を待たずに続けて送ってよい (パイプライン)
+//   応答はシリアル番号で対応付けるので，応答待ちは MAX_IN_FLIGHT 個まで
+//
+//   切断されると受信スレッドが間隔を延ばしながら再接続する。切断時の応答待ちと，
+//   切断中に送ろうとしたリクエストは REPLY_DISCONNECTED になる (実行されたかどうかは
+//   分からないので，自動では再送しない)
+//   タイムアウトしたときは，サーバが詰まっているか接続が死んでいるので接続を張り直す
+//------------------------------------------------------------------------------
+class CommandClient
+{
+     public:
+          enum{ MAX_IN_FLIGHT = 128 };       // < TcpServer::MAX_PENDING
+          enum{ DEFAULT_TIMEOUT_MS = 3000 };
+          enum{ CONNECT_TIMEOUT_MS = 1000 };
+          enum{ RECONNECT_MIN_MS = 100, RECONNECT_MAX_MS = 3200 };
+          enum{ EVENT_ID = StatusEventSchema::ID };          // StatusPublisher::EVENT_ID
+          enum{ SCRIPT_EVENT_ID = ScriptEventSchema::ID };   // ScriptStreamer::EVENT_ID
+          enum
+          {
+               REPLY_OK = 0,                 // 応答を受け取った (ステータスはデータ部の先頭)
+               REPLY_TIMEOUT,
+               REPLY_DISCONNECTED,
+               REPLY_BUSY,                   // 応答待ちが MAX_IN_FLIGHT 個ある
+          };
+
+          struct Reply
+          {
+               int      error;
+               Packet   packet;
+               std::chrono::steady_clock::time_point sent;       // 送信の直前
+               std::chrono::steady_clock::time_point received;   // 受信スレッドが応答を読んだ時刻
+          };
+          typedef std::function<void(const Packet& event)> EventHandler;
+
+     private:
+          enum{ NUM_SERIALS = 256 };
+          enum{ RECV_BUFFER_SIZE = Packet::MAX_EXT_PACKET_SIZE + 4096 };
+
+          struct Pending
+          {
+               bool     used;
+               bool     hasCompletion;      // 完了応答も待つ
+               bool     waitCompletion;     // １回目の応答を返して，完了応答を待っている
+               uint8_t  id;
+               std::chrono::steady_clock::time_point sent;
+               std::chrono::steady_clock::time_point deadline;
+               std::promise<Reply> reply;
+               std::promise<Reply> completion;
+          };
+
+          std::string  m_host;
+          int          m_port;
+          int          m_timeoutMs;
+          std::thread *m_thread;
+          int          m_socket;
+          int          m_wakeup;             // 受信スレッドを起こす eventfd
+          bool         m_terminated;
+          bool         m_connected;
+          int          m_connectCount;
+
+          std::mutex   m_mutex;
+          Pending      m_pending[NUM_SERIALS];
+          int          m_inFlight;
+          uint8_t      m_nextSerial;
+          std::vector<uint8_t> m_sendBuffer; // 送りきれなかったバイト列
+          std::vector<uint8_t> m_rawRequest;
+          EventHandler m_eventHandler;
+
+          std::vector<uint8_t> m_recvBuffer;
+          int          m_recvLength;
+
+          void execute();
+          bool connectServer();
+          void disconnect(int error);
+          bool receive();
+          void dispatch(const Packet& packet, std::chrono::steady_clock::time_point received);
+          bool flush();
+          int  expire();
+          void wake();
+          void release(Pending& pending);
+          static std::future<Reply> makeError(int error);
+
+          CommandClient(const CommandClient&);
+          CommandClient& operator=(const CommandClient&);
+
+     public:
+          CommandClient(const char *host, int port = 12468, int timeoutMs = DEFAULT_TIMEOUT_MS);
+          ~CommandClient();
+
+          bool isConnected();
+          bool waitConnected(int timeoutMs);
+          int  getConnectCount();
+          void setEventHandler(EventHandler handler);
+
+          //   completion を渡すと完了応答をそこへ返す (リクエストで完了通知を指定したときだけ渡すこと)
+          //   １回目の応答のステータスが STS_OK でなければ，completion にも同じ応答が入る
+          std::future<Reply> send(uint8_t id, const void *data, int size,
+               int format = Packet::FORMAT_BASIC, std::future<Reply> *completion = NULL);
+
+          template<typename SCHEMA>
+          std::future<Reply> call(const typename SCHEMA::Request& request,
+               int format = Packet::FORMAT_BASIC, std::future<Reply> *completion = NULL)
+          {
+               uint8_t data[SCHEMA::RequestLayout::SIZE + 1];
+               SCHEMA::RequestLayout::encode(data, request);
+               return send(SCHEMA::ID, data, SCHEMA::RequestLayout::SIZE, format, completion);
+          }
+};
+
+#endif
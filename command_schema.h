@@ -0,0 +1,722 @@
+//------------------------------------------------------------------------------
+//   command_schema.h
+//
+//   コマンドの定義 (ID，リクエスト・応答のデータ部の並びと値の範囲)
+//   各コマンドを構造体と SchemaLayout で一度だけ宣言し，サーバ側 (SchemaCommand)
+//   とクライアント側 (command_client.h) の解析・組み立てはここから生成する
+//   Robot などには依存しないので，クライアントはこのヘッダと packet.h だけでよい
+//
+//   フィールドはデータ部の先頭から宣言順に隙間なく並ぶ (little endian)
+//     SchemaValue  : 値 (範囲の検査なし)
+//     SchemaRange  : 値 (MIN ～ MAX の外なら STS_INVALID)
+//     SchemaOption : 省略できる値 (省略時は DEFAULT，末尾にのみ置ける)
+//     SchemaBytes  : 配列など，そのままコピーするもの
+//------------------------------------------------------------------------------
+#ifndef   COMMAND_SCHEMA_H
+#define   COMMAND_SCHEMA_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+//------------------------------------------------------------------------------
+//   データ部のないリクエスト・応答
+//------------------------------------------------------------------------------
+struct SchemaNone
+{
+};
+
+//------------------------------------------------------------------------------
+template<typename S, typename T, T S::*M, int64_t MIN, int64_t MAX>
+struct SchemaRange
+{
+     enum{ SIZE = sizeof(T), OPTIONAL = 0 };
+
+     static bool decode(const uint8_t *data, int length, int offset, S& s)
+     {
+          if( offset + (int)SIZE > length )
+          {
+               return false;
+          }
+          T value;
+          memcpy(&value, data + offset, SIZE);
+          if( (int64_t)value < MIN || MAX < (int64_t)value )
+          {
+               return false;
+          }
+          s.*M = value;
+          return true;
+     }
+     static void encode(uint8_t *data, int offset, const S& s)
+     {
+          memcpy(data + offset, &(s.*M), SIZE);
+     }
+};
+
+//------------------------------------------------------------------------------
+template<typename S, typename T, T S::*M>
+struct SchemaValue : public SchemaRange<S, T, M, (int64_t)std::numeric_limits<T>::min(), (int64_t)std::numeric_limits<T>::max()>
+{
+};
+
+//------------------------------------------------------------------------------
+template<typename S, typename T, T S::*M, int64_t DEFAULT,
+     int64_t MIN = (int64_t)std::numeric_limits<T>::min(), int64_t MAX = (int64_t)std::numeric_limits<T>::max()>
+struct SchemaOption
+{
+     enum{ SIZE = sizeof(T), OPTIONAL = 1 };
+
+     static bool decode(const uint8_t *data, int length, int offset, S& s)
+     {
+          if( offset >= length )
+          {
+               s.*M = (T)DEFAULT;
+               return true;
+          }
+          return SchemaRange<S, T, M, MIN, MAX>::decode(data, length, offset, s);
+     }
+     static void encode(uint8_t *data, int offset, const S& s)
+     {
+          memcpy(data + offset, &(s.*M), SIZE);
+     }
+};
+
+//------------------------------------------------------------------------------
+template<typename S, typename T, T S::*M>
+struct SchemaBytes
+{
+     enum{ SIZE = sizeof(T), OPTIONAL = 0 };
+
+     static bool decode(const uint8_t *data, int length, int offset, S& s)
+     {
+          if( offset + (int)SIZE > length )
+          {
+               return false;
+          }
+          memcpy(&(s.*M), data + offset, SIZE);
+          return true;
+     }
+     static void encode(uint8_t *data, int offset, const S& s)
+     {
+          memcpy(data + offset, &(s.*M), SIZE);
+     }
+};
+
+//------------------------------------------------------------------------------
+//   フィールドの並び
+//   SIZE は全フィールド，MIN_SIZE は省略できないフィールドのバイト数
+//   decode() は MIN_SIZE より短いデータや範囲外の値で false を返す
+//   (SIZE より後ろのデータは可変長部分として呼び出し側が扱う)
+//------------------------------------------------------------------------------
+template<typename S, typename... F>
+struct SchemaLayout
+{
+     enum{ SIZE = 0, MIN_SIZE = 0 };
+
+     static bool decode(const uint8_t *data, int length, int offset, S& s){ return true; }
+     static void encode(uint8_t *data, int offset, const S& s){}
+     static bool decode(const uint8_t *data, int length, S& s){ return true; }
+     static void encode(uint8_t *data, const S& s){}
+};
+
+template<typename S, typename F, typename... R>
+struct SchemaLayout<S, F, R...>
+{
+     typedef SchemaLayout<S, R...> Rest;
+     static_assert(!F::OPTIONAL || Rest::MIN_SIZE == 0, "optional fields must be at the end");
+
+     enum{ SIZE = F::SIZE + Rest::SIZE };
+     enum{ MIN_SIZE = F::OPTIONAL? 0 : F::SIZE + Rest::MIN_SIZE };
+
+     static bool decode(const uint8_t *data, int length, int offset, S& s)
+     {
+          return F::decode(data, length, offset, s) && Rest::decode(data, length, offset + F::SIZE, s);
+     }
+     static void encode(uint8_t *data, int offset, const S& s)
+     {
+          F::encode(data, offset, s);
+          Rest::encode(data, offset + F::SIZE, s);
+     }
+     static bool decode(const uint8_t *data, int length, S& s){ return decode(data, length, 0, s); }
+     static void encode(uint8_t *data, const S& s){ encode(data, 0, s); }
+};
+
+//------------------------------------------------------------------------------
+//   コマンドの一覧 (ID の重複をコンパイル時に調べる)
+//------------------------------------------------------------------------------
+template<int ID, typename... C>
+struct SchemaHasID
+{
+     enum{ VALUE = 0 };
+};
+
+template<int ID, typename C, typename... R>
+struct SchemaHasID<ID, C, R...>
+{
+     enum{ VALUE = (C::ID == ID) || SchemaHasID<ID, R...>::VALUE };
+};
+
+template<typename... C>
+struct SchemaList
+{
+     enum{ UNIQUE = 1 };
+     template<int ID> struct Has{ enum{ VALUE = 0 }; };
+};
+
+template<typename C, typename... R>
+struct SchemaList<C, R...>
+{
+     static_assert(0 <= C::ID && C::ID <= 255, "command ID must fit in one byte");
+     enum{ UNIQUE = !SchemaHasID<C::ID, R...>::VALUE && SchemaList<R...>::UNIQUE };
+     template<int ID> struct Has{ enum{ VALUE = SchemaHasID<ID, C, R...>::VALUE }; };
+};
+
+
+//==============================================================================
+//   各コマンドの定義
+//   (応答のデータ部は，先頭のステータス 1 バイトに続く部分で，STS_OK のときだけ付く)
+//==============================================================================
+enum
+{
+     SCHEMA_NUM_MOTORS  = 3,       // Robot / CommandObject の軸数
+     SCHEMA_NUM_PARAMS  = 32,      // L6470 のパラメータ数
+};
+
+//------------------------------------------------------------------------------
+//   EnableCommand (0)
+//------------------------------------------------------------------------------
+struct EnableSchema
+{
+     enum{ ID = 0 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2)
+          uint16_t action;         // +02 0:励磁を切る，それ以外:励磁を入れる
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint16_t, &Request::motorID, 0, SCHEMA_NUM_MOTORS-1>,
+          SchemaValue<Request, uint16_t, &Request::action> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ResetCommand (1)
+//------------------------------------------------------------------------------
+struct ResetSchema
+{
+     enum{ ID = 1 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2，これ以外は全軸)
+     };
+     typedef SchemaLayout<Request,
+          SchemaValue<Request, uint16_t, &Request::motorID> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   StopCommand (2)
+//------------------------------------------------------------------------------
+struct StopSchema
+{
+     enum{ ID = 2 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2，これ以外は全軸)
+          uint16_t action;         // +02 0:即時停止，それ以外:減速停止
+     };
+     typedef SchemaLayout<Request,
+          SchemaValue<Request, uint16_t, &Request::motorID>,
+          SchemaValue<Request, uint16_t, &Request::action> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   HomingCommand (3)
+//------------------------------------------------------------------------------
+struct HomingSchema
+{
+     enum{ ID = 3 };
+     struct Request
+     {
+          uint8_t  completion;     // +00 完了通知 (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaOption<Request, uint8_t, &Request::completion, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   MovetoCommand (4)
+//------------------------------------------------------------------------------
+struct MovetoSchema
+{
+     enum{ ID = 4 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2)
+          int32_t  position;       // +02 移動先位置(pulse)
+          uint8_t  completion;     // +06 完了通知 (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint16_t, &Request::motorID, 0, SCHEMA_NUM_MOTORS-1>,
+          SchemaValue<Request, int32_t, &Request::position>,
+          SchemaOption<Request, uint8_t, &Request::completion, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   Move3DCommand (5)
+//------------------------------------------------------------------------------
+struct Move3DSchema
+{
+     enum{ ID = 5 };
+     struct Request
+     {
+          int32_t  position[3];    // +00 BASE, SHOULDER, ELBOW の移動先座標(pulse)
+          uint8_t  completion;     // +12 完了通知 (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaBytes<Request, int32_t[3], &Request::position>,
+          SchemaOption<Request, uint8_t, &Request::completion, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ReadParamCommand (6)
+//------------------------------------------------------------------------------
+struct ReadParamSchema
+{
+     enum{ ID = 6 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2)
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint16_t, &Request::motorID, 0, SCHEMA_NUM_MOTORS-1> > RequestLayout;
+     struct Response
+     {
+          uint32_t param[SCHEMA_NUM_PARAMS];     // +00 パラメータ 0 ～ 31 の値
+     };
+     typedef SchemaLayout<Response,
+          SchemaBytes<Response, uint32_t[SCHEMA_NUM_PARAMS], &Response::param> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   WriteParamCommand (7)
+//------------------------------------------------------------------------------
+struct WriteParamSchema
+{
+     enum{ ID = 7 };
+     struct Request
+     {
+          uint16_t motorID;        // +00 モータID (0, 1, 2)
+          uint16_t paramID;        // +02 パラメータID (0 ～ 31)
+          uint32_t value;          // +04 パラメータ値
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint16_t, &Request::motorID, 0, SCHEMA_NUM_MOTORS-1>,
+          SchemaRange<Request, uint16_t, &Request::paramID, 0, SCHEMA_NUM_PARAMS-1>,
+          SchemaValue<Request, uint32_t, &Request::value> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   SaveParamCommand (8)
+//------------------------------------------------------------------------------
+struct SaveParamSchema
+{
+     enum{ ID = 8 };
+     typedef SchemaNone Request;
+     typedef SchemaLayout<Request> RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   StatusCommand (9)
+//   応答はグリッパーの変位と，軸ごとに 16 バイト
+//     +00 (4) 位置，+04 (4) 速度，+08 停止中，+09 移動中，+10 原点復帰済み，
+//     +11 逆転側リミット，+12 原点センサ，+13 正転側リミット，+14 アラームフラグ
+//------------------------------------------------------------------------------
+struct RobotStatus
+{
+     enum{ AXIS_SIZE = 16 };
+     uint8_t gripper;
+     uint8_t axis[SCHEMA_NUM_MOTORS][AXIS_SIZE];
+};
+
+struct StatusSchema
+{
+     enum{ ID = 9 };
+     typedef SchemaNone Request;
+     typedef SchemaLayout<Request> RequestLayout;
+     typedef RobotStatus Response;
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::gripper>,
+          SchemaBytes<Response, uint8_t[SCHEMA_NUM_MOTORS][RobotStatus::AXIS_SIZE], &Response::axis> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   GripperCommand (10)
+//------------------------------------------------------------------------------
+struct GripperSchema
+{
+     enum{ ID = 10 };
+     struct Request
+     {
+          uint8_t  value;          // +00 開度 (0 ～ 100)
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint8_t, &Request::value, 0, 100> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   FeedOverrideCommand (13)
+//------------------------------------------------------------------------------
+struct FeedOverrideSchema
+{
+     enum{ ID = 13 };
+     enum{ MIN_PERCENT = 10, MAX_PERCENT = 200 };     // Robot::MIN_FEED_OVERRIDE / MAX_FEED_OVERRIDE
+     struct Request
+     {
+          uint16_t percent;        // +00 オーバーライド(%) (省略時は取得のみ)
+     };
+     typedef SchemaLayout<Request,
+          SchemaOption<Request, uint16_t, &Request::percent, 0, MIN_PERCENT, MAX_PERCENT> > RequestLayout;
+     struct Response
+     {
+          uint16_t percent;        // +00 現在のオーバーライド(%)
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint16_t, &Response::percent> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   MoveJointCommand (14)
+//------------------------------------------------------------------------------
+struct MoveJointSchema
+{
+     enum{ ID = 14 };
+     struct Request
+     {
+          int32_t  position[3];    // +00 BASE, SHOULDER, ELBOW の移動先座標(pulse)
+          uint32_t speed;          // +12 速度 (0.01 deg/sec 単位，0 は既定値)
+          uint32_t accel;          // +16 加速度 (0.01 deg/sec^2 単位，0 は既定値)
+          uint8_t  completion;     // +20 完了通知 (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaBytes<Request, int32_t[3], &Request::position>,
+          SchemaValue<Request, uint32_t, &Request::speed>,
+          SchemaValue<Request, uint32_t, &Request::accel>,
+          SchemaOption<Request, uint8_t, &Request::completion, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   MoveXYZCommand (15)
+//------------------------------------------------------------------------------
+struct MoveXYZSchema
+{
+     enum{ ID = 15 };
+     struct Request
+     {
+          int32_t  position[3];    // +00 X, Y, Z (0.01 mm 単位)
+          uint32_t speed;          // +12 速度 (0.01 mm/sec 単位，0 は既定値)
+          uint32_t accel;          // +16 加速度 (0.01 mm/sec^2 単位，0 は既定値)
+          uint8_t  completion;     // +20 完了通知 (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaBytes<Request, int32_t[3], &Request::position>,
+          SchemaValue<Request, uint32_t, &Request::speed>,
+          SchemaValue<Request, uint32_t, &Request::accel>,
+          SchemaOption<Request, uint8_t, &Request::completion, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   SubscribeCommand (16)
+//------------------------------------------------------------------------------
+struct SubscribeSchema
+{
+     enum{ ID = 16 };
+     struct Request
+     {
+          uint16_t period;         // +00 配信周期 (ms，0 は配信の停止)
+          uint8_t  mode;           // +02 0:周期ごとに全項目，1:変化した項目だけ (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaValue<Request, uint16_t, &Request::period>,
+          SchemaOption<Request, uint8_t, &Request::mode, 0> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   StatusEvent (17) : SubscribeCommand で登録したセッションへのステータス配信フレーム
+//   mask で示した項目だけを順に置く (MODE_PERIODIC では常に全項目)
+//     +00 (1)   mask : bit0 グリッパー，bit1 ～ bit3 各軸
+//     +01 (4)   timestamp (ms)
+//     +05 (1)   グリッパーの開度 (mask の bit0)
+//     ...       mask の各軸の状態 (RobotStatus::AXIS_SIZE バイトずつ，StatusCommand (9) と同じ)
+//------------------------------------------------------------------------------
+struct StatusEventSchema
+{
+     enum{ ID = 17 };
+};
+
+//------------------------------------------------------------------------------
+//   WaypointsCommand (18)
+//   固定長部分に続けて，点数 × POINT_SIZE バイトの座標を置く
+//------------------------------------------------------------------------------
+struct WaypointsSchema
+{
+     enum{ ID = 18 };
+     enum{ COORD_JOINT = 0, COORD_XYZ = 1 };
+     enum{ POINT_SIZE = 12 };
+     struct Request
+     {
+          uint8_t  coord;          // +00 座標系 (COORD_JOINT / COORD_XYZ)
+          uint8_t  replace;        // +01 0:キューの末尾に追加，1:キューを空にしてから追加
+          uint16_t count;          // +02 点数
+          uint32_t speed;          // +04 速度 (0.01 deg/sec または 0.01 mm/sec 単位)
+          uint32_t accel;          // +08 加速度
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint8_t, &Request::coord, COORD_JOINT, COORD_XYZ>,
+          SchemaValue<Request, uint8_t, &Request::replace>,
+          SchemaRange<Request, uint16_t, &Request::count, 1, 65535>,
+          SchemaValue<Request, uint32_t, &Request::speed>,
+          SchemaValue<Request, uint32_t, &Request::accel> > RequestLayout;
+     struct Response
+     {
+          uint16_t queueLength;    // +00 キューに残っている点数
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint16_t, &Response::queueLength> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ジョグ (19)
+//   TCP ではなく JogServer の UDP ポートへ，１データグラムに１フレームで送る (応答はない)
+//------------------------------------------------------------------------------
+struct JogSchema
+{
+     enum{ ID = 19 };
+     struct Request
+     {
+          uint32_t sequence;       // +00 シーケンス番号 (送るたびに１つ進める)
+          int32_t  speed[3];       // +04 BASE, SHOULDER, ELBOW の速度 (pulse/sec，符号が方向，0 は停止)
+     };
+     typedef SchemaLayout<Request,
+          SchemaValue<Request, uint32_t, &Request::sequence>,
+          SchemaBytes<Request, int32_t[3], &Request::speed> > RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptProfileCommand (20)
+//   最後に実行したスクリプトの計測結果 (時間は 0.1 ms 単位)
+//   category は CAT_COMPUTE, CAT_MOTION_WAIT, CAT_GRIPPER_WAIT, CAT_DELAY の順
+//------------------------------------------------------------------------------
+struct ScriptProfileSchema
+{
+     enum{ ID = 20 };
+     enum{ ENABLE_OFF = 0, ENABLE_ON = 1, ENABLE_KEEP = 2 };
+     enum{ CAT_COMPUTE = 0, CAT_MOTION_WAIT = 1, CAT_GRIPPER_WAIT = 2, CAT_DELAY = 3, NUM_CATEGORIES = 4 };
+     enum{ MAX_LINES = 8 };
+     struct Request
+     {
+          uint8_t  enable;         // +00 以降の実行を計測するか (ENABLE_OFF / ENABLE_ON / ENABLE_KEEP，省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaOption<Request, uint8_t, &Request::enable, ENABLE_KEEP, ENABLE_OFF, ENABLE_KEEP> > RequestLayout;
+     struct Response
+     {
+          uint8_t  enabled;        // +00 1:以降の実行を計測する
+          uint8_t  available;      // +01 1:最後の実行を計測した (0 のとき以降の項目は 0)
+          uint32_t total;          // +02 実行時間
+          uint32_t category[NUM_CATEGORIES];   // +06 種類ごとの時間
+          uint8_t  count;          // +22 行の数 (MAX_LINES まで，時間の長い順)
+          uint16_t line[MAX_LINES];            // +23 行番号
+          uint32_t hits[MAX_LINES];            // +39 実行回数
+          uint32_t time[MAX_LINES];            // +71 行で費やした時間
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::enabled>,
+          SchemaValue<Response, uint8_t, &Response::available>,
+          SchemaValue<Response, uint32_t, &Response::total>,
+          SchemaBytes<Response, uint32_t[NUM_CATEGORIES], &Response::category>,
+          SchemaValue<Response, uint8_t, &Response::count>,
+          SchemaBytes<Response, uint16_t[MAX_LINES], &Response::line>,
+          SchemaBytes<Response, uint32_t[MAX_LINES], &Response::hits>,
+          SchemaBytes<Response, uint32_t[MAX_LINES], &Response::time> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptUploadCommand (21)
+//   固定長部分に続けて，スクリプトのソースの offset バイト目からの部分を置く
+//   offset 0 で受信をやり直し，total バイトそろったところでコンパイルする
+//------------------------------------------------------------------------------
+struct ScriptUploadSchema
+{
+     enum{ ID = 21 };
+     enum{ MAX_SIZE = 1024 * 1024 };
+     enum{ STATE_RECEIVING = 0, STATE_COMPILED = 1, STATE_ERROR = 2 };
+     struct Request
+     {
+          uint32_t offset;         // +00 この部分の位置(byte)
+          uint32_t total;          // +04 ソース全体の大きさ(byte)
+     };
+     typedef SchemaLayout<Request,
+          SchemaRange<Request, uint32_t, &Request::offset, 0, MAX_SIZE-1>,
+          SchemaRange<Request, uint32_t, &Request::total, 1, MAX_SIZE> > RequestLayout;
+     struct Response
+     {
+          uint8_t  state;          // +00 STATE_RECEIVING / STATE_COMPILED / STATE_ERROR (メッセージは ScriptEvent で届く)
+          uint32_t received;       // +01 受信済みの大きさ(byte)
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::state>,
+          SchemaValue<Response, uint32_t, &Response::received> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptStartCommand (22)
+//   アップロードしたスクリプトを実行する
+//------------------------------------------------------------------------------
+struct ScriptStartSchema
+{
+     enum{ ID = 22 };
+     enum{ MODE_RUN = 0, MODE_DRY_RUN = 1, MODE_PROFILE = 2 };
+     struct Request
+     {
+          uint8_t  mode;           // +00 MODE_RUN / MODE_DRY_RUN / MODE_PROFILE (省略可)
+          uint8_t  stream;         // +01 1:このセッションへ実行の経過を配信する (省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaOption<Request, uint8_t, &Request::mode, MODE_RUN, MODE_RUN, MODE_PROFILE>,
+          SchemaOption<Request, uint8_t, &Request::stream, 1, 0, 1> > RequestLayout;
+     struct Response
+     {
+          uint32_t run;            // +00 実行の番号 (ScriptEvent の run)
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint32_t, &Response::run> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptStopCommand (23)
+//------------------------------------------------------------------------------
+struct ScriptStopSchema
+{
+     enum{ ID = 23 };
+     typedef SchemaNone Request;
+     typedef SchemaLayout<Request> RequestLayout;
+     typedef SchemaNone Response;
+     typedef SchemaLayout<Response> ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptStatusCommand (24)
+//------------------------------------------------------------------------------
+struct ScriptStatusSchema
+{
+     enum{ ID = 24 };
+     enum{ STREAM_OFF = 0, STREAM_ON = 1, STREAM_KEEP = 2 };
+     struct Request
+     {
+          uint8_t  stream;         // +00 このセッションへの配信 (STREAM_OFF / STREAM_ON / STREAM_KEEP，省略可)
+     };
+     typedef SchemaLayout<Request,
+          SchemaOption<Request, uint8_t, &Request::stream, STREAM_KEEP, STREAM_OFF, STREAM_KEEP> > RequestLayout;
+     struct Response
+     {
+          uint8_t  running;        // +00 1:実行中
+          uint8_t  dryRun;         // +01 1:実行中 (または最後) の実行は試運転
+          uint8_t  uploaded;       // +02 1:アップロードしたスクリプトがある
+          uint8_t  streaming;      // +03 1:このセッションへ配信している
+          uint32_t run;            // +04 最後に開始した実行の番号 (0 はまだない)
+          uint32_t elapsed;        // +08 実行中なら開始からの，そうでなければ最後の実行の時間(ms)
+          uint8_t  result;         // +12 最後に終わった実行の終わり方 (ScriptEventSchema::RESULT_xxx)
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::running>,
+          SchemaValue<Response, uint8_t, &Response::dryRun>,
+          SchemaValue<Response, uint8_t, &Response::uploaded>,
+          SchemaValue<Response, uint8_t, &Response::streaming>,
+          SchemaValue<Response, uint32_t, &Response::run>,
+          SchemaValue<Response, uint32_t, &Response::elapsed>,
+          SchemaValue<Response, uint8_t, &Response::result> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+//   ScriptEvent (25) : 実行の経過の配信フレーム (通常形式)
+//   固定長部分に続けて，KIND_OUTPUT / KIND_ERROR ではテキスト (終端の 0 なし) を置く
+//   MAX_TEXT バイトを超えるテキストは複数のフレームに分ける (最後以外は detail が DETAIL_MORE)
+//------------------------------------------------------------------------------
+struct ScriptEventSchema
+{
+     enum{ ID = 25 };
+     enum{ KIND_START = 0, KIND_OUTPUT = 1, KIND_ERROR = 2, KIND_END = 3 };
+     enum{ RESULT_DONE = 0, RESULT_ERROR = 1, RESULT_ABORTED = 2, RESULT_NONE = 255 };
+     enum{ DETAIL_MORE = 1 };
+     struct Response
+     {
+          uint8_t  kind;           // +00 KIND_xxx
+          uint32_t run;            // +01 実行の番号 (アップロードの構文エラーは 0)
+          uint32_t time;           // +05 開始からの時間(ms)
+          uint8_t  detail;         // +09 KIND_END : 終わり方 (RESULT_xxx)
+                                   //     KIND_OUTPUT / KIND_ERROR : DETAIL_MORE なら次のフレームに続く
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::kind>,
+          SchemaValue<Response, uint32_t, &Response::run>,
+          SchemaValue<Response, uint32_t, &Response::time>,
+          SchemaValue<Response, uint8_t, &Response::detail> > ResponseLayout;
+     enum{ MAX_TEXT = 250 - ResponseLayout::SIZE };    // Packet::MAX_DATA_LENGTH - 10
+};
+
+//------------------------------------------------------------------------------
+//   完了応答 (移動・原点復帰のコマンドに完了通知を指定したとき，同じ ID とシリアル番号で届く)
+//------------------------------------------------------------------------------
+struct CompletionSchema
+{
+     enum{ KIND_MOTION_END = 0x01 };
+     struct Response
+     {
+          uint8_t  kind;           // +00 KIND_MOTION_END
+          int32_t  position[3];    // +01 各軸の最終位置(pulse)
+          uint32_t elapsed;        // +13 受付からの経過時間(ms)
+          uint8_t  alarm[3];       // +17 各軸のアラームフラグ
+     };
+     typedef SchemaLayout<Response,
+          SchemaValue<Response, uint8_t, &Response::kind>,
+          SchemaBytes<Response, int32_t[3], &Response::position>,
+          SchemaValue<Response, uint32_t, &Response::elapsed>,
+          SchemaBytes<Response, uint8_t[3], &Response::alarm> > ResponseLayout;
+};
+
+//------------------------------------------------------------------------------
+typedef SchemaList<EnableSchema, ResetSchema, StopSchema, HomingSchema, MovetoSchema, Move3DSchema,
+     ReadParamSchema, WriteParamSchema, SaveParamSchema, StatusSchema, GripperSchema,
+     FeedOverrideSchema, MoveJointSchema, MoveXYZSchema, SubscribeSchema, WaypointsSchema, JogSchema,
+     ScriptProfileSchema, ScriptUploadSchema, ScriptStartSchema, ScriptStopSchema, ScriptStatusSchema> CommandSchemas;
+
+static_assert(CommandSchemas::UNIQUE, "duplicate command ID");
+static_assert(!CommandSchemas::Has<StatusEventSchema::ID>::VALUE && !CommandSchemas::Has<ScriptEventSchema::ID>::VALUE,
+     "event frame ID used by a command");
+
+#endif
@@ -1,553 +1,35 @@
 //------------------------------------------------------------------------------
 //   command_server.cpp
 //------------------------------------------------------------------------------
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include <unistd.h>
 #include <string.h>
-#include <poll.h>
 #include <cstdio>
 #include <cmath>
+#include <chrono>
 #include <algorithm>
 #include "command_server.h"
-
-
-//==============================================================================
-//   Packet
-//==============================================================================
-//   コンストラクタ
-//------------------------------------------------------------------------------
-Packet::Packet()
-{
-     clear();
-}
-
-//------------------------------------------------------------------------------
-Packet *Packet::clone()
-{
-     Packet *p = new Packet();
-     memcpy(p->m_body, m_body, MAX_PACKET_SIZE);
-     return p;
-}
-
-//------------------------------------------------------------------------------
-//   現在の内部データをすべてクリアしてデフォルトの状態にする
-//   シーケンシャル書き込みを行う場合は必ず最初にこのメソッドを実行する
-//------------------------------------------------------------------------------
-void Packet::clear()
-{
-     m_body[0] = STX;
-     m_body[1] = DEFAULT_ID;
-     m_body[2] = DEFAULT_SERIAL;
-     m_body[3] = DEFAULT_DATALEN;
-     m_body[4] = getChecksum();
-     m_body[5] = ETX;
-
-     m_rawBytePtr = 0;
-}
-
-//------------------------------------------------------------------------------
-//   チェックサムを算出して返す
-//------------------------------------------------------------------------------
-uint8_t Packet::getChecksum()
-{
-     int length = getDataLength();
-     uint8_t sum = 0x00;
-     for( int n = 0 ; n < length ; n++ )
-     {
-          sum += m_body[4+n];
-     }
-     return sum;
-}
-
-//------------------------------------------------------------------------------
-//   新しいパケットを準備する
-//------------------------------------------------------------------------------
-void Packet::create(uint8_t id, uint8_t serialNo)
-{
-     clear();
-     m_body[1] = id;
-     m_body[2] = serialNo;
-}
-
-//------------------------------------------------------------------------------
-//   パケットへ「データ」を追加する
-//   m_body[0] : STX(0x02)
-//   m_body[1] : コマンドID
-//   m_body[2] : シリアル番号
-//   m_body[3] : (後続の)データ部の長さ(byte) = len
-//   m_body[4] : データ[0]
-//   m_body[5] : データ[1]
-//   ...
-//   m_body[4+len] : チェックサム
-//   m_body[5+len] : ETX(0x03)
-//------------------------------------------------------------------------------
-void Packet::addPacketData(void *data, int size)
-{
-     int len = getDataLength();
-     size = std::min(size, MAX_DATA_LENGTH - len);
-     uint8_t *p = m_body + 4 + len;     // 次のデータ格納位置を指すポインタ
-     memcpy(p, data, size);
-     len += size;
-     m_body[3] = (uint8_t)len;          // 「データ長」を更新
-     m_body[4+len] = getChecksum();     // チェックサムを更新
-     m_body[5+len] = ETX;
-}
-
-//------------------------------------------------------------------------------
-//   パケットのバイト列へシーケンシャルにデータを書き込む
-//------------------------------------------------------------------------------
-bool Packet::push(uint8_t data)
-{
-     bool canPush = false;
-     bool done = false;
-     int ofs, len;
-
-     // 書き込み位置別に，data が正しい（受け入れ可能な）データであるかチェックする
-     switch( m_rawBytePtr )
-     {
-          case 0:
-               canPush = (data == STX)? true : false;
-               break;
-          case 1:
-          case 2:
-               canPush = true;
-               break;
-          case 3:
-               canPush = (0 <= data && data <= MAX_DATA_LENGTH)? true : false;
-               break;
-          default:
-               ofs = m_rawBytePtr - 4;
-               len = getDataLength();
-               if( ofs < len )
-               {
-                    canPush = true;
-               }
-               else if( ofs == len )
-               {
-                    canPush = (data == getChecksum())? true : false;
-               }
-               else if( ofs == len+1 )
-               {
-                    canPush = (data == ETX)? true : false;
-                    done = canPush;
-               }
-               break;
-     }
-     if( canPush )
-     {
-          // 書式通りの正規なデータであると判断したので，バイト列へ追加する
-          m_body[m_rawBytePtr] = data;
-          if( done )
-          {
-               // パケット全体を(ETXまで)取得できた
-               m_rawBytePtr = 0;
-          }
-          else
-          {
-               m_rawBytePtr++;
-          }
-     }
-     else
-     {
-          // パケットの書式を逸脱する不正なデータなので，読み込みをリセットする
-          // Serial.print("[Packet] Unexpected data : ");
-          // Serial.println(data);
-          m_rawBytePtr = 0;
-     }
-     return done;
-}
-
-//------------------------------------------------------------------------------
-//   パケット全体を表すバイト列を取得する
-//------------------------------------------------------------------------------
-int Packet::getRawBytes(std::vector<uint8_t>& buffer)
-{
-     int len = getDataLength() + 6;     // '6' は，「STX,ID,SNO,LEN,SUM,ETX」のデータ以外の６バイト
-     buffer.clear();
-     buffer.insert(buffer.end(), m_body, m_body+len);
-     return len;
-}
-
-//------------------------------------------------------------------------------
-//   パケットのデータを読み取るためのメソッド群
-//------------------------------------------------------------------------------
-bool Packet::readUInt8Data(int offset, uint8_t *data)
-{
-     if( (0 <= offset) && (offset < getDataLength()) )
-     {
-          *data = m_body[offset+4];
-          return true;
-     }
-     return false;
-}
-//------------------------------------------------------------------------------
-bool Packet::readInt8Data(int offset, int8_t *data)
-{
-     return readUInt8Data(offset, (uint8_t *)data);
-}
-//------------------------------------------------------------------------------
-bool Packet::readUInt16Data(int offset, uint16_t *data)
-{
-     if( (0 <= offset) && (offset < (getDataLength()-1)) )
-     {
-          *data = *((uint16_t *)(m_body+offset+4));
-          return true;
-     }
-     return false;
-}
-//------------------------------------------------------------------------------
-bool Packet::readInt16Data(int offset, int16_t *data)
-{
-     return readUInt16Data(offset, (uint16_t *)data);
-}
-//------------------------------------------------------------------------------
-bool Packet::readUInt32Data(int offset, uint32_t *data)
-{
-     if( (0 <= offset) && (offset < (getDataLength()-3)) )
-     {
-          *data = *((uint32_t *)(m_body+offset+4));
-          return true;
-     }
-     return false;
-}
-//------------------------------------------------------------------------------
-bool Packet::readInt32Data(int offset, int32_t *data)
-{
-     return readUInt32Data(offset, (uint32_t *)data);
-}
-
-
-
-
-//==============================================================================
-//   Queue
-//==============================================================================
-//   コンストラクタ
-//------------------------------------------------------------------------------
-// Queue::Queue()
-// {
-//      clear();
-// }
-
-// //------------------------------------------------------------------------------
-// //   キューをクリア
-// //------------------------------------------------------------------------------
-// void Queue::clear()
-// {
-//      m_size = 0;
-//      m_rdPtr = 0;
-//      m_wrPtr = 0;
-// }
-
-// //------------------------------------------------------------------------------
-// //   エンキュー
-// //------------------------------------------------------------------------------
-// bool Queue::push(uint8_t data)
-// {
-//      if( m_size == CAPACITY )
-//      {
-//           return false;
-//      }
-//      m_buffer[m_wrPtr] = data;
-//      m_wrPtr = (m_wrPtr + 1) % CAPACITY;
-//      ++m_size;
-//      return true;
-// }
-// //------------------------------------------------------------------------------
-// bool Queue::push(const uint8_t *data, int length)
-// {
-//      for( int n = 0 ; n < length ; n++ )
-//      {
-//           if( !push(data[n]) )
-//           {
-//                return false;
-//           }
-//      }
-//      return true;
-// }
-
-// //------------------------------------------------------------------------------
-// //   デキュー
-// //------------------------------------------------------------------------------
-// uint8_t Queue::pop()
-// {
-//      if( isEmpty() )
-//      {
-//           return 0;
-//      }
-//      uint8_t data = m_buffer[m_rdPtr];
-//      m_rdPtr = (m_rdPtr + 1) % CAPACITY;
-//      --m_size;
-//      return data;
-// }
-
-// //------------------------------------------------------------------------------
-// uint8_t Queue::peek()
-// {
-//      return m_buffer[m_rdPtr];
-// }
-
-
-
-
-//==============================================================================
-//   CommandServer
-//   TCPソケットを使ったサーバ
-//==============================================================================
-//   コンストラクタ
-//------------------------------------------------------------------------------
-TcpServer::TcpServer() : m_requestReceived(false),
-     m_client(-1), m_terminated(false)
-{
-     m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-     if( m_socket < 0 )
-     {
-          perror("[TcpServer] socket() failed");
-          m_state = INIT_FAILED;
-          return;
-     }
-
-     // ソケットオプションを設定
-     int opf = 1;
-     setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &opf, sizeof(opf));
-
-     // アドレスをバインド
-     struct sockaddr_in servAddr;
-     memset(&servAddr, 0, sizeof(servAddr));
-     servAddr.sin_family = AF_INET;
-     servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-     servAddr.sin_port = htons(PORT);
-     if( bind(m_socket, (struct sockaddr *)&servAddr, sizeof(servAddr)) < 0 )
-     {
-          perror("[TcpServer] bind() failed");
-          m_state = INIT_FAILED;
-          return;
-     }
-
-     if( listen(m_socket, SOMAXCONN) < 0 )
-     {
-          perror("[TcpServer] listen() failed");
-          m_state = INIT_FAILED;
-          return;
-     }
-
-     m_state = LISTENING;
-     std::printf("[TcpServer] Waiting for a new connection.\n");
-
-     m_servThread = new std::thread([this](){ execute(); });
-}
-
-//------------------------------------------------------------------------------
-//   デストラクタ
-//------------------------------------------------------------------------------
-TcpServer::~TcpServer()
-{
-     m_terminated = true;
-     m_servThread->join();
-     delete m_servThread;
-     close(m_client);
-     close(m_socket);
-}
-
-//------------------------------------------------------------------------------
-//   サーバ処理
-//------------------------------------------------------------------------------
-void TcpServer::execute()
-{
-     printf("[TcpServer] thread started.\n");
-     while( !m_terminated )
-     {
-          m_mutex.lock();
-          switch( m_state )
-          {
-               case LISTENING:
-                    doAccept();
-                    break;
-               case PROC_SESSION:
-                    doReceive();
-                    doSend();
-                    break;
-          }
-          m_mutex.unlock();
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
-     }
-     printf("[TcpServer] thread terminated.\n");
-}
-
-//------------------------------------------------------------------------------
-void TcpServer::doAccept()
-{
-     struct pollfd fd;
-     fd.fd = m_socket;
-     fd.events = POLLIN;
-     int ret = poll(&fd, 1, 0);
-     if( (ret == -1) && (errno != EINTR) )
-     {
-          perror("TcpServer::doAccept] poll() failed");
-          m_state = POLL_ERROR;
-          return;
-     }
-     if( (ret > 0) && (fd.revents & POLLIN) )
-     {
-          struct sockaddr_in clientAddr;
-          socklen_t len = (socklen_t)sizeof(clientAddr);
-          m_client = accept(m_socket, (struct sockaddr *)&clientAddr, &len);
-          if( m_client < 0 )
-          {
-               if( errno != EINTR )
-               {
-                    perror("[TcpServer::doAccept] accept() failed");
-               }
-               return;
-          }
-          char remotehost[256];
-          getnameinfo((struct sockaddr *)&clientAddr, len, remotehost, sizeof(remotehost), NULL, 0, NI_NUMERICHOST);
-          std::printf("[TcpServer] Connected to : %s\n", remotehost);
-          m_txBuffer.clear();
-          m_rxBuffer.clear();
-          m_requestReceived = false;
-          m_requestPacket.clear();
-          m_state = PROC_SESSION;
-     }
-}
-
-//------------------------------------------------------------------------------
-void TcpServer::doReceive()
-{
-     // 受信可能かどうか調べる
-     fd_set mask;                  // selectの監視ディスクリプタセット
-     struct timeval timeout;       // selectのタイムアウト値
-     FD_ZERO(&mask);
-     FD_SET(m_client, &mask);
-     timeout.tv_sec = 0;
-     timeout.tv_usec = 20000;
-     int ret = select(m_client+1, &mask, NULL, NULL, &timeout);
-     if( ret < 0 && errno != EINTR )
-     {
-          perror("[TcpServer::doReceive] select() failed");
-          close(m_client);
-          m_client = -1;
-          m_state = LISTENING;
-          std::printf("[TcpServer::doReceive] disconnected.\n");
-          return;
-     }
-     if( ret > 0 )  //&& FD_ISSET(m_client, &mask) )
-     {
-          // std::printf("received\n");
-          std::vector<uint8_t> buf(256);
-          std::vector<uint8_t>::iterator is = buf.begin();
-          std::vector<uint8_t>::iterator ie = buf.begin();
-          ret = recv(m_client, &buf[0], buf.size(), 0);
-          if( ret <= 0 )
-          {
-               // これはクライアント側が接続を切断したことを示す
-               std::printf("[TcpServer::doReceive] disconnected by peer.\n");
-               close(m_client);
-               m_client = -1;
-               m_state = LISTENING;
-               return;
-          }
-          // std::printf("[TcpServer::doReceive] %d byte(s) received\n", ret);
-          advance(ie, ret);
-          while( is != ie )
-          {
-               m_rxBuffer.push_back(*is);
-               ++is;
-          }
-          while( !m_rxBuffer.empty() && !m_requestReceived )
-          {
-               uint8_t c = m_rxBuffer.front();
-               m_rxBuffer.pop_front();
-               m_requestReceived = m_requestPacket.push(c);
-          }
-     }
-}
-
-//------------------------------------------------------------------------------
-void TcpServer::doSend()
-{
-     if( m_txBuffer.empty() )
-     {
-          return;
-     }
-
-     // 送信可能か調べる
-     fd_set mask;                  // selectの監視ディスクリプタセット
-     struct timeval timeout;       // selectのタイムアウト値
-     FD_ZERO(&mask);
-     FD_SET(m_client, &mask);
-     timeout.tv_sec = 0;
-     timeout.tv_usec = 20000;
-     int ret = select(m_client+1, NULL, &mask, NULL, &timeout);
-     if( ret < 0 && errno != EINTR )
-     {
-          perror("[TcpServer::doSend] select() failed");
-          close(m_client);
-          m_client = -1;
-          std::printf("[TcpServer::doSend] disconnected.\n");
-          m_state = LISTENING;
-     }
-     if( ret > 0 && FD_ISSET(m_client, &mask) )
-     {
-          ret = send(m_client, &m_txBuffer[0], m_txBuffer.size(), 0);
-          if( ret > 0 )
-          {
-               std::vector<uint8_t>::iterator ie = m_txBuffer.begin();
-               advance(ie, ret);
-               m_txBuffer.erase(m_txBuffer.begin(), ie);
-          }
-          else
-          {
-               perror("[TcpServer::doSend] send() failed");
-               close(m_client);
-               m_client = -1;
-               m_state = LISTENING;
-               std::printf("[TcpServer::doSend] disconnected.\n");
-          }
-     }
-}
-
-//------------------------------------------------------------------------------
-//   レスポンスを送信
-//------------------------------------------------------------------------------
-void TcpServer::sendResponse(Packet& response)
-{
-     m_mutex.lock();
-     std::vector<uint8_t> buffer;
-     response.getRawBytes(buffer);
-     m_txBuffer.insert(m_txBuffer.end(), buffer.begin(), buffer.end());
-     m_mutex.unlock();
-}
-
-//------------------------------------------------------------------------------
-//   リクエストの受信を許可
-//------------------------------------------------------------------------------
-void TcpServer::enableRequest()
-{
-     m_mutex.lock();
-     if( m_requestReceived )
-     {
-          m_requestReceived = false;
-          m_requestPacket.clear();
-     }
-     m_mutex.unlock();
-}
-
-//------------------------------------------------------------------------------
-//   受信したリクエストを取得する
-//------------------------------------------------------------------------------
-Packet *TcpServer::getRequest()
-{
-     m_mutex.lock();
-     Packet *p = m_requestPacket.clone();
-     m_mutex.unlock();
-     return p;
-}
-
+#include "command_client.h"
+#include "script.h"
+
+static_assert((int)FeedOverrideSchema::MIN_PERCENT == (int)Robot::MIN_FEED_OVERRIDE &&
+     (int)FeedOverrideSchema::MAX_PERCENT == (int)Robot::MAX_FEED_OVERRIDE, "FeedOverrideSchema range");
+static_assert((int)SCHEMA_NUM_MOTORS == (int)CommandObject::NUM_MOTORS, "SCHEMA_NUM_MOTORS");
+static_assert((int)CommandClient::EVENT_ID == (int)StatusPublisher::EVENT_ID, "CommandClient::EVENT_ID");
+static_assert((int)CommandClient::MAX_IN_FLIGHT <= (int)TcpServer::MAX_PENDING, "CommandClient::MAX_IN_FLIGHT");
+static_assert((int)ScriptProfileSchema::NUM_CATEGORIES == (int)ScriptProfile::NUM_CATEGORIES &&
+     (int)ScriptProfileSchema::CAT_COMPUTE == (int)ScriptProfile::CAT_COMPUTE &&
+     (int)ScriptProfileSchema::CAT_MOTION_WAIT == (int)ScriptProfile::CAT_MOTION_WAIT &&
+     (int)ScriptProfileSchema::CAT_GRIPPER_WAIT == (int)ScriptProfile::CAT_GRIPPER_WAIT &&
+     (int)ScriptProfileSchema::CAT_DELAY == (int)ScriptProfile::CAT_DELAY, "ScriptProfileSchema categories");
+static_assert((int)ScriptEventSchema::KIND_START == (int)ScriptEvent::KIND_START &&
+     (int)ScriptEventSchema::KIND_OUTPUT == (int)ScriptEvent::KIND_OUTPUT &&
+     (int)ScriptEventSchema::KIND_ERROR == (int)ScriptEvent::KIND_ERROR &&
+     (int)ScriptEventSchema::KIND_END == (int)ScriptEvent::KIND_END &&
+     (int)ScriptEventSchema::RESULT_DONE == (int)ScriptEvent::RESULT_DONE &&
+     (int)ScriptEventSchema::RESULT_ERROR == (int)ScriptEvent::RESULT_ERROR &&
+     (int)ScriptEventSchema::RESULT_ABORTED == (int)ScriptEvent::RESULT_ABORTED, "ScriptEventSchema kinds");
+static_assert((int)ScriptEventSchema::MAX_TEXT + (int)ScriptEventSchema::ResponseLayout::SIZE == (int)Packet::MAX_DATA_LENGTH,
+     "ScriptEventSchema::MAX_TEXT");
+static_assert((int)CommandClient::SCRIPT_EVENT_ID == (int)ScriptStreamer::EVENT_ID, "CommandClient::SCRIPT_EVENT_ID");
 
 //==============================================================================
 //   CommandObject
@@ -556,17 +38,19 @@ Packet *TcpServer::getRequest()
 //   コンストラクタ
 //------------------------------------------------------------------------------
 CommandObject::CommandObject(int id, Robot *robot)
-     : m_id(id), m_robot(robot)
+     : m_id(id), m_robot(robot), m_session(0), m_completionAxes(0)
 {
 }
 
 //------------------------------------------------------------------------------
 //   リクエストを処理
 //------------------------------------------------------------------------------
-void CommandObject::processRequest(Packet *request, Packet *response)
+void CommandObject::processRequest(uint32_t session, Packet *request, Packet *response)
 {
+     m_session = session;
+     m_completionAxes = 0;
      uint8_t status = execute(request);
-     response->create(m_id, request->getSerialNo());
+     response->create(m_id, request->getSerialNo(), request->getFormat());
      response->addPacketData(&status, 1);
      if( status == STS_OK )
      {
@@ -574,12 +58,13 @@ void CommandObject::processRequest(Packet *request, Packet *response)
      }
 }
 
+
 //==============================================================================
 //   EnableCommand (0)
 //   モータの励磁をON/OFFするコマンド
 //==============================================================================
 EnableCommand::EnableCommand(Robot *robot)
-     : CommandObject(EnableCommand::ID, robot)
+     : SchemaCommand<EnableSchema>(robot)
 {
 
 }
@@ -588,24 +73,14 @@ EnableCommand::EnableCommand(Robot *robot)
 //   +00 (2)   モータID (0, 1, 2)
 //   +02 (2)   動作(0:励磁を切る、それ以外:励磁を入れる)
 //------------------------------------------------------------------------------
-uint8_t EnableCommand::execute(Packet *request)
+uint8_t EnableCommand::perform(const Request& request, Response *response)
 {
-     uint16_t motorID;
-     if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
-     {
-          return STS_INVALID;
-     }
-     if( m_robot->isInMotion(motorID) || m_robot->isAlarmHappened(motorID) )
+     if( m_robot->isInMotion(request.motorID) || m_robot->isAlarmHappened(request.motorID) )
      {
           return STS_UNABLE;
      }
-     uint16_t action;
-     if( !request->readUInt16Data(2, &action) )
-     {
-          return STS_INVALID;
-     }
 
-     m_robot->enableMotor(motorID, action? true : false);
+     m_robot->enableMotor(request.motorID, request.action? true : false);
 
      return STS_OK;
 }
@@ -618,7 +93,7 @@ uint8_t EnableCommand::execute(Packet *request)
 //   アラームを解除するコマンド
 //==============================================================================
 ResetCommand::ResetCommand(Robot *robot)
-     : CommandObject(ResetCommand::ID, robot)
+     : SchemaCommand<ResetSchema>(robot)
 {
 
 }
@@ -627,16 +102,11 @@ ResetCommand::ResetCommand(Robot *robot)
 //   +00 (2)   モータID (0, 1, 2)
 //             これ以外の値を指定した場合は全軸を対象
 //------------------------------------------------------------------------------
-uint8_t ResetCommand::execute(Packet *request)
+uint8_t ResetCommand::perform(const Request& request, Response *response)
 {
-     uint16_t motorID;
-     if( !request->readUInt16Data(0, &motorID) )  //|| (motorID >= NUM_MOTORS) )
-     {
-          return STS_INVALID;
-     }
      for( uint16_t axis = 0 ; axis < NUM_MOTORS ; axis++ )
      {
-          if( (motorID == axis) || (motorID >= NUM_MOTORS) )
+          if( (request.motorID == axis) || (request.motorID >= NUM_MOTORS) )
           {
                if( !m_robot->isInMotion(axis) )
                {
@@ -652,7 +122,7 @@ uint8_t ResetCommand::execute(Packet *request)
 //   停止
 //==============================================================================
 StopCommand::StopCommand(Robot *robot)
-     : CommandObject(StopCommand::ID, robot)
+     : SchemaCommand<StopSchema>(robot)
 {
 
 }
@@ -662,25 +132,15 @@ StopCommand::StopCommand(Robot *robot)
 //             これ以外の値を指定した場合は全軸を対象
 //   +02 (2)   動作(0:即時停止、それ以外:減速停止)
 //------------------------------------------------------------------------------
-uint8_t StopCommand::execute(Packet *request)
+uint8_t StopCommand::perform(const Request& request, Response *response)
 {
-     uint16_t motorID;
-     if( !request->readUInt16Data(0, &motorID) ) //|| (motorID >= NUM_MOTORS) )
-     {
-          return STS_INVALID;
-     }
-     uint16_t action;
-     if( !request->readUInt16Data(2, &action) )
-     {
-          return STS_INVALID;
-     }
      for( uint16_t axis = 0 ; axis < NUM_MOTORS ; axis++ )
      {
-          if( (motorID == axis) || (motorID >= NUM_MOTORS) )
+          if( (request.motorID == axis) || (request.motorID >= NUM_MOTORS) )
           {
                if( !m_robot->isAlarmHappened(axis) )
                {
-                    if( action )
+                    if( request.action )
                     {
                          m_robot->softStop(axis);
                     }
@@ -699,20 +159,21 @@ uint8_t StopCommand::execute(Packet *request)
 //   原点復帰
 //==============================================================================
 HomingCommand::HomingCommand(Robot *robot)
-     : CommandObject(HomingCommand::ID, robot)
+     : SchemaCommand<HomingSchema>(robot)
 {
 
 }
 
 //------------------------------------------------------------------------------
-//   パラメータなし
+//   +00 (1)   完了通知 (省略可，1 で原点復帰の終了時に完了応答を送る)
 //------------------------------------------------------------------------------
-uint8_t HomingCommand::execute(Packet *request)
+uint8_t HomingCommand::perform(const Request& request, Response *response)
 {
      if( !m_robot->startHoming() )
      {
           return STS_UNABLE;
      }
+     requestCompletion(request.completion, 0x07);
      return STS_OK;
 }
 
@@ -724,7 +185,7 @@ uint8_t HomingCommand::execute(Packet *request)
 //   指定位置移動
 //==============================================================================
 MovetoCommand::MovetoCommand(Robot *robot)
-     : CommandObject(MovetoCommand::ID, robot)
+     : SchemaCommand<MovetoSchema>(robot)
 {
 
 }
@@ -732,28 +193,20 @@ MovetoCommand::MovetoCommand(Robot *robot)
 //------------------------------------------------------------------------------
 //   +00 (2)   モータID (0, 1, 2)
 //   +02 (4)   移動先位置(pulse)
+//   +06 (1)   完了通知 (省略可，1 で移動の終了時に完了応答を送る)
 //------------------------------------------------------------------------------
-uint8_t MovetoCommand::execute(Packet *request)
+uint8_t MovetoCommand::perform(const Request& request, Response *response)
 {
-     uint16_t motorID;
-     if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
-     {
-          return STS_INVALID;
-     }
-     if( m_robot->isInMotion(motorID) || m_robot->isAlarmHappened(motorID) )
+     if( m_robot->isInMotion(request.motorID) || m_robot->isAlarmHappened(request.motorID) )
      {
           return STS_UNABLE;
      }
-     int32_t destpos;
-     if( !request->readInt32Data(2, &destpos) )
-     {
-          return STS_INVALID;
-     }
-     bool ret = m_robot->startMotion(motorID, destpos);
+     bool ret = m_robot->startMotion(request.motorID, request.position);
      if( !ret )
      {
           return STS_UNABLE;
      }
+     requestCompletion(request.completion, 1 << request.motorID);
      return STS_OK;
 }
 
@@ -762,7 +215,7 @@ uint8_t MovetoCommand::execute(Packet *request)
 //   ３軸の各目標位置を指定し，同時に駆動させる
 //==============================================================================
 Move3DCommand::Move3DCommand(Robot *robot)
-     : CommandObject(Move3DCommand::ID, robot)
+     : SchemaCommand<Move3DSchema>(robot)
 {
 
 }
@@ -770,60 +223,27 @@ Move3DCommand::Move3DCommand(Robot *robot)
 //------------------------------------------------------------------------------
 //   +00 (4)   BASE の移動先座標
 //   +04 (4)   SHOULDER の移動先座標
-//   +04 (4)   ELBOW の移動先座標
+//   +08 (4)   ELBOW の移動先座標
+//   +12 (1)   完了通知 (省略可，1 で全軸の移動の終了時に完了応答を送る)
 //------------------------------------------------------------------------------
-uint8_t Move3DCommand::execute(Packet *request)
+uint8_t Move3DCommand::perform(const Request& request, Response *response)
 {
-     int32_t destpos[3];
-     uint32_t distance[3];
-     uint32_t longest = 0;
-     bool    b[3] = {true, true, true};
-     uint8_t dir[3];
+     const int32_t *destpos = request.position;
 
      for( int axis = 0 ; axis < NUM_MOTORS ; axis++ )
      {
-          if( !request->readInt32Data(axis*4, &destpos[axis]) )
-          {
-               return STS_INVALID;
-          }
           if( m_robot->isInMotion(axis) || m_robot->isAlarmHappened(axis) )
           {
                // このコマンドは，全軸が動作可能でないと実行できない
                return STS_UNABLE;
           }
-          int32_t abspos = m_robot->getMotorPosition(axis);
-          if( abspos == destpos[axis] )
-          {
-               b[axis] = false;    // この軸は動かす必要はない
-          }
-          if( destpos[axis] > abspos )
-          {
-               dir[axis] = L6470::DIR_FORWARD;
-          }
-          else
-          {
-               dir[axis] = L6470::DIR_REVERSE;
-          }
-          distance[axis] = std::abs(destpos[axis] - abspos);
-          if( distance[axis] > longest )
-          {
-               longest = distance[axis];
-          }
-     }
-     if( longest == 0 )
-     {
-          return STS_OK; // どの軸も動かす必要がない
      }
-     // 各軸の速度を決定し，駆動開始
-     for( int axis = 0 ; axis < NUM_MOTORS ; axis++ )
+     // 各軸の速度の決定(全軸同時到着)は Robot 側で行う
+     if( !m_robot->startMotion3D(destpos[0], destpos[1], destpos[2]) )
      {
-          if( b[axis] )
-          {
-               int32_t speed = 16 * distance[axis] / longest;
-               m_robot->setMotorParam(axis, L6470::PRM_MAX_SPEED, speed);
-               m_robot->startMotion(axis, destpos[axis]);
-          }
+          return STS_UNABLE;
      }
+     requestCompletion(request.completion, 0x07);
      return STS_OK;
 }
 
@@ -834,32 +254,22 @@ uint8_t Move3DCommand::execute(Packet *request)
 //   パラメータ取得
 //==============================================================================
 ReadParamCommand::ReadParamCommand(Robot *robot)
-     : CommandObject(ReadParamCommand::ID, robot), m_motorID(0)
+     : SchemaCommand<ReadParamSchema>(robot)
 {
 }
 
 //------------------------------------------------------------------------------
 //   +00 (2)   モータID (0, 1, 2)
 //------------------------------------------------------------------------------
-uint8_t ReadParamCommand::execute(Packet *request)
+uint8_t ReadParamCommand::perform(const Request& request, Response *response)
 {
-     if( request->readUInt16Data(0, &m_motorID) || (m_motorID >= NUM_MOTORS) )
+     for( uint8_t n = 0 ; n < SCHEMA_NUM_PARAMS ; n++ )
      {
-          return STS_INVALID;
+          response->param[n] = m_robot->getMotorParam(request.motorID, n);
      }
      return STS_OK;
 }
 
-//------------------------------------------------------------------------------
-void ReadParamCommand::setResponseData(Packet *response)
-{
-     for( uint8_t n = 0 ; n < 32 ; n++ )
-     {
-          uint32_t param = m_robot->getMotorParam(m_motorID, n);
-          response->addPacketData(&param, 4);
-     }
-}
-
 
 
 
@@ -868,7 +278,7 @@ void ReadParamCommand::setResponseData(Packet *response)
 //   パラメータ書き込み
 //==============================================================================
 WriteParamCommand::WriteParamCommand(Robot *robot)
-     : CommandObject(WriteParamCommand::ID, robot)
+     : SchemaCommand<WriteParamSchema>(robot)
 {
 
 }
@@ -878,25 +288,9 @@ WriteParamCommand::WriteParamCommand(Robot *robot)
 //   +02 (2)   パラメータID (0〜31)
 //   +04 (4)   パラメータ値
 //------------------------------------------------------------------------------
-uint8_t WriteParamCommand::execute(Packet *request)
+uint8_t WriteParamCommand::perform(const Request& request, Response *response)
 {
-     uint16_t motorID;
-     uint16_t paramID;
-     uint32_t value;
-
-     if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
-     {
-          return STS_INVALID;
-     }
-     if( !request->readUInt16Data(2, &paramID) || (paramID >= 32) )
-     {
-          return STS_INVALID;
-     }
-     if( !request->readUInt32Data(4, &value) )
-     {
-          return STS_INVALID;
-     }
-     m_robot->setMotorParam(motorID, paramID, value);
+     m_robot->setMotorParam(request.motorID, request.paramID, request.value);
 
      return STS_OK;
 }
@@ -909,7 +303,7 @@ uint8_t WriteParamCommand::execute(Packet *request)
 //   パラメータをFLASHへ保存
 //==============================================================================
 SaveParamCommand::SaveParamCommand(Robot *robot)
-     : CommandObject(SaveParamCommand::ID, robot)
+     : SchemaCommand<SaveParamSchema>(robot)
 {
 
 }
@@ -917,7 +311,7 @@ SaveParamCommand::SaveParamCommand(Robot *robot)
 //------------------------------------------------------------------------------
 //   +00 (2)   モータID (0, 1, 2)
 //------------------------------------------------------------------------------
-uint8_t SaveParamCommand::execute(Packet *request)
+uint8_t SaveParamCommand::perform(const Request& request, Response *response)
 {
      // uint16_t motorID;
      // if( !request->readUInt16Data(0, &motorID) || (motorID >= NUM_MOTORS) )
@@ -950,80 +344,970 @@ uint8_t SaveParamCommand::execute(Packet *request)
 //   ステータス取得
 //==============================================================================
 StatusCommand::StatusCommand(Robot *robot)
-     : CommandObject(StatusCommand::ID, robot)
+     : SchemaCommand<StatusSchema>(robot)
 {
 }
 
 //------------------------------------------------------------------------------
-void StatusCommand::setResponseData(Packet *response)
+uint8_t StatusCommand::perform(const Request& request, Response *response)
 {
-     int32_t pos, spd;
-     uint8_t v;
+     readStatus(m_robot, response);
+     return STS_OK;
+}
 
+//------------------------------------------------------------------------------
+//   ステータスを取得する (StatusPublisher と共通)
+//------------------------------------------------------------------------------
+void StatusCommand::readStatus(Robot *robot, RobotStatus *status)
+{
      // グリッパーの変位
-     v = m_robot->getGripperValue();
-     response->addPacketData(&v, 1);
+     status->gripper = robot->getGripperValue();
 
      for( int n = 0 ; n < NUM_MOTORS ; n++ )
      {
-          uint16_t status = m_robot->getMotorStatus(n);
+          uint8_t *p = status->axis[n];
+          uint16_t motorStatus = robot->getMotorStatus(n);
+          int32_t pos = robot->getMotorPosition(n);
+          int32_t spd = robot->getMotorSpeed(n);
+
+          memcpy(p+0, &pos, 4);                                                  // +00
+          memcpy(p+4, &spd, 4);                                                  // +04
+          p[8]  = robot->isHalted(n)? 0xFF : 0x00;                               // +08
+          p[9]  = robot->isInMotion(n)? 0xFF : 0x00;                             // +09
+          p[10] = robot->isHomeCompleted(n)? 0xFF : 0x00;                        // +10
+          p[11] = robot->getLimitState(n, L6470::DIR_REVERSE)? 0x00 : 0xFF;      // +11
+          p[12] = (motorStatus & 0x04)? 0xFF : 0x00;                             // +12
+          p[13] = robot->getLimitState(n, L6470::DIR_FORWARD)? 0x00 : 0xFF;      // +13
+          p[14] = robot->getAlarmFlag(n);                                        // +14
+          p[15] = 0;    // reserved                                              // +15
+     }
+}
 
-          pos = m_robot->getMotorPosition(n);
-          response->addPacketData(&pos, 4);  // +00
 
-          spd = m_robot->getMotorSpeed(n);
-          response->addPacketData(&spd, 4);  // +04
+//==============================================================================
+//   GripperCommand (10)
+//   グリッパー制御
+//==============================================================================
+GripperCommand::GripperCommand(Robot *robot)
+     : SchemaCommand<GripperSchema>(robot)
+{
+}
 
-          v = m_robot->isHalted(n)? 0xFF : 0x00;
-          response->addPacketData(&v, 1);    // +08
+//------------------------------------------------------------------------------
+//   +00 (1)   開度 (0 ～ 100)
+//------------------------------------------------------------------------------
+uint8_t GripperCommand::perform(const Request& request, Response *response)
+{
+     m_robot->moveGripper(request.value);
+     return STS_OK;
+}
 
-          v = m_robot->isInMotion(n)? 0xFF : 0x00;
-          response->addPacketData(&v, 1);    // +09
 
-          v = m_robot->isHomeCompleted(n)? 0xFF : 0x00;
-          response->addPacketData(&v, 1);    // +10
+//==============================================================================
+//   FeedOverrideCommand (13)
+//   送り速度オーバーライドの設定・取得
+//==============================================================================
+FeedOverrideCommand::FeedOverrideCommand(Robot *robot)
+     : SchemaCommand<FeedOverrideSchema>(robot)
+{
+}
 
-          v = m_robot->getLimitState(n, L6470::DIR_REVERSE)? 0x00 : 0xFF;
-          response->addPacketData(&v, 1);    // +11
+//------------------------------------------------------------------------------
+//   +00 (2)   オーバーライド(%) (10 - 200)
+//   データ部がない場合は取得のみ
+//   応答 +00 (2)   現在のオーバーライド(%)
+//------------------------------------------------------------------------------
+uint8_t FeedOverrideCommand::perform(const Request& request, Response *response)
+{
+     if( request.percent != 0 )
+     {
+          m_robot->setFeedOverride(request.percent);
+     }
+     response->percent = (uint16_t)m_robot->getFeedOverride();
+     return STS_OK;
+}
 
-          v = (status & 0x04)? 0xFF : 0x00;
-          response->addPacketData(&v, 1);    // +12
 
-          v = m_robot->getLimitState(n, L6470::DIR_FORWARD)? 0x00 : 0xFF;
-          response->addPacketData(&v, 1);    // +13
 
-          v = m_robot->getAlarmFlag(n);
-          response->addPacketData(&v, 1);    // +14
 
-          v = 0;    // reserved
-          response->addPacketData(&v, 1);    // +15
+//==============================================================================
+//   MoveJointCommand (14)
+//   ３軸の各目標位置と，関節の角速度・角加速度を指定して同時に駆動させる
+//==============================================================================
+MoveJointCommand::MoveJointCommand(Robot *robot)
+     : SchemaCommand<MoveJointSchema>(robot)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (4)   BASE の移動先座標(pulse)
+//   +04 (4)   SHOULDER の移動先座標(pulse)
+//   +08 (4)   ELBOW の移動先座標(pulse)
+//   +12 (4)   速度 (0.01 deg/sec 単位，回転角の最も大きい関節について，0 は既定値)
+//   +16 (4)   加速度 (0.01 deg/sec^2 単位，0 は既定値)
+//   +20 (1)   完了通知 (省略可，1 で全軸の移動の終了時に完了応答を送る)
+//------------------------------------------------------------------------------
+uint8_t MoveJointCommand::perform(const Request& request, Response *response)
+{
+     const int32_t *destpos = request.position;
+     if( !m_robot->startMotion3D(destpos[0], destpos[1], destpos[2], request.speed / 100.0, request.accel / 100.0, Robot::UNIT_DEG) )
+     {
+          return STS_UNABLE;
      }
+     requestCompletion(request.completion, 0x07);
+     return STS_OK;
 }
 
 
+
+
 //==============================================================================
-//   GripperCommand (10)
-//   グリッパー制御
+//   MoveXYZCommand (15)
+//   エンドエフェクタの目標位置と，速度・加速度を指定して移動する
 //==============================================================================
-GripperCommand::GripperCommand(Robot *robot)
-     : CommandObject(GripperCommand::ID, robot)
+MoveXYZCommand::MoveXYZCommand(Robot *robot)
+     : SchemaCommand<MoveXYZSchema>(robot)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (4)   X (0.01 mm 単位)
+//   +04 (4)   Y (0.01 mm 単位)
+//   +08 (4)   Z (0.01 mm 単位)
+//   +12 (4)   速度 (0.01 mm/sec 単位，始点と終点を結ぶ直線について，0 は既定値)
+//   +16 (4)   加速度 (0.01 mm/sec^2 単位，0 は既定値)
+//   +20 (1)   完了通知 (省略可，1 で全軸の移動の終了時に完了応答を送る)
+//------------------------------------------------------------------------------
+uint8_t MoveXYZCommand::perform(const Request& request, Response *response)
+{
+     const int32_t *pos = request.position;
+     int32_t b, s, e;
+     if( !Robot::coordToMotorPos(pos[0] / 100.0, pos[1] / 100.0, pos[2] / 100.0, &b, &s, &e) )
+     {
+          return STS_INVALID;      // 可動範囲外
+     }
+     if( !m_robot->startMotion3D(b, s, e, request.speed / 100.0, request.accel / 100.0, Robot::UNIT_MM) )
+     {
+          return STS_UNABLE;
+     }
+     requestCompletion(request.completion, 0x07);
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   SubscribeCommand (16)
+//   ステータス配信の登録・解除
+//   登録したセッションには，StatusPublisher::EVENT_ID (17) のフレームが届く
+//==============================================================================
+SubscribeCommand::SubscribeCommand(Robot *robot, StatusPublisher *publisher)
+     : SchemaCommand<SubscribeSchema>(robot), m_publisher(publisher)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (2)   配信周期 (ms，TICK_MS 単位に切り上げ，0 は配信の停止)
+//   +02 (1)   0 : 周期ごとに全項目を送る
+//             1 : 変化した項目だけを送る (変化がなければその周期は送らない)
+//------------------------------------------------------------------------------
+uint8_t SubscribeCommand::perform(const Request& request, Response *response)
+{
+     if( request.period == 0 )
+     {
+          m_publisher->unsubscribe(m_session);
+          return STS_OK;
+     }
+     if( !m_publisher->subscribe(m_session, request.period, request.mode) )
+     {
+          return STS_INVALID;
+     }
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   WaypointsCommand (18)
+//   複数の経由点をまとめてモーションキューへ積む
+//   点数が多い場合は拡張形式のパケットで送る (通常形式では 19 点まで)
+//==============================================================================
+WaypointsCommand::WaypointsCommand(Robot *robot)
+     : SchemaCommand<WaypointsSchema>(robot)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (1)   座標系 (COORD_JOINT : 各軸の位置 (pulse)，COORD_XYZ : X, Y, Z (0.01 mm 単位))
+//   +01 (1)   0 : キューの末尾に追加 / 1 : キューを空にしてから追加
+//   +02 (2)   点数 N
+//   +04 (4)   速度 (COORD_JOINT は 0.01 deg/sec，COORD_XYZ は 0.01 mm/sec 単位，0 は既定値)
+//   +08 (4)   加速度 (同じく 0.01 deg/sec^2 または 0.01 mm/sec^2 単位，0 は既定値)
+//   +12       N 点 × 12 バイト (座標系に応じて base, shoulder, elbow または X, Y, Z)
+//   可動範囲外の点が１つでもあれば，どの点も積まない
+//------------------------------------------------------------------------------
+uint8_t WaypointsCommand::perform(const Request& request, Response *response)
+{
+     if( m_extraLength != request.count * POINT_SIZE )
+     {
+          return STS_INVALID;
+     }
+
+     std::vector<MotionTarget> targets(request.count);
+     for( int n = 0 ; n < request.count ; n++ )
+     {
+          int32_t v[3];
+          memcpy(v, m_extraData + n*POINT_SIZE, POINT_SIZE);
+          MotionTarget& t = targets[n];
+          if( request.coord == COORD_XYZ )
+          {
+               if( !Robot::coordToMotorPos(v[0] / 100.0, v[1] / 100.0, v[2] / 100.0, &t.position[0], &t.position[1], &t.position[2]) )
+               {
+                    return STS_INVALID;      // 可動範囲外
+               }
+               t.unit = Robot::UNIT_MM;
+          }
+          else
+          {
+               for( int k = 0 ; k < 3 ; k++ )
+               {
+                    t.position[k] = v[k];
+               }
+               t.unit = Robot::UNIT_DEG;
+          }
+          t.speed = request.speed / 100.0;
+          t.accel = request.accel / 100.0;
+     }
+
+     if( request.replace )
+     {
+          m_robot->clearMotionQueue();
+     }
+     if( !m_robot->queueMotion(targets) )
+     {
+          return STS_UNABLE;
+     }
+     response->queueLength = (uint16_t)m_robot->getQueueLength();
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   ScriptProfileCommand (20)
+//==============================================================================
+ScriptProfileCommand::ScriptProfileCommand(Robot *robot)
+     : SchemaCommand<ScriptProfileSchema>(robot), m_script(NULL)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (1)   0 : 以降の実行を計測しない / 1 : 計測する / 2 : 変えない (省略時)
+//   応答は計測の設定と最後の実行の計測結果 (時間は 0.1 ms 単位)
+//------------------------------------------------------------------------------
+uint8_t ScriptProfileCommand::perform(const Request& request, Response *response)
+{
+     Script *script = m_script;
+     if( script == NULL )
+     {
+          return STS_UNABLE;
+     }
+     if( request.enable != ScriptProfileSchema::ENABLE_KEEP )
+     {
+          script->setProfiling(request.enable == ScriptProfileSchema::ENABLE_ON);
+     }
+
+     ScriptProfile profile;
+     script->getProfile(&profile);
+     response->enabled = script->isProfilingEnabled()? 1 : 0;
+     response->available = profile.available? 1 : 0;
+     if( !profile.available )
+     {
+          return STS_OK;
+     }
+     response->total = (uint32_t)std::lround(profile.total * 10000);
+     for( int n = 0 ; n < ScriptProfileSchema::NUM_CATEGORIES ; n++ )
+     {
+          response->category[n] = (uint32_t)std::lround(profile.category[n] * 10000);
+     }
+     int count = std::min((int)profile.lines.size(), (int)ScriptProfileSchema::MAX_LINES);
+     response->count = (uint8_t)count;
+     for( int n = 0 ; n < count ; n++ )
+     {
+          response->line[n] = (uint16_t)std::min(profile.lines[n].line, 65535);
+          response->hits[n] = profile.lines[n].hits;
+          response->time[n] = (uint32_t)std::lround(profile.lines[n].seconds * 10000);
+     }
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   ScriptUploadCommand (21)
+//   スクリプトのソースを受け取ってコンパイルしておく (ScriptStartCommand で実行する)
+//   ソースが１つのリクエストに収まらなければ，offset を進めながら続けて送る
+//==============================================================================
+ScriptUploadCommand::ScriptUploadCommand(Robot *robot, ScriptStreamer *streamer)
+     : SchemaCommand<ScriptUploadSchema>(robot), m_script(NULL), m_streamer(streamer),
+       m_total(0), m_uploadSession(0)
 {
 }
 
 //------------------------------------------------------------------------------
-uint8_t GripperCommand::execute(Packet *request)
+//   +00 (4)   この部分の位置 (0 なら新しいソースの先頭)
+//   +04 (4)   ソース全体の大きさ (1 ～ MAX_SIZE)
+//   +08       ソースの offset バイト目から (total を超えないこと)
+//   続きのリクエストは，同じセッションから，受信済みの大きさを offset にして送る
+//   応答は受信の状態と受信済みの大きさ。total に達したらコンパイルし，
+//   構文エラーならメッセージを ScriptEvent (KIND_ERROR，run は 0) でこのセッションへ送る
+//------------------------------------------------------------------------------
+uint8_t ScriptUploadCommand::perform(const Request& request, Response *response)
 {
-     uint8_t value;
-     if( !request->readUInt8Data(0, &value) || (value > 100) )
+     Script *script = m_script;
+     if( script == NULL )
+     {
+          return STS_UNABLE;
+     }
+     if( request.offset + m_extraLength > request.total )
      {
           return STS_INVALID;
      }
+     if( request.offset == 0 )
+     {
+          m_source.clear();
+          m_total = request.total;
+          m_uploadSession = m_session;
+     }
+     else if( m_session != m_uploadSession || request.total != m_total || request.offset != m_source.size() )
+     {
+          return STS_INVALID;      // 受信中のソースの続きではない
+     }
+     m_source.append((const char *)m_extraData, m_extraLength);
+     response->received = (uint32_t)m_source.size();
+     if( m_source.size() < m_total )
+     {
+          response->state = ScriptUploadSchema::STATE_RECEIVING;
+          return STS_OK;
+     }
+
+     std::string error;
+     if( script->upload(m_source, &error) )
+     {
+          std::printf("[ScriptUploadCommand] %u bytes compiled.\n", m_total);
+          response->state = ScriptUploadSchema::STATE_COMPILED;
+     }
+     else
+     {
+          std::printf("[ScriptUploadCommand] %s\n", error.c_str());
+          m_streamer->sendError(m_session, error);
+          response->state = ScriptUploadSchema::STATE_ERROR;
+     }
+     m_source.clear();
+     m_total = 0;
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   ScriptStartCommand (22)
+//==============================================================================
+ScriptStartCommand::ScriptStartCommand(Robot *robot, ScriptStreamer *streamer)
+     : SchemaCommand<ScriptStartSchema>(robot), m_script(NULL), m_streamer(streamer)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (1)   0 : 実行 / 1 : 試運転 / 2 : 計測しながら実行 (省略時は 0)
+//   +01 (1)   1 : このセッションへ実行の経過を配信する (省略時は 1)
+//   実行中，またはまだアップロードしていなければ STS_UNABLE
+//   配信は応答より先に届くことがある (KIND_START の run で応答と対応付ける)
+//------------------------------------------------------------------------------
+uint8_t ScriptStartCommand::perform(const Request& request, Response *response)
+{
+     Script *script = m_script;
+     if( script == NULL )
+     {
+          return STS_UNABLE;
+     }
+     if( request.stream )
+     {
+          m_streamer->subscribe(m_session);
+     }
+     uint32_t run = script->runUploaded(request.mode == ScriptStartSchema::MODE_DRY_RUN,
+          request.mode == ScriptStartSchema::MODE_PROFILE);
+     if( run == 0 )
+     {
+          return STS_UNABLE;
+     }
+     response->run = run;
+     return STS_OK;
+}
+
 
-     m_robot->moveGripper(value);
+//==============================================================================
+//   ScriptStopCommand (23)
+//   実行中のスクリプトを中断する (タッチパネルから始めたものも含む)
+//==============================================================================
+ScriptStopCommand::ScriptStopCommand(Robot *robot)
+     : SchemaCommand<ScriptStopSchema>(robot), m_script(NULL)
+{
+}
+
+//------------------------------------------------------------------------------
+uint8_t ScriptStopCommand::perform(const Request& request, Response *response)
+{
+     Script *script = m_script;
+     if( script == NULL || !script->isRunning() )
+     {
+          return STS_UNABLE;
+     }
+     script->abort();
      return STS_OK;
 }
 
 
+//==============================================================================
+//   ScriptStatusCommand (24)
+//==============================================================================
+ScriptStatusCommand::ScriptStatusCommand(Robot *robot, ScriptStreamer *streamer)
+     : SchemaCommand<ScriptStatusSchema>(robot), m_script(NULL), m_streamer(streamer)
+{
+}
+
+//------------------------------------------------------------------------------
+//   +00 (1)   0 : このセッションへの配信をやめる / 1 : 始める / 2 : 変えない (省略時)
+//   応答は実行の状態 (時間は ms 単位)
+//------------------------------------------------------------------------------
+uint8_t ScriptStatusCommand::perform(const Request& request, Response *response)
+{
+     Script *script = m_script;
+     if( script == NULL )
+     {
+          return STS_UNABLE;
+     }
+     if( request.stream == ScriptStatusSchema::STREAM_ON )
+     {
+          m_streamer->subscribe(m_session);
+     }
+     else if( request.stream == ScriptStatusSchema::STREAM_OFF )
+     {
+          m_streamer->unsubscribe(m_session);
+     }
+
+     int result = script->getLastResult();
+     response->running = script->isRunning()? 1 : 0;
+     response->dryRun = script->isDryRun()? 1 : 0;
+     response->uploaded = script->hasUpload()? 1 : 0;
+     response->streaming = m_streamer->isSubscribed(m_session)? 1 : 0;
+     response->run = script->getRunCount();
+     response->elapsed = (uint32_t)std::lround(script->getElapsed() * 1000);
+     response->result = (result < 0)? (uint8_t)ScriptEventSchema::RESULT_NONE : (uint8_t)result;
+     return STS_OK;
+}
+
+
+//==============================================================================
+//   ScriptStreamer
+//   Script の実行の経過を，登録したセッションへ ScriptEvent (25) のフレームで送る
+//   シリアル番号はセッションごとにフレームを作るたびに１つ進む
+//   送信バッファが詰まっている間は MAX_QUEUED 個まで溜め，溢れた print() の出力は捨てる
+//   (開始・エラー・終了は捨てない)
+//
+//   配信フレーム
+//   +00 (1)   種別 (ScriptEventSchema::KIND_START / OUTPUT / ERROR / END)
+//   +01 (4)   実行の番号
+//   +05 (4)   開始からの時間(ms)
+//   +09 (1)   KIND_END : 終わり方 (RESULT_DONE / ERROR / ABORTED)
+//             KIND_OUTPUT / KIND_ERROR : DETAIL_MORE なら次のフレームに続く
+//   +10       KIND_OUTPUT : print() の１行，KIND_ERROR : エラーメッセージ
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+ScriptStreamer::ScriptStreamer(TcpServer *server)
+     : m_server(server), m_script(NULL), m_listenerID(0), m_terminated(false)
+{
+     m_thread = new std::thread([this](){ execute(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+ScriptStreamer::~ScriptStreamer()
+{
+     setScript(NULL);
+     m_terminated = true;
+     m_thread->join();
+     delete m_thread;
+}
+
+//------------------------------------------------------------------------------
+//   配信する Script を設定する (NULL で解除)
+//------------------------------------------------------------------------------
+void ScriptStreamer::setScript(Script *script)
+{
+     if( m_script )
+     {
+          m_script->removeListener(m_listenerID);
+     }
+     m_script = script;
+     if( m_script )
+     {
+          m_listenerID = m_script->addListener([this](const ScriptEvent& event){ publish(event); });
+     }
+}
+
+//------------------------------------------------------------------------------
+void ScriptStreamer::subscribe(uint32_t session)
+{
+     m_mutex.lock();
+     m_subscribers[session];
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+void ScriptStreamer::unsubscribe(uint32_t session)
+{
+     m_mutex.lock();
+     m_subscribers.erase(session);
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+bool ScriptStreamer::isSubscribed(uint32_t session)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     return m_subscribers.count(session) > 0;
+}
+
+//------------------------------------------------------------------------------
+//   アップロードの構文エラーを送る (登録していないセッションにも送る)
+//------------------------------------------------------------------------------
+void ScriptStreamer::sendError(uint32_t session, const std::string& text)
+{
+     std::vector< std::vector<uint8_t> > frames;
+     buildFrames(ScriptEventSchema::KIND_ERROR, 0, 0, 0, text, frames);
+
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::map<uint32_t, Subscriber>::iterator i = m_subscribers.find(session);
+     if( i != m_subscribers.end() )
+     {
+          enqueue(i->second, frames, false);
+          if( !flush(session, i->second) )
+          {
+               m_subscribers.erase(i);
+          }
+          return;
+     }
+     for( size_t n = 0 ; n < frames.size() ; n++ )
+     {
+          m_server->sendEvent(session, frames[n], 0);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   送れなかったフレームを TICK_MS ごとに送り直す
+//------------------------------------------------------------------------------
+void ScriptStreamer::execute()
+{
+     while( !m_terminated )
+     {
+          std::this_thread::sleep_for(std::chrono::milliseconds(TICK_MS));
+          std::lock_guard<std::mutex> lock(m_mutex);
+          std::map<uint32_t, Subscriber>::iterator i = m_subscribers.begin();
+          while( i != m_subscribers.end() )
+          {
+               if( !i->second.queue.empty() && !flush(i->first, i->second) )
+               {
+                    i = m_subscribers.erase(i);
+                    continue;
+               }
+               ++i;
+          }
+     }
+}
+
+//------------------------------------------------------------------------------
+//   Script の通知 (スクリプトのスレッドから呼ばれる。送信は待たない)
+//------------------------------------------------------------------------------
+void ScriptStreamer::publish(const ScriptEvent& event)
+{
+     std::vector< std::vector<uint8_t> > frames;
+     buildFrames(event.kind, event.run, event.elapsed, event.result, event.text, frames);
+
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::map<uint32_t, Subscriber>::iterator i = m_subscribers.begin();
+     while( i != m_subscribers.end() )
+     {
+          enqueue(i->second, frames, event.kind == ScriptEvent::KIND_OUTPUT);
+          if( !flush(i->first, i->second) )
+          {
+               i = m_subscribers.erase(i);
+               continue;
+          }
+          ++i;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   フレームにシリアル番号を付けて溜める
+//   droppable なら，溜まっている数が MAX_QUEUED を超える分は捨てる (番号は欠番になる)
+//------------------------------------------------------------------------------
+void ScriptStreamer::enqueue(Subscriber& sub, const std::vector< std::vector<uint8_t> >& frames, bool droppable)
+{
+     for( size_t n = 0 ; n < frames.size() ; n++ )
+     {
+          sub.serialNo++;
+          if( droppable && sub.queue.size() >= MAX_QUEUED )
+          {
+               continue;
+          }
+          Frame frame;
+          frame.serialNo = sub.serialNo;
+          frame.bytes = frames[n];
+          sub.queue.push_back(frame);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   溜まっているフレームを送れるだけ送る。セッションが切れていれば false
+//------------------------------------------------------------------------------
+bool ScriptStreamer::flush(uint32_t session, Subscriber& sub)
+{
+     while( !sub.queue.empty() )
+     {
+          int result = m_server->sendEvent(session, sub.queue.front().bytes, sub.queue.front().serialNo);
+          if( result == TcpServer::EVENT_NO_SESSION )
+          {
+               return false;
+          }
+          if( result == TcpServer::EVENT_COALESCED )
+          {
+               break;              // 送信バッファが空いてから送る
+          }
+          sub.queue.pop_front();
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   通知を配信フレームにする (テキストは MAX_TEXT バイトずつに分ける)
+//------------------------------------------------------------------------------
+void ScriptStreamer::buildFrames(int kind, uint32_t run, double elapsed, int result, const std::string& text,
+     std::vector< std::vector<uint8_t> >& frames)
+{
+     ScriptEventSchema::Response data;
+     data.kind = (uint8_t)kind;
+     data.run = run;
+     data.time = (uint32_t)std::lround(elapsed * 1000);
+
+     size_t length = std::min(text.size(), (size_t)MAX_LINE);
+     size_t offset = 0;
+     do
+     {
+          size_t size = std::min(length - offset, (size_t)ScriptEventSchema::MAX_TEXT);
+          if( kind == ScriptEventSchema::KIND_END )
+          {
+               data.detail = (uint8_t)result;
+          }
+          else
+          {
+               data.detail = (offset + size < length)? (uint8_t)ScriptEventSchema::DETAIL_MORE : 0;
+          }
+          uint8_t header[ScriptEventSchema::ResponseLayout::SIZE];
+          ScriptEventSchema::ResponseLayout::encode(header, data);
+
+          Packet packet;
+          packet.create(EVENT_ID, 0);
+          packet.addPacketData(header, sizeof(header));
+          packet.addPacketData(text.data() + offset, (int)size);
+          frames.push_back(std::vector<uint8_t>());
+          packet.getRawBytes(frames.back());
+          offset += size;
+     } while( offset < length );
+}
+
+
+//==============================================================================
+//   StatusPublisher
+//   TICK_MS ごとに，配信時期が来たセッションがあればステータスを１回だけ読み，
+//   同じ内容のフレームを全員へ送る
+//
+//   配信フレーム (ID 17，シリアル番号は周期ごとに１つ進む)
+//   +00 (1)   変化マスク (FIELD_GRIPPER / BASE / SHOULDER / ELBOW)
+//   +01 (4)   時刻 (ms，サーバ起動時から)
+//   +05       マスクのビットが立っている項目だけを，グリッパー(1)，
+//             BASE，SHOULDER，ELBOW (各 16 バイト，StatusCommand と同じ形式) の順に並べる
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+StatusPublisher::StatusPublisher(Robot *robot, TcpServer *server)
+     : m_robot(robot), m_server(server), m_terminated(false)
+{
+     m_thread = new std::thread([this](){ execute(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+StatusPublisher::~StatusPublisher()
+{
+     m_terminated = true;
+     m_thread->join();
+     delete m_thread;
+}
+
+//------------------------------------------------------------------------------
+//   配信の登録 (登録済みなら周期・モードを変更する)
+//   最初のフレームは次の tick で，全項目を送る
+//------------------------------------------------------------------------------
+bool StatusPublisher::subscribe(uint32_t session, int periodMs, int mode)
+{
+     if( periodMs <= 0 || MAX_PERIOD_MS < periodMs )
+     {
+          return false;
+     }
+     if( mode != MODE_PERIODIC && mode != MODE_ON_CHANGE )
+     {
+          return false;
+     }
+     m_mutex.lock();
+     Subscriber& sub = m_subscribers[session];
+     sub.periodTicks = (periodMs + TICK_MS - 1) / TICK_MS;
+     sub.mode = mode;
+     sub.countdown = 1;
+     sub.serialNo = 0;
+     sub.sent = false;
+     m_mutex.unlock();
+     return true;
+}
+
+//------------------------------------------------------------------------------
+void StatusPublisher::unsubscribe(uint32_t session)
+{
+     m_mutex.lock();
+     m_subscribers.erase(session);
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+void StatusPublisher::execute()
+{
+     std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+     std::chrono::steady_clock::time_point next = start;
+     while( !m_terminated )
+     {
+          next += std::chrono::milliseconds(TICK_MS);
+          std::this_thread::sleep_until(next);
+          uint32_t timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(next - start).count();
+          publish(timestamp);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   配信時期が来たセッションへフレームを送る
+//   フレームは変化マスクごとに１回だけ作り，同じマスクのセッションで共有する
+//   遅いクライアントへ送れなかった(EVENT_COALESCED)ときは last を更新しないので，
+//   次の周期に，その間の変化をまとめた最新のステータスが届く
+//------------------------------------------------------------------------------
+void StatusPublisher::publish(uint32_t timestamp)
+{
+     m_mutex.lock();
+     std::vector<uint32_t> due;
+     for( std::map<uint32_t, Subscriber>::iterator i = m_subscribers.begin() ; i != m_subscribers.end() ; ++i )
+     {
+          if( --i->second.countdown <= 0 )
+          {
+               i->second.countdown = i->second.periodTicks;
+               due.push_back(i->first);
+          }
+     }
+     if( due.empty() )
+     {
+          m_mutex.unlock();
+          return;
+     }
+
+     RobotStatus status;
+     StatusCommand::readStatus(m_robot, &status);
+
+     std::vector<uint8_t> frame[FIELD_ALL+1];
+     for( size_t n = 0 ; n < due.size() ; n++ )
+     {
+          Subscriber& sub = m_subscribers[due[n]];
+          sub.serialNo++;
+          uint8_t mask = FIELD_ALL;
+          if( sub.mode == MODE_ON_CHANGE && sub.sent )
+          {
+               mask = getChangeMask(sub.last, status);
+          }
+          if( mask == 0 )
+          {
+               continue;
+          }
+          if( frame[mask].empty() )
+          {
+               buildFrame(mask, timestamp, status, frame[mask]);
+          }
+          switch( m_server->sendEvent(due[n], frame[mask], sub.serialNo) )
+          {
+               case TcpServer::EVENT_SENT:
+                    sub.last = status;
+                    sub.sent = true;
+                    break;
+               case TcpServer::EVENT_NO_SESSION:
+                    m_subscribers.erase(due[n]);
+                    break;
+          }
+     }
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+uint8_t StatusPublisher::getChangeMask(const RobotStatus& a, const RobotStatus& b)
+{
+     uint8_t mask = 0;
+     if( a.gripper != b.gripper )
+     {
+          mask |= FIELD_GRIPPER;
+     }
+     for( int n = 0 ; n < CommandObject::NUM_MOTORS ; n++ )
+     {
+          if( memcmp(a.axis[n], b.axis[n], RobotStatus::AXIS_SIZE) != 0 )
+          {
+               mask |= (FIELD_BASE << n);
+          }
+     }
+     return mask;
+}
+
+//------------------------------------------------------------------------------
+void StatusPublisher::buildFrame(uint8_t mask, uint32_t timestamp, const RobotStatus& status, std::vector<uint8_t>& frame)
+{
+     Packet packet;
+     packet.create(EVENT_ID, 0);
+     packet.addPacketData(&mask, 1);
+     packet.addPacketData(&timestamp, 4);
+     if( mask & FIELD_GRIPPER )
+     {
+          uint8_t v = status.gripper;
+          packet.addPacketData(&v, 1);
+     }
+     for( int n = 0 ; n < CommandObject::NUM_MOTORS ; n++ )
+     {
+          if( mask & (FIELD_BASE << n) )
+          {
+               packet.addPacketData((void *)status.axis[n], RobotStatus::AXIS_SIZE);
+          }
+     }
+     packet.getRawBytes(frame);
+}
+
+
+//==============================================================================
+//   CompletionNotifier
+//   完了通知を指定して受け付けた移動の終了を待ち，開始時の応答と同じ ID・
+//   シリアル番号・形式で完了応答を送る
+//   終了の判定は Robot のモーション終了通知 (と受付直後の check()) で行う
+//
+//   完了応答
+//   +00 (1)   ステータス (STS_OK，アラームが発生していれば STS_FAIL)
+//   +01 (1)   種別 (CompletionSchema::KIND_MOTION_END)
+//   +02 (4)   BASE の最終位置(pulse)
+//   +06 (4)   SHOULDER の最終位置(pulse)
+//   +10 (4)   ELBOW の最終位置(pulse)
+//   +14 (4)   受付からの経過時間(ms)
+//   +18 (3)   各軸のアラームフラグ
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+CompletionNotifier::CompletionNotifier(Robot *robot, TcpServer *server)
+     : m_robot(robot), m_server(server)
+{
+     m_listenerID = m_robot->addMotionListener([this](){ check(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+CompletionNotifier::~CompletionNotifier()
+{
+     m_robot->removeMotionListener(m_listenerID);
+}
+
+//------------------------------------------------------------------------------
+//   request の応答を送った後に呼ぶ
+//------------------------------------------------------------------------------
+void CompletionNotifier::add(uint32_t session, const Packet& request, uint8_t axes)
+{
+     Pending pending;
+     pending.session = session;
+     pending.id = request.getID();
+     pending.serialNo = request.getSerialNo();
+     pending.format = request.getFormat();
+     pending.axes = axes;
+     pending.start = std::chrono::steady_clock::now();
+
+     m_mutex.lock();
+     m_pending.push_back(pending);
+     m_mutex.unlock();
+
+     // 受付から登録までの間に終わっていることがある
+     check();
+}
+
+//------------------------------------------------------------------------------
+//   対象の軸がすべて停止していれば完了応答を送る
+//------------------------------------------------------------------------------
+void CompletionNotifier::check()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::vector<Pending>::iterator i = m_pending.begin();
+     while( i != m_pending.end() )
+     {
+          bool moving = false;
+          for( int axis = 0 ; axis < CommandObject::NUM_MOTORS ; axis++ )
+          {
+               if( (i->axes & (1 << axis)) && m_robot->isInMotion(axis) )
+               {
+                    moving = true;
+                    break;
+               }
+          }
+          if( moving )
+          {
+               ++i;
+               continue;
+          }
+          sendCompletion(*i);
+          i = m_pending.erase(i);
+     }
+}
+
+//------------------------------------------------------------------------------
+void CompletionNotifier::sendCompletion(const Pending& pending)
+{
+     CompletionSchema::Response data;
+     uint8_t status = CommandObject::STS_OK;
+     data.kind = CompletionSchema::KIND_MOTION_END;
+     for( int axis = 0 ; axis < CommandObject::NUM_MOTORS ; axis++ )
+     {
+          data.position[axis] = m_robot->getMotorPosition(axis);
+          data.alarm[axis] = m_robot->getAlarmFlag(axis);
+          if( (pending.axes & (1 << axis)) && m_robot->isAlarmHappened(axis) )
+          {
+               status = CommandObject::STS_FAIL;
+          }
+     }
+     data.elapsed = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - pending.start).count();
+
+     uint8_t buffer[CompletionSchema::ResponseLayout::SIZE];
+     CompletionSchema::ResponseLayout::encode(buffer, data);
+     Packet response;
+     response.create(pending.id, pending.serialNo, pending.format);
+     response.addPacketData(&status, 1);
+     response.addPacketData(buffer, sizeof(buffer));
+     m_server->sendResponse(pending.session, response);
+}
+
+
 //==============================================================================
 //   CommandManager
 //==============================================================================
@@ -1031,6 +1315,10 @@ uint8_t GripperCommand::execute(Packet *request)
 //------------------------------------------------------------------------------
 CommandManager::CommandManager(Robot *robot) : m_robot(robot), m_terminated(false)
 {
+     for( int id = 0 ; id < MAX_COMMANDS ; id++ )
+     {
+          m_command[id] = NULL;
+     }
      m_command[EnableCommand::ID    ] = new EnableCommand(robot);
      m_command[ResetCommand::ID     ] = new ResetCommand(robot);
      m_command[StopCommand::ID      ] = new StopCommand(robot);
@@ -1042,6 +1330,20 @@ CommandManager::CommandManager(Robot *robot) : m_robot(robot), m_terminated(fals
      m_command[SaveParamCommand::ID ] = new SaveParamCommand(robot);
      m_command[StatusCommand::ID    ] = new StatusCommand(robot);
      m_command[GripperCommand::ID   ] = new GripperCommand(robot);
+     m_command[FeedOverrideCommand::ID] = new FeedOverrideCommand(robot);
+     m_command[MoveJointCommand::ID ] = new MoveJointCommand(robot);
+     m_command[MoveXYZCommand::ID   ] = new MoveXYZCommand(robot);
+     m_command[WaypointsCommand::ID ] = new WaypointsCommand(robot);
+     m_command[ScriptProfileCommand::ID] = new ScriptProfileCommand(robot);
+     m_command[ScriptStopCommand::ID] = new ScriptStopCommand(robot);
+
+     m_publisher = new StatusPublisher(robot, &m_server);
+     m_command[SubscribeCommand::ID ] = new SubscribeCommand(robot, m_publisher);
+     m_notifier = new CompletionNotifier(robot, &m_server);
+     m_streamer = new ScriptStreamer(&m_server);
+     m_command[ScriptUploadCommand::ID] = new ScriptUploadCommand(robot, m_streamer);
+     m_command[ScriptStartCommand::ID] = new ScriptStartCommand(robot, m_streamer);
+     m_command[ScriptStatusCommand::ID] = new ScriptStatusCommand(robot, m_streamer);
 
      m_thread = new std::thread([this](){ execute(); });
 }
@@ -1054,12 +1356,28 @@ CommandManager::~CommandManager()
      m_terminated = true;
      m_thread->join();
      delete m_thread;
-     for( std::map<int, CommandObject *>::iterator i = m_command.begin() ; i != m_command.end() ; ++i )
+     delete m_publisher;
+     delete m_notifier;
+     delete m_streamer;
+     for( int id = 0 ; id < MAX_COMMANDS ; id++ )
      {
-          delete i->second;
+          delete m_command[id];
      }
 }
 
+//------------------------------------------------------------------------------
+//   スクリプトに関するコマンドの対象を設定する
+//------------------------------------------------------------------------------
+void CommandManager::setScript(Script *script)
+{
+     static_cast<ScriptProfileCommand *>(m_command[ScriptProfileCommand::ID])->setScript(script);
+     static_cast<ScriptUploadCommand *>(m_command[ScriptUploadCommand::ID])->setScript(script);
+     static_cast<ScriptStartCommand *>(m_command[ScriptStartCommand::ID])->setScript(script);
+     static_cast<ScriptStopCommand *>(m_command[ScriptStopCommand::ID])->setScript(script);
+     static_cast<ScriptStatusCommand *>(m_command[ScriptStatusCommand::ID])->setScript(script);
+     m_streamer->setScript(script);
+}
+
 //------------------------------------------------------------------------------
 //   コマンド処理スレッド
 //------------------------------------------------------------------------------
@@ -1069,21 +1387,27 @@ void CommandManager::execute()
 
      while( !m_terminated )
      {
-          if( m_server.available() )
+          // リクエストが届くまで待つ (タイムアウトは終了要求の確認のため)
+          uint32_t session;
+          Packet *request = m_server.getRequest(&session, WAIT_TIMEOUT_MS);
+          if( request == NULL )
+          {
+               continue;
+          }
+          int id = request->getID();
+          // std::printf("[CommandManager] Request received (%d)\n", id);
+          CommandObject *command = m_command[id];
+          if( command != NULL )
           {
-               Packet *request = m_server.getRequest();
-               int id = request->getID();
-               // std::printf("[CommandManager] Request received (%d)\n", id);
-               std::map<int, CommandObject *>::iterator f = m_command.find(id);
-               if( f != m_command.end() )
+               command->processRequest(session, request, &response);
+               m_server.sendResponse(session, response);
+               uint8_t axes = command->getCompletionAxes();
+               if( axes != 0 )
                {
-                    f->second->processRequest(request, &response);
-                    m_server.sendResponse(response);
+                    m_notifier->add(session, *request, axes);
                }
-               delete request;
-               m_server.enableRequest();
           }
-          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          m_server.releaseRequest(request);
      }
 }
 
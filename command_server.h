@@ -5,112 +5,21 @@
 #define   COMMAND_SERVER_H
 
 #include <cstdint>
-#include <vector>
-#include <deque>
 #include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include "robot.h"
+#include "packet.h"
+#include "command_schema.h"
+#include "event_server.h"
 
-//------------------------------------------------------------------------------
-class Packet
-{
-     public:
-          enum{ STX = 0x02, ETX = 0x03 };
-          enum{ MAX_PACKET_SIZE = 256 };
-          enum{ MAX_DATA_LENGTH = 250 };     // STX, ETX, ID, SNO, LEN, SUM の６バイトを差し引いた残り
-          enum{
-               OFFSET_STX = 0,
-               OFFSET_ID  = 1,
-               OFFSET_SERIAL = 2,
-               OFFSET_LEN = 3,
-          };
-
-     private:
-          enum{ DEFAULT_ID = 0x00 };
-          enum{ DEFAULT_SERIAL = 0x00 };
-          enum{ DEFAULT_DATALEN = 0x00 };
-
-          uint8_t m_body[MAX_PACKET_SIZE];
-          int     m_rawBytePtr;
-
-          uint8_t getChecksum();
-
-     public:
-          Packet();
-          Packet *clone();
-          void clear();
-          void create(uint8_t id, uint8_t serialNo);
-          void addPacketData(void *data, int size);
-          bool push(uint8_t data);
-          int  getRawBytes(std::vector<uint8_t>& buffer);
-
-          uint8_t  getID(){ return m_body[1]; };
-          uint8_t  getSerialNo(){ return m_body[2]; };
-          uint8_t  getDataLength(){ return m_body[3]; };
-          bool     readUInt8Data(int offset, uint8_t *data);
-          bool     readInt8Data(int offset, int8_t *data);
-          bool     readUInt16Data(int offset, uint16_t *data);
-          bool     readInt16Data(int offset, int16_t *data);
-          bool     readUInt32Data(int offset, uint32_t *data);
-          bool     readInt32Data(int offset, int32_t *data);
-};
-
-
-//------------------------------------------------------------------------------
-// class Queue
-// {
-//      private:
-//           enum{ CAPACITY = 256 };
-//           uint8_t  m_buffer[CAPACITY];
-//           int      m_rdPtr;
-//           int      m_wrPtr;
-//           int      m_size;
-
-//      public:
-//           Queue();
-//           void    clear();
-//           bool    push(uint8_t);
-//           bool    push(const uint8_t *, int);
-//           uint8_t pop();
-//           uint8_t peek();
-//           bool    isEmpty() const { return (m_size == 0); }
-// };
-
-
-//------------------------------------------------------------------------------
-class TcpServer
-{
-     private:
-          enum{PORT = 12468};
-          enum{INIT_FAILED = -1, LISTENING, PROC_SESSION, POLL_ERROR};
-          std::deque<uint8_t> m_rxBuffer;
-          std::vector<uint8_t> m_txBuffer;
-          Packet m_requestPacket;
-          bool m_requestReceived;
-          std::thread *m_servThread;
-          std::mutex m_mutex;
-          int  m_socket;
-          int  m_client;
-          int  m_state;
-          bool m_terminated;
-
-          void execute();
-          void doAccept();
-          void doReceive();
-          void doSend();
-
-     public:
-          TcpServer();
-          ~TcpServer();
-
-          void enableRequest();
-          void sendResponse(Packet& response);
-
-          bool available(){ return m_requestReceived; }
-          Packet *getRequest();    //{ return &m_requestPacket; }
-};
-
+class Script;
+struct ScriptEvent;
 
 //------------------------------------------------------------------------------
 class CommandObject
@@ -135,167 +44,430 @@ class CommandObject
      protected:
           int       m_id;
           Robot    *m_robot;
+          uint32_t  m_session;     // 実行中のリクエストを送ってきたセッション
+          uint8_t   m_completionAxes;   // 完了応答を送る軸 (1 << 軸番号，0 は送らない)
 
           virtual uint8_t execute(Packet *request){ return STS_OK; }
           virtual void setResponseData(Packet *response){}
+          void requestCompletion(uint8_t flag, uint8_t axes){ m_completionAxes = flag? axes : 0; }
 
      public:
           CommandObject(int id, Robot *robot);
-          void processRequest(Packet *request, Packet *response);
+          virtual ~CommandObject(){}
+          void processRequest(uint32_t session, Packet *request, Packet *response);
+          uint8_t getCompletionAxes() const { return m_completionAxes; }
 };
 
 //------------------------------------------------------------------------------
-class EnableCommand : public CommandObject
+//   command_schema.h の定義からリクエストの解析と応答の組み立てを行うコマンド
+//   派生クラスは perform() だけを実装する (request は範囲の検査済み)
+//------------------------------------------------------------------------------
+template<typename SCHEMA>
+class SchemaCommand : public CommandObject
 {
      public:
-          enum{ID = 0};
+          enum{ ID = SCHEMA::ID };
+          typedef typename SCHEMA::Request  Request;
+          typedef typename SCHEMA::Response Response;
+
+     private:
+          Response  m_response;
+
+     protected:
+          const uint8_t *m_extraData;   // 固定長部分に続く可変長のデータ
+          int       m_extraLength;
+
+          uint8_t execute(Packet *request)
+          {
+               const uint8_t *data = request->getData();
+               int length = request->getDataLength();
+               Request req = Request();
+               if( !SCHEMA::RequestLayout::decode(data, length, req) )
+               {
+                    return STS_INVALID;
+               }
+               int fixed = (length < (int)SCHEMA::RequestLayout::SIZE)? length : (int)SCHEMA::RequestLayout::SIZE;
+               m_extraData = data + fixed;
+               m_extraLength = length - fixed;
+               m_response = Response();
+               return perform(req, &m_response);
+          }
+          void setResponseData(Packet *response)
+          {
+               uint8_t data[SCHEMA::ResponseLayout::SIZE + 1];
+               SCHEMA::ResponseLayout::encode(data, m_response);
+               response->addPacketData(data, SCHEMA::ResponseLayout::SIZE);
+          }
+          virtual uint8_t perform(const Request& request, Response *response) = 0;
+
+     public:
+          SchemaCommand(Robot *robot)
+               : CommandObject(SCHEMA::ID, robot), m_extraData(NULL), m_extraLength(0)
+          {
+          }
+};
+
+//------------------------------------------------------------------------------
+class EnableCommand : public SchemaCommand<EnableSchema>
+{
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           EnableCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class ResetCommand : public CommandObject
+class ResetCommand : public SchemaCommand<ResetSchema>
 {
-     public:
-          enum{ID = 1};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           ResetCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class StopCommand : public CommandObject
+class StopCommand : public SchemaCommand<StopSchema>
 {
-     public:
-          enum{ID = 2};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           StopCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class HomingCommand : public CommandObject
+class HomingCommand : public SchemaCommand<HomingSchema>
 {
-     public:
-          enum{ID = 3};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           HomingCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class MovetoCommand : public CommandObject
+class MovetoCommand : public SchemaCommand<MovetoSchema>
 {
-     public:
-          enum{ID = 4};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           MovetoCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class Move3DCommand : public CommandObject
+class Move3DCommand : public SchemaCommand<Move3DSchema>
 {
-     public:
-          enum{ID = 5};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           Move3DCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class ReadParamCommand : public CommandObject
+class ReadParamCommand : public SchemaCommand<ReadParamSchema>
 {
-     public:
-          enum{ID = 6};
-     private:
-          uint16_t m_motorID;
      protected:
-          uint8_t execute(Packet *request);
-          void setResponseData(Packet *response);
+          uint8_t perform(const Request& request, Response *response);
      public:
           ReadParamCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class WriteParamCommand : public CommandObject
+class WriteParamCommand : public SchemaCommand<WriteParamSchema>
 {
-     public:
-          enum{ID = 7};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           WriteParamCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class SaveParamCommand : public CommandObject
+class SaveParamCommand : public SchemaCommand<SaveParamSchema>
 {
-     public:
-          enum{ID = 8};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           SaveParamCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-class StatusCommand : public CommandObject
+class StatusCommand : public SchemaCommand<StatusSchema>
 {
-     public:
-          enum{ID = 9};
      protected:
-          void setResponseData(Packet *response);
+          uint8_t perform(const Request& request, Response *response);
      public:
           StatusCommand(Robot *robot);
+          static void readStatus(Robot *robot, RobotStatus *status);
 };
 
 //------------------------------------------------------------------------------
-class GripperCommand : public CommandObject
+class GripperCommand : public SchemaCommand<GripperSchema>
 {
-     public:
-          enum{ID = 10};
      protected:
-          uint8_t execute(Packet *request);
+          uint8_t perform(const Request& request, Response *response);
      public:
           GripperCommand(Robot *robot);
 };
 
 //------------------------------------------------------------------------------
-// class WriteTeachCommand : public CommanddObject
-// {
-//      public:
-//           enum{ID = 11};
-//      protected:
-//           uint8_t execute(Packet *request);
-//      public:
-//           WriteTeachCommand(Robot *robot);
-// };
-//
-// //------------------------------------------------------------------------------
-// class SaveTeachCommand : public CommanddObject
-// {
-//      public:
-//           enum{ID = 12};
-//      protected:
-//           uint8_t execute(Packet *request);
-//      public:
-//           SaveTeachCommand(Robot *robot);
-// };
+class FeedOverrideCommand : public SchemaCommand<FeedOverrideSchema>
+{
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          FeedOverrideCommand(Robot *robot);
+};
+
+//------------------------------------------------------------------------------
+class MoveJointCommand : public SchemaCommand<MoveJointSchema>
+{
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          MoveJointCommand(Robot *robot);
+};
+
+//------------------------------------------------------------------------------
+class MoveXYZCommand : public SchemaCommand<MoveXYZSchema>
+{
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          MoveXYZCommand(Robot *robot);
+};
+
+//------------------------------------------------------------------------------
+class WaypointsCommand : public SchemaCommand<WaypointsSchema>
+{
+     public:
+          enum{ COORD_JOINT = WaypointsSchema::COORD_JOINT, COORD_XYZ = WaypointsSchema::COORD_XYZ };
+          enum{ POINT_SIZE = WaypointsSchema::POINT_SIZE };
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          WaypointsCommand(Robot *robot);
+};
+
+//------------------------------------------------------------------------------
+//   スクリプトの計測結果 (Script は RobotConsole が作るので，後から setScript() で渡す)
+//------------------------------------------------------------------------------
+class ScriptProfileCommand : public SchemaCommand<ScriptProfileSchema>
+{
+     private:
+          std::atomic<Script *> m_script;
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          ScriptProfileCommand(Robot *robot);
+          void setScript(Script *script){ m_script = script; }
+};
+
+//------------------------------------------------------------------------------
+//   スクリプトの実行の経過の配信 (print() の出力，エラー，開始・終了)
+//   ScriptStartCommand / ScriptStatusCommand で登録したセッションへ送る
+//   送信バッファが詰まっているセッションの分は溜めておき，TICK_MS ごとに送り直す
+//------------------------------------------------------------------------------
+class ScriptStreamer
+{
+     public:
+          enum{ EVENT_ID = ScriptEventSchema::ID };    // 配信フレームのコマンドID
+          enum{ TICK_MS = 10 };
+          enum{ MAX_QUEUED = 256 };          // セッションごとに溜めるフレームの数 (溢れた出力は捨てる)
+          enum{ MAX_LINE = 4096 };           // これより長い行は切り詰める
+
+     private:
+          struct Frame
+          {
+               uint8_t serialNo;
+               std::vector<uint8_t> bytes;
+          };
+          struct Subscriber
+          {
+               uint8_t  serialNo;            // フレームごとに１つ進める (欠番 = 捨てた出力)
+               std::deque<Frame> queue;
+          };
+
+          TcpServer   *m_server;
+          Script      *m_script;
+          int          m_listenerID;
+          std::map<uint32_t, Subscriber> m_subscribers;
+          std::mutex   m_mutex;
+          std::thread *m_thread;
+          bool         m_terminated;
+
+          void execute();
+          void publish(const ScriptEvent& event);
+          void enqueue(Subscriber& sub, const std::vector< std::vector<uint8_t> >& frames, bool droppable);
+          bool flush(uint32_t session, Subscriber& sub);
+          static void buildFrames(int kind, uint32_t run, double elapsed, int result, const std::string& text,
+               std::vector< std::vector<uint8_t> >& frames);
+
+     public:
+          ScriptStreamer(TcpServer *server);
+          ~ScriptStreamer();
+          void setScript(Script *script);
+          void subscribe(uint32_t session);
+          void unsubscribe(uint32_t session);
+          bool isSubscribed(uint32_t session);
+          void sendError(uint32_t session, const std::string& text);
+};
+
+//------------------------------------------------------------------------------
+//   スクリプトのアップロード (ソースは複数のリクエストに分けて送ってよい)
+//------------------------------------------------------------------------------
+class ScriptUploadCommand : public SchemaCommand<ScriptUploadSchema>
+{
+     private:
+          std::atomic<Script *> m_script;
+          ScriptStreamer *m_streamer;
+          std::string m_source;              // 受信中のソース
+          uint32_t    m_total;
+          uint32_t    m_uploadSession;       // 受信中のソースを送っているセッション
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          ScriptUploadCommand(Robot *robot, ScriptStreamer *streamer);
+          void setScript(Script *script){ m_script = script; }
+};
+
+//------------------------------------------------------------------------------
+class ScriptStartCommand : public SchemaCommand<ScriptStartSchema>
+{
+     private:
+          std::atomic<Script *> m_script;
+          ScriptStreamer *m_streamer;
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          ScriptStartCommand(Robot *robot, ScriptStreamer *streamer);
+          void setScript(Script *script){ m_script = script; }
+};
+
+//------------------------------------------------------------------------------
+class ScriptStopCommand : public SchemaCommand<ScriptStopSchema>
+{
+     private:
+          std::atomic<Script *> m_script;
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          ScriptStopCommand(Robot *robot);
+          void setScript(Script *script){ m_script = script; }
+};
+
+//------------------------------------------------------------------------------
+class ScriptStatusCommand : public SchemaCommand<ScriptStatusSchema>
+{
+     private:
+          std::atomic<Script *> m_script;
+          ScriptStreamer *m_streamer;
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          ScriptStatusCommand(Robot *robot, ScriptStreamer *streamer);
+          void setScript(Script *script){ m_script = script; }
+};
+
+//------------------------------------------------------------------------------
+//   ステータスの配信 (SubscribeCommand で登録したセッションへ送る)
+//------------------------------------------------------------------------------
+class StatusPublisher
+{
+     public:
+          enum{ EVENT_ID = StatusEventSchema::ID };    // 配信フレームのコマンドID
+          enum{ TICK_MS = 10 };              // 配信周期の単位 (最短周期)
+          enum{ MAX_PERIOD_MS = 60000 };
+          enum{ MODE_PERIODIC = 0, MODE_ON_CHANGE = 1 };
+          enum
+          {
+               FIELD_GRIPPER  = 0x01,
+               FIELD_BASE     = 0x02,
+               FIELD_SHOULDER = 0x04,
+               FIELD_ELBOW    = 0x08,
+               FIELD_ALL      = 0x0F,
+          };
+
+     private:
+          struct Subscriber
+          {
+               int         periodTicks;
+               int         mode;
+               int         countdown;      // 次の配信までの tick 数
+               uint8_t     serialNo;       // 周期ごとに１つ進める (欠番 = 送らなかった周期)
+               bool        sent;           // last は送信済みのステータス
+               RobotStatus last;
+          };
+
+          Robot       *m_robot;
+          TcpServer   *m_server;
+          std::map<uint32_t, Subscriber> m_subscribers;
+          std::mutex   m_mutex;
+          std::thread *m_thread;
+          bool         m_terminated;
+
+          void execute();
+          void publish(uint32_t timestamp);
+          static uint8_t getChangeMask(const RobotStatus& a, const RobotStatus& b);
+          static void buildFrame(uint8_t mask, uint32_t timestamp, const RobotStatus& status, std::vector<uint8_t>& frame);
+
+     public:
+          StatusPublisher(Robot *robot, TcpServer *server);
+          ~StatusPublisher();
+          bool subscribe(uint32_t session, int periodMs, int mode);
+          void unsubscribe(uint32_t session);
+};
+
+//------------------------------------------------------------------------------
+//   完了応答 (移動・原点復帰の終了時に，開始時と同じシリアル番号で２回目の応答を送る)
+//------------------------------------------------------------------------------
+class CompletionNotifier
+{
+     private:
+          struct Pending
+          {
+               uint32_t session;
+               uint8_t  id;
+               uint8_t  serialNo;
+               int      format;
+               uint8_t  axes;
+               std::chrono::steady_clock::time_point start;
+          };
+
+          Robot       *m_robot;
+          TcpServer   *m_server;
+          std::vector<Pending> m_pending;
+          std::mutex   m_mutex;
+          int          m_listenerID;
+
+          void sendCompletion(const Pending& pending);
+
+     public:
+          CompletionNotifier(Robot *robot, TcpServer *server);
+          ~CompletionNotifier();
+          void add(uint32_t session, const Packet& request, uint8_t axes);
+          void check();
+};
+
+//------------------------------------------------------------------------------
+class SubscribeCommand : public SchemaCommand<SubscribeSchema>
+{
+     private:
+          StatusPublisher *m_publisher;
+     protected:
+          uint8_t perform(const Request& request, Response *response);
+     public:
+          SubscribeCommand(Robot *robot, StatusPublisher *publisher);
+};
 
 //------------------------------------------------------------------------------
 class CommandManager
 {
      private:
-          std::map<int, CommandObject *> m_command;
+          enum{ WAIT_TIMEOUT_MS = 100 };
+          enum{ MAX_COMMANDS = 256 };
+          CommandObject *m_command[MAX_COMMANDS];      // ID で引く表 (未定義の ID は NULL)
           TcpServer    m_server;
+          StatusPublisher *m_publisher;
+          CompletionNotifier *m_notifier;
+          ScriptStreamer *m_streamer;
           Robot       *m_robot;
           std::thread *m_thread;
           bool         m_terminated;
@@ -305,6 +477,7 @@ class CommandManager
      public:
           CommandManager(Robot *robot);
           ~CommandManager();
+          void setScript(Script *script);
 };
 
 #endif
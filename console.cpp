@@ -1,10 +1,11 @@
 #include "console.h"
 #include <cstdio>
 #include <cmath>
+#include <string>
 
 //------------------------------------------------------------------------------
 RobotConsole::RobotConsole(Robot *robot)
-     : m_robot(robot), m_terminated(false)
+     : m_robot(robot), m_feedOverride(-1), m_terminated(false)
 {
      // std::printf("RobotConsole started.\n");
 
@@ -159,6 +160,34 @@ void RobotConsole::initialize()
           stopAll();
      });
 
+     // 送り速度オーバーライド (◀ / ▶ で 10% ずつ，数値をタッチすると直接入力)
+     button = new Button(5, m_desktop, LARGE_FONT);
+     button->create(574, 440, 32, 32);
+     button->setCaption("\x11");
+     button->attachEvent(EVENT_CLICKED, [this](UIWidget *, int32_t, int32_t){
+          setFeedOverride(m_robot->getFeedOverride() - 10);
+     });
+
+     m_overrideLabel = new Label(6, m_desktop);
+     m_overrideLabel->create(608, 440, 42, 32);
+     m_overrideLabel->setColor(UIWidget::RGBToColor(0xD4,0xC3,0x6A), COLOR_BLACK);
+     m_overrideLabel->setTextAlign(ALIGN_CENTER|ALIGN_MIDDLE);
+     m_overrideLabel->attachEvent(EVENT_CLICKED, [this](UIWidget *, int32_t, int32_t){
+          NumEdit().open([this](UIWidget *, int32_t result, int32_t value){
+               if( result )
+               {
+                    setFeedOverride(value);
+               }
+          });
+     });
+
+     button = new Button(7, m_desktop, LARGE_FONT);
+     button->create(652, 440, 32, 32);
+     button->setCaption("\x10");
+     button->attachEvent(EVENT_CLICKED, [this](UIWidget *, int32_t, int32_t){
+          setFeedOverride(m_robot->getFeedOverride() + 10);
+     });
+
      m_desktop->show();
      m_desktop->refresh();
 
@@ -179,6 +208,7 @@ bool RobotConsole::execute()
      m_teachingView->update(m_robot);
      m_scriptView->update();
      updateRobotStatus();
+     updateFeedOverride();
      m_motorStatusView->update(m_robot);
      return true;
 }
@@ -296,6 +326,28 @@ void RobotConsole::startMove(int32_t base, int32_t shoulder, int32_t elbow)
      // }
 }
 
+//------------------------------------------------------------------------------
+//   送り速度オーバーライド
+//------------------------------------------------------------------------------
+void RobotConsole::setFeedOverride(int32_t percent)
+{
+     m_robot->setFeedOverride(percent);
+     updateFeedOverride();
+}
+
+//------------------------------------------------------------------------------
+//   オーバーライド値の表示 (TCP から変更された場合にも追従する)
+//------------------------------------------------------------------------------
+void RobotConsole::updateFeedOverride()
+{
+     int percent = m_robot->getFeedOverride();
+     if( percent != m_feedOverride )
+     {
+          m_feedOverride = percent;
+          m_overrideLabel->setValue(std::to_string(percent) + "%");
+     }
+}
+
 //------------------------------------------------------------------------------
 void RobotConsole::moveGripper(int32_t value)
 {
@@ -23,6 +23,8 @@ class RobotConsole
           ScriptView *m_scriptView;
           RobotStatusView *m_robotStatusView;
           MotorStatusView *m_motorStatusView;
+          Label *m_overrideLabel;
+          int    m_feedOverride;          // 表示中のオーバーライド値
 
           bool m_terminated;
 
@@ -33,6 +35,8 @@ class RobotConsole
           void clearAlarm();
           void startMove(int32_t base, int32_t shoulder, int32_t elbow);
           void moveGripper(int32_t value);
+          void setFeedOverride(int32_t percent);
+          void updateFeedOverride();
           void stopAll();
 
      public:
@@ -40,6 +44,7 @@ class RobotConsole
           ~RobotConsole();
           bool execute();
           bool terminated(){ return m_terminated; }
+          Script *getScript(){ return m_scriptView->getScript(); }
 };
 
 #endif
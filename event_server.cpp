@@ -0,0 +1,557 @@
+//------------------------------------------------------------------------------
+//   event_server.cpp
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdio>
+#include <chrono>
+#include "event_server.h"
+
+
+//==============================================================================
+//   TcpServer
+//   epoll を使った複数クライアント対応のサーバ
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+TcpServer::TcpServer(int port) : m_servThread(NULL), m_nextSessionID(FIRST_SESSION_ID),
+     m_socket(-1), m_epoll(-1), m_wakeup(-1), m_terminated(false)
+{
+     m_state = INIT_FAILED;
+     m_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+     if( m_socket < 0 )
+     {
+          perror("[TcpServer] socket() failed");
+          return;
+     }
+
+     // ソケットオプションを設定
+     int opf = 1;
+     setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &opf, sizeof(opf));
+
+     // アドレスをバインド
+     struct sockaddr_in servAddr;
+     memset(&servAddr, 0, sizeof(servAddr));
+     servAddr.sin_family = AF_INET;
+     servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+     servAddr.sin_port = htons(port);
+     if( bind(m_socket, (struct sockaddr *)&servAddr, sizeof(servAddr)) < 0 )
+     {
+          perror("[TcpServer] bind() failed");
+          return;
+     }
+
+     if( listen(m_socket, SOMAXCONN) < 0 )
+     {
+          perror("[TcpServer] listen() failed");
+          return;
+     }
+
+     m_epoll = epoll_create1(EPOLL_CLOEXEC);
+     m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+     if( m_epoll < 0 || m_wakeup < 0 )
+     {
+          perror("[TcpServer] epoll_create1() / eventfd() failed");
+          return;
+     }
+     struct epoll_event ev;
+     memset(&ev, 0, sizeof(ev));
+     ev.events = EPOLLIN | EPOLLET;
+     ev.data.u64 = LISTENER_ID;
+     epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_socket, &ev);
+     ev.events = EPOLLIN;
+     ev.data.u64 = WAKEUP_ID;
+     epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+     for( int n = 0 ; n < POOL_SIZE ; n++ )
+     {
+          m_packetPool.push_back(new Packet());
+     }
+
+     m_state = LISTENING;
+     std::printf("[TcpServer] Waiting for connections on port %d.\n", port);
+
+     m_servThread = new std::thread([this](){ execute(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+TcpServer::~TcpServer()
+{
+     m_terminated = true;
+     if( m_servThread != NULL )
+     {
+          uint64_t one = 1;
+          if( write(m_wakeup, &one, sizeof(one)) < 0 )
+          {
+               perror("[TcpServer::~TcpServer] write() failed");
+          }
+          m_servThread->join();
+          delete m_servThread;
+     }
+     for( std::map<uint32_t, Session *>::iterator i = m_sessions.begin() ; i != m_sessions.end() ; ++i )
+     {
+          close(i->second->fd);
+          delete i->second;
+     }
+     for( std::deque<Request>::iterator i = m_ready.begin() ; i != m_ready.end() ; ++i )
+     {
+          delete i->packet;
+     }
+     for( size_t n = 0 ; n < m_packetPool.size() ; n++ )
+     {
+          delete m_packetPool[n];
+     }
+     if( m_wakeup >= 0 )  close(m_wakeup);
+     if( m_epoll >= 0 )   close(m_epoll);
+     if( m_socket >= 0 )  close(m_socket);
+}
+
+//------------------------------------------------------------------------------
+//   サーバ処理
+//   イベントが来るまで epoll_wait() で待つ (タイムアウトなし)
+//------------------------------------------------------------------------------
+void TcpServer::execute()
+{
+     printf("[TcpServer] thread started.\n");
+     struct epoll_event events[MAX_EVENTS];
+     while( !m_terminated )
+     {
+          int n = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+          if( n < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               perror("[TcpServer::execute] epoll_wait() failed");
+               m_state = POLL_ERROR;
+               break;
+          }
+          m_mutex.lock();
+          for( int i = 0 ; i < n ; i++ )
+          {
+               uint64_t id = events[i].data.u64;
+               if( id == LISTENER_ID )
+               {
+                    doAccept();
+                    continue;
+               }
+               if( id == WAKEUP_ID )
+               {
+                    continue;
+               }
+               // 同じ epoll_wait() の中で先に閉じたセッションのイベントは捨てる
+               std::map<uint32_t, Session *>::iterator f = m_sessions.find((uint32_t)id);
+               if( f == m_sessions.end() )
+               {
+                    continue;
+               }
+               Session *session = f->second;
+               if( events[i].events & (EPOLLERR | EPOLLHUP) )
+               {
+                    closeSession(session, "error");
+                    continue;
+               }
+               if( (events[i].events & EPOLLOUT) && !doSend(session) )
+               {
+                    continue;
+               }
+               if( events[i].events & (EPOLLIN | EPOLLRDHUP) )
+               {
+                    doReceive(session);
+               }
+          }
+          m_mutex.unlock();
+     }
+     printf("[TcpServer] thread terminated.\n");
+}
+
+//------------------------------------------------------------------------------
+//   edge-triggered なので，保留中の接続がなくなるまで accept() する
+//------------------------------------------------------------------------------
+void TcpServer::doAccept()
+{
+     while( true )
+     {
+          struct sockaddr_in clientAddr;
+          socklen_t len = (socklen_t)sizeof(clientAddr);
+          int fd = accept4(m_socket, (struct sockaddr *)&clientAddr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if( fd < 0 )
+          {
+               if( errno == EINTR || errno == ECONNABORTED )
+               {
+                    continue;
+               }
+               if( errno != EAGAIN && errno != EWOULDBLOCK )
+               {
+                    perror("[TcpServer::doAccept] accept() failed");
+               }
+               return;
+          }
+          if( m_sessions.size() >= MAX_SESSIONS )
+          {
+               std::printf("[TcpServer::doAccept] too many sessions, connection refused.\n");
+               close(fd);
+               continue;
+          }
+
+          // 小さなパケットを溜めずにすぐ送る
+          int opf = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opf, sizeof(opf));
+
+          Session *session = new Session();
+          session->fd = fd;
+          session->id = m_nextSessionID++;
+          session->pending = 0;
+          session->throttled = false;
+          session->discarded = 0;
+
+          struct epoll_event ev;
+          memset(&ev, 0, sizeof(ev));
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+          ev.data.u64 = session->id;
+          if( epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0 )
+          {
+               perror("[TcpServer::doAccept] epoll_ctl() failed");
+               close(fd);
+               delete session;
+               continue;
+          }
+          m_sessions[session->id] = session;
+
+          char remotehost[256];
+          getnameinfo((struct sockaddr *)&clientAddr, len, remotehost, sizeof(remotehost), NULL, 0, NI_NUMERICHOST);
+          std::printf("[TcpServer] Session %u connected to : %s (%d session(s))\n",
+               session->id, remotehost, (int)m_sessions.size());
+     }
+}
+
+//------------------------------------------------------------------------------
+//   edge-triggered なので，EAGAIN になるまで読み切る
+//   受信バッファの空き領域へ readv() で直接読み込む
+//   バッファが一杯になったら読むのを止め (TCP のフロー制御に任せる)，
+//   CommandManager がリクエストを取り出した時に再開する
+//------------------------------------------------------------------------------
+void TcpServer::doReceive(Session *session)
+{
+     session->throttled = false;
+     while( true )
+     {
+          struct iovec span[2];
+          int count = session->rxBuffer.getWritableSpans(span);
+          if( count == 0 )
+          {
+               // 取り出せるフレームがあれば取り出して空きを作る
+               parseRequest(session);
+               if( session->rxBuffer.space() == 0 )
+               {
+                    session->throttled = true;
+                    return;
+               }
+               continue;
+          }
+          ssize_t ret = readv(session->fd, span, count);
+          if( ret > 0 )
+          {
+               session->rxBuffer.commit(ret);
+               continue;
+          }
+          if( ret == 0 )
+          {
+               // これはクライアント側が接続を切断したことを示す
+               closeSession(session, "disconnected by peer");
+               return;
+          }
+          if( errno == EINTR )
+          {
+               continue;
+          }
+          if( errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               perror("[TcpServer::doReceive] readv() failed");
+               closeSession(session, "disconnected");
+               return;
+          }
+          break;
+     }
+     parseRequest(session);
+}
+
+//------------------------------------------------------------------------------
+//   送信バッファを writev() で送れるだけ送る
+//   送り切れなかった分は，次の EPOLLOUT で続きを送る
+//   セッションを閉じたときは false
+//------------------------------------------------------------------------------
+bool TcpServer::doSend(Session *session)
+{
+     while( !session->txBuffer.empty() )
+     {
+          struct iovec span[2];
+          int count = session->txBuffer.getReadableSpans(span);
+          ssize_t ret = writev(session->fd, span, count);
+          if( ret > 0 )
+          {
+               session->txBuffer.consume(ret);
+               continue;
+          }
+          if( ret < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if( ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+          {
+               break;
+          }
+          perror("[TcpServer::doSend] writev() failed");
+          closeSession(session, "disconnected");
+          return false;
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   iov のバイト列を送る
+//   送信バッファが空なら，その場で writev() して送れなかった残りだけをバッファへ入れる
+//   バッファが溢れる (応答を読まないクライアント) 場合とエラーの場合はセッションを閉じて false
+//------------------------------------------------------------------------------
+bool TcpServer::queueSend(Session *session, struct iovec *iov, int count)
+{
+     size_t total = 0;
+     for( int k = 0 ; k < count ; k++ )
+     {
+          total += iov[k].iov_len;
+     }
+     size_t sent = 0;
+     if( session->txBuffer.empty() )
+     {
+          ssize_t ret;
+          do
+          {
+               ret = writev(session->fd, iov, count);
+          } while( ret < 0 && errno == EINTR );
+          if( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               perror("[TcpServer::queueSend] writev() failed");
+               closeSession(session, "disconnected");
+               return false;
+          }
+          sent = (ret > 0)? (size_t)ret : 0;
+     }
+     if( total - sent > session->txBuffer.space() )
+     {
+          closeSession(session, "closed (send buffer overflow)");
+          return false;
+     }
+     for( int k = 0 ; k < count ; k++ )
+     {
+          size_t len = iov[k].iov_len;
+          if( sent >= len )
+          {
+               sent -= len;
+               continue;
+          }
+          session->txBuffer.write((const uint8_t *)iov[k].iov_base + sent, len - sent);
+          sent = 0;
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   受信バッファからフレームを切り出し，受信順に m_ready へ積む
+//   フレームの内容はプールのパケットへ直接コピーする
+//   未実行のリクエストが MAX_PENDING に達したら，残りは後で取り出す
+//------------------------------------------------------------------------------
+void TcpServer::parseRequest(Session *session)
+{
+     bool received = false;
+     while( session->pending < MAX_PENDING )
+     {
+          struct iovec span[2];
+          int count = session->rxBuffer.getReadableSpans(span);
+          if( count == 0 )
+          {
+               break;
+          }
+          const uint8_t *p0 = (const uint8_t *)span[0].iov_base;
+          const uint8_t *p1 = (count > 1)? (const uint8_t *)span[1].iov_base : NULL;
+          int n0 = (int)span[0].iov_len;
+          int n1 = (count > 1)? (int)span[1].iov_len : 0;
+          int skip, frameSize;
+          int ret = Packet::scan(p0, n0, p1, n1, &skip, &frameSize);
+          if( skip > 0 )
+          {
+               session->rxBuffer.consume(skip);
+               session->discarded += skip;
+          }
+          if( ret != Packet::SCAN_FRAME )
+          {
+               break;
+          }
+
+          Packet *packet;
+          if( m_packetPool.empty() )
+          {
+               packet = new Packet();
+          }
+          else
+          {
+               packet = m_packetPool.back();
+               m_packetPool.pop_back();
+          }
+          count = session->rxBuffer.getReadableSpans(span);
+          packet->assign((const uint8_t *)span[0].iov_base, (int)span[0].iov_len,
+               (count > 1)? (const uint8_t *)span[1].iov_base : NULL, (count > 1)? (int)span[1].iov_len : 0, frameSize);
+          session->rxBuffer.consume(frameSize);
+
+          Request r;
+          r.session = session->id;
+          r.packet = packet;
+          m_ready.push_back(r);
+          session->pending++;
+          received = true;
+     }
+     if( received )
+     {
+          m_readyCond.notify_one();
+     }
+}
+
+//------------------------------------------------------------------------------
+void TcpServer::closeSession(Session *session, const char *reason)
+{
+     if( session->discarded > 0 )
+     {
+          std::printf("[TcpServer] Session %u : %llu byte(s) discarded.\n", session->id, (unsigned long long)session->discarded);
+     }
+     std::printf("[TcpServer] Session %u %s.\n", session->id, reason);
+     close(session->fd);       // close() で epoll の監視対象からも外れる
+     m_sessions.erase(session->id);
+     delete session;
+}
+
+//------------------------------------------------------------------------------
+int TcpServer::getNumSessions()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     return (int)m_sessions.size();
+}
+
+//------------------------------------------------------------------------------
+//   受信したリクエストを受信順に取得する (使い終わったら releaseRequest() で返す)
+//   timeoutMs 以内にリクエストがなければ NULL
+//------------------------------------------------------------------------------
+Packet *TcpServer::getRequest(uint32_t *session, int timeoutMs)
+{
+     std::unique_lock<std::mutex> lock(m_mutex);
+     std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+     while( true )
+     {
+          while( m_ready.empty() )
+          {
+               if( m_readyCond.wait_until(lock, deadline) == std::cv_status::timeout && m_ready.empty() )
+               {
+                    return NULL;
+               }
+          }
+          Request r = m_ready.front();
+          m_ready.pop_front();
+          std::map<uint32_t, Session *>::iterator f = m_sessions.find(r.session);
+          if( f == m_sessions.end() )
+          {
+               // 実行する前に切断されたセッション
+               m_packetPool.push_back(r.packet);
+               continue;
+          }
+
+          // 上限で止めていた取り出し・受信を再開する
+          Session *s = f->second;
+          s->pending--;
+          if( s->pending == MAX_PENDING - 1 )
+          {
+               parseRequest(s);
+          }
+          if( s->throttled )
+          {
+               doReceive(s);
+          }
+          *session = r.session;
+          return r.packet;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   getRequest() で取得したパケットをプールへ返す
+//------------------------------------------------------------------------------
+void TcpServer::releaseRequest(Packet *request)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_packetPool.push_back(request);
+}
+
+//------------------------------------------------------------------------------
+//   レスポンスを送信
+//   パケットの本体とチェックサムを writev() でそのまま送り，
+//   送り切れなかった分だけを送信バッファに入れる (残りはサーバスレッドが EPOLLOUT で送る)
+//------------------------------------------------------------------------------
+void TcpServer::sendResponse(uint32_t session, Packet& response)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::map<uint32_t, Session *>::iterator f = m_sessions.find(session);
+     if( f == m_sessions.end() )
+     {
+          return;
+     }
+     uint8_t trailer[Packet::EXT_TRAILER_SIZE];
+     struct iovec iov[2];
+     iov[0].iov_base = (void *)response.getBody();
+     iov[0].iov_len = response.getBodySize();
+     iov[1].iov_base = trailer;
+     iov[1].iov_len = response.getTrailer(trailer);
+     queueSend(f->second, iov, 2);
+}
+
+//------------------------------------------------------------------------------
+//   サーバから能動的に送るフレーム (ステータス配信など，通常形式) を送信する
+//   frame は作成済みのバイト列で，シリアル番号だけをセッションごとに差し替える
+//   送信待ちが溜まっている遅いクライアントには送らず EVENT_COALESCED を返すので，
+//   呼び出し側は次の機会に最新の内容をまとめて送る
+//------------------------------------------------------------------------------
+int TcpServer::sendEvent(uint32_t session, const std::vector<uint8_t>& frame, uint8_t serialNo)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::map<uint32_t, Session *>::iterator f = m_sessions.find(session);
+     if( f == m_sessions.end() )
+     {
+          return EVENT_NO_SESSION;
+     }
+     Session *s = f->second;
+     if( s->txBuffer.size() > MAX_EVENT_BACKLOG )
+     {
+          return EVENT_COALESCED;
+     }
+     struct iovec iov[3];
+     iov[0].iov_base = (void *)&frame[0];
+     iov[0].iov_len = Packet::OFFSET_SERIAL;
+     iov[1].iov_base = &serialNo;
+     iov[1].iov_len = 1;
+     iov[2].iov_base = (void *)&frame[Packet::OFFSET_SERIAL+1];
+     iov[2].iov_len = frame.size() - (Packet::OFFSET_SERIAL+1);
+     if( !queueSend(s, iov, 3) )
+     {
+          return EVENT_NO_SESSION;
+     }
+     return EVENT_SENT;
+}
@@ -0,0 +1,95 @@
+//------------------------------------------------------------------------------
+//   event_server.h
+//
+//   epoll による複数クライアント対応のコマンドサーバ
+//   １本のスレッドがすべてのセッションの送受信を edge-triggered で処理する
+//   受信したリクエストはセッション番号と組にして CommandManager へ渡す
+//   クライアントは応答を待たずに次々とリクエストを送ってよい (パイプライン)
+//   リクエストは受信順に実行され，応答には同じシリアル番号が付く
+//------------------------------------------------------------------------------
+#ifndef   EVENT_SERVER_H
+#define   EVENT_SERVER_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "packet.h"
+#include "ring_buffer.h"
+
+//------------------------------------------------------------------------------
+class TcpServer
+{
+     public:
+          enum{PORT = 12468};
+          enum{MAX_SESSIONS = 32};
+          enum{MAX_PENDING = 256};           // セッションあたりの未実行リクエストの上限
+          enum{RX_CAPACITY = 131072};        // 受信バッファ (最大の拡張形式フレームが収まる大きさ)
+          enum{TX_CAPACITY = 131072};        // 送信バッファ (溢れるほど応答を読まないクライアントは切断する)
+          enum{POOL_SIZE = 64};              // 最初に用意しておくリクエスト用パケットの数
+          enum{INIT_FAILED = -1, LISTENING, POLL_ERROR};
+          enum{EVENT_SENT, EVENT_COALESCED, EVENT_NO_SESSION};   // sendEvent() の結果
+          enum{MAX_EVENT_BACKLOG = 1024};    // 送信待ちがこれを超えたセッションには配信しない
+
+     private:
+          enum{MAX_EVENTS = 64};
+          // epoll_event.data.u64 に格納する識別子 (2 以降はセッション番号)
+          enum{LISTENER_ID = 0, WAKEUP_ID = 1, FIRST_SESSION_ID = 2};
+
+          struct Session
+          {
+               int      fd;
+               uint32_t id;
+               RingBuffer rxBuffer;
+               RingBuffer txBuffer;
+               int      pending;           // m_ready にある，このセッションのリクエスト数
+               bool     throttled;         // 受信バッファが一杯なので受信を一時停止している
+               uint64_t discarded;         // フレームとして読めずに捨てたバイト数
+
+               Session() : rxBuffer(RX_CAPACITY), txBuffer(TX_CAPACITY) {}
+          };
+
+          struct Request
+          {
+               uint32_t session;
+               Packet  *packet;
+          };
+
+          std::map<uint32_t, Session *> m_sessions;
+          std::deque<Request> m_ready;       // 受信順のリクエスト (全セッション共通)
+          std::vector<Packet *> m_packetPool;  // 返却されたリクエスト用パケット
+          std::thread *m_servThread;
+          std::mutex   m_mutex;
+          std::condition_variable m_readyCond;
+          uint32_t m_nextSessionID;
+          int  m_socket;
+          int  m_epoll;
+          int  m_wakeup;                     // スレッド終了を通知する eventfd
+          int  m_state;
+          bool m_terminated;
+
+          void execute();
+          void doAccept();
+          void doReceive(Session *session);
+          bool doSend(Session *session);
+          bool queueSend(Session *session, struct iovec *iov, int count);
+          void parseRequest(Session *session);
+          void closeSession(Session *session, const char *reason);
+
+     public:
+          TcpServer(int port = PORT);
+          ~TcpServer();
+
+          int  getState(){ return m_state; }
+          int  getNumSessions();
+
+          Packet *getRequest(uint32_t *session, int timeoutMs);
+          void releaseRequest(Packet *request);
+          void sendResponse(uint32_t session, Packet& response);
+          int  sendEvent(uint32_t session, const std::vector<uint8_t>& frame, uint8_t serialNo);
+};
+
+#endif
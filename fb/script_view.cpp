@@ -55,6 +55,20 @@ ScriptView::ScriptView(UIWidget *parent, Robot *robot)
           stopScript();
      });
 
+     button = new Button(ID_DRY_RUN, this);
+     button->create(266, 144, 110, 32);
+     button->setCaption("時間見積り");
+     button->attachEvent(EVENT_CLICKED, [this](UIWidget *, int32_t, int32_t){
+          runScript(true);
+     });
+
+     button = new Button(ID_PROFILE, this);
+     button->create(266, 184, 110, 32);
+     button->setCaption("計測実行");
+     button->attachEvent(EVENT_CLICKED, [this](UIWidget *, int32_t, int32_t){
+          runScript(false, true);
+     });
+
      createFileList();
 
      Rect r = m_clientRect.clone();
@@ -80,6 +94,39 @@ ScriptView::ScriptView(UIWidget *parent, Robot *robot)
           {
                m_messages.push_back(msg);
           }
+          if( script->isDryRun() )
+          {
+               // 試運転の結果 (詳細は標準出力に出る)
+               const DryRunResult& result = script->getDryRunResult();
+               char buf[64];
+               std::snprintf(buf, sizeof(buf), "cycle time : %.2f sec (%d moves)", result.cycleTime, (int)result.moves.size());
+               m_messages.push_back(buf);
+               if( !result.errors.empty() )
+               {
+                    m_messages.push_back(result.errors[0]);
+               }
+          }
+          ScriptProfile profile;
+          script->getProfile(&profile);
+          if( profile.available )
+          {
+               // 計測の結果 (待ち時間の内訳と，時間のかかった行の上位。全体は標準出力に出る)
+               char buf[64];
+               std::snprintf(buf, sizeof(buf), "%.1fs: move %.1f grip %.1f delay %.1f cpu %.1f", profile.total,
+                    profile.category[ScriptProfile::CAT_MOTION_WAIT], profile.category[ScriptProfile::CAT_GRIPPER_WAIT],
+                    profile.category[ScriptProfile::CAT_DELAY], profile.category[ScriptProfile::CAT_COMPUTE]);
+               m_messages.push_back(buf);
+               std::string hot;
+               for( size_t n = 0 ; n < profile.lines.size() && n < 3 ; n++ )
+               {
+                    std::snprintf(buf, sizeof(buf), "L%d %.2fs  ", profile.lines[n].line, profile.lines[n].seconds);
+                    hot += buf;
+               }
+               if( !hot.empty() )
+               {
+                    m_messages.push_back(hot);
+               }
+          }
           m_messages.push_back("terminated.");
           m_messageUpdated = true;
           m_mutex.unlock();
@@ -138,6 +185,24 @@ void ScriptView::update()
                stpBtn->refresh();
           }
      }
+     // 時間見積り・計測実行ボタンは実行ボタンと同じ状態にする
+     static const int FOLLOWERS[] = { ID_DRY_RUN, ID_PROFILE };
+     for( int id : FOLLOWERS )
+     {
+          Button *btn = dynamic_cast<Button *>(getChildByID(id));
+          if( btn->isEnabled() != runBtn->isEnabled() )
+          {
+               if( runBtn->isEnabled() )
+               {
+                    btn->enable();
+               }
+               else
+               {
+                    btn->disable();
+               }
+               btn->refresh();
+          }
+     }
      m_mutex.lock();
      if( m_messageUpdated )
      {
@@ -236,7 +301,10 @@ void ScriptView::createFileList()
 }
 
 //------------------------------------------------------------------------------
-void ScriptView::runScript()
+//   dryRun が true の場合はロボットを動かさずに動作時間を見積もる
+//   profile が true の場合は行ごと・待ち時間の種類ごとの実行時間を計測する
+//------------------------------------------------------------------------------
+void ScriptView::runScript(bool dryRun, bool profile)
 {
      if( m_script->isRunning() || m_selectedIndex < 0 )
      {
@@ -245,23 +313,7 @@ void ScriptView::runScript()
           
      std::string path = "./script/";
      path += m_files[m_selectedIndex]; 
-     FILE *fp = fopen(path.c_str(), "r");
-     if( !fp )
-     {
-          printf("[ScriptView] Unable to open %s\n", path.c_str());
-          return;
-     }
-     std::string code;
-     char buffer[256+1];
-     int cb;
-     while( (cb = fread(buffer, 1, 256, fp)) > 0 )
-     {
-          buffer[cb] = '\0';
-          code += buffer;
-     }
-     fclose(fp);
-
-     m_script->run(code);
+     m_script->runFile(path, dryRun, profile);
 }
 
 //------------------------------------------------------------------------------
@@ -18,7 +18,9 @@ class ScriptView : public PaintBox
           enum{
                ID_UPDATE = 6001,
                ID_RUN = 6002,
-               ID_STOP = 6003
+               ID_STOP = 6003,
+               ID_DRY_RUN = 6004,
+               ID_PROFILE = 6005
           };
           Script *m_script;
           std::vector<Rect> m_itemRect;
@@ -30,7 +32,7 @@ class ScriptView : public PaintBox
           void internalDraw();
           void drawFileItem(int n);
           void createFileList();
-          void runScript();
+          void runScript(bool dryRun = false, bool profile = false);
           void stopScript();
 
           static int fileFilter(const struct dirent *dir);
@@ -46,6 +48,7 @@ class ScriptView : public PaintBox
           ScriptView(UIWidget *parent, Robot *robot);
           ~ScriptView();
           void update();
+          Script *getScript(){ return m_script; }
 };
 
 #endif
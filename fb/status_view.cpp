@@ -128,6 +128,7 @@ const char *MotorStatus::FLAG_LABELS[NUM_FLAGS][2] = {
      {"-", "ERROR"},
      {"-", "ERROR"},
      {"-", "ERROR"},
+     {"-", "ERROR"},
      {"-", "ERROR"}
 };
 
@@ -143,6 +144,7 @@ const uint16_t MotorStatus::FLAG_COLORS[NUM_FLAGS] = {
      COLOR_RED,
      COLOR_RED,
      COLOR_RED,
+     COLOR_RED,
      COLOR_RED
 };
 
@@ -153,12 +155,13 @@ std::function<bool(Robot*, int)> MotorStatus::readFlagFn[NUM_FLAGS] = {
      [](Robot *robot, int axis){ return robot->getLimitState(axis, L6470::DIR_REVERSE)? false : true; },
      [](Robot *robot, int axis){ return (robot->getMotorStatus(axis) & 0x04)? true : false; },
      [](Robot *robot, int axis){ return robot->getLimitState(axis, L6470::DIR_FORWARD)? false : true; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x01)? true : false; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x02)? true : false; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x04)? true : false; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x08)? true : false; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x10)? true : false; },
-     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & 0x20)? true : false; }
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_TH_WARN)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_UVLO)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_TH_SD)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_OCD)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_STEP_LOSS_A)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_STEP_LOSS_B)? true : false; },
+     [](Robot *robot, int axis){ return (robot->getAlarmFlag(axis) & L6470::ALM_POSITION)? true : false; }
 }; 
 
 //------------------------------------------------------------------------------
@@ -232,7 +235,7 @@ uint16_t MotorStatus::getFlagColor(int n)
 }
 
 //==============================================================================
-const char *MotorStatusView::ITEM_NAME[14] = {
+const char *MotorStatusView::ITEM_NAME[15] = {
      "Position (pulse)",
      "Speed (pulse/sec)",
      "Motor Enabled",
@@ -247,6 +250,7 @@ const char *MotorStatusView::ITEM_NAME[14] = {
      "Overcurrent",
      "Bridge-A stall",
      "Bridge-B stall",
+     "Position error",
 };
 
 const char *MotorStatusView::MOTOR_NAME[3] = {
@@ -256,8 +260,8 @@ const char *MotorStatusView::MOTOR_NAME[3] = {
 //------------------------------------------------------------------------------
 MotorStatusView::MotorStatusView(UIWidget *parent) : PaintBox(0, parent)
 {
-     // 1+24+(1+20)*16+1 = 362;
-     create(416, 112, 376, 320);
+     // 1+24+(1+20)*15+1 = 341;
+     create(416, 112, 376, 341);
      attachEvent(EVENT_PAINT, [this](UIWidget *, int32_t, int32_t){
           internalDraw();
      });
@@ -271,10 +275,10 @@ void MotorStatusView::internalDraw()
      Rect r = m_clientRect.clone();
      r.inflate(-1, -1).resizeHeight(24);
      fillRect(r, RGBToColor(0x70,0x13,0x34));
-     r.resizeWidth(146).resizeHeight(21*6).offset(0, 24+21*8);
+     r.resizeWidth(146).resizeHeight(21*7).offset(0, 24+21*8);
      fillRect(r, RGBToColor(0x55,0x47,0x00));
      Point p(0, 25);
-     for( int n = 0 ; n < 14 ; n++ )
+     for( int n = 0 ; n < 15 ; n++ )
      {
           drawFastHLine(p, m_clientRect.width, DEFAULT_BORDER_COLOR);
           r.setRect(p.x+1, p.y+1, 140, 20);
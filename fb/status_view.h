@@ -41,7 +41,8 @@ class MotorStatus
                OVC            = 9,
                STALL_A        = 10,
                STALL_B        = 11,
-               NUM_FLAGS      = 12
+               POSITION_ERR   = 12,
+               NUM_FLAGS      = 13
           };
      private:
           static const char    *FLAG_LABELS[NUM_FLAGS][2];
@@ -67,7 +68,7 @@ class MotorStatus
 class MotorStatusView : public PaintBox
 {
      private:
-          static const char *ITEM_NAME[14];
+          static const char *ITEM_NAME[15];
           static const char *MOTOR_NAME[3];
 
           MotorStatus m_status[3];
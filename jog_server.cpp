@@ -0,0 +1,264 @@
+//------------------------------------------------------------------------------
+//   jog_server.cpp
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdio>
+#include "jog_server.h"
+
+
+//==============================================================================
+//   JogServer
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+JogServer::JogServer(Robot *robot, int port, int deadmanMs)
+     : m_robot(robot), m_thread(NULL), m_socket(-1), m_wakeup(-1), m_deadmanMs(deadmanMs),
+       m_terminated(false), m_active(false), m_lastSequence(0)
+{
+     memset(&m_stats, 0, sizeof(m_stats));
+     memset(&m_owner, 0, sizeof(m_owner));
+
+     m_state = INIT_FAILED;
+     m_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+     m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+     if( m_socket < 0 || m_wakeup < 0 )
+     {
+          perror("[JogServer] socket() / eventfd() failed");
+          return;
+     }
+
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_addr.s_addr = htonl(INADDR_ANY);
+     addr.sin_port = htons(port);
+     if( bind(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+     {
+          perror("[JogServer] bind() failed");
+          return;
+     }
+
+     m_state = LISTENING;
+     m_thread = new std::thread([this](){ execute(); });
+     std::printf("[JogServer] Waiting for jog datagrams on UDP port %d.\n", port);
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+JogServer::~JogServer()
+{
+     m_terminated = true;
+     if( m_thread )
+     {
+          uint64_t one = 1;
+          if( write(m_wakeup, &one, sizeof(one)) < 0 )
+          {
+               perror("[JogServer::~JogServer] write() failed");
+          }
+          m_thread->join();
+          delete m_thread;
+     }
+     if( m_active )
+     {
+          m_robot->stopJog();
+     }
+     if( m_socket >= 0 )
+     {
+          close(m_socket);
+     }
+     if( m_wakeup >= 0 )
+     {
+          close(m_wakeup);
+     }
+}
+
+//------------------------------------------------------------------------------
+void JogServer::getStats(Stats *stats)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     *stats = m_stats;
+}
+
+//------------------------------------------------------------------------------
+//   速度を Robot::jog() に渡した直後 (RUN コマンドを送った後) に呼ばれる関数を登録する
+//   (レイテンシの測定用，受信スレッドから呼ばれる)
+//------------------------------------------------------------------------------
+void JogServer::setAppliedHook(std::function<void(uint32_t sequence)> hook)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_appliedHook = hook;
+}
+
+//------------------------------------------------------------------------------
+//   受信スレッド
+//   ジョグ中は途絶の期限まで，それ以外は受信があるまで待つ
+//------------------------------------------------------------------------------
+void JogServer::execute()
+{
+     std::printf("[JogServer] thread started.\n");
+
+     while( !m_terminated )
+     {
+          int timeout = -1;
+          if( m_active )
+          {
+               std::chrono::steady_clock::time_point deadline = m_lastReceived + std::chrono::milliseconds(m_deadmanMs);
+               std::chrono::steady_clock::duration rest = deadline - std::chrono::steady_clock::now();
+               timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(rest + std::chrono::microseconds(999)).count();
+               if( timeout < 0 )
+               {
+                    timeout = 0;
+               }
+          }
+
+          struct pollfd fds[2];
+          fds[0].fd = m_socket;
+          fds[0].events = POLLIN;
+          fds[1].fd = m_wakeup;
+          fds[1].events = POLLIN;
+          int n = poll(fds, 2, timeout);
+          if( n < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               perror("[JogServer] poll() failed");
+               break;
+          }
+          if( fds[1].revents & POLLIN )
+          {
+               break;
+          }
+          if( fds[0].revents & POLLIN )
+          {
+               receive();
+          }
+
+          if( m_active && std::chrono::steady_clock::now() - m_lastReceived >= std::chrono::milliseconds(m_deadmanMs) )
+          {
+               m_robot->stopJog();
+               m_active = false;
+               std::lock_guard<std::mutex> lock(m_mutex);
+               m_stats.deadman++;
+               std::printf("[JogServer] No jog datagram for %d ms, stopped.\n", m_deadmanMs);
+          }
+     }
+
+     std::printf("[JogServer] thread terminated.\n");
+}
+
+//------------------------------------------------------------------------------
+//   届いているデータグラムをすべて読み，最新の１つだけを Robot へ渡す
+//------------------------------------------------------------------------------
+void JogServer::receive()
+{
+     JogSchema::Request newest;
+     struct sockaddr_in newestFrom;
+     bool found = false;
+     Stats count;
+     memset(&count, 0, sizeof(count));
+
+     while( true )
+     {
+          uint8_t data[MAX_DATAGRAM];
+          struct sockaddr_in from;
+          socklen_t len = sizeof(from);
+          ssize_t size = recvfrom(m_socket, data, sizeof(data), 0, (struct sockaddr *)&from, &len);
+          if( size < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               break;         // EAGAIN : 読み尽くした
+          }
+          count.received++;
+
+          JogSchema::Request request;
+          bool other = m_active && (from.sin_addr.s_addr != m_owner.sin_addr.s_addr || from.sin_port != m_owner.sin_port);
+          if( other || !readDatagram(data, (int)size, &request) )
+          {
+               count.invalid++;
+               continue;
+          }
+          // シーケンス番号は一周するので差の符号で比べる
+          if( m_active && (int32_t)(request.sequence - m_lastSequence) <= 0 )
+          {
+               count.late++;
+               continue;
+          }
+          if( found && (int32_t)(request.sequence - newest.sequence) <= 0 )
+          {
+               count.late++;
+               continue;
+          }
+          if( found )
+          {
+               count.superseded++;
+          }
+          newest = request;
+          newestFrom = from;
+          found = true;
+     }
+
+     std::function<void(uint32_t)> hook;
+     if( found )
+     {
+          m_active = true;
+          m_owner = newestFrom;
+          m_lastSequence = newest.sequence;
+          m_lastReceived = std::chrono::steady_clock::now();
+          if( m_robot->jog(newest.speed) )
+          {
+               count.applied++;
+          }
+          else
+          {
+               count.refused++;
+          }
+     }
+
+     m_mutex.lock();
+     m_stats.received += count.received;
+     m_stats.applied += count.applied;
+     m_stats.late += count.late;
+     m_stats.superseded += count.superseded;
+     m_stats.invalid += count.invalid;
+     m_stats.refused += count.refused;
+     hook = m_appliedHook;
+     m_mutex.unlock();
+
+     if( count.applied > 0 && hook )
+     {
+          hook(newest.sequence);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   データグラムがちょうど１つの JogSchema のフレームであれば request に取り出す
+//------------------------------------------------------------------------------
+bool JogServer::readDatagram(const uint8_t *data, int size, JogSchema::Request *request)
+{
+     int skip, frameSize;
+     if( Packet::scan(data, size, NULL, 0, &skip, &frameSize) != Packet::SCAN_FRAME ||
+          skip != 0 || frameSize != size )
+     {
+          return false;
+     }
+     Packet packet;
+     packet.assign(data, size, NULL, 0, frameSize);
+     if( packet.getID() != JogSchema::ID )
+     {
+          return false;
+     }
+     return JogSchema::RequestLayout::decode(packet.getData(), packet.getDataLength(), *request);
+}
@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+//   jog_server.h
+//
+//   ペンダント・ジョイスティック用のジョグ (速度指令) を UDP で受け付ける
+//   TCP のコマンドサーバとは別のスレッド・ソケットで，順序待ちや再送による遅れがない
+//
+//   データグラムは JogSchema (command_schema.h) のリクエスト１つを通常形式のフレームに
+//   入れたもの。シーケンス番号が前回以下のもの (遅れて届いたもの) は捨て，溜まっていた
+//   ものは最新の１つだけを使う。受け付けた速度はその場で Robot::jog() (RUN コマンド) に渡す
+//   最後のデータグラムから deadmanMs の間なにも届かなければ，ジョグを減速停止する
+//   停止するまでは最初に送ってきたアドレスのデータグラムだけを受け付ける
+//------------------------------------------------------------------------------
+#ifndef   JOG_SERVER_H
+#define   JOG_SERVER_H
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <netinet/in.h>
+#include "robot.h"
+#include "packet.h"
+#include "command_schema.h"
+
+//------------------------------------------------------------------------------
+class JogServer
+{
+     public:
+          enum{ PORT = 12468 };              // UDP (TCP のコマンドサーバと同じ番号)
+          enum{ DEADMAN_MS = 200 };
+          enum{ INIT_FAILED = -1, LISTENING };
+
+          struct Stats
+          {
+               uint64_t received;       // 受信したデータグラム
+               uint64_t applied;        // Robot::jog() に渡したもの
+               uint64_t late;           // シーケンス番号が古くて捨てたもの
+               uint64_t superseded;     // より新しいものが一緒に届いたので捨てたもの
+               uint64_t invalid;        // フレームとして読めない，または他のアドレスから届いたもの
+               uint64_t refused;        // Robot が受け付けなかったもの (移動中・アラームなど)
+               uint64_t deadman;        // 途絶による停止の回数
+          };
+
+     private:
+          enum{ MAX_DATAGRAM = Packet::MAX_PACKET_SIZE };
+
+          Robot       *m_robot;
+          std::thread *m_thread;
+          int          m_socket;
+          int          m_wakeup;             // スレッド終了を通知する eventfd
+          int          m_state;
+          int          m_deadmanMs;
+          bool         m_terminated;
+
+          bool         m_active;             // ジョグ中 (途絶の監視中)
+          uint32_t     m_lastSequence;
+          struct sockaddr_in m_owner;
+          std::chrono::steady_clock::time_point m_lastReceived;
+
+          Stats        m_stats;
+          std::mutex   m_mutex;
+          std::function<void(uint32_t)> m_appliedHook;
+
+          void execute();
+          void receive();
+          bool readDatagram(const uint8_t *data, int size, JogSchema::Request *request);
+
+     public:
+          JogServer(Robot *robot, int port = PORT, int deadmanMs = DEADMAN_MS);
+          ~JogServer();
+
+          int  getState(){ return m_state; }
+          void getStats(Stats *stats);
+          void setAppliedHook(std::function<void(uint32_t sequence)> hook);
+};
+
+#endif
@@ -0,0 +1,188 @@
+//------------------------------------------------------------------------------
+//   kinematics.cpp
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include "kinematics.h"
+
+const char *KinematicModel::PARAM_NAME[NUM_PARAMS] = {
+     "a", "b", "c", "d", "e", "f", "h", "l1", "l2", "m", "n",
+     "shoulder_offset", "elbow_offset", "base_offset"
+};
+const char *KinematicModel::DEFAULT_PATH = "./kinematics.dat";
+
+static const double PI = 3.14159265359;
+const double KinematicModel::BASE_PULSE_PER_RAD = 25600.0 * 45.0 / 21.0 / PI;
+const double KinematicModel::ARM_PULSE_PER_RAD  = 25600.0 * 45.0 / 11.0 / PI;
+
+//------------------------------------------------------------------------------
+KinematicModel::KinematicModel()
+{
+     setDefault();
+}
+
+//------------------------------------------------------------------------------
+//   設計値
+//------------------------------------------------------------------------------
+void KinematicModel::setDefault()
+{
+     m_param[PRM_A] = 180;
+     m_param[PRM_B] = 68;
+     m_param[PRM_C] = 180;
+     m_param[PRM_D] = 30;
+     m_param[PRM_E] = 60;
+     m_param[PRM_F] = 175;
+     m_param[PRM_H] = 100;
+     m_param[PRM_L1] = 135;
+     m_param[PRM_L2] = 15;
+     m_param[PRM_M] = 10;
+     m_param[PRM_N] = 40;
+     m_param[PRM_SHOULDER_OFS] = PI/3;
+     m_param[PRM_ELBOW_OFS] = 38*PI/180;     // = 0.6632
+     m_param[PRM_BASE_OFS] = 0;
+}
+
+//------------------------------------------------------------------------------
+//   ファイルから読み込む
+//   書式は１行に「パラメータ名 値」。記載のないパラメータは現在値のまま
+//------------------------------------------------------------------------------
+bool KinematicModel::load(const char *path)
+{
+     FILE *fp = fopen(path, "r");
+     if( !fp )
+     {
+          return false;
+     }
+     char line[128];
+     char name[64];
+     double value;
+     while( fgets(line, sizeof(line), fp) )
+     {
+          if( line[0] == '#' || sscanf(line, "%63s %lf", name, &value) != 2 )
+          {
+               continue;
+          }
+          for( int n = 0 ; n < NUM_PARAMS ; n++ )
+          {
+               if( strcmp(name, PARAM_NAME[n]) == 0 )
+               {
+                    m_param[n] = value;
+               }
+          }
+     }
+     fclose(fp);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+bool KinematicModel::save(const char *path) const
+{
+     FILE *fp = fopen(path, "w");
+     if( !fp )
+     {
+          return false;
+     }
+     fprintf(fp, "# kinematic model of the robotic arm\n");
+     for( int n = 0 ; n < NUM_PARAMS ; n++ )
+     {
+          fprintf(fp, "%s %.9f\n", PARAM_NAME[n], m_param[n]);
+     }
+     fclose(fp);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   エンドエフェクタ位置(mm単位)から，モータ軸位置(pulse単位)を算出する
+//   解が存在しない場合は false
+//------------------------------------------------------------------------------
+bool KinematicModel::inverse(double X, double Y, double Z, double *base, double *shoulder, double *elbow) const
+{
+     const double a = m_param[PRM_A];
+     const double b = m_param[PRM_B];
+     const double c = m_param[PRM_C];
+     const double d = m_param[PRM_D];
+     const double e = m_param[PRM_E];
+     const double f = m_param[PRM_F];
+     const double r = std::sqrt(d*d + e*e);
+     const double m = m_param[PRM_M];
+     const double n = m_param[PRM_N];
+
+     X = X + m;
+
+     double t = std::asin(X/std::sqrt(X*X+Y*Y));
+     double omega = std::asin(m/std::sqrt(X*X+Y*Y)) - t;
+     *base = (omega - m_param[PRM_BASE_OFS]) * BASE_PULSE_PER_RAD;
+
+     double x = -(-X*std::sin(omega) + Y*std::cos(omega) - n - m_param[PRM_L1]);
+     double y = Z - (m_param[PRM_H] - m_param[PRM_L2]);
+
+     double s = std::acos(x/std::sqrt(x*x+y*y));
+     if( y < 0 )
+     {
+          s = 2*PI - s;
+     }
+
+     double alpha = s - std::acos((a*a+x*x+y*y-(d*d+f*f))/(2*a*std::sqrt(x*x+y*y)));
+
+     double theta = PI + alpha - std::acos((a*a+d*d+f*f-(x*x+y*y))/(2*a*std::sqrt(d*d+f*f)))
+                    - std::acos((d*d-e*f)/(std::sqrt(d*d+f*f)*std::sqrt(d*d+e*e)));
+
+     t = a*a+r*r+2*a*r*std::cos(alpha - theta);
+
+     double u = std::acos((a*std::cos(alpha)+r*std::cos(theta))/std::sqrt(t));
+
+     double beta = u - std::acos((t+b*b-c*c)/(2*b*std::sqrt(t)));
+
+     *shoulder = (alpha - m_param[PRM_SHOULDER_OFS]) * ARM_PULSE_PER_RAD;
+     *elbow = (beta - m_param[PRM_ELBOW_OFS]) * ARM_PULSE_PER_RAD;
+
+     return std::isfinite(*base) && std::isfinite(*shoulder) && std::isfinite(*elbow);
+}
+
+//------------------------------------------------------------------------------
+//   モータの軸位置(pulse単位)から，エンドエフェクタ位置(mm単位)を算出する
+//------------------------------------------------------------------------------
+void KinematicModel::forward(double base, double shoulder, double elbow, double *X, double *Y, double *Z) const
+{
+     const double a = m_param[PRM_A];
+     const double b = m_param[PRM_B];
+     const double c = m_param[PRM_C];
+     const double d = m_param[PRM_D];
+     const double e = m_param[PRM_E];
+     const double f = m_param[PRM_F];
+     const double m = m_param[PRM_M];
+     const double n = m_param[PRM_N];
+
+     double alpha = shoulder / ARM_PULSE_PER_RAD + m_param[PRM_SHOULDER_OFS];
+     double beta  = elbow / ARM_PULSE_PER_RAD + m_param[PRM_ELBOW_OFS];
+     double phi   = base / BASE_PULSE_PER_RAD + m_param[PRM_BASE_OFS];
+
+     double r = std::sqrt(d*d+e*e);
+     double s = a*std::cos(alpha) - b*std::cos(beta);
+     double t = a*std::sin(alpha) - b*std::sin(beta);
+
+     double gamma;
+     if( t > 0 )
+     {
+          gamma = std::acos(s/std::sqrt(s*s+t*t));
+     }
+     else
+     {
+          gamma = 2*PI - std::acos(s/std::sqrt(s*s+t*t));
+     }
+     double theta = gamma - std::acos((c*c-(a*a+b*b+d*d+e*e)+2*a*b*std::cos(alpha -beta))/(2*std::sqrt(d*d+e*e)*std::sqrt(s*s+t*t)));
+
+     // アーム面内での「P点」からの水平距離をベース回転角 phi で回転させる
+     // (k はベース回転軸とアーム面とのオフセット量)
+     const double k = std::sqrt(m*m + n*n);
+     double w = -m_param[PRM_L1] + a*std::cos(alpha) + ((d*d-e*f)*std::cos(theta) - d*(e+f)*std::sin(theta))/r;
+
+     double x = -w*(n*std::cos(phi) - m*std::sin(phi))/k + k*std::cos(phi);
+     double y = -w*(m*std::cos(phi) + n*std::sin(phi))/k + k*std::sin(phi);
+     double z = a*std::sin(alpha) + (d*(e+f)*std::cos(theta) + (d*d-e*f)*std::sin(theta))/r + m_param[PRM_H] - m_param[PRM_L2];
+
+     *X = (m*x - n*y)/k - m;
+     *Y = (n*x + m*y)/k;
+     *Z = z;
+}
@@ -0,0 +1,56 @@
+//------------------------------------------------------------------------------
+//   kinematics.h
+//
+//   アームの幾何モデル (IK / FK)
+//   リンク長などの寸法を個体ごとに校正できるよう，パラメータとして保持する
+//------------------------------------------------------------------------------
+#ifndef   KINEMATICS_H
+#define   KINEMATICS_H
+
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+class KinematicModel
+{
+     public:
+          enum{
+               PRM_A = 0,          // 上腕の長さ
+               PRM_B,              // 肘駆動リンク(クランク)の長さ
+               PRM_C,              // 肘駆動リンク(ロッド)の長さ
+               PRM_D,              // 前腕の寸法 (d, e, f)
+               PRM_E,
+               PRM_F,
+               PRM_H,              // アームの支点の高さ
+               PRM_L1,             // 「P点」とエンドエフェクタとの水平距離
+               PRM_L2,             // 「P点」とエンドエフェクタとの垂直距離
+               PRM_M,              // ベース回転軸とアーム面とのオフセット (m, n)
+               PRM_N,
+               PRM_SHOULDER_OFS,   // SHOULDER の原点角度(rad)
+               PRM_ELBOW_OFS,      // ELBOW の原点角度(rad)
+               PRM_BASE_OFS,       // BASE の原点角度(rad)
+               NUM_PARAMS
+          };
+          static const char *PARAM_NAME[NUM_PARAMS];
+          static const char *DEFAULT_PATH;
+
+          // モータ軸のパルス数と関節角度の関係 (1/128 マイクロステップ，減速比 45:21 / 45:11)
+          static const double BASE_PULSE_PER_RAD;
+          static const double ARM_PULSE_PER_RAD;
+
+     private:
+          double m_param[NUM_PARAMS];
+
+     public:
+          KinematicModel();
+          void   setDefault();
+          double get(int id) const { return m_param[id]; }
+          void   set(int id, double value){ m_param[id] = value; }
+
+          bool load(const char *path);
+          bool save(const char *path) const;
+
+          bool inverse(double X, double Y, double Z, double *base, double *shoulder, double *elbow) const;
+          void forward(double base, double shoulder, double elbow, double *X, double *Y, double *Z) const;
+};
+
+#endif
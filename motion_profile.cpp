@@ -0,0 +1,149 @@
+//------------------------------------------------------------------------------
+//   motion_profile.cpp
+//------------------------------------------------------------------------------
+#include <cmath>
+#include <cstdlib>
+#include "motion_profile.h"
+
+//------------------------------------------------------------------------------
+//   物理量からレジスタ値への変換 (範囲外は丸める)
+//------------------------------------------------------------------------------
+uint32_t MotionProfile::ppsToMaxSpeed(double pps)
+{
+     double reg = std::round(pps / (15.2587890625 * MICROSTEP));
+     if( reg < 1 ){ return 1; }
+     if( reg > 0x3FF ){ return 0x3FF; }
+     return (uint32_t)reg;
+}
+
+//------------------------------------------------------------------------------
+uint32_t MotionProfile::pps2ToAcc(double pps2)
+{
+     double reg = std::round(pps2 / (14.5519152284 * MICROSTEP));
+     if( reg < 1 ){ return 1; }
+     if( reg > 0xFFE ){ return 0xFFE; }      // 0xFFF は「無限大」を意味するので使わない
+     return (uint32_t)reg;
+}
+
+//------------------------------------------------------------------------------
+uint32_t MotionProfile::ppsToSpeed(double pps)
+{
+     double reg = std::round(pps / (0.01490116119384765625 * MICROSTEP));
+     if( reg < 0 ){ return 0; }
+     if( reg > 0xFFFFF ){ return 0xFFFFF; }
+     return (uint32_t)reg;
+}
+
+//------------------------------------------------------------------------------
+//   最も移動量の大きい軸(longest)を maxSpeed(レジスタ値) で動かすときの，distance だけ動く軸の MAX_SPEED
+//------------------------------------------------------------------------------
+uint32_t MotionProfile::syncMaxSpeed(double maxSpeed, uint32_t distance, uint32_t longest)
+{
+     double speed = (longest == 0)? maxSpeed : std::round(maxSpeed * distance / longest);
+     if( speed < 1 )
+     {
+          return 1;      // MAX_SPEED = 0 では目標位置へ到達しない
+     }
+     if( speed > 0x3FF )
+     {
+          return 0x3FF;
+     }
+     return (uint32_t)speed;
+}
+
+//------------------------------------------------------------------------------
+MotionProfile::MotionProfile()
+     : m_start(0), m_target(0), m_vmax(0), m_acc(1), m_dec(1),
+     m_tAcc(0), m_tConst(0), m_tDec(0)
+{
+}
+
+//------------------------------------------------------------------------------
+//   start から target への移動を計画する
+//   vmax : MAX_SPEED (pulse/sec)
+//   acc  : 加速度 (pulse/sec^2)
+//   dec  : 減速度 (pulse/sec^2)
+//
+//   移動距離が短く MAX_SPEED まで到達しない場合は三角形のプロファイルとなる
+//------------------------------------------------------------------------------
+void MotionProfile::plan(int32_t start, int32_t target, double vmax, double acc, double dec)
+{
+     m_start = start;
+     m_target = target;
+     m_acc = (acc > 0)? acc : 1;
+     m_dec = (dec > 0)? dec : 1;
+
+     double distance = std::abs(target - start);
+     if( distance == 0 || vmax <= 0 )
+     {
+          m_vmax = 0;
+          m_tAcc = m_tConst = m_tDec = 0;
+          return;
+     }
+
+     // 加速・減速に要する距離の合計
+     double ramp = vmax*vmax/(2*m_acc) + vmax*vmax/(2*m_dec);
+     if( ramp <= distance )
+     {
+          m_vmax = vmax;
+          m_tConst = (distance - ramp) / vmax;
+     }
+     else
+     {
+          m_vmax = std::sqrt(2*distance*m_acc*m_dec/(m_acc + m_dec));
+          m_tConst = 0;
+     }
+     m_tAcc = m_vmax / m_acc;
+     m_tDec = m_vmax / m_dec;
+}
+
+//------------------------------------------------------------------------------
+//   移動開始から t 秒後の位置
+//------------------------------------------------------------------------------
+int32_t MotionProfile::getPosition(double t) const
+{
+     double d;
+     if( t <= 0 )
+     {
+          d = 0;
+     }
+     else if( t < m_tAcc )
+     {
+          d = m_acc*t*t/2;
+     }
+     else if( t < m_tAcc + m_tConst )
+     {
+          d = m_vmax*m_tAcc/2 + m_vmax*(t - m_tAcc);
+     }
+     else if( t < getDuration() )
+     {
+          double r = getDuration() - t;
+          d = std::abs(m_target - m_start) - m_dec*r*r/2;
+     }
+     else
+     {
+          return m_target;
+     }
+     return (m_target >= m_start)? m_start + (int32_t)d : m_start - (int32_t)d;
+}
+
+//------------------------------------------------------------------------------
+//   移動開始から t 秒後の速度(絶対値, pulse/sec)
+//------------------------------------------------------------------------------
+double MotionProfile::getSpeed(double t) const
+{
+     if( t <= 0 || t >= getDuration() ){ return 0; }
+     if( t < m_tAcc ){ return m_acc*t; }
+     if( t < m_tAcc + m_tConst ){ return m_vmax; }
+     return m_dec*(getDuration() - t);
+}
+
+//------------------------------------------------------------------------------
+//   移動時間だけを求める
+//------------------------------------------------------------------------------
+double MotionProfile::getDuration(uint32_t distance, double vmax, double acc, double dec)
+{
+     MotionProfile p;
+     p.plan(0, (int32_t)distance, vmax, acc, dec);
+     return p.getDuration();
+}
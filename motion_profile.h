@@ -0,0 +1,59 @@
+//------------------------------------------------------------------------------
+//   motion_profile.h
+//
+//   L6470 の台形速度プロファイルの計算
+//   (ACC / DEC / MAX_SPEED レジスタの値から，移動時間や任意時刻の位置を求める)
+//------------------------------------------------------------------------------
+#ifndef   MOTION_PROFILE_H
+#define   MOTION_PROFILE_H
+
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+class MotionProfile
+{
+     public:
+          enum{ MICROSTEP = 128 };      // STEP_MODE = 0x07 (1/128 マイクロステップ)
+
+          // レジスタ値 <-> 物理量 (pulse/sec, pulse/sec^2) の変換 (L6470 データシート参照)
+          //   MAX_SPEED : 15.25 step/s / LSB
+          //   ACC, DEC  : 14.55 step/s^2 / LSB
+          //   SPEED     : 0.0149 step/s / LSB (RUN コマンドの速度)
+          static double   maxSpeedToPps(uint32_t reg){ return reg * 15.2587890625 * MICROSTEP; }
+          static double   accToPps2(uint32_t reg){ return reg * 14.5519152284 * MICROSTEP; }
+          static uint32_t ppsToMaxSpeed(double pps);
+          static uint32_t pps2ToAcc(double pps2);
+          static uint32_t ppsToSpeed(double pps);
+
+          // 複数軸を同時に到着させるための MAX_SPEED (移動量に比例させる)
+          static uint32_t syncMaxSpeed(double maxSpeed, uint32_t distance, uint32_t longest);
+
+     private:
+          int32_t m_start;
+          int32_t m_target;
+          double  m_vmax;          // 実際に到達する最高速度(pulse/sec)
+          double  m_acc;
+          double  m_dec;
+          double  m_tAcc;          // 加速時間
+          double  m_tConst;        // 定速時間
+          double  m_tDec;          // 減速時間
+
+     public:
+          MotionProfile();
+          void plan(int32_t start, int32_t target, double vmax, double acc, double dec);
+          void planByRegister(int32_t start, int32_t target, uint32_t maxSpeed, uint32_t acc, uint32_t dec)
+          {
+               plan(start, target, maxSpeedToPps(maxSpeed), accToPps2(acc), accToPps2(dec));
+          }
+
+          int32_t getStart() const { return m_start; }
+          int32_t getTarget() const { return m_target; }
+          double  getPeakSpeed() const { return m_vmax; }
+          double  getDuration() const { return m_tAcc + m_tConst + m_tDec; }
+          int32_t getPosition(double t) const;
+          double  getSpeed(double t) const;
+
+          static double getDuration(uint32_t distance, double vmax, double acc, double dec);
+};
+
+#endif
@@ -0,0 +1,544 @@
+//------------------------------------------------------------------------------
+//   packet.cpp
+//------------------------------------------------------------------------------
+#include <string.h>
+#include <algorithm>
+#include "packet.h"
+
+
+//==============================================================================
+//   Packet
+//==============================================================================
+//   コンストラクタ
+//------------------------------------------------------------------------------
+Packet::Packet()
+{
+     m_body.reserve(MAX_PACKET_SIZE);
+     clear();
+}
+
+//------------------------------------------------------------------------------
+Packet *Packet::clone()
+{
+     return new Packet(*this);
+}
+
+//------------------------------------------------------------------------------
+//   現在の内部データをすべてクリアしてデフォルトの状態にする
+//   シーケンシャル書き込みを行う場合は必ず最初にこのメソッドを実行する
+//------------------------------------------------------------------------------
+void Packet::clear()
+{
+     m_body.resize(BASIC_HEADER_SIZE);
+     m_body[0] = STX;
+     m_body[1] = DEFAULT_ID;
+     m_body[2] = DEFAULT_SERIAL;
+     m_body[3] = DEFAULT_DATALEN;
+     m_format = FORMAT_BASIC;
+     m_dataLength = 0;
+
+     m_rawBytePtr = 0;
+}
+
+//------------------------------------------------------------------------------
+//   チェックサムを算出して返す (通常形式)
+//------------------------------------------------------------------------------
+uint8_t Packet::getChecksum() const
+{
+     uint8_t sum = 0x00;
+     for( int n = 0 ; n < m_dataLength ; n++ )
+     {
+          sum += m_body[4+n];
+     }
+     return sum;
+}
+
+//------------------------------------------------------------------------------
+//   CRC を算出して返す (拡張形式，VER からデータの末尾まで)
+//------------------------------------------------------------------------------
+uint32_t Packet::getCRC() const
+{
+     return crc32(&m_body[OFFSET_EXT_VERSION], EXT_HEADER_SIZE - 1 + m_dataLength);
+}
+
+//------------------------------------------------------------------------------
+//   CRC-32 (IEEE 802.3，zlib と同じ)
+//   crc に前回の結果を渡せば，続きのデータについて計算できる
+//------------------------------------------------------------------------------
+uint32_t Packet::crc32(const uint8_t *data, int size, uint32_t crc)
+{
+     struct Table
+     {
+          uint32_t value[256];
+          Table(){
+               for( uint32_t n = 0 ; n < 256 ; n++ )
+               {
+                    uint32_t c = n;
+                    for( int k = 0 ; k < 8 ; k++ )
+                    {
+                         c = (c & 1)? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+                    }
+                    value[n] = c;
+               }
+          }
+     };
+     static const Table table;
+
+     crc = ~crc;
+     for( int n = 0 ; n < size ; n++ )
+     {
+          crc = table.value[(crc ^ data[n]) & 0xFF] ^ (crc >> 8);
+     }
+     return ~crc;
+}
+
+//------------------------------------------------------------------------------
+//   新しいパケットを準備する
+//------------------------------------------------------------------------------
+void Packet::create(uint8_t id, uint8_t serialNo, int format)
+{
+     clear();
+     if( format == FORMAT_EXTENDED )
+     {
+          m_format = FORMAT_EXTENDED;
+          m_body.assign(EXT_HEADER_SIZE, 0);
+          m_body[OFFSET_EXT_SOH] = SOH;
+          m_body[OFFSET_EXT_VERSION] = EXT_VERSION;
+          m_body[OFFSET_EXT_ID] = id;
+          m_body[OFFSET_EXT_SERIAL] = serialNo;
+     }
+     else
+     {
+          m_body[1] = id;
+          m_body[2] = serialNo;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   パケットへ「データ」を追加する
+//   m_body[0] : STX(0x02)
+//   m_body[1] : コマンドID
+//   m_body[2] : シリアル番号
+//   m_body[3] : (後続の)データ部の長さ(byte) = len
+//   m_body[4] : データ[0]
+//   m_body[5] : データ[1]
+//   ...
+//   (チェックサムと ETX は getRawBytes() で付ける)
+//------------------------------------------------------------------------------
+void Packet::addPacketData(const void *data, int size)
+{
+     size = std::min(size, getMaxDataLength() - m_dataLength);
+     const uint8_t *p = (const uint8_t *)data;
+     m_body.insert(m_body.end(), p, p+size);
+     m_dataLength += size;
+     // 「データ長」を更新
+     if( m_format == FORMAT_EXTENDED )
+     {
+          uint32_t len = (uint32_t)m_dataLength;
+          for( int n = 0 ; n < 4 ; n++ )
+          {
+               m_body[OFFSET_EXT_LEN+n] = (uint8_t)(len >> (8*n));
+          }
+     }
+     else
+     {
+          m_body[OFFSET_LEN] = (uint8_t)m_dataLength;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   パケットのバイト列へシーケンシャルにデータを書き込む
+//   先頭バイトが STX なら通常形式，SOH なら拡張形式として読む
+//------------------------------------------------------------------------------
+bool Packet::push(uint8_t data)
+{
+     bool canPush = false;
+     bool done = false;
+
+     if( m_rawBytePtr == 0 )
+     {
+          if( data == STX || data == SOH )
+          {
+               m_format = (data == SOH)? FORMAT_EXTENDED : FORMAT_BASIC;
+               m_dataLength = 0;
+               m_body.clear();
+               m_body.push_back(data);
+               m_rawBytePtr = 1;
+          }
+          return false;
+     }
+
+     // 書き込み位置別に，data が正しい（受け入れ可能な）データであるかチェックする
+     if( m_format == FORMAT_EXTENDED )
+     {
+          canPush = pushExtended(data, &done);
+     }
+     else
+     {
+          canPush = pushBasic(data, &done);
+     }
+
+     if( canPush )
+     {
+          if( done )
+          {
+               // パケット全体を(ETXまで)取得できた
+               m_rawBytePtr = 0;
+          }
+          else
+          {
+               m_rawBytePtr++;
+          }
+     }
+     else
+     {
+          // パケットの書式を逸脱する不正なデータなので，読み込みをリセットする
+          m_rawBytePtr = 0;
+     }
+     return done;
+}
+
+//------------------------------------------------------------------------------
+bool Packet::pushBasic(uint8_t data, bool *done)
+{
+     int ofs;
+     switch( m_rawBytePtr )
+     {
+          case 1:
+          case 2:
+               m_body.push_back(data);
+               return true;
+          case 3:
+               if( data > MAX_DATA_LENGTH )
+               {
+                    return false;
+               }
+               m_body.push_back(data);
+               m_dataLength = data;
+               return true;
+          default:
+               ofs = m_rawBytePtr - BASIC_HEADER_SIZE;
+               if( ofs < m_dataLength )
+               {
+                    m_body.push_back(data);
+                    return true;
+               }
+               if( ofs == m_dataLength )
+               {
+                    return (data == getChecksum());
+               }
+               *done = (data == ETX);
+               return *done;
+     }
+}
+
+//------------------------------------------------------------------------------
+bool Packet::pushExtended(uint8_t data, bool *done)
+{
+     int ofs = m_rawBytePtr - EXT_HEADER_SIZE;
+     if( m_rawBytePtr == OFFSET_EXT_VERSION )
+     {
+          if( data != EXT_VERSION )
+          {
+               return false;
+          }
+          m_body.push_back(data);
+          return true;
+     }
+     if( m_rawBytePtr < EXT_HEADER_SIZE )
+     {
+          m_body.push_back(data);
+          if( m_rawBytePtr == EXT_HEADER_SIZE - 1 )
+          {
+               uint32_t len = 0;
+               for( int n = 0 ; n < 4 ; n++ )
+               {
+                    len |= (uint32_t)m_body[OFFSET_EXT_LEN+n] << (8*n);
+               }
+               if( len > MAX_EXT_DATA_LENGTH )
+               {
+                    return false;
+               }
+               m_dataLength = (int)len;
+               m_body.reserve(EXT_HEADER_SIZE + m_dataLength + 4);
+          }
+          return true;
+     }
+     if( ofs < m_dataLength + 4 )
+     {
+          // データと CRC (CRC は照合が済んだら取り除く)
+          m_body.push_back(data);
+          if( ofs == m_dataLength + 3 )
+          {
+               uint32_t crc = 0;
+               for( int n = 0 ; n < 4 ; n++ )
+               {
+                    crc |= (uint32_t)m_body[EXT_HEADER_SIZE + m_dataLength + n] << (8*n);
+               }
+               m_body.resize(EXT_HEADER_SIZE + m_dataLength);
+               return (crc == getCRC());
+          }
+          return true;
+     }
+     *done = (data == ETX);
+     return *done;
+}
+
+//------------------------------------------------------------------------------
+//   パケット全体を表すバイト列を取得する
+//------------------------------------------------------------------------------
+int Packet::getRawBytes(std::vector<uint8_t>& buffer)
+{
+     uint8_t trailer[EXT_TRAILER_SIZE];
+     int n = getTrailer(trailer);
+     buffer.assign(m_body.begin(), m_body.end());
+     buffer.insert(buffer.end(), trailer, trailer+n);
+     return (int)buffer.size();
+}
+
+//------------------------------------------------------------------------------
+//   チェックサム (拡張形式は CRC) と ETX を trailer へ書き，そのバイト数を返す
+//   送信時は getBody() と trailer をそのまま writev() すればよい
+//------------------------------------------------------------------------------
+int Packet::getTrailer(uint8_t trailer[EXT_TRAILER_SIZE]) const
+{
+     if( m_format == FORMAT_EXTENDED )
+     {
+          uint32_t crc = getCRC();
+          for( int n = 0 ; n < 4 ; n++ )
+          {
+               trailer[n] = (uint8_t)(crc >> (8*n));
+          }
+          trailer[4] = ETX;
+          return 5;
+     }
+     trailer[0] = getChecksum();
+     trailer[1] = ETX;
+     return 2;
+}
+
+
+//==============================================================================
+//   フレームの検出
+//   受信バッファ (リングバッファの２つの連続領域) を１バイトずつコピーせずに走査し，
+//   STX / SOH，データ長，チェックサム，ETX がすべて正しいフレームを探す
+//==============================================================================
+struct ByteSpans
+{
+     const uint8_t *p[2];
+     int n[2];
+     int total;
+
+     uint8_t at(int i) const { return (i < n[0])? p[0][i] : p[1][i-n[0]]; }
+
+     // from 以降で最初の STX / SOH の位置 (なければ -1)
+     int findStart(int from, int limit) const
+     {
+          for( int k = 0 ; k < 2 ; k++ )
+          {
+               int base = (k == 0)? 0 : n[0];
+               int end = std::min(n[k], limit - base);
+               for( int i = std::max(from - base, 0) ; i < end ; i++ )
+               {
+                    if( p[k][i] == Packet::STX || p[k][i] == Packet::SOH )
+                    {
+                         return base + i;
+                    }
+               }
+          }
+          return -1;
+     }
+
+     uint8_t sum(int from, int len) const
+     {
+          uint8_t s = 0;
+          for( int k = 0 ; k < 2 ; k++ )
+          {
+               int base = (k == 0)? 0 : n[0];
+               int top = std::max(from - base, 0);
+               int end = std::min(from + len - base, n[k]);
+               for( int i = top ; i < end ; i++ )
+               {
+                    s += p[k][i];
+               }
+          }
+          return s;
+     }
+
+     uint32_t crc(int from, int len) const
+     {
+          uint32_t c = 0;
+          for( int k = 0 ; k < 2 ; k++ )
+          {
+               int base = (k == 0)? 0 : n[0];
+               int top = std::max(from - base, 0);
+               int end = std::min(from + len - base, n[k]);
+               if( top < end )
+               {
+                    c = Packet::crc32(p[k] + top, end - top, c);
+               }
+          }
+          return c;
+     }
+};
+
+//------------------------------------------------------------------------------
+//   pos から limit までの範囲でフレームを探す
+//   書式に合わない候補は捨てて次の STX / SOH から探し直す (再同期)
+//   lookahead が true の場合，途中までしか届いていない通常形式の候補の後ろに
+//   完全なフレームがあればそちらを採る (ゴミの STX が後続のフレームを待たせ続けないように)
+//   拡張形式はデータ部に別のフレームに見えるバイト列を含み得るので，先読みしない
+//------------------------------------------------------------------------------
+static int scanSpans(const ByteSpans& b, int pos, int limit, bool lookahead, int *skip, int *frameSize)
+{
+     while( true )
+     {
+          int s = b.findStart(pos, limit);
+          if( s < 0 )
+          {
+               *skip = limit;
+               return Packet::SCAN_INCOMPLETE;
+          }
+          int avail = limit - s;
+          int size = -1;           // フレーム長 (分からなければ -1)
+          bool invalid = false;
+          if( b.at(s) == Packet::STX )
+          {
+               if( avail >= 4 )
+               {
+                    int len = b.at(s + Packet::OFFSET_LEN);
+                    invalid = (len > Packet::MAX_DATA_LENGTH);
+                    size = len + 6;
+                    if( !invalid && avail >= size )
+                    {
+                         invalid = (b.sum(s+4, len) != b.at(s+4+len)) || (b.at(s+5+len) != Packet::ETX);
+                    }
+               }
+          }
+          else
+          {
+               if( avail >= 2 && b.at(s + Packet::OFFSET_EXT_VERSION) != Packet::EXT_VERSION )
+               {
+                    invalid = true;
+               }
+               else if( avail >= Packet::EXT_HEADER_SIZE )
+               {
+                    uint32_t len = 0;
+                    for( int n = 0 ; n < 4 ; n++ )
+                    {
+                         len |= (uint32_t)b.at(s + Packet::OFFSET_EXT_LEN + n) << (8*n);
+                    }
+                    invalid = (len > Packet::MAX_EXT_DATA_LENGTH);
+                    size = (int)len + Packet::EXT_HEADER_SIZE + Packet::EXT_TRAILER_SIZE;
+                    if( !invalid && avail >= size )
+                    {
+                         uint32_t crc = 0;
+                         for( int n = 0 ; n < 4 ; n++ )
+                         {
+                              crc |= (uint32_t)b.at(s + Packet::EXT_HEADER_SIZE + len + n) << (8*n);
+                         }
+                         invalid = (b.crc(s+1, Packet::EXT_HEADER_SIZE - 1 + len) != crc) || (b.at(s+size-1) != Packet::ETX);
+                    }
+               }
+          }
+
+          if( invalid )
+          {
+               pos = s + 1;
+               continue;
+          }
+          if( size >= 0 && avail >= size )
+          {
+               *skip = s;
+               *frameSize = size;
+               return Packet::SCAN_FRAME;
+          }
+
+          // 途中までしか届いていない
+          if( lookahead && b.at(s) == Packet::STX )
+          {
+               int window = std::min(limit, s + (int)Packet::MAX_PACKET_SIZE);
+               if( scanSpans(b, s+1, window, false, skip, frameSize) == Packet::SCAN_FRAME )
+               {
+                    return Packet::SCAN_FRAME;
+               }
+          }
+          *skip = s;
+          return Packet::SCAN_INCOMPLETE;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   受信データ (p0[0..n0) に p1[0..n1) が続く) の中から次のフレームを探す
+//   skip      : フレームの前にある捨ててよいバイト数
+//   frameSize : フレームのバイト数 (SCAN_FRAME の場合)
+//   SCAN_INCOMPLETE の場合は，skip バイトを捨てて続きの受信を待つ
+//------------------------------------------------------------------------------
+int Packet::scan(const uint8_t *p0, int n0, const uint8_t *p1, int n1, int *skip, int *frameSize)
+{
+     ByteSpans b;
+     b.p[0] = p0;
+     b.n[0] = n0;
+     b.p[1] = p1;
+     b.n[1] = n1;
+     b.total = n0 + n1;
+     return scanSpans(b, 0, b.total, true, skip, frameSize);
+}
+
+//------------------------------------------------------------------------------
+//   scan() で見つけたフレームの内容を取り込む (p0 の先頭がフレームの先頭)
+//   m_body の領域は再利用するので，十分な容量があればメモリ確保は起きない
+//------------------------------------------------------------------------------
+void Packet::assign(const uint8_t *p0, int n0, const uint8_t *p1, int n1, int frameSize)
+{
+     m_format = (p0[0] == SOH)? FORMAT_EXTENDED : FORMAT_BASIC;
+     int bodySize = frameSize - ((m_format == FORMAT_EXTENDED)? (int)EXT_TRAILER_SIZE : 2);
+     int first = std::min(n0, bodySize);
+     m_body.assign(p0, p0 + first);
+     m_body.insert(m_body.end(), p1, p1 + (bodySize - first));
+     m_dataLength = bodySize - getHeaderSize();
+     m_rawBytePtr = 0;
+}
+
+//------------------------------------------------------------------------------
+//   パケットのデータを読み取るためのメソッド群
+//------------------------------------------------------------------------------
+bool Packet::readData(int offset, void *data, int size)
+{
+     if( (0 <= offset) && (offset + size <= m_dataLength) )
+     {
+          memcpy(data, getData() + offset, size);
+          return true;
+     }
+     return false;
+}
+//------------------------------------------------------------------------------
+bool Packet::readUInt8Data(int offset, uint8_t *data)
+{
+     return readData(offset, data, 1);
+}
+//------------------------------------------------------------------------------
+bool Packet::readInt8Data(int offset, int8_t *data)
+{
+     return readUInt8Data(offset, (uint8_t *)data);
+}
+//------------------------------------------------------------------------------
+bool Packet::readUInt16Data(int offset, uint16_t *data)
+{
+     return readData(offset, data, 2);
+}
+//------------------------------------------------------------------------------
+bool Packet::readInt16Data(int offset, int16_t *data)
+{
+     return readUInt16Data(offset, (uint16_t *)data);
+}
+//------------------------------------------------------------------------------
+bool Packet::readUInt32Data(int offset, uint32_t *data)
+{
+     return readData(offset, data, 4);
+}
+//------------------------------------------------------------------------------
+bool Packet::readInt32Data(int offset, int32_t *data)
+{
+     return readUInt32Data(offset, (uint32_t *)data);
+}
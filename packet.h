@@ -0,0 +1,95 @@
+//------------------------------------------------------------------------------
+//   packet.h
+//
+//   コマンドのパケット
+//   通常形式 (データ長 1 バイト，最大 250 バイト) と，大量のデータを送るための
+//   拡張形式 (データ長 4 バイト，CRC-32) がある
+//   受信側は先頭バイト (STX / SOH) で形式を判別するので，同じポートで混在してよい
+//------------------------------------------------------------------------------
+#ifndef   PACKET_H
+#define   PACKET_H
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------
+class Packet
+{
+     public:
+          enum{ STX = 0x02, ETX = 0x03 };
+          enum{ SOH = 0x01 };                // 拡張形式の先頭
+          enum{ EXT_VERSION = 0x01 };        // 拡張形式のバージョン
+          enum{ FORMAT_BASIC = 0, FORMAT_EXTENDED = 1 };
+          enum{ MAX_PACKET_SIZE = 256 };
+          enum{ MAX_DATA_LENGTH = 250 };     // STX, ETX, ID, SNO, LEN, SUM の６バイトを差し引いた残り
+          enum{ MAX_EXT_DATA_LENGTH = 65536 };
+          enum{ MAX_EXT_PACKET_SIZE = MAX_EXT_DATA_LENGTH + 13 };
+          enum{ SCAN_INCOMPLETE = 0, SCAN_FRAME = 1 };   // scan() の結果
+          enum{
+               OFFSET_STX = 0,
+               OFFSET_ID  = 1,
+               OFFSET_SERIAL = 2,
+               OFFSET_LEN = 3,
+          };
+          //   拡張形式
+          //   SOH, VER, ID, SNO, LEN (4, little endian), データ, CRC (4, VER からデータ末尾まで), ETX
+          enum{
+               OFFSET_EXT_SOH = 0,
+               OFFSET_EXT_VERSION = 1,
+               OFFSET_EXT_ID = 2,
+               OFFSET_EXT_SERIAL = 3,
+               OFFSET_EXT_LEN = 4,
+               EXT_HEADER_SIZE = 8,
+               EXT_TRAILER_SIZE = 5,
+          };
+
+     private:
+          enum{ DEFAULT_ID = 0x00 };
+          enum{ DEFAULT_SERIAL = 0x00 };
+          enum{ DEFAULT_DATALEN = 0x00 };
+          enum{ BASIC_HEADER_SIZE = 4 };
+
+          std::vector<uint8_t> m_body;       // ヘッダとデータ (チェックサム以降は含まない)
+          int      m_format;
+          int      m_dataLength;
+          int      m_rawBytePtr;
+
+          int      getHeaderSize() const { return (m_format == FORMAT_EXTENDED)? (int)EXT_HEADER_SIZE : (int)BASIC_HEADER_SIZE; }
+          uint8_t  getChecksum() const;
+          uint32_t getCRC() const;
+          bool     pushBasic(uint8_t data, bool *done);
+          bool     pushExtended(uint8_t data, bool *done);
+          bool     readData(int offset, void *data, int size);
+
+     public:
+          Packet();
+          Packet *clone();
+          void clear();
+          void create(uint8_t id, uint8_t serialNo, int format = FORMAT_BASIC);
+          void addPacketData(const void *data, int size);
+          bool push(uint8_t data);
+          int  getRawBytes(std::vector<uint8_t>& buffer);
+          const uint8_t *getBody() const { return m_body.data(); }
+          int  getBodySize() const { return (int)m_body.size(); }
+          int  getTrailer(uint8_t trailer[EXT_TRAILER_SIZE]) const;
+
+          static int scan(const uint8_t *p0, int n0, const uint8_t *p1, int n1, int *skip, int *frameSize);
+          void assign(const uint8_t *p0, int n0, const uint8_t *p1, int n1, int frameSize);
+
+          static uint32_t crc32(const uint8_t *data, int size, uint32_t crc = 0);
+
+          int      getFormat() const { return m_format; }
+          int      getMaxDataLength() const { return (m_format == FORMAT_EXTENDED)? (int)MAX_EXT_DATA_LENGTH : (int)MAX_DATA_LENGTH; }
+          uint8_t  getID() const { return m_body[(m_format == FORMAT_EXTENDED)? (int)OFFSET_EXT_ID : (int)OFFSET_ID]; }
+          uint8_t  getSerialNo() const { return m_body[(m_format == FORMAT_EXTENDED)? (int)OFFSET_EXT_SERIAL : (int)OFFSET_SERIAL]; }
+          int      getDataLength() const { return m_dataLength; }
+          const uint8_t *getData() const { return m_body.data() + getHeaderSize(); }
+          bool     readUInt8Data(int offset, uint8_t *data);
+          bool     readInt8Data(int offset, int8_t *data);
+          bool     readUInt16Data(int offset, uint16_t *data);
+          bool     readInt16Data(int offset, int16_t *data);
+          bool     readUInt32Data(int offset, uint32_t *data);
+          bool     readInt32Data(int offset, int32_t *data);
+};
+
+#endif
@@ -0,0 +1,208 @@
+//------------------------------------------------------------------------------
+//   path_profile.cpp
+//------------------------------------------------------------------------------
+#include <cmath>
+#include <algorithm>
+#include "path_profile.h"
+
+//------------------------------------------------------------------------------
+PathProfile::PathProfile()
+{
+}
+
+//------------------------------------------------------------------------------
+//   start から points を順に通る軌道を計画する
+//   ブレンドが隣の点のブレンドと重なる区間は，重ならなくなるまで時間を延ばす
+//   (加速度の制限を守るため，短い区間や急な角では指定より遅くなる)
+//   移動の必要がなければ false
+//------------------------------------------------------------------------------
+bool PathProfile::plan(const int32_t start[3], const std::vector<Waypoint>& points)
+{
+     m_nodes.clear();
+     if( points.empty() )
+     {
+          return false;
+     }
+
+     size_t n = points.size();
+     m_nodes.resize(n + 1);
+     std::vector<double> duration(n);
+     std::vector<const double *> accel(n + 1);
+     bool moved = false;
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_nodes[0].q[axis] = start[axis];
+     }
+     for( size_t k = 0 ; k < n ; k++ )
+     {
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               m_nodes[k + 1].q[axis] = points[k].position[axis];
+               moved = moved || (m_nodes[k + 1].q[axis] != m_nodes[k].q[axis]);
+          }
+          duration[k] = std::max(points[k].duration, 0.001);
+          accel[k + 1] = points[k].accel;
+     }
+     accel[0] = points[0].accel;
+     if( !moved )
+     {
+          m_nodes.clear();
+          return false;
+     }
+
+     for( int iteration = 0 ; ; iteration++ )
+     {
+          // 区間の速度と，点ごとのブレンドの時間 (速度の変化が最も大きい軸で決まる)
+          for( size_t k = 0 ; k <= n ; k++ )
+          {
+               Node& node = m_nodes[k];
+               node.blend = 0;
+               for( int axis = 0 ; axis < 3 ; axis++ )
+               {
+                    node.v[axis] = (k < n)? (m_nodes[k + 1].q[axis] - node.q[axis]) / duration[k] : 0;
+                    double vin = (k > 0)? m_nodes[k - 1].v[axis] : 0;
+                    double a = (accel[k][axis] > 0)? accel[k][axis] : 1;
+                    node.blend = std::max(node.blend, std::abs(node.v[axis] - vin) / a);
+               }
+          }
+          bool fit = true;
+          for( size_t k = 0 ; k < n ; k++ )
+          {
+               double need = (m_nodes[k].blend + m_nodes[k + 1].blend) / 2;
+               if( need > duration[k] * 1.0001 )
+               {
+                    // 時間を延ばすと速度が下がってブレンドも短くなるので，その釣り合う所へ近づける
+                    duration[k] = std::sqrt(duration[k] * need) * 1.02;
+                    fit = false;
+               }
+          }
+          if( fit )
+          {
+               break;
+          }
+          if( iteration >= MAX_ITERATIONS )
+          {
+               // 収束しなければブレンドを区間に収める (その点では加速度が制限を超える)
+               for( size_t k = 0 ; k < n ; k++ )
+               {
+                    double need = (m_nodes[k].blend + m_nodes[k + 1].blend) / 2;
+                    if( need > duration[k] )
+                    {
+                         m_nodes[k].blend *= duration[k] / need;
+                         m_nodes[k + 1].blend *= duration[k] / need;
+                    }
+               }
+               break;
+          }
+     }
+
+     m_nodes[0].time = m_nodes[0].blend / 2;
+     for( size_t k = 0 ; k < n ; k++ )
+     {
+          m_nodes[k + 1].time = m_nodes[k].time + duration[k];
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+double PathProfile::getDuration() const
+{
+     if( isEmpty() )
+     {
+          return 0;
+     }
+     const Node& last = m_nodes.back();
+     return last.time + last.blend / 2;
+}
+
+//------------------------------------------------------------------------------
+int32_t PathProfile::getTarget(int axis) const
+{
+     return isEmpty()? 0 : (int32_t)m_nodes.back().q[axis];
+}
+
+//------------------------------------------------------------------------------
+//   区間の速度の最大値(絶対値, pulse/sec)
+//------------------------------------------------------------------------------
+double PathProfile::getPeakSpeed(int axis) const
+{
+     double peak = 0;
+     for( size_t k = 0 ; k < m_nodes.size() ; k++ )
+     {
+          peak = std::max(peak, std::abs(m_nodes[k].v[axis]));
+     }
+     return peak;
+}
+
+//------------------------------------------------------------------------------
+//   ブレンドの加速度の最大値(絶対値, pulse/sec^2)
+//------------------------------------------------------------------------------
+double PathProfile::getPeakAccel(int axis) const
+{
+     double peak = 0;
+     for( size_t k = 0 ; k < m_nodes.size() ; k++ )
+     {
+          if( m_nodes[k].blend > 0 )
+          {
+               double vin = (k > 0)? m_nodes[k - 1].v[axis] : 0;
+               peak = std::max(peak, std::abs(m_nodes[k].v[axis] - vin) / m_nodes[k].blend);
+          }
+     }
+     return peak;
+}
+
+//------------------------------------------------------------------------------
+//   開始から t 秒後の位置
+//------------------------------------------------------------------------------
+int32_t PathProfile::getPosition(int axis, double t) const
+{
+     double q[3], v[3];
+     evaluate(t, q, v);
+     return (int32_t)std::lround(q[axis]);
+}
+
+//------------------------------------------------------------------------------
+//   開始から t 秒後の位置(pulse)と速度(pulse/sec，符号が方向)
+//------------------------------------------------------------------------------
+void PathProfile::evaluate(double t, double q[3], double v[3]) const
+{
+     if( isEmpty() )
+     {
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               q[axis] = v[axis] = 0;
+          }
+          return;
+     }
+
+     // t がブレンドの終わりより前にある最初の点
+     size_t k = 0;
+     while( k < m_nodes.size() && t >= m_nodes[k].time + m_nodes[k].blend / 2 )
+     {
+          k++;
+     }
+     if( k == m_nodes.size() )
+     {
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               q[axis] = m_nodes.back().q[axis];
+               v[axis] = 0;
+          }
+          return;
+     }
+
+     const Node& node = m_nodes[k];
+     double s = t - (node.time - node.blend / 2);      // ブレンドの開始からの時間
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          double vin = (k > 0)? m_nodes[k - 1].v[axis] : 0;
+          q[axis] = node.q[axis] + vin * (t - node.time);
+          v[axis] = vin;
+          if( s > 0 && node.blend > 0 )
+          {
+               double a = (node.v[axis] - vin) / node.blend;
+               q[axis] += a * s * s / 2;
+               v[axis] += a * s;
+          }
+     }
+}
@@ -0,0 +1,56 @@
+//------------------------------------------------------------------------------
+//   path_profile.h
+//
+//   複数の点を止まらずに通過する３軸の軌道 (放物線ブレンド付きの折れ線)
+//   各区間は等速の直線，点の前後は加速度一定の放物線でつなぎ，角を丸める
+//   (点そのものは通らない。最後の点にだけは止まる)
+//------------------------------------------------------------------------------
+#ifndef   PATH_PROFILE_H
+#define   PATH_PROFILE_H
+
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------
+class PathProfile
+{
+     public:
+          struct Waypoint
+          {
+               int32_t position[3];     // 各軸の位置(pulse)
+               double  duration;        // 前の点からの等速移動の時間(sec)
+               double  accel[3];        // この点でのブレンドに使う各軸の加速度(pulse/sec^2)
+          };
+
+     private:
+          enum{ MAX_ITERATIONS = 50 };
+
+          //   点 k : 直線 k-1 と直線 k (速度 v) が m_time[k] に交わる。
+          //   その前後 m_blend[k] 秒を放物線でつなぐ (始点・終点の外側は速度 0 の直線)
+          struct Node
+          {
+               double q[3];
+               double v[3];             // 点 k から点 k+1 への速度(pulse/sec)
+               double time;
+               double blend;
+          };
+          std::vector<Node> m_nodes;
+
+          void evaluate(double t, double q[3], double v[3]) const;
+
+     public:
+          PathProfile();
+          bool plan(const int32_t start[3], const std::vector<Waypoint>& points);
+          void clear(){ m_nodes.clear(); }
+
+          bool    isEmpty() const { return m_nodes.size() < 2; }
+          double  getDuration() const;
+          int32_t getTarget(int axis) const;
+          double  getPeakSpeed(int axis) const;
+          double  getPeakAccel(int axis) const;
+          int32_t getPosition(int axis, double t) const;
+          void    getPosition(double t, double q[3]) const { double v[3]; evaluate(t, q, v); }
+          void    getSpeed(double t, double v[3]) const { double q[3]; evaluate(t, q, v); }
+};
+
+#endif
@@ -0,0 +1,96 @@
+//------------------------------------------------------------------------------
+//   ring_buffer.cpp
+//------------------------------------------------------------------------------
+#include <string.h>
+#include <algorithm>
+#include "ring_buffer.h"
+
+
+//------------------------------------------------------------------------------
+//   コンストラクタ
+//   capacity は 2 のべき乗に切り上げる
+//------------------------------------------------------------------------------
+RingBuffer::RingBuffer(uint32_t capacity) : m_head(0), m_tail(0)
+{
+     m_capacity = 1;
+     while( m_capacity < capacity )
+     {
+          m_capacity <<= 1;
+     }
+     m_mask = m_capacity - 1;
+     m_buffer = new uint8_t[m_capacity];
+}
+
+//------------------------------------------------------------------------------
+RingBuffer::~RingBuffer()
+{
+     delete[] m_buffer;
+}
+
+//------------------------------------------------------------------------------
+//   読み出せるデータ (先頭から offset バイト以降) の連続領域を返す
+//   戻り値は領域の数 (0 ～ 2)
+//------------------------------------------------------------------------------
+int RingBuffer::getReadableSpans(struct iovec span[2], uint32_t offset) const
+{
+     uint32_t n = size();
+     if( offset >= n )
+     {
+          return 0;
+     }
+     n -= offset;
+     uint32_t top = (m_head + offset) & m_mask;
+     uint32_t first = std::min(n, m_capacity - top);
+     span[0].iov_base = m_buffer + top;
+     span[0].iov_len = first;
+     if( first == n )
+     {
+          return 1;
+     }
+     span[1].iov_base = m_buffer;
+     span[1].iov_len = n - first;
+     return 2;
+}
+
+//------------------------------------------------------------------------------
+//   書き込める空き領域の連続領域を返す (書き込んだら commit() する)
+//------------------------------------------------------------------------------
+int RingBuffer::getWritableSpans(struct iovec span[2]) const
+{
+     uint32_t n = space();
+     if( n == 0 )
+     {
+          return 0;
+     }
+     uint32_t top = m_tail & m_mask;
+     uint32_t first = std::min(n, m_capacity - top);
+     span[0].iov_base = m_buffer + top;
+     span[0].iov_len = first;
+     if( first == n )
+     {
+          return 1;
+     }
+     span[1].iov_base = m_buffer;
+     span[1].iov_len = n - first;
+     return 2;
+}
+
+//------------------------------------------------------------------------------
+//   data を末尾へコピーする
+//   戻り値は書き込めたバイト数 (空きが足りなければ n より少ない)
+//------------------------------------------------------------------------------
+uint32_t RingBuffer::write(const void *data, uint32_t n)
+{
+     struct iovec span[2];
+     int count = getWritableSpans(span);
+     const uint8_t *p = (const uint8_t *)data;
+     uint32_t written = 0;
+     for( int k = 0 ; k < count && written < n ; k++ )
+     {
+          uint32_t len = std::min((uint32_t)span[k].iov_len, n - written);
+          memcpy(span[k].iov_base, p + written, len);
+          written += len;
+     }
+     commit(written);
+     return written;
+}
@@ -0,0 +1,46 @@
+//------------------------------------------------------------------------------
+//   ring_buffer.h
+//
+//   固定容量のリングバッファ (セッションの送受信バッファ)
+//   容量は 2 のべき乗。読み書きは連続領域 (最大２つ) 単位で行うので，
+//   readv() / writev() で直接読み書きでき，途中のコピーが要らない
+//------------------------------------------------------------------------------
+#ifndef   RING_BUFFER_H
+#define   RING_BUFFER_H
+
+#include <cstdint>
+#include <sys/uio.h>
+
+//------------------------------------------------------------------------------
+class RingBuffer
+{
+     private:
+          uint8_t  *m_buffer;
+          uint32_t  m_capacity;
+          uint32_t  m_mask;
+          uint32_t  m_head;        // 読み出し位置 (累積バイト数，m_mask で添字にする)
+          uint32_t  m_tail;        // 書き込み位置
+
+          RingBuffer(const RingBuffer&);
+          RingBuffer& operator=(const RingBuffer&);
+
+     public:
+          RingBuffer(uint32_t capacity);
+          ~RingBuffer();
+
+          uint32_t getCapacity() const { return m_capacity; }
+          uint32_t size() const { return m_tail - m_head; }
+          uint32_t space() const { return m_capacity - size(); }
+          bool     empty() const { return m_head == m_tail; }
+          void     clear(){ m_head = m_tail = 0; }
+
+          int  getReadableSpans(struct iovec span[2], uint32_t offset = 0) const;
+          int  getWritableSpans(struct iovec span[2]) const;
+          void commit(uint32_t n){ m_tail += n; }
+          void consume(uint32_t n){ m_head += n; }
+
+          uint32_t write(const void *data, uint32_t n);
+          uint8_t  at(uint32_t offset) const { return m_buffer[(m_head + offset) & m_mask]; }
+};
+
+#endif
@@ -1,16 +1,21 @@
 #include <cstdio>
 #include <chrono>
 #include <cmath>
+#include <algorithm>
 #include <functional>
 #include <wiringPi.h>
 #include "robot.h"
 
+const char *Robot::STALL_LOG_PATH = "./stall.log";
+KinematicModel Robot::s_kinematics;
+
 //------------------------------------------------------------------------------
 //   コンストラクタ
 //------------------------------------------------------------------------------
 Robot::Robot()
-     : m_terminated(false), m_homingState(0),
-     m_homingThread(nullptr), m_motionThread(nullptr), m_servoThread(nullptr)
+     : m_homingState(0), m_terminated(false), m_stallTolerance(2000),
+     m_homingThread(nullptr), m_motionThread(nullptr), m_servoThread(nullptr),
+     m_feedOverride(100), m_telemetry(nullptr)
 {
      m_stepper[MOTOR_BASE] = nullptr;
      m_stepper[MOTOR_SHOULDER] = nullptr;
@@ -20,6 +25,24 @@ Robot::Robot()
      m_motionState[MOTOR_SHOULDER] = 0;
      m_motionState[MOTOR_ELBOW] = 0;
 
+     m_planned[MOTOR_BASE] = false;
+     m_planned[MOTOR_SHOULDER] = false;
+     m_planned[MOTOR_ELBOW] = false;
+
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_overridden[axis] = false;
+          m_moveSpeed[axis] = 0;
+          m_jogging[axis] = false;
+          m_jogSpeed[axis] = 0;
+     }
+     m_nextListenerID = 0;
+     m_dispatching = false;
+     m_pathActive = false;
+     m_pathCancel = false;
+     m_pathFeedOverride = 100;
+     m_pathThread = nullptr;
+
      // if( wiringPiSetupGpio() < 0 )
      // {
      //      cerr << "Failed to setup GPIO I/F." << endl;
@@ -50,6 +73,12 @@ Robot::~Robot()
           m_servoThread->join();
           delete m_servoThread;
      }
+     if( m_pathThread )
+     {
+          m_pathThread->join();
+          delete m_pathThread;
+     }
+     stopTelemetry();
      delete m_stepper[MOTOR_BASE];
      delete m_stepper[MOTOR_SHOULDER];
      delete m_stepper[MOTOR_ELBOW];
@@ -76,6 +105,14 @@ void Robot::initialize()
      m_stepper[MOTOR_ELBOW   ] = new L6470(ELBOW_CS, ELBOW_BUSY, 
           std::function<uint8_t(int)>([this](int dir){ return getLimitState(MOTOR_ELBOW, dir); }));
 
+     // 速度・加速度の指定がない移動では，初期化時のレジスタ値を使う
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_defaultMaxSpeed[axis] = m_stepper[axis]->getWrittenParam(L6470::PRM_MAX_SPEED);
+          m_defaultAcc[axis] = m_stepper[axis]->getWrittenParam(L6470::PRM_ACC);
+          m_defaultDec[axis] = m_stepper[axis]->getWrittenParam(L6470::PRM_DEC);
+     }
+
      pinMode(SERVO_PIN, PWM_OUTPUT);
      pwmSetMode(PWM_MODE_MS);
      pwmSetClock(400);
@@ -211,6 +248,7 @@ uint8_t Robot::getAlarmFlag(int axis)
 void Robot::enableMotor(int axis, bool ena)
 {
      m_mutex.lock();
+     m_planned[axis] = false;
      if( ena )
      {
           m_stepper[axis]->hardStop();
@@ -239,11 +277,14 @@ void Robot::clearAlarm(int axis)
 //------------------------------------------------------------------------------
 void Robot::softStop(int axis)
 {
+     clearMotionQueue();
      m_mutex.lock();
+     m_pathCancel = true;
      for( int n = 0 ; n < 3 ; n++ )
      {
           if( n == axis || axis < 0 )
           {
+               m_planned[n] = false;
                m_stepper[n]->softStop();
           }
      }
@@ -253,11 +294,14 @@ void Robot::softStop(int axis)
 //------------------------------------------------------------------------------
 void Robot::hardStop(int axis)
 {
+     clearMotionQueue();
      m_mutex.lock();
+     m_pathCancel = true;
      for( int n = 0 ; n < 3 ; n++ )
      {
           if( n == axis || axis < 0 )
           {
+               m_planned[n] = false;
                m_stepper[n]->hardStop();
           }
      }
@@ -293,6 +337,7 @@ void Robot::execHoming()
      while( !m_terminated )
      {
           m_mutex.lock();
+          int lastState = m_homingState;
 
           switch( m_homingState )
           {
@@ -362,7 +407,12 @@ void Robot::execHoming()
                     m_homingState = 0;
                     break;
           }
+          bool ended = (lastState > 0 && m_homingState == 0);
           m_mutex.unlock();
+          if( ended )
+          {
+               notifyMotionEnd();
+          }
           std::this_thread::sleep_for(std::chrono::milliseconds(100));
      }
 
@@ -383,6 +433,7 @@ void Robot::execMotion()
                std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
                m_mutex.lock();
+               bool ended = false;
                
                m_stepper[axis]->execControl();
 
@@ -391,22 +442,57 @@ void Robot::execMotion()
                     case 0:
                          break;
                     case 1:
-                         if( m_stepper[axis]->isInMotion() )
+                         // 連続軌道の追従中は，速度の向きが変わるときに一瞬止まっても終了としない
+                         if( m_stepper[axis]->isInMotion() || m_pathActive )
                          {
+                              // 移動中のストール検出
+                              // (チップの STEP_LOSS フラグ，または速度プロファイルからの位置偏差)
+                              int32_t expected = m_stepper[axis]->getAbsPos();
+                              uint8_t stall = m_stepper[axis]->getAlarmFlag() & L6470::ALM_STALL_MASK;
+                              if( stall == 0 && !checkMotionProfile(axis, &expected) )
+                              {
+                                   stall = L6470::ALM_POSITION;
+                              }
+                              if( stall != 0 )
+                              {
+                                   stopOnStall(axis, stall, expected);
+                              }
                               break;
                          }
+                         if( m_planned[axis] && !m_stepper[axis]->isAlarmHappened() )
+                         {
+                              // 停止位置が目標位置と一致しない(リミット等で途中停止した)
+                              if( m_stepper[axis]->getAbsPos() != m_plan[axis].getTarget() )
+                              {
+                                   stopOnStall(axis, L6470::ALM_POSITION, m_plan[axis].getTarget());
+                              }
+                         }
+                         m_planned[axis] = false;
+                         m_jogging[axis] = false;
+                         m_jogSpeed[axis] = 0;
                          if( m_stepper[axis]->isAlarmHappened() )
                          {
                               std::printf("[AXIS-%d] Alarm : 0x%02X\n", axis, m_stepper[axis]->getAlarmFlag());
-                              m_stepper[MOTOR_BASE]->hardHIZ();
-                              m_stepper[MOTOR_SHOULDER]->hardHIZ();
-                              m_stepper[MOTOR_ELBOW]->hardHIZ();
+                              if( (m_stepper[axis]->getAlarmFlag() & ~L6470::ALM_STALL_MASK) != 0 )
+                              {
+                                   m_stepper[MOTOR_BASE]->hardHIZ();
+                                   m_stepper[MOTOR_SHOULDER]->hardHIZ();
+                                   m_stepper[MOTOR_ELBOW]->hardHIZ();
+                              }
+                              // ストールのみの場合は，アームが落下しないよう励磁を保持したまま停止する
                          }
                          m_motionState[axis] = 0;
+                         ended = true;
                          break;
                }
                m_mutex.unlock();
+               if( ended )
+               {
+                    notifyMotionEnd();
+               }
+               dispatchQueue();
           }
+          recordTelemetry();
      }
 
      std::printf("[Robot] motion thread terminated.\n");
@@ -443,74 +529,740 @@ bool Robot::startMotion(int axis, int32_t destpos)
      }
 
      m_mutex.lock();
+     double ov = m_feedOverride / 100.0;
+     m_stepper[axis]->setParam(L6470::PRM_ACC, MotionProfile::pps2ToAcc(MotionProfile::accToPps2(m_defaultAcc[axis]) * ov));
+     m_stepper[axis]->setParam(L6470::PRM_DEC, MotionProfile::pps2ToAcc(MotionProfile::accToPps2(m_defaultDec[axis]) * ov));
+     m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, MotionProfile::syncMaxSpeed(m_defaultMaxSpeed[axis] * ov, 1, 1));
+     m_moveSpeed[axis] = MotionProfile::maxSpeedToPps(m_defaultMaxSpeed[axis]);
      uint8_t dir = (m_stepper[axis]->getAbsPos() > destpos)? L6470::DIR_REVERSE : L6470::DIR_FORWARD; 
      m_stepper[axis]->moveTo(dir, destpos);
      m_motionState[axis] = 1;
+     planMotion(axis, destpos);
      m_mutex.unlock();
 
      return true;
 }
 
 //------------------------------------------------------------------------------
-bool Robot::startMotion3D(int32_t base, int32_t shoulder, int32_t elbow)
+//   ジョグ (速度指令)
+//   speed : 各軸の速度 (pulse/sec，符号が方向)，0 の軸は減速停止する
+//   RUN コマンドをその場で送るので，モーション監視スレッドの周期を待たない
+//   速度は単軸移動の MAX_SPEED (オーバーライド適用後) で頭打ちになる
+//   前回と同じ速度の軸には何も送らない
+//   原点復帰中，位置指令で移動中，アラーム発生中，励磁が切れている軸があれば何もせず false
+//------------------------------------------------------------------------------
+bool Robot::jog(const int32_t speed[3])
+{
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          if( speed[axis] == 0 )
+          {
+               continue;
+          }
+          if( m_homingState > 0 || (m_motionState[axis] > 0 && !m_jogging[axis]) ||
+               m_stepper[axis]->isHalted() || m_stepper[axis]->isAlarmHappened() )
+          {
+               m_mutex.unlock();
+               return false;
+          }
+     }
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          if( speed[axis] == m_jogSpeed[axis] )
+          {
+               continue;
+          }
+          if( speed[axis] == 0 )
+          {
+               // 監視スレッドが停止を確認するまで m_jogging は立てたままにする
+               m_stepper[axis]->softStop();
+               m_jogSpeed[axis] = 0;
+               continue;
+          }
+          if( !m_jogging[axis] )
+          {
+               double ov = m_feedOverride / 100.0;
+               m_stepper[axis]->setParam(L6470::PRM_ACC, MotionProfile::pps2ToAcc(MotionProfile::accToPps2(m_defaultAcc[axis]) * ov));
+               m_stepper[axis]->setParam(L6470::PRM_DEC, MotionProfile::pps2ToAcc(MotionProfile::accToPps2(m_defaultDec[axis]) * ov));
+               m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, MotionProfile::syncMaxSpeed(m_defaultMaxSpeed[axis] * ov, 1, 1));
+               m_moveSpeed[axis] = MotionProfile::maxSpeedToPps(m_defaultMaxSpeed[axis]);
+               m_planned[axis] = false;
+               m_jogging[axis] = true;
+               m_motionState[axis] = 1;
+          }
+          uint8_t dir = (speed[axis] < 0)? L6470::DIR_REVERSE : L6470::DIR_FORWARD;
+          m_stepper[axis]->run(dir, MotionProfile::ppsToSpeed(std::abs((double)speed[axis])));
+          m_jogSpeed[axis] = speed[axis];
+     }
+     m_mutex.unlock();
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   ジョグで動いている軸を減速停止する
+//------------------------------------------------------------------------------
+void Robot::stopJog()
+{
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          if( m_jogging[axis] && m_jogSpeed[axis] != 0 )
+          {
+               m_stepper[axis]->softStop();
+               m_jogSpeed[axis] = 0;
+          }
+     }
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+//   ３軸を同時に動かす (全軸が同時に到着するよう，各軸の速度は移動量に比例させる)
+//   speed, accel : 移動量の最も大きい軸(関節・直線)の速度と加速度 (単位は unit)
+//                  0 の場合は既定値 (MAX_SPEED_3D と初期化時の ACC / DEC)
+//   いずれも送り速度オーバーライドが掛かる
+//------------------------------------------------------------------------------
+bool Robot::startMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed, double accel, int unit)
 {
      if( !canMove() )
      {
           return false;
      }
 
-     int32_t destpos[3];
-     uint32_t distance[3];
-     uint32_t longest = 0;
-     bool b[3] = {true, true, true};
-     uint8_t dir[3];
+     int32_t abspos[3];
+     int32_t destpos[3] = { base, shoulder, elbow };
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          abspos[axis] = getMotorPosition(axis);
+     }
+
+     m_mutex.lock();
+     MotionRegister reg[3];
+     if( computeMotion3D(abspos, destpos, speed, accel, unit, m_feedOverride, m_defaultAcc, m_defaultDec, reg) == 0 )
+     {
+          m_mutex.unlock();
+          return true;   // どの軸も動かす必要がない
+     }
+     // 各軸の速度を設定し，駆動開始
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          if( abspos[axis] == destpos[axis] )
+          {
+               continue;      // この軸は動かす必要はない
+          }
+          uint8_t dir = (destpos[axis] > abspos[axis])? L6470::DIR_FORWARD : L6470::DIR_REVERSE;
+          m_stepper[axis]->setParam(L6470::PRM_ACC, reg[axis].acc);
+          m_stepper[axis]->setParam(L6470::PRM_DEC, reg[axis].dec);
+          m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, reg[axis].maxSpeed);
+          m_moveSpeed[axis] = reg[axis].speed;
+          m_stepper[axis]->moveTo(dir, destpos[axis]);
+          m_motionState[axis] = 1;
+          planMotion(axis, destpos[axis]);
+     }
+     m_mutex.unlock();
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   軸の移動・原点復帰・グリッパーの動作が終わるたびに呼ばれる関数を登録する
+//   (モーション監視スレッド・原点復帰スレッド・サーボ制御スレッドから，m_mutex を保持せずに呼ばれる)
+//   戻り値は removeMotionListener() に渡す識別子
+//------------------------------------------------------------------------------
+int Robot::addMotionListener(std::function<void()> listener)
+{
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     int id = m_nextListenerID++;
+     m_motionListeners[id] = listener;
+     return id;
+}
+
+//------------------------------------------------------------------------------
+//   登録を解除する
+//   呼び出し中の関数があれば，その終了を待ってから戻る
+//------------------------------------------------------------------------------
+void Robot::removeMotionListener(int id)
+{
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     m_motionListeners.erase(id);
+}
 
-     destpos[0] = base;
-     destpos[1] = shoulder;
-     destpos[2] = elbow;
+//------------------------------------------------------------------------------
+//   登録された関数を呼ぶ (関数の中から add / removeMotionListener() は呼べない)
+//------------------------------------------------------------------------------
+void Robot::notifyMotionEnd()
+{
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     for( std::map<int, std::function<void()> >::iterator i = m_motionListeners.begin() ; i != m_motionListeners.end() ; ++i )
+     {
+          i->second();
+     }
+}
 
+//------------------------------------------------------------------------------
+//   モーションキューの末尾に移動先を追加する
+//   前の移動が完了するたびに，モーション監視スレッドが次の点へ startMotion3D() する
+//   原点復帰が済んでいない，またはキューが溢れる場合は何も追加せずに false
+//------------------------------------------------------------------------------
+bool Robot::queueMotion(const std::vector<MotionTarget>& targets)
+{
+     return queueMotion(targets.data(), (int)targets.size());
+}
+
+//------------------------------------------------------------------------------
+//   (スクリプトの関数からは，luaL_error() で抜けても解放漏れのないようにこちらを使う)
+//------------------------------------------------------------------------------
+bool Robot::queueMotion(const MotionTarget *targets, int count)
+{
+     if( !isHomeCompleted() )
+     {
+          return false;
+     }
+     m_queueMutex.lock();
+     bool ok = (m_motionQueue.size() + count <= MAX_QUEUE_LENGTH);
+     if( ok )
+     {
+          m_motionQueue.insert(m_motionQueue.end(), targets, targets + count);
+     }
+     m_queueMutex.unlock();
+     return ok;
+}
+
+//------------------------------------------------------------------------------
+void Robot::clearMotionQueue()
+{
+     m_queueMutex.lock();
+     m_motionQueue.clear();
+     m_queueMutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+int Robot::getQueueLength()
+{
+     m_queueMutex.lock();
+     int n = (int)m_motionQueue.size();
+     m_queueMutex.unlock();
+     return n;
+}
+
+//------------------------------------------------------------------------------
+//   終わっていない移動の数 (キューの点数と，移動中であれば 1)
+//   開始の途中の点を二重に数えることはあっても，数え落とすことはない
+//------------------------------------------------------------------------------
+int Robot::getPendingMotions()
+{
+     m_queueMutex.lock();
+     int n = (int)m_motionQueue.size() + (m_dispatching? 1 : 0);
+     m_queueMutex.unlock();
+     return n + (isInMotion()? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+//   移動が完了していれば，キューの次の点へ移動を開始する
+//   アラーム発生中などで移動できなければ，キューを空にする
+//   (m_queueMutex を保持したまま m_mutex を取らないよう，先に状態を調べておく)
+//------------------------------------------------------------------------------
+void Robot::dispatchQueue()
+{
+     bool busy = isInMotion();
+     bool fault = isAlarmHappened() || !isHomeCompleted();
+
+     m_queueMutex.lock();
+     if( m_motionQueue.empty() || (busy && !fault) )
+     {
+          m_queueMutex.unlock();
+          return;
+     }
+     if( fault )
+     {
+          std::printf("[Robot] motion queue cleared (%d point(s) left).\n", (int)m_motionQueue.size());
+          m_motionQueue.clear();
+          m_queueMutex.unlock();
+          return;
+     }
+     MotionTarget t = m_motionQueue.front();
+     m_motionQueue.pop_front();
+     m_dispatching = true;
+     m_queueMutex.unlock();
+
+     bool ok = startMotion3D(t.position[0], t.position[1], t.position[2], t.speed, t.accel, t.unit);
+     m_queueMutex.lock();
+     m_dispatching = false;
+     if( !ok )
+     {
+          m_motionQueue.clear();
+     }
+     m_queueMutex.unlock();
+     if( !ok || !isInMotion() )
+     {
+          notifyMotionEnd();       // 動かずに終わった (移動量 0，または開始できなかった)
+     }
+}
+
+//------------------------------------------------------------------------------
+//   連続軌道を開始する (移動先・速度・加速度の意味は startMotion3D() と同じ)
+//   各点で止まらず，角は加速度の範囲で丸めて通過し，最後の点で止まる
+//   専用のスレッドが軌道の位置と速度に合わせて各軸を RUN コマンドで動かし，
+//   最後に GOTO で最後の点に合わせる
+//   送り速度オーバーライドは開始時の値で計画し，途中で下げると遅くなる (上げても速くはならない)
+//------------------------------------------------------------------------------
+bool Robot::startPath(const std::vector<MotionTarget>& path)
+{
+     if( !canMove() || path.empty() )
+     {
+          return false;
+     }
+     if( m_pathThread )
+     {
+          m_pathThread->join();         // 前の軌道は終わっている (canMove() が true)
+          delete m_pathThread;
+          m_pathThread = nullptr;
+     }
+
+     int32_t abspos[3];
      for( int axis = 0 ; axis < 3 ; axis++ )
      {
-          int32_t abspos = getMotorPosition(axis);
-          if( abspos == destpos[axis] )
+          abspos[axis] = getMotorPosition(axis);
+     }
+
+     m_mutex.lock();
+     if( !planPath(abspos, path, m_feedOverride, m_defaultAcc, m_defaultDec, &m_path) )
+     {
+          m_mutex.unlock();
+          return true;   // どの軸も動かす必要がない
+     }
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          double peak = m_path.getPeakSpeed(axis);
+          if( peak <= 0 && m_path.getTarget(axis) == abspos[axis] )
           {
-               b[axis] = false;    // この軸は動かす必要はない
-               continue;
+               continue;      // この軸は動かす必要はない
           }
-          if( destpos[axis] > abspos )
+          // 位置偏差を詰める分の余裕を持たせる (RUN の速度は MAX_SPEED で頭打ちになる)
+          double acc = std::max(m_path.getPeakAccel(axis) * 1.5, MotionProfile::accToPps2(m_defaultAcc[axis]));
+          m_stepper[axis]->setParam(L6470::PRM_ACC, MotionProfile::pps2ToAcc(acc));
+          m_stepper[axis]->setParam(L6470::PRM_DEC, MotionProfile::pps2ToAcc(acc));
+          m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, MotionProfile::ppsToMaxSpeed(peak * 1.5 + MotionProfile::maxSpeedToPps(1)));
+          m_moveSpeed[axis] = 0;        // setFeedOverride() で MAX_SPEED を書き換えない
+          m_planned[axis] = false;
+          m_jogging[axis] = false;
+          m_motionState[axis] = 1;
+     }
+     m_pathActive = true;
+     m_pathCancel = false;
+     m_pathFeedOverride = m_feedOverride;
+     m_mutex.unlock();
+
+     m_pathThread = new std::thread([this](){ execPath(); });
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   連続軌道の追従スレッド
+//   PATH_TICK_MS ごとに ABS_POS を読み，軌道の速度 + 位置偏差 x PATH_GAIN で RUN する
+//   停止要求・アラーム・リミットで中断する
+//------------------------------------------------------------------------------
+void Robot::execPath()
+{
+     typedef std::chrono::steady_clock Clock;
+     bool moving[3];
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          moving[axis] = (m_motionState[axis] > 0);
+     }
+     m_mutex.unlock();
+
+     double duration = m_path.getDuration();
+     double t = 0;
+     bool completed = false;
+     Clock::time_point prev = Clock::now();
+     Clock::time_point next = prev;
+     while( true )
+     {
+          next += std::chrono::milliseconds(PATH_TICK_MS);
+          std::this_thread::sleep_until(next);
+          Clock::time_point now = Clock::now();
+
+          std::lock_guard<std::mutex> lock(m_mutex);
+          bool abort = m_terminated || m_pathCancel;
+          for( int axis = 0 ; axis < 3 ; axis++ )
           {
-               dir[axis] = L6470::DIR_FORWARD;
+               abort = abort || m_stepper[axis]->isAlarmHappened();
           }
-          else
+          if( abort )
           {
-               dir[axis] = L6470::DIR_REVERSE;
+               break;
+          }
+
+          // 送り速度オーバーライドは時間の進み方で掛ける
+          double rate = std::min(1.0, (double)m_feedOverride / m_pathFeedOverride);
+          t += std::chrono::duration<double>(now - prev).count() * rate;
+          prev = now;
+          if( t >= duration )
+          {
+               completed = true;
+               break;
+          }
+
+          double q[3], v[3];
+          m_path.getPosition(t, q);
+          m_path.getSpeed(t, v);
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               if( !moving[axis] )
+               {
+                    continue;
+               }
+               double speed = v[axis] * rate + PATH_GAIN * (q[axis] - m_stepper[axis]->updateAbsPos());
+               uint8_t dir = (speed < 0)? L6470::DIR_REVERSE : L6470::DIR_FORWARD;
+               if( m_stepper[axis]->getLimitFlag(dir) == 0 )
+               {
+                    abort = true;
+                    break;
+               }
+               m_stepper[axis]->run(dir, MotionProfile::ppsToSpeed(std::abs(speed)));
+          }
+          if( abort )
+          {
+               std::printf("[Robot] path stopped at the end limit.\n");
+               break;
+          }
+     }
+
+     // 減速停止して，止まったら最後の点へ GOTO で合わせる
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          if( moving[axis] )
+          {
+               m_stepper[axis]->softStop();
+          }
+     }
+     m_mutex.unlock();
+     for( int ms = 0 ; ms < PATH_SETTLE_MS && !m_terminated ; ms += 10 )
+     {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          std::lock_guard<std::mutex> lock(m_mutex);
+          bool stopped = true;
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               stopped = stopped && !(moving[axis] && m_stepper[axis]->isInMotion());
+          }
+          if( stopped )
+          {
+               break;
+          }
+     }
+
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 && completed && !m_pathCancel ; axis++ )
+     {
+          int32_t target = m_path.getTarget(axis);
+          int32_t pos = m_stepper[axis]->updateAbsPos();
+          if( !moving[axis] || pos == target || m_stepper[axis]->isAlarmHappened() )
+          {
+               continue;
           }
-          distance[axis] = std::abs(destpos[axis] - abspos);
-          if( distance[axis] > longest )
+          m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, m_defaultMaxSpeed[axis]);
+          m_stepper[axis]->moveTo((target > pos)? L6470::DIR_FORWARD : L6470::DIR_REVERSE, target);
+          planMotion(axis, target);
+     }
+     m_pathActive = false;
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+//   from から to への移動で，unit での移動量から最も移動量の大きい軸の pulse への換算係数
+//   (姿勢だけが変わる移動など，換算できない場合は 0)
+//------------------------------------------------------------------------------
+double Robot::getUnitScale(const int32_t from[3], const int32_t to[3], int unit)
+{
+     uint32_t distance[3];
+     uint32_t longest = 0;
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          distance[axis] = std::abs(to[axis] - from[axis]);
+          longest = std::max(longest, distance[axis]);
+     }
+     if( longest == 0 )
+     {
+          return 0;
+     }
+
+     double scale = 1;
+     if( unit == UNIT_DEG )
+     {
+          double deg = 0;
+          for( int axis = 0 ; axis < 3 ; axis++ )
           {
-               longest = distance[axis];
+               double pulsePerRad = (axis == MOTOR_BASE)? KinematicModel::BASE_PULSE_PER_RAD : KinematicModel::ARM_PULSE_PER_RAD;
+               deg = std::max(deg, distance[axis] / pulsePerRad * 180 / M_PI);
           }
+          scale = longest / deg;
+     }
+     else if( unit == UNIT_MM )
+     {
+          double x0, y0, z0, x1, y1, z1;
+          motorPosToCoord(from[0], from[1], from[2], &x0, &y0, &z0);
+          motorPosToCoord(to[0], to[1], to[2], &x1, &y1, &z1);
+          double mm = std::sqrt((x1-x0)*(x1-x0) + (y1-y0)*(y1-y0) + (z1-z0)*(z1-z0));
+          scale = (mm > 0.01)? longest / mm : 0;     // 姿勢だけが変わる移動は既定の速度とする
+     }
+     return scale;
+}
+
+//------------------------------------------------------------------------------
+//   ３軸同時移動の各軸のレジスタ値を求める (VirtualRobot と共通)
+//   from, to     : 移動元・移動先(pulse)
+//   speed, accel : 移動量の最も大きい軸の速度と加速度 (単位は unit，0 は既定値)
+//   acc, dec     : 加速度の指定がない場合の ACC / DEC
+//   戻り値は最も大きい軸の移動量(pulse)。0 の場合は移動の必要がない
+//------------------------------------------------------------------------------
+uint32_t Robot::computeMotion3D(const int32_t from[3], const int32_t to[3], double speed, double accel, int unit,
+     int feedOverride, const uint32_t acc[3], const uint32_t dec[3], MotionRegister reg[3])
+{
+     uint32_t distance[3];
+     uint32_t longest = 0;
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          distance[axis] = std::abs(to[axis] - from[axis]);
+          longest = std::max(longest, distance[axis]);
      }
      if( longest == 0 )
      {
-          return true;   // どの軸も動かす必要がない
+          return 0;
+     }
+
+     double scale = getUnitScale(from, to, unit);
+
+     double ov = feedOverride / 100.0;
+     double vmax = (speed > 0 && scale > 0)? speed * scale : MotionProfile::maxSpeedToPps(MAX_SPEED_3D);
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          double ratio = (double)distance[axis] / longest;
+          reg[axis].speed = vmax * ratio;
+          reg[axis].maxSpeed = MotionProfile::syncMaxSpeed(vmax * ov / MotionProfile::maxSpeedToPps(1), distance[axis], longest);
+          if( accel > 0 && scale > 0 )
+          {
+               // 加速度も移動量に比例させ，全軸の速度プロファイルを相似形にする
+               reg[axis].acc = reg[axis].dec = MotionProfile::pps2ToAcc(accel * scale * ov * ratio);
+          }
+          else
+          {
+               reg[axis].acc = MotionProfile::pps2ToAcc(MotionProfile::accToPps2(acc[axis]) * ov);
+               reg[axis].dec = MotionProfile::pps2ToAcc(MotionProfile::accToPps2(dec[axis]) * ov);
+          }
+     }
+     return longest;
+}
+
+//------------------------------------------------------------------------------
+//   連続軌道を計画する (VirtualRobot と共通)
+//   区間ごとの時間は，最も移動量の大きい軸を path[n].speed (単位は path[n].unit) で
+//   動かす時間。加速度は path[n].accel，指定がなければ acc / dec の小さい方
+//   移動量 0 の点は飛ばす。移動の必要がなければ false
+//------------------------------------------------------------------------------
+bool Robot::planPath(const int32_t from[3], const std::vector<MotionTarget>& path, int feedOverride,
+     const uint32_t acc[3], const uint32_t dec[3], PathProfile *profile)
+{
+     double ov = feedOverride / 100.0;
+     std::vector<PathProfile::Waypoint> points;
+     const int32_t *prev = from;
+     for( size_t n = 0 ; n < path.size() ; n++ )
+     {
+          const MotionTarget& target = path[n];
+          uint32_t longest = 0;
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               longest = std::max(longest, (uint32_t)std::abs(target.position[axis] - prev[axis]));
+          }
+          if( longest == 0 )
+          {
+               continue;
+          }
+          double scale = getUnitScale(prev, target.position, target.unit);
+          double vmax = (target.speed > 0 && scale > 0)? target.speed * scale : MotionProfile::maxSpeedToPps(MAX_SPEED_3D);
+
+          PathProfile::Waypoint point;
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               point.position[axis] = target.position[axis];
+               if( target.accel > 0 && scale > 0 )
+               {
+                    point.accel[axis] = target.accel * scale * ov;
+               }
+               else
+               {
+                    point.accel[axis] = MotionProfile::accToPps2(std::min(acc[axis], dec[axis])) * ov;
+               }
+          }
+          point.duration = longest / (vmax * ov);
+          points.push_back(point);
+          prev = target.position;
      }
-     // 各軸の速度を決定し，駆動開始
+     return profile->plan(from, points);
+}
+
+//------------------------------------------------------------------------------
+//   送り速度オーバーライド(%)を設定する
+//   移動中の軸は MAX_SPEED を即時に書き換える (ACC / DEC は停止中しか書けないので次の移動から)
+//------------------------------------------------------------------------------
+void Robot::setFeedOverride(int percent)
+{
+     percent = std::max((int)MIN_FEED_OVERRIDE, std::min(percent, (int)MAX_FEED_OVERRIDE));
      m_mutex.lock();
+     m_feedOverride = percent;
      for( int axis = 0 ; axis < 3 ; axis++ )
      {
-          if( b[axis] )
+          if( m_motionState[axis] > 0 && m_moveSpeed[axis] > 0 )
           {
-               int32_t speed = 16 * distance[axis] / longest;
+               uint32_t speed = MotionProfile::syncMaxSpeed(m_moveSpeed[axis] * percent / 100.0 / MotionProfile::maxSpeedToPps(1), 1, 1);
                m_stepper[axis]->setParam(L6470::PRM_MAX_SPEED, speed);
-               m_stepper[axis]->moveTo(dir[axis], destpos[axis]);
-               m_motionState[axis] = 1;
+               m_overridden[axis] = true;
           }
      }
      m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+void Robot::getDefaultAccDec(uint32_t acc[3], uint32_t dec[3])
+{
+     m_mutex.lock();
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          acc[axis] = m_defaultAcc[axis];
+          dec[axis] = m_defaultDec[axis];
+     }
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+//   移動開始時に，その軸の速度プロファイルを計画しておく
+//   (m_mutex をロックした状態で呼び出すこと)
+//------------------------------------------------------------------------------
+void Robot::planMotion(int axis, int32_t destpos)
+{
+     L6470 *stepper = m_stepper[axis];
+     m_plan[axis].planByRegister(stepper->getAbsPos(), destpos,
+          stepper->getWrittenParam(L6470::PRM_MAX_SPEED),
+          stepper->getWrittenParam(L6470::PRM_ACC),
+          stepper->getWrittenParam(L6470::PRM_DEC));
+     m_planStart[axis] = std::chrono::steady_clock::now();
+     m_planned[axis] = (m_plan[axis].getDuration() > 0);
+     m_overridden[axis] = false;
+}
+
+//------------------------------------------------------------------------------
+//   現在位置を速度プロファイルと比較する
+//   偏差が許容値を超えた，または予定時間を大幅に過ぎても移動中であれば false
+//
+//   位置の取得は execControl() の周期(約30ms)に依存するので，
+//   許容値にはその間の移動量を加えておく
+//------------------------------------------------------------------------------
+bool Robot::checkMotionProfile(int axis, int32_t *expected)
+{
+     if( !m_planned[axis] || m_overridden[axis] )
+     {
+          return true;
+     }
+     std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_planStart[axis];
+     double t = elapsed.count();
+     *expected = m_plan[axis].getPosition(t);
+
+     int32_t tolerance = m_stallTolerance + (int32_t)(m_plan[axis].getPeakSpeed() * 0.06);
+     if( std::abs(m_stepper[axis]->getAbsPos() - *expected) > tolerance )
+     {
+          return false;
+     }
+     if( t > m_plan[axis].getDuration()*1.5 + 0.5 )
+     {
+          return false;
+     }
      return true;
 }
 
+//------------------------------------------------------------------------------
+//   ストールを検出したので全軸を即時停止(励磁は保持)し，記録を残す
+//   (m_mutex をロックした状態で呼び出すこと)
+//------------------------------------------------------------------------------
+void Robot::stopOnStall(int axis, uint8_t alarm, int32_t expected)
+{
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          m_stepper[n]->hardStop();
+     }
+     m_stepper[axis]->raiseAlarm(alarm);
+
+     StallEvent e;
+     e.time = std::time(NULL);
+     e.axis = axis;
+     e.alarm = alarm;
+     e.position = m_stepper[axis]->getAbsPos();
+     e.expected = expected;
+     e.target = m_plan[axis].getTarget();
+     e.speed = m_stepper[axis]->getSpeed();
+     m_stallEvents.push_back(e);
+     while( m_stallEvents.size() > MAX_STALL_EVENTS )
+     {
+          m_stallEvents.pop_front();
+     }
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          m_planned[n] = false;
+     }
+
+     std::printf("[AXIS-%d] Stall detected : 0x%02X (pos=%d, expected=%d, target=%d)\n",
+          axis, alarm, e.position, e.expected, e.target);
+
+     FILE *fp = fopen(STALL_LOG_PATH, "a");
+     if( fp )
+     {
+          char buf[32];
+          strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&e.time));
+          fprintf(fp, "%s AXIS-%d alarm=0x%02X pos=%d expected=%d target=%d speed=%d\n",
+               buf, axis, alarm, e.position, e.expected, e.target, e.speed);
+          fclose(fp);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   ストール検出(STEP_LOSS_A/B)の有効/無効を切り替える
+//   位置偏差の検出は常に有効
+//------------------------------------------------------------------------------
+void Robot::setStallDetection(bool enable)
+{
+     m_mutex.lock();
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          m_stepper[n]->setStallDetection(enable);
+     }
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+//   ストール検出しきい値(STALL_TH)を電流値(mA)で設定する
+//   31.25mA ～ 4000mA (31.25mA 刻み)
+//------------------------------------------------------------------------------
+void Robot::setStallThreshold(int axis, uint32_t mA)
+{
+     uint32_t value = (uint32_t)(mA / 31.25);
+     value = (value > 0)? value - 1 : 0;
+     value = (value > 0x7F)? 0x7F : value;
+     m_mutex.lock();
+     m_stepper[axis]->setParam(L6470::PRM_STALL_TH, value);
+     m_mutex.unlock();
+}
+
+//------------------------------------------------------------------------------
+//   ストールの検出記録を取得する(古い順)
+//------------------------------------------------------------------------------
+void Robot::getStallEvents(std::vector<StallEvent>& events)
+{
+     m_mutex.lock();
+     events.assign(m_stallEvents.begin(), m_stallEvents.end());
+     m_mutex.unlock();
+}
+
 //------------------------------------------------------------------------------
 //   現在のモータのステータスを返す
 //------------------------------------------------------------------------------
@@ -562,9 +1314,86 @@ void Robot::setMotorParam(int axis, uint8_t id, uint32_t value)
 {
      m_mutex.lock();
      m_stepper[axis]->setParam(id, value);
+     // 速度・加速度の設定は，以降の移動の既定値となる
+     switch( id )
+     {
+          case L6470::PRM_MAX_SPEED:  m_defaultMaxSpeed[axis] = value;  break;
+          case L6470::PRM_ACC:        m_defaultAcc[axis] = value;       break;
+          case L6470::PRM_DEC:        m_defaultDec[axis] = value;       break;
+     }
      m_mutex.unlock();
 }
 
+//------------------------------------------------------------------------------
+//   テレメトリの記録を開始する
+//   以降，軸の動作遷移監視スレッドの周期ごとに全軸の状態を path へ記録する
+//------------------------------------------------------------------------------
+bool Robot::startTelemetry(const char *path)
+{
+     TelemetryWriter *writer = new TelemetryWriter();
+     if( !writer->open(path) )
+     {
+          delete writer;
+          return false;
+     }
+     stopTelemetry();
+
+     m_telemetryMutex.lock();
+     m_telemetryStart = std::chrono::steady_clock::now();
+     m_telemetry = writer;
+     m_telemetryMutex.unlock();
+
+     std::printf("[Robot] telemetry started (%s)\n", path);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   テレメトリの記録を終了し，ファイルを閉じる
+//------------------------------------------------------------------------------
+void Robot::stopTelemetry()
+{
+     m_telemetryMutex.lock();
+     TelemetryWriter *writer = m_telemetry;
+     m_telemetry = nullptr;
+     m_telemetryMutex.unlock();
+
+     // 残りのブロックの書き出しを待つ間，動作遷移監視スレッドを止めない
+     if( writer )
+     {
+          writer->close();
+          delete writer;
+          std::printf("[Robot] telemetry stopped.\n");
+     }
+}
+
+//------------------------------------------------------------------------------
+//   全軸の現在状態を１サンプルとして記録する
+//   (値は execControl() で更新済みのものを使うので，SPI通信は発生しない)
+//   (ファイルへの書き込みは TelemetryWriter のスレッドが行うので，ここでは追記だけ)
+//------------------------------------------------------------------------------
+void Robot::recordTelemetry()
+{
+     m_telemetryMutex.lock();
+     if( m_telemetry )
+     {
+          TelemetrySample sample;
+          sample.time = std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - m_telemetryStart).count();
+          m_mutex.lock();
+          for( int axis = 0 ; axis < 3 ; axis++ )
+          {
+               sample.position[axis] = m_stepper[axis]->getAbsPos();
+               sample.speed[axis] = m_stepper[axis]->getSpeed();
+               sample.status[axis] = m_stepper[axis]->getStatus();
+               sample.alarm[axis] = m_stepper[axis]->getAlarmFlag();
+          }
+          sample.gripper = getGripperValue();
+          m_mutex.unlock();
+          m_telemetry->append(sample);
+     }
+     m_telemetryMutex.unlock();
+}
+
 //------------------------------------------------------------------------------
 //   グリッパー（サーボ）を動かす
 //   value はグリッパーの開度をパーセントで指定する
@@ -589,81 +1418,90 @@ void Robot::stopGripper()
      m_mutex.unlock();
 }
 
+//------------------------------------------------------------------------------
+bool Robot::isGripperMoving()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     return m_gripperCurrentValue != m_gripperDestValue;
+}
+
 //------------------------------------------------------------------------------
 //   グリッパー（サーボモータ）制御スレッド
+//   目標値に着いたら (stopGripper() で止めた場合も) 登録された関数を呼ぶ
 //------------------------------------------------------------------------------
 void Robot::execServo()
 {
      std::printf("[Robot] servo thread started.\n");
 
+     bool gripping = false;
      while( !m_terminated )
      {
+          bool ended = false;
           m_mutex.lock();
           if( m_gripperCurrentValue != m_gripperDestValue )
           {
                int delta = (m_gripperCurrentValue < m_gripperDestValue)? 1 : -1;
                m_gripperCurrentValue += delta;
                pwmWrite(SERVO_PIN, m_gripperCurrentValue);
+               gripping = true;
+          }
+          if( gripping && m_gripperCurrentValue == m_gripperDestValue )
+          {
+               gripping = false;
+               ended = true;
           }
           m_mutex.unlock();
-          std::this_thread::sleep_for(std::chrono::milliseconds(25));
+          if( ended )
+          {
+               notifyMotionEnd();
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(SERVO_STEP_MS));
      }
 
      std::printf("[Robot] servo thread terminated.\n");
 }
 
+//------------------------------------------------------------------------------
+//   校正済みの幾何モデルを読み込む
+//   (ファイルが無い場合は設計値のまま)
+//------------------------------------------------------------------------------
+bool Robot::loadKinematics(const char *path)
+{
+     if( !s_kinematics.load(path) )
+     {
+          std::printf("[Robot] %s not found. using nominal geometry.\n", path);
+          return false;
+     }
+     std::printf("[Robot] kinematic model loaded from %s\n", path);
+     return true;
+}
+
 //------------------------------------------------------------------------------
 //   エンドエフェクタ位置(mm単位)から，モータ軸位置(pulse単位)を算出する
 //------------------------------------------------------------------------------
 bool Robot::coordToMotorPos(double X, double Y, double Z, int32_t *base, int32_t *shoulder, int32_t *elbow)
 {
-     double a = 180;
-     double b = 68;
-     double c = 180;
-     double d = 30;
-     double e = 60;
-     double f = 175;
-     double r = std::sqrt(d*d + e*e);
-     double m = 10;
-     double n = 40;
-
-     const double PI = 3.14159265359;
-     
-     X = X + m;
-
-     double t = std::asin(X/std::sqrt(X*X+Y*Y));
-     double omega = std::asin(m/std::sqrt(X*X+Y*Y)) - t;
-     *base = (int32_t)(25600.0 * (omega / PI) * 45.0 / 21.0);
-
-     double x = -(-X*std::sin(omega) + Y*std::cos(omega) - n - 135);     // 135(mm) は，「P点」とエンドエフェクタとの水平距離
-
-     double y = Z - 85;
-
-     double s = std::acos(x/std::sqrt(x*x+y*y));
-     if( y < 0 )
+     double b, s, e;
+     if( !s_kinematics.inverse(X, Y, Z, &b, &s, &e) )
      {
-          s = 2*PI - s;
+          return false;
      }
-     
-     double alpha = s - std::acos((a*a+x*x+y*y-(d*d+f*f))/(2*a*std::sqrt(x*x+y*y))); 
-     
-     double theta = PI + alpha - std::acos((a*a+d*d+f*f-(x*x+y*y))/(2*a*std::sqrt(d*d+f*f)))
-                    - std::acos((d*d-e*f)/(std::sqrt(d*d+f*f)*std::sqrt(d*d+e*e)));
-
-     t = a*a+r*r+2*a*r*std::cos(alpha - theta);
-     
-     double u = std::acos((a*std::cos(alpha)+r*std::cos(theta))/std::sqrt(t));
-     
-     double beta = u - std::acos((t+b*b-c*c)/(2*b*std::sqrt(t)));
-
-     *shoulder = (int32_t)(25600.0*((alpha - PI/3)/PI) * 45 / 11);
-     *elbow = (int32_t)(25600.0*((beta-0.6632)/PI) * 45 / 11);
+     *base = (int32_t)b;
+     *shoulder = (int32_t)s;
+     *elbow = (int32_t)e;
+     return isValidMotorPos(*base, *shoulder, *elbow);
+}
 
-     if( std::abs(*base) > 21000 )
+//------------------------------------------------------------------------------
+//   各軸の位置(pulse)が可動範囲にあるか
+//------------------------------------------------------------------------------
+bool Robot::isValidMotorPos(int32_t base, int32_t shoulder, int32_t elbow)
+{
+     if( std::abs(base) > 21000 )
      {
           return false;
      }
-     if( *shoulder < 0 || *elbow < 0 || *shoulder < *elbow || *shoulder > 51200 )
+     if( shoulder < 0 || elbow < 0 || shoulder < elbow || shoulder > 51200 )
      {
           return false;
      }
@@ -675,44 +1513,5 @@ bool Robot::coordToMotorPos(double X, double Y, double Z, int32_t *base, int32_t
 //------------------------------------------------------------------------------
 void Robot::motorPosToCoord(int32_t base, int32_t shoulder, int32_t elbow, double *X, double *Y, double *Z)
 {
-     double a = 180;
-     double b = 68;
-     double c = 180;
-     double d = 30;
-     double e = 60;
-     double f = 175; 
-     double h = 100;  //アームの支点の高さ
-     double l1 =135;
-     double l2 =15;
-
-     const double PI = 3.14159265359;
-     
-     double alpha = 11*shoulder*2*PI/2304000 + PI/3;
-     double beta  = 11*elbow*2*PI/2304000 + 38*PI/180;
-     double phi   = 21*base*2*PI/2304000;
-     
-     double r = std::sqrt(d*d+e*e);
-     double s = a*std::cos(alpha) - b*std::cos(beta);
-     double t = a*std::sin(alpha)-b*std::sin(beta);
-
-     double gamma;
-     if( t > 0 )
-     {
-          gamma = std::acos(s/std::sqrt(s*s+t*t));
-     }
-     else
-     {
-          gamma = 2*PI - std::acos(s/std::sqrt(s*s+t*t));
-     }
-     double theta = gamma - std::acos((c*c-(a*a+b*b+d*d+e*e)+2*a*b*std::cos(alpha -beta))/(2*std::sqrt(d*d+e*e)*std::sqrt(s*s+t*t)));
-     
-     const double ROOT17 = std::sqrt(17);
-
-     double x = -(-l1+a*std::cos(alpha)+((d*d-e*f)*std::cos(theta) - d*(e+f)*std::sin(theta))/r)*(4*std::cos(phi)-std::sin(phi))/ROOT17 + 10*ROOT17*std::cos(phi);
-     double y = -(-l1+a*std::cos(alpha)+((d*d-e*f)*std::cos(theta) - d*(e+f)*std::sin(theta))/r)*(std::cos(phi)+4*std::sin(phi))/ROOT17 + 10*ROOT17*std::sin(phi);                //点Pからアームの位置の差を調整した値（-135、-15）
-     double z = a*std::sin(alpha)+(d*(e+f)*std::cos(theta)+(d*d-e*f)*std::sin(theta))/r + h - l2;
-     
-     *X = x/ROOT17-4*y/ROOT17 -10;
-     *Y = 4*x/ROOT17+y/ROOT17;
-     *Z = z;
+     s_kinematics.forward(base, shoulder, elbow, X, Y, Z);
 }
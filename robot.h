@@ -3,8 +3,54 @@
 
 #include <thread>
 #include <mutex>
+#include <deque>
+#include <vector>
+#include <map>
+#include <functional>
 #include <cstdint>
+#include <ctime>
+#include <chrono>
 #include "L6470.h"
+#include "motion_profile.h"
+#include "path_profile.h"
+#include "telemetry.h"
+#include "kinematics.h"
+
+//------------------------------------------------------------------------------
+//   ストール(脱調)の検出記録
+//------------------------------------------------------------------------------
+struct StallEvent
+{
+     time_t  time;            // 検出時刻
+     int     axis;
+     uint8_t alarm;           // 検出要因 (L6470::ALM_STEP_LOSS_A / _B / ALM_POSITION)
+     int32_t position;        // 検出時の ABS_POS
+     int32_t expected;        // 速度プロファイル上の位置
+     int32_t target;          // 移動先
+     int32_t speed;           // 検出時の速度(pulse/sec)
+};
+
+//------------------------------------------------------------------------------
+//   ３軸同時移動での各軸のレジスタ値
+//------------------------------------------------------------------------------
+struct MotionRegister
+{
+     uint32_t maxSpeed;       // MAX_SPEED (オーバーライド適用後)
+     uint32_t acc;            // ACC
+     uint32_t dec;            // DEC
+     double   speed;          // オーバーライド適用前の速度(pulse/sec)
+};
+
+//------------------------------------------------------------------------------
+//   モーションキューの１点 (startMotion3D() の引数と同じ)
+//------------------------------------------------------------------------------
+struct MotionTarget
+{
+     int32_t position[3];     // 各軸の目標位置(pulse)
+     double  speed;
+     double  accel;
+     int     unit;
+};
 
 //------------------------------------------------------------------------------
 class Robot
@@ -16,6 +62,22 @@ class Robot
                MOTOR_SHOULDER = 1,
                MOTOR_ELBOW    = 2
           };
+          enum{
+               SERVO_MIN_VALUE = 76,
+               SERVO_MAX_VALUE = 101,
+               SERVO_STEP_MS   = 25     // グリッパーはこの周期で１ずつ動く
+          };
+          enum{ MAX_SPEED_3D = 16 };    // startMotion3D() で最も移動量の大きい軸の MAX_SPEED
+          enum{
+               UNIT_PULSE = 0,          // pulse/sec, pulse/sec^2 (移動量の最も大きい軸について)
+               UNIT_DEG,                // deg/sec, deg/sec^2 (回転角の最も大きい関節について)
+               UNIT_MM                  // mm/sec, mm/sec^2 (エンドエフェクタの始点と終点を結ぶ直線について)
+          };
+          enum{
+               MIN_FEED_OVERRIDE = 10,  // 送り速度オーバーライド(%)の範囲
+               MAX_FEED_OVERRIDE = 200
+          };
+          enum{ MAX_QUEUE_LENGTH = 4096 };  // モーションキューに積める点数
 
      private:
           enum{ BASE_BUSY = 17 };  // ESP32 : 36 };             
@@ -32,10 +94,12 @@ class Robot
           enum{ ELBOW_PLIM = 21 }; // ESP32 : 13 };
 
           enum{ SERVO_PIN = 18 };  // ESP32 : 27 };
-          enum{
-               SERVO_MIN_VALUE = 76,
-               SERVO_MAX_VALUE = 101
-          };
+          enum{ MAX_STALL_EVENTS = 32 };
+          enum{ PATH_TICK_MS = 5 };          // 連続軌道の追従周期
+          enum{ PATH_GAIN = 10 };            // 連続軌道の位置偏差に掛けるゲイン(1/sec)
+          enum{ PATH_SETTLE_MS = 2000 };     // 連続軌道の終わりに停止を待つ時間の上限
+          static const char *STALL_LOG_PATH;
+          static KinematicModel s_kinematics;      // IK / FK で共通に使う幾何モデル
 
           L6470 *m_stepper[3];
           int    m_homingState;
@@ -44,14 +108,54 @@ class Robot
           int    m_gripperDestValue;
           bool   m_terminated;
 
+          MotionProfile m_plan[3];           // 移動中の軸の速度プロファイル
+          bool   m_planned[3];
+          std::chrono::steady_clock::time_point m_planStart[3];
+          bool   m_overridden[3];            // 移動中にオーバーライドが変更された(速度プロファイルとの比較はしない)
+          int32_t m_stallTolerance;          // 位置偏差の許容値(pulse)
+          std::deque<StallEvent> m_stallEvents;
+
           std::thread *m_homingThread;
           std::thread *m_motionThread;
           std::thread *m_servoThread;
           std::mutex   m_mutex;
 
+          int      m_feedOverride;           // 送り速度オーバーライド(%)
+          uint32_t m_defaultMaxSpeed[3];     // 単軸移動の MAX_SPEED
+          uint32_t m_defaultAcc[3];          // 加速度の指定がない移動の ACC / DEC
+          uint32_t m_defaultDec[3];
+          double   m_moveSpeed[3];           // 移動中の軸のオーバーライド適用前の速度(pulse/sec)
+          bool     m_jogging[3];             // ジョグ (RUN コマンド) で動いている
+          int32_t  m_jogSpeed[3];            // 最後に送ったジョグ速度(pulse/sec，符号が方向)
+
+          std::deque<MotionTarget> m_motionQueue;
+          bool         m_dispatching;        // キューから取り出した点の移動を開始している
+          std::mutex   m_queueMutex;
+
+          PathProfile  m_path;               // move_path() の連続軌道
+          bool         m_pathActive;         // 連続軌道を追従している (m_mutex で保護)
+          bool         m_pathCancel;
+          int          m_pathFeedOverride;   // 計画時の送り速度オーバーライド
+          std::thread *m_pathThread;
+
+          std::map<int, std::function<void()> > m_motionListeners;
+          int          m_nextListenerID;
+          std::mutex   m_listenerMutex;
+
+          TelemetryWriter *m_telemetry;
+          std::chrono::steady_clock::time_point m_telemetryStart;
+          std::mutex   m_telemetryMutex;
+
           void execHoming();
           void execMotion();
           void execServo();
+          void execPath();
+          void recordTelemetry();
+          void planMotion(int axis, int32_t destpos);
+          bool checkMotionProfile(int axis, int32_t *expected);
+          void stopOnStall(int axis, uint8_t alarm, int32_t expected);
+          void dispatchQueue();
+          void notifyMotionEnd();
 
 
      public:
@@ -61,7 +165,17 @@ class Robot
           void initialize();
           bool startHoming();
           bool startMotion(int axis, int32_t destpos);
-          bool startMotion3D(int32_t base, int32_t shoulder, int32_t elbow);
+          bool startMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed = 0, double accel = 0, int unit = UNIT_PULSE);
+          bool jog(const int32_t speed[3]);
+          void stopJog();
+          int  addMotionListener(std::function<void()> listener);
+          void removeMotionListener(int id);
+          bool queueMotion(const std::vector<MotionTarget>& targets);
+          bool queueMotion(const MotionTarget *targets, int count);
+          bool startPath(const std::vector<MotionTarget>& path);
+          void clearMotionQueue();
+          int  getQueueLength();
+          int  getPendingMotions();
           bool isInMotion(int axis = -1);
           bool isAlarmHappened(int axis = -1);
           bool isHalted(int axis);
@@ -78,7 +192,9 @@ class Robot
           uint8_t getGripperValue() const {
                 return (uint8_t)(100*(m_gripperCurrentValue - SERVO_MIN_VALUE)/(SERVO_MAX_VALUE - SERVO_MIN_VALUE)); 
           }
+          int  getGripperServoValue() const { return m_gripperCurrentValue; }
           void stopGripper();
+          bool isGripperMoving();
 
           uint16_t getMotorStatus(int axis);
           int32_t  getMotorPosition(int axis);
@@ -86,8 +202,30 @@ class Robot
           uint32_t getMotorParam(int axis, uint8_t id);
           void     setMotorParam(int axis, uint8_t id, uint32_t value);
 
+          void setFeedOverride(int percent);
+          int  getFeedOverride() const { return m_feedOverride; }
+          void getDefaultAccDec(uint32_t acc[3], uint32_t dec[3]);
+
+          bool startTelemetry(const char *path);
+          void stopTelemetry();
+
+          void setStallDetection(bool enable);
+          void setStallThreshold(int axis, uint32_t mA);
+          void setStallTolerance(int32_t pulse){ m_stallTolerance = pulse; }
+          void getStallEvents(std::vector<StallEvent>& events);
+
+          static uint32_t computeMotion3D(const int32_t from[3], const int32_t to[3], double speed, double accel, int unit,
+               int feedOverride, const uint32_t acc[3], const uint32_t dec[3], MotionRegister reg[3]);
+
+          static bool planPath(const int32_t from[3], const std::vector<MotionTarget>& path, int feedOverride,
+               const uint32_t acc[3], const uint32_t dec[3], PathProfile *profile);
+
+          static bool loadKinematics(const char *path);
+          static const KinematicModel& getKinematics(){ return s_kinematics; }
           static bool coordToMotorPos(double x, double y, double z, int32_t *base, int32_t *shoulder, int32_t *elbow);
           static void motorPosToCoord(int32_t base, int32_t shoulder, int32_t elbow, double *X, double *Y, double *Z);
+          static bool isValidMotorPos(int32_t base, int32_t shoulder, int32_t elbow);
+          static double getUnitScale(const int32_t from[3], const int32_t to[3], int unit);
 };
 
 
@@ -1,12 +1,15 @@
 #include "robot.h"
 #include "L6470.h"
 #include "command_server.h"
+#include "jog_server.h"
+#include "shm_server.h"
 // #include "script.h"
 #include "console.h"
 #include <signal.h>
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
 #include <cstdio>
+#include <cstring>
 
 //------------------------------------------------------------------------------
 typedef void (*sighandler_t)(int);
@@ -29,29 +32,50 @@ void handler(int)
 }
 
 //------------------------------------------------------------------------------
-int main()
+int main(int argc, char *argv[])
 {
      trap_signal(SIGINT, handler);
 
+     // -t <path> : モータ状態をテレメトリファイルへ記録する
+     const char *telemetryPath = NULL;
+     for( int n = 1 ; n < argc-1 ; n++ )
+     {
+          if( strcmp(argv[n], "-t") == 0 )
+          {
+               telemetryPath = argv[n+1];
+          }
+     }
+
      wiringPiSetupGpio();
      wiringPiSPISetupMode(L6470::SPI_CHANNEL, 1000000, 3);  // L6470 は「モード３」であることに注意！
 
+     Robot::loadKinematics(KinematicModel::DEFAULT_PATH);
+
      Robot *robot = new Robot();
      robot->initialize();
+     if( telemetryPath )
+     {
+          robot->startTelemetry(telemetryPath);
+     }
 
      CommandManager *commandManager = new CommandManager(robot);
+     JogServer *jogServer = new JogServer(robot);
+     ShmServer *shmServer = new ShmServer(robot);
      // Script *script = new Script(robot);
 
      // std::printf("RobotScript\n");
      RobotConsole *console = new RobotConsole(robot);
+     commandManager->setScript(console->getScript());
 
      while( !g_terminated && console->execute() )
      {
           std::this_thread::sleep_for(std::chrono::milliseconds(10));
      }
 
+     delete commandManager;         // console の Script を参照しているので先に止める
      delete console;
-     delete commandManager;
+     delete shmServer;
+     delete jogServer;
      // delete script;
      delete robot;
 
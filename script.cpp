@@ -4,8 +4,14 @@
 #include <wiringPi.h>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <regex>
 #include <sstream>
+#include <algorithm>
+
+//   メンバ関数 Script::fn を登録する lua_CFunction
+#define   SCRIPT_METHOD(fn)   &LuaMethod<decltype(&Script::fn), &Script::fn>::call
 
 //------------------------------------------------------------------------------
 const char *Script::STARTUP_CODE =
@@ -22,11 +28,59 @@ const char *Script::STARTUP_CODE =
      "end\n"
 ;
 const char *Script::GLOBAL_NAME = "niwda_adwin";
+const char *Script::UPLOAD_CHUNK_NAME = "=[remote]";
+#ifdef USE_LUAJIT
+//   実機で実行するとき，問い合わせ関数を FFI 版に置き換える (引数は Script *)
+//   FFI の呼び出し中は longjmp できないので，中断はラッパーでエラーにする
+//   移動中の in_motion() は，待ち (タスクの切り替え) を lua_CFunction 版に任せる
+const char *Script::FFI_BINDINGS =
+     "local self = ...\n"
+     "local ffi = require(\"ffi\")\n"
+     "ffi.cdef[[\n"
+     "int script_in_motion(void *script);\n"
+     "int script_alarm_happened(void *script);\n"
+     "int script_get_position(void *script, double *xyz);\n"
+     "]]\n"
+     "local C = ffi.C\n"
+     "local c_in_motion = in_motion\n"
+     "local xyz = ffi.new(\"double[3]\")\n"
+     "local function check(r)\n"
+     "     if r < 0 then error(\"aborted.\", 3) end\n"
+     "     return r\n"
+     "end\n"
+     "in_motion = function()\n"
+     "     local r = check(C.script_in_motion(self))\n"
+     "     if r == 2 then return c_in_motion() end\n"
+     "     return r ~= 0\n"
+     "end\n"
+     "alarm_hapenned = function() return check(C.script_alarm_happened(self)) ~= 0 end\n"
+     "get_position = function(t)\n"
+     "     check(C.script_get_position(self, xyz))\n"
+     "     t = t or {}\n"
+     "     t.x, t.y, t.z = xyz[0], xyz[1], xyz[2]\n"
+     "     return t\n"
+     "end\n"
+;
+#endif
 
 //------------------------------------------------------------------------------
 Script::Script(Robot *robot) : m_robot(robot), m_running(false),
-     m_terminated(false), m_aborted(false)
+     m_terminated(false), m_aborted(false), m_dryRun(false),
+     m_uploadRun(false), m_exited(false), m_runCount(0), m_currentRun(0),
+     m_lastElapsed(0), m_lastResult(-1), m_nextListenerID(0),
+     m_currentTask(-1), m_armOwner(-1), m_taskOrder(0), m_movesIssued(0), m_gripsIssued(0),
+     m_waitEvents(0), m_warmState(NULL), m_warmMemory(NULL), m_memory(NULL), m_memoryLimit(MEMORY_LIMIT),
+     m_profileRequested(false), m_profileRun(false), m_profiling(false), m_profileSource(NULL), m_profileLine(0)
 {
+     m_cache = new ScriptCache("./script/");
+     m_profile.available = false;
+     m_profile.total = 0;
+     memset(&m_memoryStats, 0, sizeof(m_memoryStats));
+     for( int n = 0 ; n < ScriptProfile::NUM_CATEGORIES ; n++ )
+     {
+          m_profile.category[n] = 0;
+     }
+
      m_onStart = [](Script *){ 
           std::printf("[Script] started.\n"); 
      };
@@ -39,6 +93,13 @@ Script::Script(Robot *robot) : m_robot(robot), m_running(false),
           std::printf("[Script] done.\n"); 
      };
 
+     // 移動・グリッパーの動作が終わったら，await() で待っているスクリプトを起こす
+     m_listenerID = m_robot->addMotionListener([this](){
+          std::lock_guard<std::mutex> lock(m_waitMutex);
+          m_waitEvents++;
+          m_waitCond.notify_all();
+     });
+
      m_thread = new std::thread([this](){ execute(); });
 }
 
@@ -46,273 +107,2107 @@ Script::Script(Robot *robot) : m_robot(robot), m_running(false),
 Script::~Script()
 {
      m_terminated = true;
-     m_aborted = true;
+     abort();
+     {
+          std::lock_guard<std::mutex> lock(m_runMutex);
+          m_runCond.notify_one();
+     }
      m_thread->join();
      delete m_thread;
+     delete m_cache;
+     m_robot->removeMotionListener(m_listenerID);
+}
+
+//------------------------------------------------------------------------------
+//   lua_State を作って組み込み関数を登録する
+//   実機用の lua_State は前の実行が終わった時点で作っておき，開始を待たせない
+//   メモリは memory から取る (lua_close() の後まで消さないこと)
+//------------------------------------------------------------------------------
+lua_State *Script::createState(bool dryRun, ScriptAllocator *memory)
+{
+     lua_State *pLua = memory->newState();
+     luaL_openlibs(pLua);
+
+     // フック・atPanic() 用 (組み込み関数は upvalue から引く)
+     lua_pushlightuserdata(pLua, this);
+     lua_setglobal(pLua, GLOBAL_NAME);
+
+     // 組み込み関数は this を upvalue に持つクロージャ (script_binding.h)
+     // 試運転では同じ名前で仮想ロボットを動かす関数を登録する
+     static const LuaBinding ROBOT_FUNCTIONS[] =
+     {
+          { "moveto",          SCRIPT_METHOD(moveTo) },
+          { "go_home",         SCRIPT_METHOD(goHome) },
+          { "grip",            SCRIPT_METHOD(grip) },
+          { "delay",           SCRIPT_METHOD(delayScript) },
+          { "in_motion",       SCRIPT_METHOD(inMotion) },
+          { "alarm_hapenned",  SCRIPT_METHOD(alarmHappened) },
+          { "get_position",    SCRIPT_METHOD(getPosition) },
+          { "get_joint",       SCRIPT_METHOD(getJoint) },
+          { "get_gripper",     SCRIPT_METHOD(getGripper) },
+          { "moveto_async",    SCRIPT_METHOD(moveToAsync) },
+          { "grip_async",      SCRIPT_METHOD(gripAsync) },
+          { "move_path",       SCRIPT_METHOD(movePath) },
+     };
+     static const LuaBinding DRY_RUN_FUNCTIONS[] =
+     {
+          { "moveto",          SCRIPT_METHOD(dryMoveTo) },
+          { "go_home",         SCRIPT_METHOD(dryGoHome) },
+          { "grip",            SCRIPT_METHOD(dryGrip) },
+          { "delay",           SCRIPT_METHOD(dryDelay) },
+          { "in_motion",       SCRIPT_METHOD(dryInMotion) },
+          { "alarm_hapenned",  SCRIPT_METHOD(dryAlarmHappened) },
+          { "get_position",    SCRIPT_METHOD(dryGetPosition) },
+          { "get_joint",       SCRIPT_METHOD(dryGetJoint) },
+          { "get_gripper",     SCRIPT_METHOD(dryGetGripper) },
+          { "moveto_async",    SCRIPT_METHOD(dryMoveToAsync) },
+          { "grip_async",      SCRIPT_METHOD(dryGripAsync) },
+          { "move_path",       SCRIPT_METHOD(dryMovePath) },
+     };
+     static const LuaBinding COMMON_FUNCTIONS[] =
+     {
+          { "get_feed_override", SCRIPT_METHOD(getFeedOverride) },
+          { "await",           SCRIPT_METHOD(await) },
+          { "await_all",       SCRIPT_METHOD(awaitAll) },
+          { "spawn",           SCRIPT_METHOD(spawnTask) },
+          { "send",            SCRIPT_METHOD(sendMessage) },
+          { "receive",         SCRIPT_METHOD(receiveMessage) },
+          { "task_yield",      SCRIPT_METHOD(yieldTask) },
+          { "task_name",       SCRIPT_METHOD(taskName) },
+          { "take_arm",        SCRIPT_METHOD(takeArm) },
+          { "release_arm",     SCRIPT_METHOD(releaseArm) },
+          { "exit_script",     SCRIPT_METHOD(exitScript) },
+          { "output_str",      SCRIPT_METHOD(outputStr) },
+     };
+     static_assert(sizeof(ROBOT_FUNCTIONS) == sizeof(DRY_RUN_FUNCTIONS), "dry run must replace every robot function");
+     if( dryRun )
+     {
+          luaBind(pLua, DRY_RUN_FUNCTIONS, sizeof(DRY_RUN_FUNCTIONS) / sizeof(DRY_RUN_FUNCTIONS[0]), this);
+     }
+     else
+     {
+          luaBind(pLua, ROBOT_FUNCTIONS, sizeof(ROBOT_FUNCTIONS) / sizeof(ROBOT_FUNCTIONS[0]), this);
+     }
+     luaBind(pLua, COMMON_FUNCTIONS, sizeof(COMMON_FUNCTIONS) / sizeof(COMMON_FUNCTIONS[0]), this);
+#ifdef USE_LUAJIT
+     if( !dryRun )
+     {
+          // 読み込めなければ lua_CFunction 版のまま動かす
+          int status = luaL_loadstring(pLua, FFI_BINDINGS);
+          if( status == 0 )
+          {
+               lua_pushlightuserdata(pLua, this);
+               status = lua_pcall(pLua, 1, 0, 0);
+          }
+          if( status != 0 )
+          {
+               std::printf("[Script] FFI bindings unavailable : %s\n", lua_tostring(pLua, -1));
+               lua_pop(pLua, 1);
+          }
+     }
+#endif
+     lua_atpanic(pLua, &atPanic);
+     lua_sethook(pLua, &hookProc, LUA_MASKCOUNT, HOOK_COUNT);
+     return pLua;
+}
+
+//------------------------------------------------------------------------------
+//   スクリプト全体のチャンクを積む
+//   ファイルはキャッシュを通す。チャンク名は atPanic() の書式 ([名前]:行:) に合わせる
+//------------------------------------------------------------------------------
+int Script::loadChunk(lua_State *L)
+{
+     if( m_uploadRun )
+     {
+          return luaL_loadbuffer(L, m_code.data(), m_code.size(), UPLOAD_CHUNK_NAME);
+     }
+     if( m_path.empty() )
+     {
+          return luaL_loadstring(L, m_code.c_str());
+     }
+     std::string::size_type slash = m_path.rfind('/');
+     std::string chunkName = "=[" + m_path.substr((slash == std::string::npos)? 0 : slash + 1) + "]";
+     return m_cache->load(L, m_path, STARTUP_CODE, chunkName.c_str());
 }
 
 //------------------------------------------------------------------------------
 void Script::execute()
 {
      std::printf("[Script] thread started.\n");
-     while( !m_terminated )
+     m_warmMemory = new ScriptAllocator();
+     m_warmState = createState(false, m_warmMemory);
+     while( true )
      {
-          std::this_thread::sleep_for(std::chrono::milliseconds(100));
-          if( !m_running )
           {
-               continue;
+               std::unique_lock<std::mutex> lock(m_runMutex);
+               m_runCond.wait(lock, [this](){ return m_running || m_terminated; });
+          }
+          if( m_terminated )
+          {
+               break;
           }
 
-          lua_State *pLua = luaL_newstate();
-          luaL_openlibs(pLua);
-
-          lua_pushlightuserdata(pLua, this);
-          lua_setglobal(pLua, GLOBAL_NAME);
+          lua_State *pLua;
+          if( !m_dryRun && m_warmState )
+          {
+               pLua = m_warmState;
+               m_memory = m_warmMemory;
+               m_warmState = NULL;
+               m_warmMemory = NULL;
+          }
+          else
+          {
+               m_memory = new ScriptAllocator();
+               pLua = createState(m_dryRun, m_memory);
+          }
+          m_memory->startRun(pLua, m_memoryLimit);
+          if( m_dryRun )
+          {
+               startDryRun();
+          }
 
-          lua_register(pLua, "moveto", &moveTo);
-          lua_register(pLua, "go_home", &goHome);
-          lua_register(pLua, "grip", &grip);
-          lua_register(pLua, "delay", &delayScript);
-          lua_register(pLua, "in_motion", &inMotion);
-          lua_register(pLua, "alarm_hapenned", &alarmHappened);
-          lua_register(pLua, "get_position", &getPosition);
-          lua_register(pLua, "exit_script", &exitScript);
-          lua_atpanic(pLua, &atPanic);
-          lua_sethook(pLua, &hookProc, LUA_MASKCOUNT, 10);
+          m_handles.clear();
+          m_movesIssued = 0;
+          m_gripsIssued = 0;
+          m_profiling = (m_profileRun || m_profileRequested) && !m_dryRun;
+          {
+               std::lock_guard<std::mutex> lock(m_profileMutex);
+               m_profile.available = false;
+          }
 
+          {
+               std::lock_guard<std::mutex> lock(m_runMutex);
+               m_currentRun = m_runCount;
+               m_runStart = std::chrono::steady_clock::now();
+          }
+          m_exited = false;
           m_onStart(this);
+          notify(ScriptEvent::KIND_START, "");
 
-          if( luaL_dostring(pLua, m_code.c_str()) )
+          if( loadChunk(pLua) )
           {
                atPanic(pLua);
           }
+          else if( m_profiling )
+          {
+               startProfile(pLua);
+               runMain(pLua);
+               finishProfile();
+          }
           else
           {
-               // 正常終了
+               runMain(pLua);
           }
+          m_profiling = false;
+          finishMemory(pLua);
           lua_close(pLua);
-          m_running = false;
+          delete m_memory;
+          m_memory = NULL;
+          if( m_dryRun )
+          {
+               finishDryRun();
+          }
+          if( !m_warmState )
+          {
+               m_warmMemory = new ScriptAllocator();
+               m_warmState = createState(false, m_warmMemory);
+          }
+
+          // 終わり方は次の実行が始まる前に決めておく (通知は m_running を戻してから)
+          std::string error = m_errorMessage;
+          int result = ScriptEvent::RESULT_DONE;
+          if( !error.empty() )
+          {
+               result = ScriptEvent::RESULT_ERROR;
+          }
+          else if( m_aborted && !m_exited )
+          {
+               result = ScriptEvent::RESULT_ABORTED;
+          }
+          {
+               std::lock_guard<std::mutex> lock(m_runMutex);
+               m_lastElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_runStart).count();
+               m_lastResult = result;
+               m_running = false;
+          }
           m_aborted = false;
           m_onEnd(this);
+          if( !error.empty() )
+          {
+               notify(ScriptEvent::KIND_ERROR, error);
+          }
+          notify(ScriptEvent::KIND_END, "", result);
           // if( m_errorMessage.length() > 0 )
           // {
           //      std::printf("%s\n", m_errorMessage.c_str());
           // }
      }
+     if( m_warmState )
+     {
+          lua_close(m_warmState);
+          m_warmState = NULL;
+          delete m_warmMemory;
+          m_warmMemory = NULL;
+     }
      std::printf("[Script] thread terminated.\n");
 }
 
 //------------------------------------------------------------------------------
-void Script::run(std::string code)
+//   dryRun が true の場合は実機を動かさず，仮想時刻で実行して動作時間を見積もる
+//   (結果は終了後に getDryRunResult() で参照する)
+//   profile が true の場合は行ごとの実行時間を計測する (結果は getProfile() で参照する)
+//------------------------------------------------------------------------------
+//   戻り値は実行の番号 (実行中で始められなければ 0)
+//------------------------------------------------------------------------------
+uint32_t Script::run(std::string code, bool dryRun, bool profile)
 {
+     std::lock_guard<std::mutex> lock(m_runMutex);
      if( m_running )
      {
-          return;
+          return 0;
      }
 
      m_code = code + STARTUP_CODE;
-     m_errorMessage = "";
-     m_aborted = false;
-     m_running = true;
+     m_path = "";
+     m_uploadRun = false;
+     return beginRun(dryRun, profile);
 }
 
 //------------------------------------------------------------------------------
-void Script::abort()
+//   ファイルのスクリプトを実行する
+//   前回と内容が変わっていなければ，コンパイル済みのバイトコードから始める
+//------------------------------------------------------------------------------
+uint32_t Script::runFile(const std::string& path, bool dryRun, bool profile)
 {
-     m_aborted = true;
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     if( m_running )
+     {
+          return 0;
+     }
+
+     m_code = "";
+     m_path = path;
+     m_uploadRun = false;
+     return beginRun(dryRun, profile);
 }
 
 //------------------------------------------------------------------------------
-int Script::atPanic(lua_State *L)
+//   ファイルを介さずに送られたスクリプト (TCP の ScriptUpload) をコンパイルしておく
+//   構文エラーなら false (error に atPanic() と同じ書式のメッセージ)。前のスクリプトは残る
+//------------------------------------------------------------------------------
+bool Script::upload(const std::string& source, std::string *error)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
-
-     if( self->m_aborted || self->m_terminated )
+     lua_State *L = luaL_newstate();
+     if( L == NULL )
      {
-          return 0;
+          *error = "ERROR not enough memory";
+          return false;
      }
-
-     std::regex re("\\[.+\\]:(\\d+):\\s*(.+)");
-     std::cmatch cm;
-     std::string msg(lua_tostring(L, 1));
-     std::regex_match(msg.c_str(), cm, re);
-     if( cm.empty() )
+     std::string bytecode;
+     int status = m_cache->compile(L, source, STARTUP_CODE, UPLOAD_CHUNK_NAME, &bytecode);
+     if( status != 0 )
      {
-          self->m_errorMessage = msg;
+          *error = formatError(lua_tostring(L, -1));
      }
-     else
+     lua_close(L);
+     if( status != 0 )
      {
-          std::ostringstream oss;
-          oss << "ERROR [line " << cm[1] << "] " << cm[2];
-          self->m_errorMessage = oss.str();
+          return false;
      }
-     // self->m_errorMessage = std::string(lua_tostring(L, 1));
 
-     return 0;
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     m_upload.swap(bytecode);
+     return true;
 }
 
 //------------------------------------------------------------------------------
-void Script::hookProc(lua_State *L, lua_Debug *ar)
+bool Script::hasUpload()
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
-
-     std::this_thread::sleep_for(std::chrono::milliseconds(5));
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     return !m_upload.empty();
+}
 
-     if( self->m_aborted || self->m_terminated )
+//------------------------------------------------------------------------------
+//   upload() したスクリプトを実行する
+//   実行中，またはまだ upload() していなければ 0
+//------------------------------------------------------------------------------
+uint32_t Script::runUploaded(bool dryRun, bool profile)
+{
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     if( m_running || m_upload.empty() )
      {
-          luaL_error(L, "aborted.");
+          return 0;
      }
+
+     m_code = m_upload;
+     m_path = "";
+     m_uploadRun = true;
+     return beginRun(dryRun, profile);
 }
 
 //------------------------------------------------------------------------------
-int Script::moveTo(lua_State *L)
+//   実行スレッドを起こす (m_runMutex を保持して呼ぶ)
+//------------------------------------------------------------------------------
+uint32_t Script::beginRun(bool dryRun, bool profile)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
+     m_errorMessage = "";
+     m_aborted = false;
+     m_dryRun = dryRun;
+     m_profileRun = profile;
+     m_running = true;
+     m_runCount++;
+     m_runCond.notify_one();
+     return m_runCount;
+}
 
-     double x = luaL_checknumber(L, 1);
-     double y = luaL_checknumber(L, 2);
-     double z = luaL_checknumber(L, 3);
+//------------------------------------------------------------------------------
+//   最後に開始した実行の番号 (0 はまだない)
+//------------------------------------------------------------------------------
+uint32_t Script::getRunCount()
+{
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     return m_runCount;
+}
 
-     int32_t b, s, e;
-     if( !Robot::coordToMotorPos(x, y, z, &b, &s, &e) )
-     {
-          return luaL_error(L, "moveto - Designated position is out of range");
-     }
-     if( !self->m_robot->startMotion3D(b, s, e) )
+//------------------------------------------------------------------------------
+//   最後に終わった実行の終わり方 (ScriptEvent::RESULT_xxx，-1 はまだない)
+//------------------------------------------------------------------------------
+int Script::getLastResult()
+{
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     return m_lastResult;
+}
+
+//------------------------------------------------------------------------------
+//   実行中なら開始からの時間，そうでなければ最後の実行の時間(sec)
+//------------------------------------------------------------------------------
+double Script::getElapsed()
+{
+     std::lock_guard<std::mutex> lock(m_runMutex);
+     if( m_running && m_currentRun == m_runCount )
      {
-          return luaL_error(L, "moveto - Unable to start motion");
+          return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_runStart).count();
      }
-     std::this_thread::sleep_for(std::chrono::milliseconds(100));
-     return 0;
+     return m_lastElapsed;
 }
 
 //------------------------------------------------------------------------------
-int Script::goHome(lua_State *L)
+//   実行の開始・print() の出力・エラー・終了を受け取る関数を登録する
+//   (スクリプトのスレッドから，m_listenerMutex を保持して呼ばれる。待たずに戻ること)
+//   戻り値は removeListener() に渡す識別子
+//------------------------------------------------------------------------------
+int Script::addListener(EventListener listener)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     int id = m_nextListenerID++;
+     m_listeners[id] = listener;
+     return id;
+}
+
+//------------------------------------------------------------------------------
+//   登録を解除する (呼び出し中の関数があれば，その終了を待ってから戻る)
+//------------------------------------------------------------------------------
+void Script::removeListener(int id)
+{
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     m_listeners.erase(id);
+}
+
+//------------------------------------------------------------------------------
+void Script::notify(int kind, const std::string& text, int result)
+{
+     ScriptEvent event;
+     event.kind = kind;
+     event.run = m_currentRun;
+     event.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_runStart).count();
+     event.result = result;
+     event.text = text;
 
-     if( !self->m_robot->startMotion3D(0, 0, 0) )
+     std::lock_guard<std::mutex> lock(m_listenerMutex);
+     for( std::map<int, EventListener>::iterator i = m_listeners.begin() ; i != m_listeners.end() ; ++i )
      {
-          return luaL_error(L, "go_home - Unable to start motion");
+          i->second(event);
      }
-     return 0;
 }
 
 //------------------------------------------------------------------------------
-int Script::grip(lua_State *L)
+void Script::abort()
+{
+     m_aborted = true;
+     std::lock_guard<std::mutex> lock(m_waitMutex);
+     m_waitCond.notify_all();
+}
+
+//------------------------------------------------------------------------------
+//   スタックトップのチャンク (スクリプト全体) をタスク main として実行する
+//   main が spawn() したタスクと合わせて，すべてこのスレッドで切り替えて動かす
+//   (待っている動作の完了はモーション監視スレッドなどからの通知で知る)
+//   main が終わるか，どれかのタスクでエラーが起きたら終える
+//------------------------------------------------------------------------------
+void Script::runMain(lua_State *L)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
+     m_tasks.clear();
+     m_taskOrder = 0;
+     newTask(L, "main", 0);
+     m_currentTask = 0;
+     m_armOwner = 0;
 
-     int value = (int)luaL_checknumber(L, 1);
-     if( value < 0 || 100 < value )
+     while( !m_aborted && !m_terminated && m_tasks[0].state != TASK_DONE )
      {
-          return luaL_error(L, "grip - Out of range (%d)", value);
+          uint32_t events;
+          {
+               std::lock_guard<std::mutex> lock(m_waitMutex);
+               events = m_waitEvents;
+          }
+          updateTasks(L);
+          int next = nextTask();
+          if( next < 0 )
+          {
+               waitTasks(L, events);
+          }
+          else if( !resumeTask(L, next) )
+          {
+               break;
+          }
      }
-
-     self->m_robot->moveGripper((uint8_t)value);
-     return 0;
+     endTasks(L);
 }
 
 //------------------------------------------------------------------------------
-int Script::delayScript(lua_State *L)
+int Script::atPanic(lua_State *L)
 {
      lua_getglobal(L, GLOBAL_NAME);
      Script *self = (Script *)lua_touserdata(L, -1);
      lua_pop(L, 1);
 
-     uint32_t value = (uint32_t)luaL_checknumber(L, 1);
-     if( value == 0 || 60000 < value )
+     if( self->m_aborted || self->m_terminated )
      {
-          return luaL_error(L, "delay - Out of range (%d)", value);
+          return 0;
      }
 
-     uint32_t timeout = millis() + value;
-     while( (millis() < timeout) && !self->m_aborted )
+     self->m_errorMessage = formatError(lua_tostring(L, 1));
+     // self->m_errorMessage = std::string(lua_tostring(L, 1));
+
+     return 0;
+}
+
+//------------------------------------------------------------------------------
+//   Lua のエラーメッセージ ([名前]:行: 内容) を ERROR [line 行] 内容 にする
+//------------------------------------------------------------------------------
+std::string Script::formatError(const char *msg)
+{
+     std::regex re("\\[.+\\]:(\\d+):\\s*(.+)");
+     std::cmatch cm;
+     std::regex_match(msg, cm, re);
+     if( cm.empty() )
      {
-          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          return msg;
      }
-     return 0;
+     std::ostringstream oss;
+     oss << "ERROR [line " << cm[1] << "] " << cm[2];
+     return oss.str();
 }
 
 //------------------------------------------------------------------------------
-int Script::inMotion(lua_State *L)
+//   HOOK_COUNT 命令ごとに中断の要求を確認する (ここでは待たない)
+//   スクリプトが CPU を譲るのは delay() と，移動中の in_motion() だけ
+//   待たずにメモリを使い続けている場合は，ここで GC を進める
+//------------------------------------------------------------------------------
+void Script::hookProc(lua_State *L, lua_Debug *ar)
 {
      lua_getglobal(L, GLOBAL_NAME);
      Script *self = (Script *)lua_touserdata(L, -1);
      lua_pop(L, 1);
 
-     int b = self->m_robot->isInMotion()? 1 : 0;
-
-     lua_pushboolean(L, b);
-     return 1;
+     if( self->m_aborted || self->m_terminated )
+     {
+          luaL_error(L, "aborted.");
+     }
+     self->m_memory->collectForced(L);
 }
 
 //------------------------------------------------------------------------------
-int Script::alarmHappened(lua_State *L)
+//   moveto() の第４引数 { speed = mm/sec, accel = mm/sec^2 } を読む
+//   (省略時・項目がない場合は 0 = 既定値)
+//------------------------------------------------------------------------------
+static void getMoveOptions(lua_State *L, int index, double *speed, double *accel)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
+     *speed = 0;
+     *accel = 0;
+     if( lua_isnoneornil(L, index) )
+     {
+          return;
+     }
+     luaL_checktype(L, index, LUA_TTABLE);
+     lua_getfield(L, index, "speed");
+     *speed = luaL_optnumber(L, -1, 0);
      lua_pop(L, 1);
-
-     int b = self->m_robot->isAlarmHappened()? 1 : 0;
-
-     lua_pushboolean(L, b);
-     return 1;
+     lua_getfield(L, index, "accel");
+     *accel = luaL_optnumber(L, -1, 0);
+     lua_pop(L, 1);
+     if( *speed < 0 || *accel < 0 )
+     {
+          luaL_error(L, "moveto - speed and accel must be positive");
+     }
 }
 
 //------------------------------------------------------------------------------
-int Script::getPosition(lua_State *L)
+ScriptMoveOptions LuaType<ScriptMoveOptions>::get(lua_State *L, int index)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
+     ScriptMoveOptions options;
+     getMoveOptions(L, index, &options.speed, &options.accel);
+     return options;
+}
 
-     int32_t pos[3];
-     double x, y, z;
-     for( int n = 0 ; n < 3 ; n++ )
+//------------------------------------------------------------------------------
+//   get_position() の戻り値 { x = , y = , z = }
+//   テーブルが渡されていればそれに入れる。なければ３項目分の大きさで作る
+//------------------------------------------------------------------------------
+static LuaReturn pushPosition(lua_State *L, LuaOptional<LuaTable> table, double x, double y, double z)
+{
+     if( table.present )
      {
-          pos[n] = self->m_robot->getMotorPosition(n);
+          lua_pushvalue(L, table.value.index);
+     }
+     else
+     {
+          lua_createtable(L, 0, 3);
      }
-     Robot::motorPosToCoord(pos[0], pos[1], pos[2], &x, &y, &z);
-     
-     // 戻り値を格納するためのテーブルを作成する
-     lua_newtable(L);
-
-     // 以下，テーブル（連想配列）の「キー」「値」の順にスタックに積み
-     // それをテーブルへ格納する，という手順を繰り返す
-     lua_pushstring(L, "x");
      lua_pushnumber(L, x);
-     lua_settable(L, -3);
-
-     lua_pushstring(L, "y");
+     lua_setfield(L, -2, "x");
      lua_pushnumber(L, y);
-     lua_settable(L, -3);
-
-     lua_pushstring(L, "z");
+     lua_setfield(L, -2, "y");
      lua_pushnumber(L, z);
-     lua_settable(L, -3);
-     
-     return 1; // テーブルはスタックのトップにある
+     lua_setfield(L, -2, "z");
+     return LuaReturn(1);
 }
 
 //------------------------------------------------------------------------------
-int Script::exitScript(lua_State *L)
+//   モータの位置(pulse)から原点からの関節角度(deg)
+//------------------------------------------------------------------------------
+static std::tuple<double, double, double> jointAngles(int32_t base, int32_t shoulder, int32_t elbow)
 {
-     lua_getglobal(L, GLOBAL_NAME);
-     Script *self = (Script *)lua_touserdata(L, -1);
-     lua_pop(L, 1);
+     return std::make_tuple(base / KinematicModel::BASE_PULSE_PER_RAD * 180 / M_PI,
+          shoulder / KinematicModel::ARM_PULSE_PER_RAD * 180 / M_PI, elbow / KinematicModel::ARM_PULSE_PER_RAD * 180 / M_PI);
+}
 
-     lua_sethook(L, &hookProc, LUA_MASKLINE, 0);
-     self->m_aborted = true;
-     return 0;
+//------------------------------------------------------------------------------
+//   move_path() の引数 (点の配列，{ speed, accel, joint }) を各軸の移動先の列にする
+//   点は { x, y, z } または { x = , y = , z = } (mm)。joint = true のときは関節角度(deg)で
+//   { base, shoulder, elbow } または { base = , shoulder = , elbow = }
+//   動かす前にすべての点を逆運動学で解いて範囲を調べ，範囲外の点があればその番号 (1 ～) を返す
+//   引数の誤りは luaL_error() で抜けるので，path はローカル変数にしないこと (Script::m_pathPoints)
+//------------------------------------------------------------------------------
+static int readPath(lua_State *L, std::vector<MotionTarget> *path)
+{
+     static const char *KEYS[2][3] = { { "x", "y", "z" }, { "base", "shoulder", "elbow" } };
+
+     luaL_checktype(L, 1, LUA_TTABLE);
+     double speed, accel;
+     getMoveOptions(L, 2, &speed, &accel);
+     int joint = 0;
+     if( lua_istable(L, 2) )
+     {
+          lua_getfield(L, 2, "joint");
+          joint = lua_toboolean(L, -1)? 1 : 0;
+          lua_pop(L, 1);
+     }
+
+     int count = (int)lua_objlen(L, 1);
+     if( count == 0 || Robot::MAX_QUEUE_LENGTH < count )
+     {
+          return luaL_error(L, "move_path - Number of points must be 1 to %d", (int)Robot::MAX_QUEUE_LENGTH);
+     }
+     path->resize(count);
+     for( int n = 1 ; n <= count ; n++ )
+     {
+          lua_rawgeti(L, 1, n);
+          if( !lua_istable(L, -1) )
+          {
+               return luaL_error(L, "move_path - Point %d is not a table", n);
+          }
+          double value[3];
+          for( int i = 0 ; i < 3 ; i++ )
+          {
+               lua_rawgeti(L, -1, i + 1);
+               if( lua_isnil(L, -1) )
+               {
+                    lua_pop(L, 1);
+                    lua_getfield(L, -1, KEYS[joint][i]);
+               }
+               if( !lua_isnumber(L, -1) )
+               {
+                    return luaL_error(L, "move_path - Point %d has no %s", n, KEYS[joint][i]);
+               }
+               value[i] = lua_tonumber(L, -1);
+               lua_pop(L, 1);
+          }
+          lua_pop(L, 1);
+
+          MotionTarget& target = (*path)[n - 1];
+          bool valid;
+          if( joint )
+          {
+               target.position[0] = (int32_t)std::lround(value[0] * M_PI / 180 * KinematicModel::BASE_PULSE_PER_RAD);
+               target.position[1] = (int32_t)std::lround(value[1] * M_PI / 180 * KinematicModel::ARM_PULSE_PER_RAD);
+               target.position[2] = (int32_t)std::lround(value[2] * M_PI / 180 * KinematicModel::ARM_PULSE_PER_RAD);
+               valid = Robot::isValidMotorPos(target.position[0], target.position[1], target.position[2]);
+          }
+          else
+          {
+               valid = Robot::coordToMotorPos(value[0], value[1], value[2], &target.position[0], &target.position[1], &target.position[2]);
+          }
+          if( !valid )
+          {
+               return n;
+          }
+          target.speed = speed;
+          target.accel = accel;
+          target.unit = joint? Robot::UNIT_DEG : Robot::UNIT_MM;
+     }
+     return 0;
+}
+
+//------------------------------------------------------------------------------
+//   moveto(x, y, z [, { speed = mm/sec, accel = mm/sec^2 }])
+//------------------------------------------------------------------------------
+LuaReturn Script::moveTo(lua_State *L, double x, double y, double z, ScriptMoveOptions options)
+{
+     checkArm(L, "moveto");
+
+     int32_t b, s, e;
+     if( !Robot::coordToMotorPos(x, y, z, &b, &s, &e) )
+     {
+          luaL_error(L, "moveto - Designated position is out of range");
+     }
+     if( !m_robot->startMotion3D(b, s, e, options.speed, options.accel, Robot::UNIT_MM) )
+     {
+          luaL_error(L, "moveto - Unable to start motion");
+     }
+     m_movesIssued++;
+     if( canYield(L) )
+     {
+          return taskWait(L, TASK_SLEEP, MOVETO_WAIT_MS, ScriptProfile::CAT_MOTION_WAIT);
+     }
+     if( m_profiling )
+     {
+          ProfileClock::time_point t0 = ProfileClock::now();
+          std::this_thread::sleep_for(std::chrono::milliseconds(MOVETO_WAIT_MS));
+          addWait(ScriptProfile::CAT_MOTION_WAIT, t0);
+          return LuaReturn(0);
+     }
+     std::this_thread::sleep_for(std::chrono::milliseconds(MOVETO_WAIT_MS));
+     return LuaReturn(0);
+}
+
+//------------------------------------------------------------------------------
+void Script::goHome(lua_State *L)
+{
+     checkArm(L, "go_home");
+
+     if( !m_robot->startMotion3D(0, 0, 0) )
+     {
+          luaL_error(L, "go_home - Unable to start motion");
+     }
+     m_movesIssued++;
+}
+
+//------------------------------------------------------------------------------
+void Script::grip(lua_State *L, int value)
+{
+     checkArm(L, "grip");
+
+     if( value < 0 || 100 < value )
+     {
+          luaL_error(L, "grip - Out of range (%d)", value);
+     }
+
+     m_robot->moveGripper((uint8_t)value);
+     m_gripsIssued++;
+}
+
+//------------------------------------------------------------------------------
+LuaReturn Script::delayScript(lua_State *L, double ms)
+{
+     uint32_t value = (uint32_t)ms;
+     if( value == 0 || 60000 < value )
+     {
+          luaL_error(L, "delay - Out of range (%d)", value);
+     }
+     if( canYield(L) )
+     {
+          return taskWait(L, TASK_SLEEP, (int32_t)value, ScriptProfile::CAT_DELAY);
+     }
+
+     ProfileClock::time_point t0;
+     if( m_profiling )
+     {
+          t0 = ProfileClock::now();
+     }
+     uint32_t timeout = millis() + value;
+     while( (millis() < timeout) && !m_aborted )
+     {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+     }
+     if( m_profiling )
+     {
+          addWait(ScriptProfile::CAT_DELAY, t0);
+     }
+     return LuaReturn(0);
+}
+
+//------------------------------------------------------------------------------
+LuaReturn Script::inMotion(lua_State *L)
+{
+     int b = m_robot->isInMotion()? 1 : 0;
+     if( b && canYield(L) )
+     {
+          // while in_motion() do end で待つ間は他のタスクを動かす
+          return taskWait(L, TASK_SLEEP, IN_MOTION_WAIT_MS, ScriptProfile::CAT_MOTION_WAIT, true);
+     }
+     if( b )
+     {
+          // while in_motion() do end で待つスクリプトが CPU を使い切らないように
+          // (待つ間に GC を進める)
+          ProfileClock::time_point t0;
+          if( m_profiling )
+          {
+               t0 = ProfileClock::now();
+          }
+          m_memory->collectIdle(L, GC_IDLE_MS);
+          std::this_thread::sleep_for(std::chrono::milliseconds(IN_MOTION_WAIT_MS));
+          if( m_profiling )
+          {
+               addWait(ScriptProfile::CAT_MOTION_WAIT, t0);
+          }
+     }
+
+     lua_pushboolean(L, b);
+     return LuaReturn(1);
+}
+
+//------------------------------------------------------------------------------
+bool Script::alarmHappened(lua_State *L)
+{
+     return m_robot->isAlarmHappened();
+}
+
+//------------------------------------------------------------------------------
+//   p = get_position([p])
+//   テーブル p を渡すとそこに入れて返す (ループの中で毎回テーブルを作らずに済む)
+//------------------------------------------------------------------------------
+LuaReturn Script::getPosition(lua_State *L, LuaOptional<LuaTable> table)
+{
+     int32_t pos[3];
+     double x, y, z;
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          pos[n] = m_robot->getMotorPosition(n);
+     }
+     Robot::motorPosToCoord(pos[0], pos[1], pos[2], &x, &y, &z);
+     return pushPosition(L, table, x, y, z);
+}
+
+//------------------------------------------------------------------------------
+//   base, shoulder, elbow = get_joint()
+//   原点からの各軸の角度(deg)
+//------------------------------------------------------------------------------
+std::tuple<double, double, double> Script::getJoint(lua_State *L)
+{
+     return jointAngles(m_robot->getMotorPosition(0), m_robot->getMotorPosition(1), m_robot->getMotorPosition(2));
+}
+
+//------------------------------------------------------------------------------
+//   value = get_gripper()
+//------------------------------------------------------------------------------
+int Script::getGripper(lua_State *L)
+{
+     return m_robot->getGripperServoValue();
+}
+
+//------------------------------------------------------------------------------
+//   percent = get_feed_override()
+//------------------------------------------------------------------------------
+int Script::getFeedOverride(lua_State *L)
+{
+     return m_robot->getFeedOverride();
+}
+
+#ifdef USE_LUAJIT
+//------------------------------------------------------------------------------
+//   FFI 版の in_motion() / alarm_hapenned() / get_position()
+//   動作は inMotion() / alarmHappened() / getPosition() と同じ
+//   ただし script_in_motion() は移動中なら 2 を返すだけで，待つのはラッパーから呼ぶ inMotion()
+//   (ffi.C から見えるように，実行ファイルは -rdynamic でリンクする)
+//------------------------------------------------------------------------------
+int script_in_motion(void *script)
+{
+     Script *self = (Script *)script;
+     if( self->m_aborted || self->m_terminated )
+     {
+          return -1;
+     }
+     return self->m_robot->isInMotion()? 2 : 0;
+}
+
+//------------------------------------------------------------------------------
+int script_alarm_happened(void *script)
+{
+     Script *self = (Script *)script;
+     if( self->m_aborted || self->m_terminated )
+     {
+          return -1;
+     }
+     return self->m_robot->isAlarmHappened()? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+int script_get_position(void *script, double *xyz)
+{
+     Script *self = (Script *)script;
+     if( self->m_aborted || self->m_terminated )
+     {
+          return -1;
+     }
+     int32_t pos[3];
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          pos[n] = self->m_robot->getMotorPosition(n);
+     }
+     Robot::motorPosToCoord(pos[0], pos[1], pos[2], &xyz[0], &xyz[1], &xyz[2]);
+     return 0;
+}
+#endif
+
+//------------------------------------------------------------------------------
+void Script::exitScript(lua_State *L)
+{
+     lua_sethook(L, &hookProc, LUA_MASKLINE, 0);
+     m_exited = true;
+     m_aborted = true;
+}
+
+//------------------------------------------------------------------------------
+//   output_str(...) (print) : 引数を tostring() して TAB でつなぎ，１行として
+//   標準出力と addListener() で登録した関数へ送る
+//   (tostring() のエラーで抜けてもよいように，文字列は Lua のバッファで組み立てる)
+//------------------------------------------------------------------------------
+void Script::outputStr(lua_State *L)
+{
+     int n = lua_gettop(L);
+     luaL_Buffer buffer;
+     lua_getglobal(L, "tostring");
+     luaL_buffinit(L, &buffer);
+     for( int i = 1 ; i <= n ; i++ )
+     {
+          lua_pushvalue(L, n + 1);
+          lua_pushvalue(L, i);
+          lua_call(L, 1, 1);
+          if( !lua_isstring(L, -1) )
+          {
+               luaL_error(L, "'tostring' must return a string to 'print'");
+          }
+          if( i > 1 )
+          {
+               luaL_addchar(&buffer, '\t');
+          }
+          luaL_addvalue(&buffer);
+     }
+     luaL_pushresult(&buffer);
+
+     size_t length;
+     const char *s = lua_tolstring(L, -1, &length);
+     std::string line(s, length);
+     std::printf("%s\n", line.c_str());
+     notify(ScriptEvent::KIND_OUTPUT, line);
+}
+
+//==============================================================================
+//   非同期の動作と await
+//==============================================================================
+//   ハンドルを作って，Lua に返す番号を返す
+//------------------------------------------------------------------------------
+int Script::newHandle(int kind, uint32_t sequence, double endTime)
+{
+     Handle handle;
+     handle.kind = kind;
+     handle.sequence = sequence;
+     handle.endTime = endTime;
+     m_handles.push_back(handle);
+     return (int)m_handles.size();
+}
+
+//------------------------------------------------------------------------------
+//   移動 : その移動とそれより前の移動がすべて終わった (キューから外れた場合も含む)
+//   グリッパー : 目標値に着いたか，後の grip_async() / grip() で目標値が変わった
+//------------------------------------------------------------------------------
+bool Script::isHandleDone(const Handle& handle)
+{
+     if( handle.kind == HANDLE_MOVE )
+     {
+          return handle.sequence + (uint32_t)m_robot->getPendingMotions() <= m_movesIssued;
+     }
+     return handle.sequence < m_gripsIssued || !m_robot->isGripperMoving();
+}
+
+//------------------------------------------------------------------------------
+//   L のスタックの first ～ last にあるハンドルがすべて完了するまで待つ
+//   試運転では仮想時刻を最も遅い完了時刻まで進める
+//   途中でアラームが発生していれば false
+//------------------------------------------------------------------------------
+bool Script::waitHandles(lua_State *L, int first, int last)
+{
+     if( m_dryRun )
+     {
+          double t = m_virtual.getTime();
+          for( int n = first ; n <= last ; n++ )
+          {
+               const Handle& handle = m_handles[lua_tointeger(L, n) - 1];
+               double end = handle.endTime + ((handle.kind == HANDLE_MOVE)? VirtualRobot::DETECT_DELAY : 0);
+               t = std::max(t, end);
+          }
+          m_virtual.advance(t - m_virtual.getTime());
+          return true;
+     }
+
+     // 計測中は，移動を１つでも待てば移動待ち，グリッパーだけならグリッパー待ちとする
+     int category = ScriptProfile::CAT_GRIPPER_WAIT;
+     ProfileClock::time_point t0;
+     if( m_profiling )
+     {
+          t0 = ProfileClock::now();
+          for( int n = first ; n <= last ; n++ )
+          {
+               if( m_handles[lua_tointeger(L, n) - 1].kind == HANDLE_MOVE )
+               {
+                    category = ScriptProfile::CAT_MOTION_WAIT;
+               }
+          }
+     }
+
+     m_memory->collectIdle(L, GC_IDLE_MS);
+     std::unique_lock<std::mutex> lock(m_waitMutex);
+     while( !m_aborted && !m_terminated )
+     {
+          bool done = true;
+          for( int n = first ; n <= last && done ; n++ )
+          {
+               done = isHandleDone(m_handles[lua_tointeger(L, n) - 1]);
+          }
+          if( done )
+          {
+               break;
+          }
+          // 通知を取りこぼしても止まったままにならないよう，AWAIT_CHECK_MS ごとに見直す
+          m_waitCond.wait_for(lock, std::chrono::milliseconds(AWAIT_CHECK_MS));
+     }
+     if( m_profiling )
+     {
+          addWait(category, t0);
+     }
+     return !m_robot->isAlarmHappened();
+}
+
+//------------------------------------------------------------------------------
+//   スタックのハンドル (1 ～ top) を調べて待つ
+//   タスクのコルーチンからは yield して，待っている間は他のタスクを動かす
+//   それ以外 (スクリプトが作ったコルーチンの中，pcall の中など : canYield()) と試運転では，ここで待つ
+//------------------------------------------------------------------------------
+LuaReturn Script::awaitHandles(lua_State *L, const char *name)
+{
+     int n = lua_gettop(L);
+     for( int i = 1 ; i <= n ; i++ )
+     {
+          lua_Integer h = lua_tointeger(L, i);
+          if( !lua_isnumber(L, i) || h < 1 || (lua_Integer)m_handles.size() < h )
+          {
+               luaL_error(L, "%s - Invalid handle", name);
+          }
+     }
+     if( !m_dryRun && canYield(L) )
+     {
+          Task& task = m_tasks[m_currentTask];
+          int category = ScriptProfile::CAT_GRIPPER_WAIT;
+          task.handles.clear();
+          for( int i = 1 ; i <= n ; i++ )
+          {
+               task.handles.push_back((int)lua_tointeger(L, i));
+               if( m_handles[task.handles.back() - 1].kind == HANDLE_MOVE )
+               {
+                    category = ScriptProfile::CAT_MOTION_WAIT;
+               }
+          }
+          lua_settop(L, 0);
+          return taskWait(L, TASK_AWAIT, -1, category);
+     }
+     lua_pushboolean(L, waitHandles(L, 1, n));
+     return LuaReturn(1);
+}
+
+//------------------------------------------------------------------------------
+//   h = moveto_async(x, y, z [, { speed = mm/sec, accel = mm/sec^2 }])
+//   移動を開始して (移動中であればモーションキューに積んで) すぐに戻る
+//------------------------------------------------------------------------------
+int Script::moveToAsync(lua_State *L, double x, double y, double z, ScriptMoveOptions options)
+{
+     checkArm(L, "moveto_async");
+
+     int32_t b, s, e;
+     if( !Robot::coordToMotorPos(x, y, z, &b, &s, &e) )
+     {
+          luaL_error(L, "moveto_async - Designated position is out of range");
+     }
+     if( m_robot->getPendingMotions() > 0 )
+     {
+          MotionTarget target;
+          target.position[0] = b;
+          target.position[1] = s;
+          target.position[2] = e;
+          target.speed = options.speed;
+          target.accel = options.accel;
+          target.unit = Robot::UNIT_MM;
+          if( !m_robot->queueMotion(&target, 1) )
+          {
+               luaL_error(L, "moveto_async - Unable to queue motion");
+          }
+     }
+     else if( !m_robot->startMotion3D(b, s, e, options.speed, options.accel, Robot::UNIT_MM) )
+     {
+          luaL_error(L, "moveto_async - Unable to start motion");
+     }
+     m_movesIssued++;
+     return newHandle(HANDLE_MOVE, m_movesIssued, 0);
+}
+
+//------------------------------------------------------------------------------
+//   h = move_path(points [, { speed = , accel = , joint = true }])
+//   点の列を止まらずに通過する連続軌道を開始してすぐに戻る
+//   (速度・加速度の単位は mm/sec, mm/sec^2，joint = true のときは deg/sec, deg/sec^2)
+//------------------------------------------------------------------------------
+//   (引数は readPath() で読む)
+//------------------------------------------------------------------------------
+LuaReturn Script::movePath(lua_State *L)
+{
+     checkArm(L, "move_path");
+
+     int bad = readPath(L, &m_pathPoints);
+     if( bad > 0 )
+     {
+          luaL_error(L, "move_path - Point %d is out of range", bad);
+     }
+     if( m_robot->getPendingMotions() > 0 )
+     {
+          luaL_error(L, "move_path - Unable to start path (in motion)");
+     }
+     if( !m_robot->startPath(m_pathPoints) )
+     {
+          luaL_error(L, "move_path - Unable to start path");
+     }
+     m_movesIssued++;
+     lua_pushinteger(L, newHandle(HANDLE_MOVE, m_movesIssued, 0));
+     return LuaReturn(1);
+}
+
+//------------------------------------------------------------------------------
+//   h = grip_async(value)
+//------------------------------------------------------------------------------
+int Script::gripAsync(lua_State *L, int value)
+{
+     checkArm(L, "grip_async");
+
+     if( value < 0 || 100 < value )
+     {
+          luaL_error(L, "grip_async - Out of range (%d)", value);
+     }
+
+     m_robot->moveGripper((uint8_t)value);
+     m_gripsIssued++;
+     return newHandle(HANDLE_GRIP, m_gripsIssued, 0);
+}
+
+//------------------------------------------------------------------------------
+//   ok = await(h [, h2, ...])
+//   すべての動作の完了を待つ。アラームが発生していれば false
+//------------------------------------------------------------------------------
+LuaReturn Script::await(lua_State *L)
+{
+     return awaitHandles(L, "await");
+}
+
+//------------------------------------------------------------------------------
+//   ok = await_all{ h1, h2, ... }
+//------------------------------------------------------------------------------
+LuaReturn Script::awaitAll(lua_State *L, LuaTable handles)
+{
+     int n = (int)lua_objlen(L, handles.index);
+     luaL_checkstack(L, n, "await_all - Too many handles");
+     for( int i = 1 ; i <= n ; i++ )
+     {
+          lua_rawgeti(L, handles.index, i);
+     }
+     lua_remove(L, handles.index);
+     return awaitHandles(L, "await_all");
+}
+
+//==============================================================================
+//   タスク
+//   main (スクリプト本体) と spawn() で作ったタスクは同じ lua_State のコルーチンで，
+//   runMain() が１つずつ resume する (協調型。グローバル変数は共有する)
+//   タスクが切り替わるのは，await() / delay() / moveto() / 移動中の in_motion() /
+//   receive() / take_arm() で待つときと，task_yield() または coroutine.yield() したとき
+//   実行できるタスクのうち優先度の高いものから，同じ優先度では先に実行できるように
+//   なったものから動かす (待たずに計算を続けるタスクがあれば，他は動かない)
+//   ロボットに動作を指示できるのは，アームを持っているタスクだけ (最初は main)
+//==============================================================================
+//   スタックトップの関数をタスクにする (関数は取り除く)
+//   終わったタスクの場所があれば使い回す (main は除く)
+//   Lua の API はメモリ不足で longjmp することがあるので，先に済ませてから
+//   m_tasks と名前 (std::string) を変える
+//------------------------------------------------------------------------------
+int Script::newTask(lua_State *L, const char *name, int priority)
+{
+     lua_State *thread = lua_newthread(L);
+     lua_insert(L, -2);
+     lua_xmove(L, thread, 1);
+     int threadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+     lua_newtable(L);
+     int queueRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+     int index = (int)m_tasks.size();
+     for( int n = 1 ; n < (int)m_tasks.size() ; n++ )
+     {
+          if( m_tasks[n].state == TASK_DONE )
+          {
+               luaL_unref(L, LUA_REGISTRYINDEX, m_tasks[n].threadRef);
+               luaL_unref(L, LUA_REGISTRYINDEX, m_tasks[n].queueRef);
+               index = n;
+               break;
+          }
+     }
+     if( index == (int)m_tasks.size() )
+     {
+          m_tasks.push_back(Task());
+     }
+
+     Task& task = m_tasks[index];
+     task.name = name;
+     task.priority = priority;
+     task.thread = thread;
+     task.threadRef = threadRef;
+     task.queueRef = queueRef;
+     task.queueHead = 0;
+     task.queueTail = 0;
+     task.state = TASK_READY;
+     task.started = false;
+     task.order = ++m_taskOrder;
+     task.wakeTime = 0;
+     task.forever = false;
+     task.sleepResult = false;
+     task.category = -1;
+     task.line = 0;
+     task.handles.clear();
+     return index;
+}
+
+//------------------------------------------------------------------------------
+//   L がタスクのコルーチンそのものであればその番号 (タスクの中で作ったコルーチンは -1)
+//------------------------------------------------------------------------------
+int Script::findTask(lua_State *L)
+{
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          if( m_tasks[n].thread == L && m_tasks[n].state != TASK_DONE )
+          {
+               return n;
+          }
+     }
+     return -1;
+}
+
+//------------------------------------------------------------------------------
+//   L がタスクのコルーチンそのもので，ここから yield できれば true
+//   Lua 5.1 は C の関数 (pcall, xpcall, table.sort など)・メタメソッド・for のイテレータを
+//   またいで yield できない ("attempt to yield across metamethod/C-call boundary")
+//   呼び出し元をたどって，それらの中から呼ばれていれば false (呼んだ関数はその場で待つ)
+//   メタメソッドは呼び出し元の名前が分からない Lua の関数として見えるので，
+//   (function() ... end)() のような名前のない呼び出しも念のため false にする
+//------------------------------------------------------------------------------
+bool Script::canYield(lua_State *L)
+{
+     if( findTask(L) < 0 )
+     {
+          return false;
+     }
+     lua_Debug ar;
+     for( int level = 1 ; lua_getstack(L, level, &ar) ; level++ )
+     {
+          lua_getinfo(L, "Sn", &ar);
+          if( std::strcmp(ar.what, "C") == 0 )
+          {
+               return false;
+          }
+          if( ar.name != NULL && std::strcmp(ar.name, "(for generator)") == 0 )
+          {
+               return false;
+          }
+          if( std::strcmp(ar.what, "tail") != 0 && ar.namewhat[0] == '\0' )
+          {
+               // 名前がなくてよいのは，タスクの関数 (一番下) と末尾呼び出しされた関数だけ
+               lua_Debug caller;
+               if( lua_getstack(L, level + 1, &caller) )
+               {
+                    lua_getinfo(L, "S", &caller);
+                    if( std::strcmp(caller.what, "tail") != 0 )
+                    {
+                         return false;
+                    }
+               }
+          }
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+int Script::findTask(const std::string& name)
+{
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          if( m_tasks[n].name == name && m_tasks[n].state != TASK_DONE )
+          {
+               return n;
+          }
+     }
+     return -1;
+}
+
+//------------------------------------------------------------------------------
+//   task の受信キューの先頭を取り出して L に積む
+//------------------------------------------------------------------------------
+void Script::popMessage(lua_State *L, Task& task)
+{
+     task.queueHead++;
+     lua_rawgeti(L, LUA_REGISTRYINDEX, task.queueRef);
+     lua_rawgeti(L, -1, task.queueHead);
+     lua_pushnil(L);
+     lua_rawseti(L, -3, task.queueHead);
+     lua_remove(L, -2);
+}
+
+//------------------------------------------------------------------------------
+//   待ちの終わったタスクを実行可能にする
+//   待っていた関数の戻り値は，ここでタスクのスタックに積んでおく (resume の引数になる)
+//------------------------------------------------------------------------------
+void Script::updateTasks(lua_State *L)
+{
+     uint32_t now = millis();
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          Task& task = m_tasks[n];
+          bool expired = !task.forever && (int32_t)(now - task.wakeTime) >= 0;
+          bool ready = false;
+          if( task.state == TASK_AWAIT )
+          {
+               ready = true;
+               for( int h : task.handles )
+               {
+                    ready = ready && isHandleDone(m_handles[h - 1]);
+               }
+               if( ready )
+               {
+                    lua_pushboolean(task.thread, !m_robot->isAlarmHappened());
+               }
+          }
+          else if( task.state == TASK_SLEEP )
+          {
+               ready = expired;
+               if( ready && task.sleepResult )
+               {
+                    lua_pushboolean(task.thread, 1);
+               }
+          }
+          else if( task.state == TASK_RECEIVE )
+          {
+               if( task.queueHead != task.queueTail )
+               {
+                    popMessage(L, task);
+                    lua_xmove(L, task.thread, 1);
+                    ready = true;
+               }
+               else if( expired )
+               {
+                    lua_pushnil(task.thread);
+                    ready = true;
+               }
+          }
+          else if( task.state == TASK_ARM )
+          {
+               if( m_armOwner < 0 )
+               {
+                    m_armOwner = n;
+                    lua_pushboolean(task.thread, 1);
+                    ready = true;
+               }
+               else if( expired )
+               {
+                    lua_pushboolean(task.thread, 0);
+                    ready = true;
+               }
+          }
+          if( ready )
+          {
+               task.state = TASK_READY;
+               task.order = ++m_taskOrder;
+          }
+     }
+}
+
+//------------------------------------------------------------------------------
+//   次に実行するタスク (なければ -1)
+//------------------------------------------------------------------------------
+int Script::nextTask()
+{
+     int next = -1;
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          const Task& task = m_tasks[n];
+          if( task.state != TASK_READY )
+          {
+               continue;
+          }
+          if( next < 0 || task.priority > m_tasks[next].priority ||
+               (task.priority == m_tasks[next].priority && (int32_t)(task.order - m_tasks[next].order) < 0) )
+          {
+               next = n;
+          }
+     }
+     return next;
+}
+
+//------------------------------------------------------------------------------
+//   タスクを次に待つところまで実行する
+//   エラーで終わったら false (エラーメッセージは m_errorMessage に入る)
+//------------------------------------------------------------------------------
+bool Script::resumeTask(lua_State *L, int index)
+{
+     lua_State *co = m_tasks[index].thread;
+     int nargs = lua_gettop(co) - (m_tasks[index].started? 0 : 1);
+     m_tasks[index].started = true;
+     m_currentTask = index;
+     if( m_profiling )
+     {
+          chargeLine();
+          m_profileLine = m_tasks[index].line;
+     }
+     int status = lua_resume(co, nargs);
+
+     Task& task = m_tasks[index];       // spawn() で m_tasks が伸びていることがある
+     task.line = m_profileLine;
+     if( status == LUA_YIELD )
+     {
+          lua_settop(co, 0);
+          if( task.state == TASK_READY )
+          {
+               task.order = ++m_taskOrder;   // task_yield() / coroutine.yield() : 同じ優先度の後ろへ回す
+          }
+          return true;
+     }
+
+     task.state = TASK_DONE;
+     if( m_armOwner == index )
+     {
+          m_armOwner = -1;
+     }
+     if( status != 0 )
+     {
+          lua_settop(L, 0);
+          lua_xmove(co, L, 1);          // エラーメッセージ
+          atPanic(L);
+          if( index > 0 && m_errorMessage.length() > 0 )
+          {
+               m_errorMessage += " (task " + task.name + ")";
+          }
+          return false;
+     }
+     if( index > 0 )
+     {
+          std::printf("[Script] task '%s' finished.\n", task.name.c_str());
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   実行できるタスクがないとき，動作の完了の通知か，最も早い時間切れまで待つ
+//   (events は updateTasks() の前に読んだ通知の回数。その後に来た通知は取りこぼさない)
+//   待つ前に GC を進める (通知が来ていれば進めない)
+//------------------------------------------------------------------------------
+void Script::waitTasks(lua_State *L, uint32_t events)
+{
+     uint32_t now = millis();
+     int32_t timeout = AWAIT_CHECK_MS;
+     int waiting = -1;
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          const Task& task = m_tasks[n];
+          if( task.state == TASK_READY || task.state == TASK_DONE )
+          {
+               continue;
+          }
+          if( !task.forever && task.state != TASK_AWAIT )
+          {
+               timeout = std::min(timeout, std::max((int32_t)(task.wakeTime - now), (int32_t)0));
+          }
+          // 計測では，待っているタスクのうち優先度の最も高いもの (同じなら先に作ったもの) の
+          // 待ちとして，そのタスクの行と種類に数える
+          if( task.category >= 0 && (waiting < 0 || task.priority > m_tasks[waiting].priority) )
+          {
+               waiting = n;
+          }
+     }
+
+     ProfileClock::time_point t0;
+     int category = -1;
+     if( m_profiling && waiting >= 0 )
+     {
+          chargeLine();
+          m_profileLine = m_tasks[waiting].line;
+          category = m_tasks[waiting].category;
+          t0 = ProfileClock::now();
+     }
+     bool notified;
+     {
+          std::lock_guard<std::mutex> lock(m_waitMutex);
+          notified = (m_waitEvents != events);
+     }
+     if( !notified && timeout > 0 )
+     {
+          m_memory->collectIdle(L, std::min(timeout, (int32_t)GC_IDLE_MS));
+          timeout = std::max(timeout - (int32_t)(millis() - now), (int32_t)0);
+     }
+     {
+          std::unique_lock<std::mutex> lock(m_waitMutex);
+          m_waitCond.wait_for(lock, std::chrono::milliseconds(timeout), [this, events](){
+               return m_waitEvents != events || m_aborted || m_terminated;
+          });
+     }
+     if( category >= 0 )
+     {
+          addWait(category, t0);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   実行の終わりにすべてのタスクを片付ける
+//------------------------------------------------------------------------------
+void Script::endTasks(lua_State *L)
+{
+     for( int n = 0 ; n < (int)m_tasks.size() ; n++ )
+     {
+          Task& task = m_tasks[n];
+          if( n > 0 && task.state != TASK_DONE && !m_dryRun )
+          {
+               std::printf("[Script] task '%s' stopped.\n", task.name.c_str());
+          }
+          luaL_unref(L, LUA_REGISTRYINDEX, task.threadRef);
+          luaL_unref(L, LUA_REGISTRYINDEX, task.queueRef);
+     }
+     m_tasks.clear();
+     m_currentTask = -1;
+     m_armOwner = -1;
+}
+
+//------------------------------------------------------------------------------
+//   実行中のタスクがアームを持っていなければエラーにする
+//------------------------------------------------------------------------------
+void Script::checkArm(lua_State *L, const char *name)
+{
+     if( m_currentTask != m_armOwner )
+     {
+          luaL_error(L, "%s - Task '%s' does not own the arm", name, m_tasks[m_currentTask].name.c_str());
+     }
+}
+
+//------------------------------------------------------------------------------
+//   実行中のタスクを state の待ちにして yield する (L はタスクのコルーチン)
+//   ms は TASK_SLEEP / TASK_RECEIVE / TASK_ARM の時間切れ (負の値は時間切れなし)
+//------------------------------------------------------------------------------
+LuaReturn Script::taskWait(lua_State *L, int state, int32_t ms, int category, bool sleepResult)
+{
+     Task& task = m_tasks[m_currentTask];
+     task.state = state;
+     task.forever = (ms < 0);
+     task.wakeTime = millis() + (uint32_t)std::max(ms, (int32_t)0);
+     task.category = category;
+     task.sleepResult = sleepResult;
+     return LuaReturn(lua_yield(L, 0));
+}
+
+//------------------------------------------------------------------------------
+//   spawn(name, function [, priority])
+//   function を新しいタスクとして実行可能にする (実行は spawn() を呼んだタスクが待ったとき)
+//   試運転ではタスクを作るだけで実行しない (見積もるのは main だけ)
+//------------------------------------------------------------------------------
+void Script::spawnTask(lua_State *L, const char *name, LuaFunction function, LuaOptional<int> priority)
+{
+     if( findTask(name) >= 0 )
+     {
+          luaL_error(L, "spawn - Task '%s' already exists", name);
+     }
+     int alive = 0;
+     for( const Task& task : m_tasks )
+     {
+          alive += (task.state != TASK_DONE)? 1 : 0;
+     }
+     if( alive >= MAX_TASKS )
+     {
+          luaL_error(L, "spawn - Too many tasks (max %d)", (int)MAX_TASKS);
+     }
+
+     lua_settop(L, function.index);
+     int n = newTask(L, name, priority.value);
+     if( m_dryRun )
+     {
+          m_tasks[n].state = TASK_SLEEP;
+          m_tasks[n].forever = true;
+          return;
+     }
+     std::printf("[Script] task '%s' started (priority %d).\n", name, priority.value);
+}
+
+//------------------------------------------------------------------------------
+//   ok = send(name, value)
+//   タスク name の受信キューに value を積む。タスクが終わっているかキューが一杯なら false
+//------------------------------------------------------------------------------
+bool Script::sendMessage(lua_State *L, const char *name, LuaAny value)
+{
+     int n = findTask(name);
+     if( n < 0 )
+     {
+          for( const Task& task : m_tasks )
+          {
+               if( task.name == name )
+               {
+                    return false;      // 終わったタスク
+               }
+          }
+          luaL_error(L, "send - No such task '%s'", name);
+     }
+     Task& task = m_tasks[n];
+     if( task.queueTail - task.queueHead >= MAX_MESSAGES )
+     {
+          return false;
+     }
+     lua_rawgeti(L, LUA_REGISTRYINDEX, task.queueRef);
+     lua_pushvalue(L, value.index);
+     lua_rawseti(L, -2, ++task.queueTail);
+     lua_pop(L, 1);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   value = receive([timeout_ms])
+//   自分の受信キューから１つ取り出す。空ならメッセージが来るか時間切れまで待つ (時間切れは nil)
+//   yield できないところ (タスクの中で作ったコルーチン，pcall の中など) と試運転では待たない
+//------------------------------------------------------------------------------
+LuaReturn Script::receiveMessage(lua_State *L, LuaOptional<int> timeoutMs)
+{
+     int32_t timeout = timeoutMs.present? timeoutMs.value : -1;
+     Task& task = m_tasks[m_currentTask];
+     if( task.queueHead != task.queueTail )
+     {
+          popMessage(L, task);
+          return LuaReturn(1);
+     }
+     if( timeout == 0 || m_dryRun || !canYield(L) )
+     {
+          lua_pushnil(L);
+          return LuaReturn(1);
+     }
+     return taskWait(L, TASK_RECEIVE, timeout, -1);
+}
+
+//------------------------------------------------------------------------------
+//   task_yield()
+//   同じ優先度以上の他のタスクに実行を譲る
+//------------------------------------------------------------------------------
+LuaReturn Script::yieldTask(lua_State *L)
+{
+     if( m_dryRun || !canYield(L) )
+     {
+          return LuaReturn(0);
+     }
+     return LuaReturn(lua_yield(L, 0));
+}
+
+//------------------------------------------------------------------------------
+//   name = task_name()
+//------------------------------------------------------------------------------
+const char *Script::taskName(lua_State *L)
+{
+     return m_tasks[m_currentTask].name.c_str();
+}
+
+//------------------------------------------------------------------------------
+//   ok = take_arm([timeout_ms])
+//   アームを持つ。他のタスクが持っていれば release_arm() するか終わるまで待つ (時間切れは false)
+//------------------------------------------------------------------------------
+LuaReturn Script::takeArm(lua_State *L, LuaOptional<int> timeoutMs)
+{
+     int32_t timeout = timeoutMs.present? timeoutMs.value : -1;
+     if( m_armOwner < 0 )
+     {
+          m_armOwner = m_currentTask;
+     }
+     if( m_armOwner == m_currentTask || timeout == 0 || m_dryRun || !canYield(L) )
+     {
+          lua_pushboolean(L, (m_armOwner == m_currentTask)? 1 : 0);
+          return LuaReturn(1);
+     }
+     return taskWait(L, TASK_ARM, timeout, -1);
+}
+
+//------------------------------------------------------------------------------
+//   release_arm()
+//   持っているアームを放す (持っていなければ何もしない)
+//------------------------------------------------------------------------------
+void Script::releaseArm(lua_State *L)
+{
+     if( m_armOwner == m_currentTask )
+     {
+          m_armOwner = -1;
+     }
+}
+
+//==============================================================================
+//   計測(profile)
+//   行フックで実行中の行を追い，行が変わるたびに経過時間をそれまでの行に加える
+//   組み込み関数の中の時間は呼び出した行に入り，待ち時間は種類ごとにも数える
+//   (呼び出し時は最初の行でフックが呼ばれるので，戻るときだけ呼び出し元の行へ戻す)
+//==============================================================================
+//   スタックトップのチャンクを計測しながら実行するように準備する
+//------------------------------------------------------------------------------
+void Script::startProfile(lua_State *L)
+{
+     lua_Debug ar;
+     lua_pushvalue(L, -1);
+     lua_getinfo(L, ">S", &ar);
+     m_profileSource = ar.source;       // 同じチャンクの関数はソース名の文字列を共有する
+     m_profileLine = 0;
+     m_lineHits.clear();
+     m_lineSeconds.clear();
+     for( int n = 0 ; n < ScriptProfile::NUM_CATEGORIES ; n++ )
+     {
+          m_waitSeconds[n] = 0;
+     }
+     m_profileStart = m_profileLast = ProfileClock::now();
+     lua_sethook(L, &profileHook, LUA_MASKCOUNT | LUA_MASKLINE | LUA_MASKRET, HOOK_COUNT);
+}
+
+//------------------------------------------------------------------------------
+//   結果をまとめて getProfile() で参照できるようにする
+//------------------------------------------------------------------------------
+void Script::finishProfile()
+{
+     chargeLine();
+     ScriptProfile profile;
+     profile.available = true;
+     profile.total = std::chrono::duration<double>(m_profileLast - m_profileStart).count();
+     double waits = 0;
+     for( int n = 0 ; n < ScriptProfile::NUM_CATEGORIES ; n++ )
+     {
+          profile.category[n] = m_waitSeconds[n];
+          waits += m_waitSeconds[n];
+     }
+     profile.category[ScriptProfile::CAT_COMPUTE] = std::max(profile.total - waits, 0.0);
+
+     // 行 0 は最初の行より前 (チャンクの外) の時間なので，一覧には入れない
+     for( size_t n = 1 ; n < m_lineSeconds.size() ; n++ )
+     {
+          if( m_lineHits[n] > 0 )
+          {
+               ScriptProfile::Line line = { (int)n, m_lineHits[n], m_lineSeconds[n] };
+               profile.lines.push_back(line);
+          }
+     }
+     std::sort(profile.lines.begin(), profile.lines.end(),
+          [](const ScriptProfile::Line& a, const ScriptProfile::Line& b){ return a.seconds > b.seconds; });
+     m_profileSource = NULL;
+
+     std::printf("[Script] profile : total %.3f sec, compute %.3f, motion %.3f, gripper %.3f, delay %.3f\n",
+          profile.total, profile.category[ScriptProfile::CAT_COMPUTE], profile.category[ScriptProfile::CAT_MOTION_WAIT],
+          profile.category[ScriptProfile::CAT_GRIPPER_WAIT], profile.category[ScriptProfile::CAT_DELAY]);
+     for( size_t n = 0 ; n < profile.lines.size() && n < 20 ; n++ )
+     {
+          const ScriptProfile::Line& line = profile.lines[n];
+          std::printf("  line %-4d %8.3f sec  %5.1f %%  %u hit(s)\n", line.line, line.seconds,
+               (profile.total > 0)? line.seconds * 100 / profile.total : 0.0, line.hits);
+     }
+
+     std::lock_guard<std::mutex> lock(m_profileMutex);
+     m_profile = profile;
+}
+
+//------------------------------------------------------------------------------
+//   前回からの経過時間を m_profileLine に加える
+//------------------------------------------------------------------------------
+void Script::chargeLine()
+{
+     ProfileClock::time_point now = ProfileClock::now();
+     if( m_profileLine >= (int)m_lineSeconds.size() )
+     {
+          m_lineSeconds.resize(m_profileLine + 1, 0.0);
+          m_lineHits.resize(m_profileLine + 1, 0);
+     }
+     m_lineSeconds[m_profileLine] += std::chrono::duration<double>(now - m_profileLast).count();
+     m_profileLast = now;
+}
+
+//------------------------------------------------------------------------------
+//   組み込み関数が since から待っていた時間を category に加える (計測中だけ呼ぶ)
+//------------------------------------------------------------------------------
+void Script::addWait(int category, ProfileClock::time_point since)
+{
+     m_waitSeconds[category] += std::chrono::duration<double>(ProfileClock::now() - since).count();
+}
+
+//------------------------------------------------------------------------------
+//   計測中のフック (中断の確認は hookProc() と同じ)
+//------------------------------------------------------------------------------
+void Script::profileHook(lua_State *L, lua_Debug *ar)
+{
+     lua_getglobal(L, GLOBAL_NAME);
+     Script *self = (Script *)lua_touserdata(L, -1);
+     lua_pop(L, 1);
+
+     if( ar->event == LUA_HOOKCOUNT )
+     {
+          if( self->m_aborted || self->m_terminated )
+          {
+               luaL_error(L, "aborted.");
+          }
+          self->m_memory->collectForced(L);
+          return;
+     }
+
+     self->chargeLine();
+     if( ar->event == LUA_HOOKLINE )
+     {
+          lua_getinfo(L, "S", ar);
+          if( ar->source == self->m_profileSource && ar->currentline > 0 )
+          {
+               self->m_profileLine = ar->currentline;
+               if( ar->currentline >= (int)self->m_lineHits.size() )
+               {
+                    self->m_lineSeconds.resize(ar->currentline + 1, 0.0);
+                    self->m_lineHits.resize(ar->currentline + 1, 0);
+               }
+               self->m_lineHits[ar->currentline]++;
+          }
+     }
+     else
+     {
+          // 関数から戻る : 以降の時間は呼び出し元の行に入れる
+          lua_Debug caller;
+          if( lua_getstack(L, 1, &caller) && lua_getinfo(L, "Sl", &caller) &&
+               caller.source == self->m_profileSource && caller.currentline > 0 )
+          {
+               self->m_profileLine = caller.currentline;
+          }
+     }
+}
+
+//------------------------------------------------------------------------------
+void Script::getProfile(ScriptProfile *profile)
+{
+     std::lock_guard<std::mutex> lock(m_profileMutex);
+     *profile = m_profile;
+}
+
+//==============================================================================
+//   メモリ
+//==============================================================================
+//   実行の終わりに統計をまとめて getMemoryStats() で参照できるようにする
+//   上限で止まったときは，Lua のエラーメッセージを上限の値に置き換える
+//------------------------------------------------------------------------------
+void Script::finishMemory(lua_State *L)
+{
+     m_memory->finishRun(L);
+     ScriptAllocator::Stats stats;
+     m_memory->getStats(&stats);
+
+     std::string::size_type pos = m_errorMessage.find("not enough memory");
+     if( stats.refused > 0 && pos != std::string::npos )
+     {
+          char buf[64];
+          std::snprintf(buf, sizeof(buf), "ERROR memory limit (%zu KiB) exceeded", stats.limit / 1024);
+          m_errorMessage.replace(pos, std::strlen("not enough memory"), buf);
+     }
+
+     if( stats.managed )
+     {
+          std::printf("[Script] memory : peak %zu KiB / limit %zu KiB, arena %zu KiB, %llu allocs (%.1f %% pooled), %llu refused\n",
+               stats.peak / 1024, stats.limit / 1024, stats.arena / 1024, (unsigned long long)stats.allocations,
+               (stats.allocations > 0)? stats.pooled * 100.0 / stats.allocations : 0.0, (unsigned long long)stats.refused);
+          std::printf("[Script] GC : %u cycle(s), idle %u step(s) %.1f ms, forced %u step(s) %.1f ms\n",
+               stats.cycles, stats.idleSteps, stats.idleSeconds * 1000, stats.forcedSteps, stats.forcedSeconds * 1000);
+     }
+
+     std::lock_guard<std::mutex> lock(m_memoryMutex);
+     m_memoryStats = stats;
+}
+
+//------------------------------------------------------------------------------
+void Script::getMemoryStats(ScriptAllocator::Stats *stats)
+{
+     std::lock_guard<std::mutex> lock(m_memoryMutex);
+     *stats = m_memoryStats;
+}
+
+//==============================================================================
+//   試運転(dry-run)
+//==============================================================================
+//------------------------------------------------------------------------------
+//   組み込み関数を呼び出したスクリプトの行番号
+//------------------------------------------------------------------------------
+static int currentLine(lua_State *L)
+{
+     lua_Debug ar;
+     if( lua_getstack(L, 1, &ar) && lua_getinfo(L, "l", &ar) )
+     {
+          return ar.currentline;
+     }
+     return 0;
+}
+
+//------------------------------------------------------------------------------
+//   実機の現在位置・パラメータを仮想ロボットへ写す
+//------------------------------------------------------------------------------
+void Script::startDryRun()
+{
+     int32_t position[3];
+     uint32_t acc[3], dec[3];
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          position[axis] = m_robot->getMotorPosition(axis);
+     }
+     m_robot->getDefaultAccDec(acc, dec);
+     m_virtual.reset(position, m_robot->getGripperServoValue(), m_robot->getFeedOverride(), acc, dec);
+
+     m_dryRunResult.cycleTime = 0;
+     m_dryRunResult.scriptTime = 0;
+     m_dryRunResult.moves.clear();
+     m_dryRunResult.errors.clear();
+}
+
+//------------------------------------------------------------------------------
+void Script::finishDryRun()
+{
+     double t = m_virtual.getTime();
+     m_dryRunResult.scriptTime = t;
+     t = std::max(t, m_virtual.getMotionEndTime());
+     t = std::max(t, m_virtual.getGripperEndTime());
+     m_dryRunResult.cycleTime = t;
+
+     std::printf("[Script] dry run : cycle time %.3f sec, %d move(s), %d error(s)\n",
+          m_dryRunResult.cycleTime, (int)m_dryRunResult.moves.size(), (int)m_dryRunResult.errors.size());
+     for( const ScriptMove& move : m_dryRunResult.moves )
+     {
+          std::printf("  line %-4d %8.3f sec  %6.3f sec  (%.1f, %.1f, %.1f)\n",
+               move.line, move.start, move.duration, move.x, move.y, move.z);
+     }
+     for( const std::string& error : m_dryRunResult.errors )
+     {
+          std::printf("  %s\n", error.c_str());
+     }
+}
+
+//------------------------------------------------------------------------------
+//   実機ではエラーとなる箇所を記録する (試運転はそのまま続行する)
+//------------------------------------------------------------------------------
+void Script::addDryRunError(lua_State *L, const char *msg)
+{
+     std::ostringstream oss;
+     oss << "ERROR [line " << currentLine(L) << "] " << msg;
+     m_dryRunResult.errors.push_back(oss.str());
+     notify(ScriptEvent::KIND_ERROR, oss.str());
+}
+
+//------------------------------------------------------------------------------
+void Script::dryMoveTo(lua_State *L, double x, double y, double z, ScriptMoveOptions options)
+{
+     int32_t b, s, e;
+     if( !Robot::coordToMotorPos(x, y, z, &b, &s, &e) )
+     {
+          char msg[128];
+          std::snprintf(msg, sizeof(msg), "moveto - Designated position is out of range (%.1f, %.1f, %.1f)", x, y, z);
+          addDryRunError(L, msg);
+          return;
+     }
+
+     VirtualRobot& robot = m_virtual;
+     if( robot.isInMotion() )
+     {
+          // 実機では移動を開始できない。見積りを続けるため，前の移動の完了を待ってから動かす
+          addDryRunError(L, "moveto - Unable to start motion (in motion)");
+          robot.advance(robot.getMotionEndTime() + VirtualRobot::DETECT_DELAY - robot.getTime());
+     }
+
+     ScriptMove move;
+     move.line = currentLine(L);
+     move.start = robot.getTime();
+     move.x = x;
+     move.y = y;
+     move.z = z;
+     robot.startMotion3D(b, s, e, options.speed, options.accel, Robot::UNIT_MM, &move.duration);
+     m_dryRunResult.moves.push_back(move);
+
+     robot.advance(MOVETO_WAIT_MS / 1000.0);
+}
+
+//------------------------------------------------------------------------------
+void Script::dryGoHome(lua_State *L)
+{
+     VirtualRobot& robot = m_virtual;
+     if( robot.isInMotion() )
+     {
+          addDryRunError(L, "go_home - Unable to start motion (in motion)");
+          robot.advance(robot.getMotionEndTime() + VirtualRobot::DETECT_DELAY - robot.getTime());
+     }
+
+     ScriptMove move;
+     move.line = currentLine(L);
+     move.start = robot.getTime();
+     Robot::motorPosToCoord(0, 0, 0, &move.x, &move.y, &move.z);
+     robot.startMotion3D(0, 0, 0, 0, 0, Robot::UNIT_PULSE, &move.duration);
+     m_dryRunResult.moves.push_back(move);
+}
+
+//------------------------------------------------------------------------------
+void Script::dryGrip(lua_State *L, int value)
+{
+     if( value < 0 || 100 < value )
+     {
+          luaL_error(L, "grip - Out of range (%d)", value);
+     }
+
+     m_virtual.moveGripper((uint8_t)value);
+}
+
+//------------------------------------------------------------------------------
+void Script::dryDelay(lua_State *L, double ms)
+{
+     uint32_t value = (uint32_t)ms;
+     if( value == 0 || 60000 < value )
+     {
+          luaL_error(L, "delay - Out of range (%d)", value);
+     }
+
+     m_virtual.advance(value / 1000.0);
+}
+
+//------------------------------------------------------------------------------
+//   移動中であれば仮想時刻を DRY_RUN_POLL_MS だけ進める
+//   (「while in_motion() do end」のような待ちループが有限回で抜けるように)
+//------------------------------------------------------------------------------
+bool Script::dryInMotion(lua_State *L)
+{
+     bool b = m_virtual.isInMotion();
+     if( b )
+     {
+          m_virtual.advance(DRY_RUN_POLL_MS / 1000.0);
+     }
+     return b;
+}
+
+//------------------------------------------------------------------------------
+bool Script::dryAlarmHappened(lua_State *L)
+{
+     return false;
+}
+
+//------------------------------------------------------------------------------
+//   実機ではモーションキューに積まれるので，前の移動の完了後に開始する
+//   範囲外の場合もエラーを記録して，完了済みのハンドルを返す
+//------------------------------------------------------------------------------
+int Script::dryMoveToAsync(lua_State *L, double x, double y, double z, ScriptMoveOptions options)
+{
+     VirtualRobot& robot = m_virtual;
+     int32_t b, s, e;
+     if( !Robot::coordToMotorPos(x, y, z, &b, &s, &e) )
+     {
+          char msg[128];
+          std::snprintf(msg, sizeof(msg), "moveto_async - Designated position is out of range (%.1f, %.1f, %.1f)", x, y, z);
+          addDryRunError(L, msg);
+          return newHandle(HANDLE_MOVE, 0, robot.getTime());
+     }
+
+     ScriptMove move;
+     move.line = currentLine(L);
+     move.x = x;
+     move.y = y;
+     move.z = z;
+     robot.queueMotion3D(b, s, e, options.speed, options.accel, Robot::UNIT_MM, &move.start, &move.duration);
+     m_dryRunResult.moves.push_back(move);
+     return newHandle(HANDLE_MOVE, 0, move.start + move.duration);
+}
+
+//------------------------------------------------------------------------------
+int Script::dryMovePath(lua_State *L)
+{
+     VirtualRobot& robot = m_virtual;
+     std::vector<MotionTarget>& path = m_pathPoints;
+     int bad = readPath(L, &path);
+     if( bad > 0 )
+     {
+          char msg[128];
+          std::snprintf(msg, sizeof(msg), "move_path - Point %d is out of range", bad);
+          addDryRunError(L, msg);
+          return newHandle(HANDLE_MOVE, 0, robot.getTime());
+     }
+     if( robot.isInMotion() )
+     {
+          addDryRunError(L, "move_path - Unable to start path (in motion)");
+          robot.advance(robot.getMotionEndTime() + VirtualRobot::DETECT_DELAY - robot.getTime());
+     }
+
+     ScriptMove move;
+     move.line = currentLine(L);
+     move.start = robot.getTime();
+     const int32_t *last = path.back().position;
+     Robot::motorPosToCoord(last[0], last[1], last[2], &move.x, &move.y, &move.z);
+     robot.startPath(path, &move.duration);
+     m_dryRunResult.moves.push_back(move);
+     return newHandle(HANDLE_MOVE, 0, move.start + move.duration);
+}
+
+//------------------------------------------------------------------------------
+int Script::dryGripAsync(lua_State *L, int value)
+{
+     if( value < 0 || 100 < value )
+     {
+          luaL_error(L, "grip_async - Out of range (%d)", value);
+     }
+
+     m_virtual.moveGripper((uint8_t)value);
+     return newHandle(HANDLE_GRIP, 0, m_virtual.getGripperEndTime());
+}
+
+//------------------------------------------------------------------------------
+LuaReturn Script::dryGetPosition(lua_State *L, LuaOptional<LuaTable> table)
+{
+     double x, y, z;
+     Robot::motorPosToCoord(m_virtual.getMotorPosition(0), m_virtual.getMotorPosition(1),
+          m_virtual.getMotorPosition(2), &x, &y, &z);
+     return pushPosition(L, table, x, y, z);
+}
+
+//------------------------------------------------------------------------------
+std::tuple<double, double, double> Script::dryGetJoint(lua_State *L)
+{
+     return jointAngles(m_virtual.getMotorPosition(0), m_virtual.getMotorPosition(1), m_virtual.getMotorPosition(2));
+}
+
+//------------------------------------------------------------------------------
+int Script::dryGetGripper(lua_State *L)
+{
+     return m_virtual.getGripperServoValue();
 }
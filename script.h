@@ -2,39 +2,303 @@
 #define   SCRIPT_H
 
 #include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <string>
+#include <vector>
 #include <functional>
+#include <map>
+#include <tuple>
 #include <lua.hpp>
 #include "robot.h"
+#include "virtual_robot.h"
+#include "script_cache.h"
+#include "script_alloc.h"
+#include "script_binding.h"
+
+//------------------------------------------------------------------------------
+//   試運転(dry-run)の結果
+//------------------------------------------------------------------------------
+struct ScriptMove
+{
+     int    line;               // moveto / go_home を呼び出した行
+     double start;              // 開始時刻(sec)
+     double duration;           // 移動時間(sec)
+     double x, y, z;            // 移動先
+};
+
+struct DryRunResult
+{
+     double cycleTime;          // 全動作(移動・グリッパー)の完了までの時間(sec)
+     double scriptTime;         // スクリプトの終了時刻(sec)
+     std::vector<ScriptMove>  moves;
+     std::vector<std::string> errors;   // 実機では実行時エラーとなる箇所
+};
+
+//------------------------------------------------------------------------------
+//   計測(profile)の結果
+//   経過時間を，その間に実行していた行と，組み込み関数の待ち時間の種類に振り分ける
+//------------------------------------------------------------------------------
+struct ScriptProfile
+{
+     enum
+     {
+          CAT_COMPUTE,               // スクリプト自体の処理 (全体から待ち時間を引いたもの)
+          CAT_MOTION_WAIT,           // moveto() / in_motion() / await() で移動の完了を待った時間
+          CAT_GRIPPER_WAIT,          // await() でグリッパーの完了だけを待った時間
+          CAT_DELAY,                 // delay()
+          NUM_CATEGORIES
+     };
+     struct Line
+     {
+          int      line;
+          uint32_t hits;             // その行を実行した回数
+          double   seconds;          // その行で費やした時間 (呼び出した関数の中の行は含まない)
+     };
+     bool   available;               // 最後の実行を計測した (実行中・計測しなかった実行の後は false)
+     double total;                   // 実行時間(sec)
+     double category[NUM_CATEGORIES];
+     std::vector<Line> lines;        // 時間の長い順
+};
+
+//------------------------------------------------------------------------------
+//   実行の経過の通知 (addListener() で登録した関数へ，スクリプトのスレッドから送る)
+//------------------------------------------------------------------------------
+struct ScriptEvent
+{
+     enum{ KIND_START, KIND_OUTPUT, KIND_ERROR, KIND_END };
+     enum{ RESULT_DONE, RESULT_ERROR, RESULT_ABORTED };
+     int         kind;
+     uint32_t    run;                // 何回目の実行か (run() などの戻り値)
+     double      elapsed;            // 開始からの時間(sec)
+     int         result;             // KIND_END : 終わり方 (RESULT_DONE / ERROR / ABORTED)
+     std::string text;               // KIND_OUTPUT : print() の１行，KIND_ERROR : エラーメッセージ
+};
+
+//------------------------------------------------------------------------------
+//   moveto() などの最後の引数 { speed = , accel = } (省略時・項目がない場合は 0 = 既定値)
+//------------------------------------------------------------------------------
+struct ScriptMoveOptions
+{
+     double speed;
+     double accel;
+};
+
+template<>
+struct LuaType<ScriptMoveOptions>
+{
+     static ScriptMoveOptions get(lua_State *L, int index);
+};
+
+#ifdef USE_LUAJIT
+//------------------------------------------------------------------------------
+//   LuaJIT の FFI から直接呼ぶ問い合わせ関数 (script は Script *)
+//   中断が要求されていれば -1 を返す
+//------------------------------------------------------------------------------
+extern "C"
+{
+     int script_in_motion(void *script);
+     int script_alarm_happened(void *script);
+     int script_get_position(void *script, double *xyz);
+}
+#endif
 
 //------------------------------------------------------------------------------
 class Script
 {
      typedef std::function<void(Script *)>   EventHandler;
+     typedef std::function<void(const ScriptEvent&)> EventListener;
      private:
           static const char *STARTUP_CODE;
           static const char *GLOBAL_NAME;
+          static const char *UPLOAD_CHUNK_NAME;
+#ifdef USE_LUAJIT
+          static const char *FFI_BINDINGS;
+          friend int ::script_in_motion(void *script);
+          friend int ::script_alarm_happened(void *script);
+          friend int ::script_get_position(void *script, double *xyz);
+#endif
+          enum{ MOVETO_WAIT_MS = 100 };      // moveto() 後の待ち時間
+          enum{ HOOK_COUNT = 10000 };        // 中断を確認する間隔 (VM の命令数)
+          enum{ IN_MOTION_WAIT_MS = 5 };     // 移動中の in_motion() で CPU を譲る時間
+          enum{ AWAIT_CHECK_MS = 100 };      // await() で完了の通知がなくても状態を見直す間隔
+          enum{ MEMORY_LIMIT = 32 * 1024 * 1024 };  // スクリプトが使えるメモリの既定の上限(byte)
+          enum{ GC_IDLE_MS = 2 };            // 待ちに入るたびに GC に使う時間の上限
+          enum{ HANDLE_MOVE, HANDLE_GRIP };
+
+          //   moveto_async() / grip_async() が返すハンドル (Lua には m_handles の添字 + 1 を返す)
+          struct Handle
+          {
+               int      kind;
+               uint32_t sequence;            // 何回目の移動・グリッパー動作か
+               double   endTime;             // 試運転 : 完了する仮想時刻
+          };
+          enum{ DRY_RUN_POLL_MS = 10 };      // 試運転時，移動中の in_motion() １回で進める時間
+
+          //   タスク : スクリプト本体 (main) と spawn() で作ったコルーチン
+          //   １つのスレッドで，待ちに入ったところで切り替える (協調型)
+          enum{ MAX_TASKS = 16 };
+          enum{ MAX_MESSAGES = 256 };        // タスクごとの受信キューの長さ
+          enum{ TASK_READY, TASK_AWAIT, TASK_SLEEP, TASK_RECEIVE, TASK_ARM, TASK_DONE };
+          struct Task
+          {
+               std::string name;
+               int         priority;         // 大きいほど先に実行する
+               lua_State  *thread;
+               int         threadRef;        // レジストリの参照 (GC されないように)
+               int         queueRef;         // 受信キュー (Lua のテーブル)
+               uint32_t    queueHead;        // 次に受け取るメッセージの番号 - 1
+               uint32_t    queueTail;        // 最後に送られたメッセージの番号
+               int         state;
+               bool        started;          // 一度でも resume した
+               uint32_t    order;            // 同じ優先度では先に実行可能になったものから
+               uint32_t    wakeTime;         // TASK_SLEEP / TASK_RECEIVE : 起こす時刻 (millis())
+               bool        forever;          // TASK_RECEIVE : 時間切れなし
+               bool        sleepResult;      // TASK_SLEEP : 起きたときに true を返す (in_motion())
+               int         category;         // 待っている間の計測の種類 (-1 は数えない)
+               int         line;             // 計測 : 最後に実行していた行
+               std::vector<int> handles;     // TASK_AWAIT : 待っているハンドル
+          };
+          typedef std::chrono::steady_clock ProfileClock;
           Robot *m_robot;
           bool m_running;
-          bool m_terminated;
-          bool m_aborted;
+          std::atomic<bool> m_terminated;
+          std::atomic<bool> m_aborted;
+          bool m_dryRun;
+          VirtualRobot m_virtual;
+          DryRunResult m_dryRunResult;
           std::thread *m_thread;
           std::string m_code;
+          std::string m_path;                // runFile() のときのファイル (m_code は使わない)
           std::string m_errorMessage;
           EventHandler m_onStart;
           EventHandler m_onEnd;
 
+          //   TCP から送られたスクリプトと，実行の経過の通知
+          std::string  m_upload;             // upload() でコンパイルしたバイトコード
+          bool         m_uploadRun;          // runUploaded() : m_code はバイトコード
+          bool         m_exited;             // exit_script() で終えた (中断とは数えない)
+          uint32_t     m_runCount;           // 開始した実行の数 (m_runMutex で保護)
+          uint32_t     m_currentRun;         // 実行中のスクリプトの番号
+          std::chrono::steady_clock::time_point m_runStart;  // (m_runMutex で保護)
+          double       m_lastElapsed;        // 最後に終わった実行の時間(sec) (m_runMutex で保護)
+          int          m_lastResult;         // 最後に終わった実行の終わり方 (-1 はまだない)
+          std::map<int, EventListener> m_listeners;
+          int          m_nextListenerID;
+          std::mutex   m_listenerMutex;
+
+          std::vector<Task> m_tasks;         // m_tasks[0] が main (実行中に消すことはない)
+          int          m_currentTask;        // 実行中のタスク
+          int          m_armOwner;           // ロボットに動作を指示できるタスク (-1 は空き)
+          uint32_t     m_taskOrder;
+          std::vector<Handle> m_handles;
+          std::vector<MotionTarget> m_pathPoints;   // move_path() の点 (luaL_error() で抜けても解放漏れしないようにメンバに置く)
+          uint32_t     m_movesIssued;
+          uint32_t     m_gripsIssued;
+          int          m_listenerID;
+          std::mutex   m_waitMutex;
+          std::condition_variable m_waitCond;
+          uint32_t     m_waitEvents;         // 動作の完了の通知の回数 (m_waitMutex で保護)
+
+          ScriptCache *m_cache;
+          lua_State   *m_warmState;          // 次の実機での実行用に作っておいた lua_State
+          ScriptAllocator *m_warmMemory;     // m_warmState の allocator
+          ScriptAllocator *m_memory;         // 実行中の lua_State の allocator
+          std::atomic<size_t> m_memoryLimit;
+          std::mutex   m_memoryMutex;
+          ScriptAllocator::Stats m_memoryStats;   // 最後の実行のメモリの統計
+          std::mutex   m_runMutex;
+          std::condition_variable m_runCond; // run() / runFile() で実行スレッドを起こす
+
+          //   計測 : 実機での実行のときだけ行う。しないときはフックも時刻の取得も増えない
+          std::atomic<bool> m_profileRequested;  // setProfiling() : 以降のすべての実行を計測する
+          bool         m_profileRun;         // run() / runFile() の profile : その実行だけを計測する
+          bool         m_profiling;          // 実行中のスクリプトを計測している
+          const char  *m_profileSource;      // スクリプトのチャンクのソース名 (他のチャンクの行は数えない)
+          int          m_profileLine;        // 時間を振り分ける行
+          ProfileClock::time_point m_profileStart;
+          ProfileClock::time_point m_profileLast;
+          std::vector<uint32_t> m_lineHits;  // 行番号で引く
+          std::vector<double>   m_lineSeconds;
+          double       m_waitSeconds[ScriptProfile::NUM_CATEGORIES];
+          std::mutex   m_profileMutex;
+          ScriptProfile m_profile;           // 最後に計測した実行の結果
+
           void execute();
+          uint32_t beginRun(bool dryRun, bool profile);
+          void notify(int kind, const std::string& text, int result = ScriptEvent::RESULT_DONE);
+          static std::string formatError(const char *msg);
+          lua_State *createState(bool dryRun, ScriptAllocator *memory);
+          void finishMemory(lua_State *L);
+          int  loadChunk(lua_State *L);
+          void runMain(lua_State *L);
+          int  newTask(lua_State *L, const char *name, int priority);
+          int  findTask(lua_State *L);
+          int  findTask(const std::string& name);
+          bool canYield(lua_State *L);
+          void popMessage(lua_State *L, Task& task);
+          void updateTasks(lua_State *L);
+          int  nextTask();
+          bool resumeTask(lua_State *L, int index);
+          void waitTasks(lua_State *L, uint32_t events);
+          void endTasks(lua_State *L);
+          void checkArm(lua_State *L, const char *name);
+          LuaReturn taskWait(lua_State *L, int state, int32_t ms, int category, bool sleepResult = false);
+          bool isHandleDone(const Handle& handle);
+          bool waitHandles(lua_State *L, int first, int last);
+          int  newHandle(int kind, uint32_t sequence, double endTime);
+          LuaReturn awaitHandles(lua_State *L, const char *name);
           static int atPanic(lua_State *L);
           static void hookProc(lua_State *L, lua_Debug *ar);
-          static int moveTo(lua_State *L);
-          static int goHome(lua_State *L);
-          static int grip(lua_State *L);
-          static int delayScript(lua_State *L);
-          static int inMotion(lua_State *L);
-          static int alarmHappened(lua_State *L);
-          static int getPosition(lua_State *L);
-          static int exitScript(lua_State *L);
+          static void profileHook(lua_State *L, lua_Debug *ar);
+          void startProfile(lua_State *L);
+          void finishProfile();
+          void chargeLine();
+          void addWait(int category, ProfileClock::time_point since);
+
+          //   組み込み関数 (script_binding.h の LuaMethod で登録する。引数は Lua の引数 1, 2, ...)
+          LuaReturn moveTo(lua_State *L, double x, double y, double z, ScriptMoveOptions options);
+          void      goHome(lua_State *L);
+          void      grip(lua_State *L, int value);
+          LuaReturn delayScript(lua_State *L, double ms);
+          LuaReturn inMotion(lua_State *L);
+          bool      alarmHappened(lua_State *L);
+          LuaReturn getPosition(lua_State *L, LuaOptional<LuaTable> table);
+          std::tuple<double, double, double> getJoint(lua_State *L);
+          int       getGripper(lua_State *L);
+          int       getFeedOverride(lua_State *L);
+          void      exitScript(lua_State *L);
+          void      outputStr(lua_State *L);
+          int       moveToAsync(lua_State *L, double x, double y, double z, ScriptMoveOptions options);
+          int       gripAsync(lua_State *L, int value);
+          LuaReturn movePath(lua_State *L);
+          LuaReturn await(lua_State *L);
+          LuaReturn awaitAll(lua_State *L, LuaTable handles);
+          void      spawnTask(lua_State *L, const char *name, LuaFunction function, LuaOptional<int> priority);
+          bool      sendMessage(lua_State *L, const char *name, LuaAny value);
+          LuaReturn receiveMessage(lua_State *L, LuaOptional<int> timeoutMs);
+          LuaReturn yieldTask(lua_State *L);
+          const char *taskName(lua_State *L);
+          LuaReturn takeArm(lua_State *L, LuaOptional<int> timeoutMs);
+          void      releaseArm(lua_State *L);
+
+          void startDryRun();
+          void finishDryRun();
+          void addDryRunError(lua_State *L, const char *msg);
+          void      dryMoveTo(lua_State *L, double x, double y, double z, ScriptMoveOptions options);
+          void      dryGoHome(lua_State *L);
+          void      dryGrip(lua_State *L, int value);
+          void      dryDelay(lua_State *L, double ms);
+          bool      dryInMotion(lua_State *L);
+          bool      dryAlarmHappened(lua_State *L);
+          LuaReturn dryGetPosition(lua_State *L, LuaOptional<LuaTable> table);
+          std::tuple<double, double, double> dryGetJoint(lua_State *L);
+          int       dryGetGripper(lua_State *L);
+          int       dryMoveToAsync(lua_State *L, double x, double y, double z, ScriptMoveOptions options);
+          int       dryGripAsync(lua_State *L, int value);
+          int       dryMovePath(lua_State *L);
 
      public:
           Script(Robot *robot);
@@ -45,10 +309,28 @@ class Script
           void onEnd(EventHandler handler){
                m_onEnd = handler;
           }
-          void run(std::string code);
+          uint32_t run(std::string code, bool dryRun = false, bool profile = false);
+          uint32_t runFile(const std::string& path, bool dryRun = false, bool profile = false);
+          bool upload(const std::string& source, std::string *error);
+          bool hasUpload();
+          uint32_t runUploaded(bool dryRun = false, bool profile = false);
           void abort();
           bool isRunning(){ return m_running; }
+          bool isDryRun(){ return m_dryRun; }
+          uint32_t getRunCount();
+          int  getLastResult();
+          double getElapsed();
+          int  addListener(EventListener listener);
+          void removeListener(int id);
+          const DryRunResult& getDryRunResult() const { return m_dryRunResult; }
           std::string getErrorMessage(){ return m_errorMessage; }
+          void getCacheStats(ScriptCache::Stats *stats){ m_cache->getStats(stats); }
+          void setProfiling(bool enable){ m_profileRequested = enable; }
+          bool isProfilingEnabled(){ return m_profileRequested; }
+          void getProfile(ScriptProfile *profile);
+          void setMemoryLimit(size_t bytes){ m_memoryLimit = bytes; }
+          size_t getMemoryLimit(){ return m_memoryLimit; }
+          void getMemoryStats(ScriptAllocator::Stats *stats);
 };
 
 #endif
@@ -0,0 +1,50 @@
+-- pcall の中から待つ関数 (delay, moveto, in_motion, await) を呼ぶテスト
+-- main からとタスクからの両方で，yield できないところでもエラーにならずに待つことを確かめる
+-- 原点復帰してから実行すること (アームは今の位置へ移動するので動かない)
+
+local function check(label, ok, err)
+     if not ok then
+          error(label .. " : " .. tostring(err))
+     end
+     print(label .. " : ok")
+end
+
+local function waits(who)
+     local p = get_position()
+     check(who .. " pcall(delay, 10)", pcall(delay, 10))
+     check(who .. " pcall(moveto)", pcall(moveto, p.x, p.y, p.z))
+     check(who .. " xpcall(in_motion)", xpcall(function()
+          while in_motion() do end
+     end, function(e) return e end))
+     check(who .. " pcall(await)", pcall(function()
+          await(moveto_async(p.x, p.y, p.z))
+     end))
+     local t = setmetatable({}, { __index = function(t, k) delay(10) return k end })
+     check(who .. " delay in metamethod", t.x == "x")
+     for i in function(s, c) if c then return nil end delay(10) return 1 end do end
+     check(who .. " delay in iterator", true)
+     delay(10)          -- pcall の外では今までどおり他のタスクへ切り替わる
+end
+
+function main()
+     local ticks = 0
+     spawn("ticker", function()
+          while true do
+               ticks = ticks + 1
+               delay(5)
+          end
+     end)
+
+     waits("main")
+
+     release_arm()
+     spawn("worker", function()
+          take_arm()
+          waits("worker")
+          release_arm()
+          send("main", "done")
+     end)
+     check("worker finished", receive(10000) == "done", "timeout")
+     check("ticker ran", ticks > 0, ticks)
+     print("test_task_wait : all passed")
+end
@@ -0,0 +1,312 @@
+//------------------------------------------------------------------------------
+//   script_alloc.cpp
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "script_alloc.h"
+
+//------------------------------------------------------------------------------
+//   コンストラクタ
+//   lua_State を作る間 (startRun() まで) は上限なし
+//------------------------------------------------------------------------------
+ScriptAllocator::ScriptAllocator()
+     : m_managed(true), m_limit(0), m_used(0), m_bump(NULL), m_bumpEnd(NULL),
+       m_live(0), m_collecting(false), m_allocatedBytes(0), m_chargedBytes(0)
+{
+     for( int n = 0 ; n < NUM_CLASSES ; n++ )
+     {
+          m_free[n] = NULL;
+     }
+     memset(&m_stats, 0, sizeof(m_stats));
+     m_stats.managed = true;
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//   lua_close() の後に呼ぶこと (大きいブロックは lua_close() で解放済み)
+//------------------------------------------------------------------------------
+ScriptAllocator::~ScriptAllocator()
+{
+     for( size_t n = 0 ; n < m_chunks.size() ; n++ )
+     {
+          std::free(m_chunks[n]);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   この allocator を使う lua_State を作る
+//   LuaJIT の 64 bit 版 (GC64 でないもの) は lua_newstate() を使えないので，
+//   標準の allocator で作る (上限と統計はなし。GC の進め方も Lua に任せる)
+//------------------------------------------------------------------------------
+lua_State *ScriptAllocator::newState()
+{
+     lua_State *L = lua_newstate(&alloc, this);
+     if( L == NULL )
+     {
+          std::printf("[ScriptAllocator] lua_newstate() failed, using the default allocator.\n");
+          m_managed = false;
+          m_stats.managed = false;
+          L = luaL_newstate();
+     }
+     return L;
+}
+
+//------------------------------------------------------------------------------
+//   実行の開始 : 上限を決め，統計を始め，自動の GC を止める
+//   limit が 0 なら上限なし
+//------------------------------------------------------------------------------
+void ScriptAllocator::startRun(lua_State *L, size_t limit)
+{
+     memset(&m_stats, 0, sizeof(m_stats));
+     m_stats.managed = m_managed;
+     m_stats.limit = limit;
+     m_stats.peak = m_used;
+     m_stats.arena = m_chunks.size() * CHUNK_SIZE;
+     m_limit = m_managed? limit : 0;
+     m_live = usage(L);
+     m_collecting = false;
+     m_allocatedBytes = m_chargedBytes = 0;
+     if( m_managed )
+     {
+          lua_gc(L, LUA_GCSTOP, 0);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   実行の終わり : 統計を確定し，上限を外す (lua_close() の中の __gc で断らない)
+//------------------------------------------------------------------------------
+void ScriptAllocator::finishRun(lua_State *L)
+{
+     m_stats.current = usage(L);
+     m_stats.peak = std::max(m_stats.peak, m_stats.current);
+     m_limit = 0;
+}
+
+//------------------------------------------------------------------------------
+void ScriptAllocator::getStats(Stats *stats)
+{
+     *stats = m_stats;
+}
+
+//------------------------------------------------------------------------------
+//   lua_Alloc
+//   大きくなる確保だけ上限を見る (縮めるのと解放は失敗させない)
+//------------------------------------------------------------------------------
+void *ScriptAllocator::alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+     ScriptAllocator *self = (ScriptAllocator *)ud;
+     if( nsize == 0 )
+     {
+          if( ptr )
+          {
+               self->release(ptr, osize);
+          }
+          return NULL;
+     }
+
+     size_t grow = blockSize(nsize);
+     size_t old = ptr? blockSize(osize) : 0;
+     if( self->m_limit > 0 && grow > old && self->m_used + grow - old > self->m_limit )
+     {
+          self->m_stats.refused++;
+          return NULL;
+     }
+     return ptr? self->resize(ptr, osize, nsize) : self->allocate(nsize);
+}
+
+//------------------------------------------------------------------------------
+//   小さいブロックは区分の空きリストから，なければチャンクの残りから切り出す
+//------------------------------------------------------------------------------
+void *ScriptAllocator::allocate(size_t size)
+{
+     size_t bytes = blockSize(size);
+     void *p;
+     if( size <= SMALL_LIMIT )
+     {
+          int c = bytes / ALIGN - 1;
+          if( m_free[c] )
+          {
+               p = m_free[c];
+               m_free[c] = m_free[c]->next;
+          }
+          else
+          {
+               if( (size_t)(m_bumpEnd - m_bump) < bytes )
+               {
+                    // 残りは捨てる (SMALL_LIMIT 未満)
+                    char *chunk = (char *)std::malloc(CHUNK_SIZE);
+                    if( chunk == NULL )
+                    {
+                         return NULL;
+                    }
+                    m_chunks.push_back(chunk);
+                    m_bump = chunk;
+                    m_bumpEnd = chunk + CHUNK_SIZE;
+                    m_stats.arena += CHUNK_SIZE;
+               }
+               p = m_bump;
+               m_bump += bytes;
+          }
+          m_stats.pooled++;
+     }
+     else
+     {
+          p = std::malloc(size);
+          if( p == NULL )
+          {
+               return NULL;
+          }
+     }
+     m_used += bytes;
+     m_allocatedBytes += bytes;
+     m_stats.allocations++;
+     m_stats.peak = std::max(m_stats.peak, m_used);
+     return p;
+}
+
+//------------------------------------------------------------------------------
+void ScriptAllocator::release(void *ptr, size_t size)
+{
+     size_t bytes = blockSize(size);
+     if( size <= SMALL_LIMIT )
+     {
+          int c = bytes / ALIGN - 1;
+          FreeBlock *block = (FreeBlock *)ptr;
+          block->next = m_free[c];
+          m_free[c] = block;
+     }
+     else
+     {
+          std::free(ptr);
+     }
+     m_used -= bytes;
+     m_stats.frees++;
+}
+
+//------------------------------------------------------------------------------
+//   同じ区分ならそのまま，どちらも大きいブロックなら realloc()，
+//   それ以外は新しいブロックへ移す
+//------------------------------------------------------------------------------
+void *ScriptAllocator::resize(void *ptr, size_t osize, size_t nsize)
+{
+     size_t obytes = blockSize(osize);
+     size_t nbytes = blockSize(nsize);
+     if( osize <= SMALL_LIMIT && nsize <= SMALL_LIMIT && obytes == nbytes )
+     {
+          return ptr;
+     }
+     if( osize > SMALL_LIMIT && nsize > SMALL_LIMIT )
+     {
+          void *p = std::realloc(ptr, nsize);
+          if( p == NULL )
+          {
+               return NULL;
+          }
+          m_used = m_used - obytes + nbytes;
+          if( nbytes > obytes )
+          {
+               m_allocatedBytes += nbytes - obytes;
+               m_stats.peak = std::max(m_stats.peak, m_used);
+          }
+          return p;
+     }
+
+     void *p = allocate(nsize);
+     if( p == NULL )
+     {
+          return NULL;
+     }
+     memcpy(p, ptr, std::min(osize, nsize));
+     release(ptr, osize);
+     return p;
+}
+
+//------------------------------------------------------------------------------
+//   使用量(byte)
+//------------------------------------------------------------------------------
+size_t ScriptAllocator::usage(lua_State *L)
+{
+     if( m_managed )
+     {
+          return m_used;
+     }
+     return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+//------------------------------------------------------------------------------
+//   GC を１ステップ進める。周回が終わったら true
+//   (LUA_GCSTEP は自動の GC を再開させるので止め直す)
+//------------------------------------------------------------------------------
+bool ScriptAllocator::step(lua_State *L)
+{
+     bool done = lua_gc(L, LUA_GCSTEP, 0) != 0;
+     if( m_managed )
+     {
+          lua_gc(L, LUA_GCSTOP, 0);
+     }
+     if( done )
+     {
+          m_live = usage(L);
+          m_stats.cycles++;
+     }
+     m_collecting = !done;
+     return done;
+}
+
+//------------------------------------------------------------------------------
+//   スクリプトが待っている間に GC を進める (最長 budgetMs)
+//   周回の途中か，使用量が前回の GC の後の GC_IDLE_PAUSE % を超えていれば進める
+//------------------------------------------------------------------------------
+void ScriptAllocator::collectIdle(lua_State *L, int32_t budgetMs)
+{
+     size_t base = std::max(m_live, (size_t)MIN_GC_BASE);
+     if( budgetMs <= 0 || (!m_collecting && usage(L) * 100 < base * GC_IDLE_PAUSE) )
+     {
+          return;
+     }
+     Clock::time_point t0 = Clock::now();
+     Clock::time_point deadline = t0 + std::chrono::milliseconds(budgetMs);
+     while( true )
+     {
+          m_stats.idleSteps++;
+          if( step(L) || Clock::now() >= deadline )
+          {
+               break;
+          }
+     }
+     m_stats.idleSeconds += std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+//------------------------------------------------------------------------------
+//   計算中 (フックから呼ぶ) : 使用量が前回の GC の後の GC_PAUSE % を超えていれば，
+//   超えてから確保した GC_STEP_BYTES ごとに１ステップ進める (Lua の自動の GC と同じ割合)
+//   待ち時間がないまま確保を続けるスクリプトが上限に達しないように
+//------------------------------------------------------------------------------
+void ScriptAllocator::collectForced(lua_State *L)
+{
+     if( !m_managed )
+     {
+          return;
+     }
+     lua_gc(L, LUA_GCSTOP, 0);          // collectgarbage() で再開されていても止め直す
+     size_t base = std::max(m_live, (size_t)MIN_GC_BASE);
+     if( m_used * 100 < base * GC_PAUSE )
+     {
+          m_chargedBytes = m_allocatedBytes;
+          return;
+     }
+     uint64_t steps = std::max((m_allocatedBytes - m_chargedBytes) / GC_STEP_BYTES, (uint64_t)1);
+     m_chargedBytes = m_allocatedBytes;
+     Clock::time_point t0 = Clock::now();
+     for( uint64_t n = 0 ; n < steps ; n++ )
+     {
+          m_stats.forcedSteps++;
+          if( step(L) )
+          {
+               break;
+          }
+     }
+     m_stats.forcedSeconds += std::chrono::duration<double>(Clock::now() - t0).count();
+}
@@ -0,0 +1,92 @@
+//------------------------------------------------------------------------------
+//   script_alloc.h
+//
+//   スクリプトの lua_State ごとのメモリ (lua_Alloc) と GC の進め方
+//   小さいブロック (SMALL_LIMIT バイト以下) は大きさの区分ごとの空きリストで
+//   使い回し，足りなければチャンク (CHUNK_SIZE) から切り出す。チャンクは
+//   lua_State と一緒にまとめて解放する (実行ごとのアリーナ)
+//   使用量が上限を超える確保は失敗させる (スクリプトは not enough memory で止まる)
+//   自動の GC は止めておき，スクリプトが動作の完了などを待っている間に進める
+//   使用量が前回の GC の後の量の GC_PAUSE % を超えたら，計算中でも進める
+//------------------------------------------------------------------------------
+#ifndef   SCRIPT_ALLOC_H
+#define   SCRIPT_ALLOC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <vector>
+#include <lua.hpp>
+
+//------------------------------------------------------------------------------
+class ScriptAllocator
+{
+     public:
+          struct Stats
+          {
+               bool     managed;            // false : lua_newstate() が使えず，Lua 標準の allocator で動いた
+               size_t   limit;              // 上限(byte)
+               size_t   current;            // 実行の終わりの使用量(byte)
+               size_t   peak;               // 使用量の最大(byte)
+               size_t   arena;              // チャンクとして確保した量(byte)
+               uint64_t allocations;        // 新しく確保した回数
+               uint64_t pooled;             // そのうち空きリスト・チャンクから渡した回数
+               uint64_t frees;
+               uint64_t refused;            // 上限で断った回数
+               uint32_t idleSteps;          // 待ち時間に進めた GC のステップ数
+               uint32_t forcedSteps;        // 計算中に進めた GC のステップ数
+               uint32_t cycles;             // 完了した GC の周回数
+               double   idleSeconds;        // 待ち時間に GC に使った時間(sec)
+               double   forcedSeconds;      // 計算中に GC に使った時間(sec)
+          };
+
+     private:
+          enum{ ALIGN = 16 };                         // 区分の幅 (ブロックの境界)
+          enum{ SMALL_LIMIT = 512 };
+          enum{ NUM_CLASSES = SMALL_LIMIT / ALIGN };
+          enum{ CHUNK_SIZE = 64 * 1024 };
+          enum{ GC_PAUSE = 200 };                     // 計算中に GC を進め始める使用量(%)
+          enum{ GC_IDLE_PAUSE = 125 };                // 待ち時間に GC を進め始める使用量(%)
+          enum{ GC_STEP_BYTES = 1024 };               // 計算中は確保したこの量ごとに１ステップ
+          enum{ MIN_GC_BASE = 256 * 1024 };           // 使用量が少ないうちは GC しない
+          typedef std::chrono::steady_clock Clock;
+
+          struct FreeBlock
+          {
+               FreeBlock *next;
+          };
+
+          bool       m_managed;
+          size_t     m_limit;
+          size_t     m_used;                          // ブロックの大きさ (区分に切り上げた値) の合計
+          FreeBlock *m_free[NUM_CLASSES];
+          std::vector<char *> m_chunks;
+          char      *m_bump;                          // 最後のチャンクの未使用部分
+          char      *m_bumpEnd;
+          size_t     m_live;                          // 最後に GC を終えたときの使用量
+          bool       m_collecting;                    // GC の周回の途中
+          uint64_t   m_allocatedBytes;                // 確保した量の累計 (計算中の GC の進め方に使う)
+          uint64_t   m_chargedBytes;                  // そのうち GC のステップに換算した量
+          Stats      m_stats;
+
+          static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+          void *allocate(size_t size);
+          void  release(void *ptr, size_t size);
+          void *resize(void *ptr, size_t osize, size_t nsize);
+          static size_t blockSize(size_t size){ return (size <= SMALL_LIMIT)? (size + ALIGN - 1) & ~(size_t)(ALIGN - 1) : size; }
+          size_t usage(lua_State *L);
+          bool  step(lua_State *L);
+
+     public:
+          ScriptAllocator();
+          ~ScriptAllocator();
+          lua_State *newState();
+          void startRun(lua_State *L, size_t limit);
+          void finishRun(lua_State *L);
+          void collectIdle(lua_State *L, int32_t budgetMs);
+          void collectForced(lua_State *L);
+          bool isLimitReached() const { return m_stats.refused > 0; }
+          void getStats(Stats *stats);
+};
+
+#endif
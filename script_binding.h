@@ -0,0 +1,214 @@
+//------------------------------------------------------------------------------
+//   script_binding.h
+//
+//   C++ のメンバ関数を Lua の関数として登録する
+//   メンバ関数は R (C::*)(lua_State *L, A...) の形で，引数 A... は Lua の引数
+//   1, 2, ... から型に合わせて読み，戻り値 R は Lua の戻り値として積む
+//   オブジェクト (C *) はクロージャの upvalue に入れておき，呼び出しごとに
+//   グローバル変数を引かない
+//
+//     引数の型   : double, int, bool, const char *, LuaTable, LuaFunction, LuaAny,
+//                  LuaOptional<T> (省略・nil なら present が false，value は T())
+//     戻り値の型 : void, double, int, bool, const char *, std::tuple<...> (複数の値),
+//                  LuaReturn (関数が自分で積んだ値の数。lua_yield() の戻り値もそのまま返せる)
+//
+//   引数の読み取りと関数の中のエラー (luaL_error()) は longjmp で抜けるので，
+//   引数には後始末のいらない型だけを使う (std::string などは使わない)
+//------------------------------------------------------------------------------
+#ifndef   SCRIPT_BINDING_H
+#define   SCRIPT_BINDING_H
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <lua.hpp>
+
+//------------------------------------------------------------------------------
+//   引数・戻り値の型
+//------------------------------------------------------------------------------
+struct LuaReturn
+{
+     int count;
+     explicit LuaReturn(int n) : count(n) {}
+};
+
+struct LuaTable
+{
+     int index;               // スタック上の位置
+};
+
+struct LuaFunction
+{
+     int index;
+};
+
+struct LuaAny
+{
+     int index;
+};
+
+template<typename T>
+struct LuaOptional
+{
+     bool present;
+     T    value;
+};
+
+//------------------------------------------------------------------------------
+//   型ごとの読み取り (get) と積み込み (push : 積んだ値の数を返す)
+//------------------------------------------------------------------------------
+template<typename T>
+struct LuaType;
+
+template<>
+struct LuaType<double>
+{
+     static double get(lua_State *L, int index){ return luaL_checknumber(L, index); }
+     static int push(lua_State *L, double value){ lua_pushnumber(L, value); return 1; }
+};
+
+template<>
+struct LuaType<int>
+{
+     // 小数は切り捨てる (以前の (int)luaL_checknumber() と同じ)
+     static int get(lua_State *L, int index){ return (int)luaL_checknumber(L, index); }
+     static int push(lua_State *L, int value){ lua_pushinteger(L, value); return 1; }
+};
+
+template<>
+struct LuaType<bool>
+{
+     static bool get(lua_State *L, int index){ return lua_toboolean(L, index) != 0; }
+     static int push(lua_State *L, bool value){ lua_pushboolean(L, value? 1 : 0); return 1; }
+};
+
+template<>
+struct LuaType<const char *>
+{
+     static const char *get(lua_State *L, int index){ return luaL_checkstring(L, index); }
+     static int push(lua_State *L, const char *value){ lua_pushstring(L, value); return 1; }
+};
+
+template<>
+struct LuaType<LuaReturn>
+{
+     static int push(lua_State *L, LuaReturn value){ return value.count; }
+};
+
+template<>
+struct LuaType<LuaTable>
+{
+     static LuaTable get(lua_State *L, int index){ luaL_checktype(L, index, LUA_TTABLE); return LuaTable{ index }; }
+};
+
+template<>
+struct LuaType<LuaFunction>
+{
+     static LuaFunction get(lua_State *L, int index){ luaL_checktype(L, index, LUA_TFUNCTION); return LuaFunction{ index }; }
+};
+
+template<>
+struct LuaType<LuaAny>
+{
+     static LuaAny get(lua_State *L, int index){ luaL_checkany(L, index); return LuaAny{ index }; }
+};
+
+template<typename T>
+struct LuaType< LuaOptional<T> >
+{
+     static LuaOptional<T> get(lua_State *L, int index)
+     {
+          if( lua_isnoneornil(L, index) )
+          {
+               return LuaOptional<T>{ false, T() };
+          }
+          return LuaOptional<T>{ true, LuaType<T>::get(L, index) };
+     }
+};
+
+template<typename... T>
+struct LuaType< std::tuple<T...> >
+{
+     static int push(lua_State *L, const std::tuple<T...>& value)
+     {
+          return push(L, value, std::index_sequence_for<T...>());
+     }
+     template<size_t... I>
+     static int push(lua_State *L, const std::tuple<T...>& value, std::index_sequence<I...>)
+     {
+          int count = 0;
+          int dummy[] = { 0, (count += LuaType<T>::push(L, std::get<I>(value)))... };
+          (void)dummy;
+          return count;
+     }
+};
+
+//------------------------------------------------------------------------------
+//   メンバ関数を呼んで戻り値を積む
+//------------------------------------------------------------------------------
+template<typename R>
+struct LuaResult
+{
+     template<typename C, typename F, typename T, size_t... I>
+     static int call(lua_State *L, C *self, F method, T& args, std::index_sequence<I...>)
+     {
+          return LuaType<R>::push(L, (self->*method)(L, std::get<I>(args)...));
+     }
+};
+
+template<>
+struct LuaResult<void>
+{
+     template<typename C, typename F, typename T, size_t... I>
+     static int call(lua_State *L, C *self, F method, T& args, std::index_sequence<I...>)
+     {
+          (self->*method)(L, std::get<I>(args)...);
+          return 0;
+     }
+};
+
+//------------------------------------------------------------------------------
+//   LuaMethod<decltype(&C::f), &C::f>::call が lua_CFunction になる
+//   (upvalue 1 に C * を入れたクロージャとして登録すること : luaBind())
+//------------------------------------------------------------------------------
+template<typename F, F M>
+struct LuaMethod;
+
+template<typename C, typename R, typename... A, R (C::*M)(lua_State *, A...)>
+struct LuaMethod<R (C::*)(lua_State *, A...), M>
+{
+     static int call(lua_State *L)
+     {
+          C *self = (C *)lua_touserdata(L, lua_upvalueindex(1));
+          return invoke(L, self, std::index_sequence_for<A...>());
+     }
+     template<size_t... I>
+     static int invoke(lua_State *L, C *self, std::index_sequence<I...> sequence)
+     {
+          // 波括弧の初期化なので，引数は 1, 2, ... の順に読む
+          std::tuple<typename std::decay<A>::type...> args{ LuaType<typename std::decay<A>::type>::get(L, (int)I + 1)... };
+          return LuaResult<R>::call(L, self, M, args, sequence);
+     }
+};
+
+//------------------------------------------------------------------------------
+//   登録
+//------------------------------------------------------------------------------
+struct LuaBinding
+{
+     const char    *name;
+     lua_CFunction  function;
+};
+
+inline void luaBind(lua_State *L, const LuaBinding *bindings, int count, void *self)
+{
+     for( int n = 0 ; n < count ; n++ )
+     {
+          lua_pushlightuserdata(L, self);
+          lua_pushcclosure(L, bindings[n].function, 1);
+          lua_setglobal(L, bindings[n].name);
+     }
+}
+
+#endif
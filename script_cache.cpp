@@ -0,0 +1,305 @@
+//------------------------------------------------------------------------------
+//   script_cache.cpp
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <cstdio>
+#include <lauxlib.h>
+#include "script_cache.h"
+
+//------------------------------------------------------------------------------
+//   ソースと suffix を続けて lua_load() に渡す
+//------------------------------------------------------------------------------
+struct SourceReader
+{
+     const char *part[2];
+     size_t      size[2];
+     int         index;
+};
+
+static const char *readSource(lua_State *L, void *data, size_t *size)
+{
+     SourceReader *reader = (SourceReader *)data;
+     while( reader->index < 2 )
+     {
+          int n = reader->index++;
+          if( reader->size[n] > 0 )
+          {
+               *size = reader->size[n];
+               return reader->part[n];
+          }
+     }
+     *size = 0;
+     return NULL;
+}
+
+//------------------------------------------------------------------------------
+static int writeBytecode(lua_State *L, const void *p, size_t size, void *data)
+{
+     ((std::string *)data)->append((const char *)p, size);
+     return 0;
+}
+
+
+//==============================================================================
+//   ScriptCache
+//==============================================================================
+//   コンストラクタ
+//   dir の監視を始める (inotify が使えなくても，更新時刻とサイズの照合で動く)
+//------------------------------------------------------------------------------
+ScriptCache::ScriptCache(const char *dir)
+     : m_dir(dir), m_thread(NULL), m_inotify(-1), m_wakeup(-1), m_terminated(false)
+{
+     memset(&m_stats, 0, sizeof(m_stats));
+     if( m_dir.empty() || m_dir[m_dir.size() - 1] != '/' )
+     {
+          m_dir += '/';
+     }
+
+     m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+     m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+     if( m_inotify < 0 || m_wakeup < 0 )
+     {
+          perror("[ScriptCache] inotify_init1() / eventfd() failed");
+          return;
+     }
+     uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF;
+     if( inotify_add_watch(m_inotify, m_dir.c_str(), mask) < 0 )
+     {
+          perror("[ScriptCache] inotify_add_watch() failed");
+          return;
+     }
+     m_thread = new std::thread([this](){ watch(); });
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//------------------------------------------------------------------------------
+ScriptCache::~ScriptCache()
+{
+     m_terminated = true;
+     if( m_thread )
+     {
+          uint64_t one = 1;
+          if( write(m_wakeup, &one, sizeof(one)) < 0 )
+          {
+               perror("[ScriptCache::~ScriptCache] write() failed");
+          }
+          m_thread->join();
+          delete m_thread;
+     }
+     if( m_inotify >= 0 )
+     {
+          close(m_inotify);
+     }
+     if( m_wakeup >= 0 )
+     {
+          close(m_wakeup);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   path のスクリプトの末尾に suffix を付けてコンパイルした関数を L に積む
+//   戻り値とスタックは luaL_loadfile() と同じ (エラーならメッセージを積む)
+//   chunkName はエラーメッセージに出る名前 (lua_load() と同じ書式)
+//------------------------------------------------------------------------------
+int ScriptCache::load(lua_State *L, const std::string& path, const char *suffix, const char *chunkName)
+{
+     int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+     struct stat st;
+     if( fd < 0 || fstat(fd, &st) < 0 )
+     {
+          if( fd >= 0 )
+          {
+               close(fd);
+          }
+          lua_pushfstring(L, "cannot open %s", path.c_str());
+          return LUA_ERRFILE;
+     }
+
+     std::lock_guard<std::mutex> lock(m_mutex);
+     std::map<std::string, Entry>::iterator i = m_entries.find(path);
+     if( i != m_entries.end() && i->second.size == st.st_size &&
+          i->second.mtime.tv_sec == st.st_mtim.tv_sec && i->second.mtime.tv_nsec == st.st_mtim.tv_nsec )
+     {
+          close(fd);
+          m_stats.hits++;
+          const std::string& code = i->second.bytecode;
+          return luaL_loadbuffer(L, code.data(), code.size(), chunkName);
+     }
+
+     // 更新時刻が変わっていても，内容が同じであればバイトコードを使う
+     const char *source = "";
+     void *map = NULL;
+     if( st.st_size > 0 )
+     {
+          map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if( map == MAP_FAILED )
+          {
+               close(fd);
+               lua_pushfstring(L, "cannot read %s", path.c_str());
+               return LUA_ERRFILE;
+          }
+          source = (const char *)map;
+     }
+     close(fd);
+     size_t suffixLength = strlen(suffix);
+     uint64_t h = hash(suffix, suffixLength, hash(source, st.st_size));
+
+     int status;
+     if( i != m_entries.end() && i->second.hash == h )
+     {
+          m_stats.hits++;
+          status = luaL_loadbuffer(L, i->second.bytecode.data(), i->second.bytecode.size(), chunkName);
+     }
+     else
+     {
+          m_stats.compiled++;
+          SourceReader reader = { { source, suffix }, { (size_t)st.st_size, suffixLength }, 0 };
+          status = lua_load(L, &readSource, &reader, chunkName);
+          if( status == 0 )
+          {
+               Entry& entry = m_entries[path];
+               entry.bytecode.clear();
+               lua_dump(L, &writeBytecode, &entry.bytecode);
+               entry.hash = h;
+               i = m_entries.find(path);
+          }
+          else if( i != m_entries.end() )
+          {
+               m_entries.erase(i);
+               i = m_entries.end();
+          }
+     }
+     if( i != m_entries.end() )
+     {
+          i->second.mtime = st.st_mtim;
+          i->second.size = st.st_size;
+     }
+     if( map )
+     {
+          munmap(map, st.st_size);
+     }
+     return status;
+}
+
+//------------------------------------------------------------------------------
+//   ファイルを介さずに，source の末尾に suffix を付けてコンパイルした関数を L に積み，
+//   バイトコードを bytecode に入れる (キャッシュには入れない)
+//   戻り値とスタックは luaL_loadbuffer() と同じ
+//------------------------------------------------------------------------------
+int ScriptCache::compile(lua_State *L, const std::string& source, const char *suffix, const char *chunkName, std::string *bytecode)
+{
+     {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_stats.compiled++;
+     }
+     SourceReader reader = { { source.data(), suffix }, { source.size(), strlen(suffix) }, 0 };
+     int status = lua_load(L, &readSource, &reader, chunkName);
+     if( status == 0 )
+     {
+          bytecode->clear();
+          lua_dump(L, &writeBytecode, bytecode);
+     }
+     return status;
+}
+
+//------------------------------------------------------------------------------
+void ScriptCache::clear()
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_stats.invalidated += m_entries.size();
+     m_entries.clear();
+}
+
+//------------------------------------------------------------------------------
+void ScriptCache::getStats(Stats *stats)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     *stats = m_stats;
+}
+
+//------------------------------------------------------------------------------
+void ScriptCache::invalidate(const std::string& path)
+{
+     std::lock_guard<std::mutex> lock(m_mutex);
+     m_stats.invalidated += m_entries.erase(path);
+}
+
+//------------------------------------------------------------------------------
+//   FNV-1a (64 bit)
+//------------------------------------------------------------------------------
+uint64_t ScriptCache::hash(const void *data, size_t size, uint64_t h)
+{
+     const uint8_t *p = (const uint8_t *)data;
+     for( size_t n = 0 ; n < size ; n++ )
+     {
+          h = (h ^ p[n]) * 1099511628211ULL;
+     }
+     return h;
+}
+
+//------------------------------------------------------------------------------
+//   監視スレッド
+//   ファイルの変更・削除・名前の変更でそのパスのキャッシュを捨てる
+//   イベントが溢れたとき，ディレクトリ自体が消えたときはすべて捨てる
+//------------------------------------------------------------------------------
+void ScriptCache::watch()
+{
+     std::printf("[ScriptCache] watching %s\n", m_dir.c_str());
+
+     while( !m_terminated )
+     {
+          struct pollfd fds[2];
+          fds[0].fd = m_inotify;
+          fds[0].events = POLLIN;
+          fds[1].fd = m_wakeup;
+          fds[1].events = POLLIN;
+          if( poll(fds, 2, -1) < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               perror("[ScriptCache] poll() failed");
+               break;
+          }
+          if( fds[1].revents & POLLIN )
+          {
+               break;
+          }
+
+          alignas(struct inotify_event) char buffer[4096];
+          while( true )
+          {
+               ssize_t size = read(m_inotify, buffer, sizeof(buffer));
+               if( size <= 0 )
+               {
+                    break;         // EAGAIN : 読み尽くした
+               }
+               for( char *p = buffer ; p < buffer + size ; )
+               {
+                    const struct inotify_event *event = (const struct inotify_event *)p;
+                    if( event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED) )
+                    {
+                         clear();
+                    }
+                    else if( event->len > 0 )
+                    {
+                         invalidate(m_dir + event->name);
+                    }
+                    p += sizeof(struct inotify_event) + event->len;
+               }
+          }
+     }
+
+     std::printf("[ScriptCache] thread terminated.\n");
+}
@@ -0,0 +1,65 @@
+//------------------------------------------------------------------------------
+//   script_cache.h
+//
+//   スクリプトのコンパイル結果 (Lua のバイトコード) のキャッシュ
+//   パス・更新時刻・サイズ・内容のハッシュで照合し，変わっていなければ
+//   ソースを解析せずにバイトコードから読み込む
+//   ソースファイルは mmap で読む。監視するディレクトリ (./script/) の変更は
+//   inotify で受けて，該当するキャッシュを捨てる
+//------------------------------------------------------------------------------
+#ifndef   SCRIPT_CACHE_H
+#define   SCRIPT_CACHE_H
+
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <lua.hpp>
+
+//------------------------------------------------------------------------------
+class ScriptCache
+{
+     public:
+          struct Stats
+          {
+               uint64_t hits;           // バイトコードから読み込んだ
+               uint64_t compiled;       // ソースを解析した
+               uint64_t invalidated;    // inotify で捨てた
+          };
+
+     private:
+          struct Entry
+          {
+               struct timespec mtime;
+               off_t       size;
+               uint64_t    hash;             // ソース (+ suffix) の FNV-1a
+               std::string bytecode;
+          };
+
+          std::string  m_dir;
+          std::map<std::string, Entry> m_entries;   // キーはパス
+          Stats        m_stats;
+          std::mutex   m_mutex;
+          std::thread *m_thread;
+          int          m_inotify;
+          int          m_wakeup;             // 監視スレッドの終了を通知する eventfd
+          std::atomic<bool> m_terminated;
+
+          void watch();
+          void invalidate(const std::string& path);
+          static uint64_t hash(const void *data, size_t size, uint64_t h = 14695981039346656037ULL);
+
+     public:
+          ScriptCache(const char *dir);
+          ~ScriptCache();
+
+          int  load(lua_State *L, const std::string& path, const char *suffix, const char *chunkName);
+          int  compile(lua_State *L, const std::string& source, const char *suffix, const char *chunkName, std::string *bytecode);
+          void clear();
+          void getStats(Stats *stats);
+};
+
+#endif
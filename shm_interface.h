@@ -0,0 +1,294 @@
+//------------------------------------------------------------------------------
+//   shm_interface.h
+//
+//   同じ Pi 上のプロセス (画像処理など) 向けの共有メモリ I/F
+//   ロボットの状態をシーケンスロックで公開し，移動などのコマンドをロックなしの
+//   メールボックスで受け付ける。TCP を経由しないので，状態はいくらでも読んでよい
+//   (サーバのスレッドには触れない)
+//
+//   クライアントはこのヘッダだけを使う (リンク時に -lrt が要る環境がある)
+//
+//     ShmClient arm;
+//     arm.open();
+//     ShmArmState state;
+//     arm.readState(&state);
+//     ShmCommand cmd = { ShmCommand::MOVE_XYZ, { 20000, 0, 15000 }, 5000, 20000 };
+//     uint32_t ticket;
+//     arm.post(cmd, &ticket);
+//     ... arm.getResult(ticket) が SHM_PENDING でなくなるまで待つ ...
+//------------------------------------------------------------------------------
+#ifndef   SHM_INTERFACE_H
+#define   SHM_INTERFACE_H
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define   SHM_NAME  "/robotic_arm"
+
+enum
+{
+     SHM_MAGIC = 0x4D524152,       // "RARM"
+     SHM_VERSION = 1,
+     SHM_MAILBOX_SIZE = 64,        // 2 のべき乗
+};
+
+//   コマンドの結果 (CommandObject::STS_xxx と同じ値)
+enum
+{
+     SHM_STS_OK      = 0,
+     SHM_STS_UNABLE  = 1,
+     SHM_STS_INVALID = 2,
+     SHM_STS_FAIL    = 4,
+     SHM_PENDING     = -1,         // まだ実行されていない
+     SHM_UNKNOWN     = -2,         // 結果が後のコマンドで上書きされた
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "atomic<uint32_t> must be lock-free to be shared between processes");
+
+//------------------------------------------------------------------------------
+struct ShmAxisState
+{
+     int32_t  position;            // pulse
+     int32_t  speed;               // pulse/sec
+     uint16_t status;              // L6470 の STATUS レジスタ
+     uint8_t  halted;              // 励磁が切れている
+     uint8_t  moving;              // 移動中 (原点復帰，ジョグを含む)
+     uint8_t  homed;               // 原点復帰済み
+     uint8_t  alarm;               // アラームフラグ
+     uint8_t  limit[2];            // リミットスイッチ [逆転側, 正転側] (1 で入)
+};
+
+//------------------------------------------------------------------------------
+struct ShmArmState
+{
+     uint64_t timestamp;           // 更新時刻 (CLOCK_MONOTONIC，ns)
+     uint32_t updateCount;
+     uint16_t feedOverride;        // %
+     uint16_t queueLength;         // モーションキューの点数
+     uint8_t  gripper;             // 0 ～ 100
+     uint8_t  reserved[7];
+     ShmAxisState axis[3];
+};
+
+//------------------------------------------------------------------------------
+//   メールボックスに入れるコマンド
+//   単位は TCP の MoveJoint (14) / MoveXYZ (15) と同じ
+//------------------------------------------------------------------------------
+struct ShmCommand
+{
+     enum
+     {
+          MOVE_JOINT = 1,          // value : 各軸の移動先(pulse)，speed : 0.01 deg/sec
+          MOVE_XYZ   = 2,          // value : X, Y, Z (0.01 mm)，speed : 0.01 mm/sec
+          STOP       = 3,          // 全軸を減速停止
+          GRIPPER    = 4,          // value[0] : 開度 (0 ～ 100)
+     };
+     uint32_t kind;
+     int32_t  value[3];
+     uint32_t speed;               // 0 は既定値
+     uint32_t accel;
+};
+
+//------------------------------------------------------------------------------
+//   共有メモリの内容
+//   state は stateSeq が奇数の間 (サーバが書き込み中) は読まない
+//   メールボックスは複数のクライアントが書き込める有限長のキュー (各スロットの
+//   sequence で空き・書き込み済みを判別する)。サーバだけが取り出す
+//------------------------------------------------------------------------------
+struct ShmRegion
+{
+     uint32_t magic;
+     uint32_t version;
+     std::atomic<uint32_t> online;           // サーバが動いていれば 1
+
+     alignas(64) std::atomic<uint32_t> stateSeq;
+     ShmArmState state;
+
+     alignas(64) std::atomic<uint32_t> enqueuePos;
+     alignas(64) uint32_t dequeuePos;        // サーバのみ
+     struct Slot
+     {
+          std::atomic<uint32_t> sequence;
+          ShmCommand command;
+     } slots[SHM_MAILBOX_SIZE];
+     struct Result
+     {
+          std::atomic<uint32_t> ticket;      // 結果を書いたコマンドの番号 + 1 (0 はなし)
+          int32_t status;
+     } results[SHM_MAILBOX_SIZE];
+};
+
+//------------------------------------------------------------------------------
+//   クライアント
+//------------------------------------------------------------------------------
+class ShmClient
+{
+     public:
+          enum
+          {
+               READ_SPIN = 100,         // 休まずに読み直す回数
+               READ_PAUSE_US = 50,      // その後の読み直しの間隔
+               READ_TIMEOUT_MS = 50,    // これだけ読めなければ諦める (状態の更新周期の 10 倍)
+          };
+
+     private:
+          ShmRegion *m_region;
+
+          ShmClient(const ShmClient&);
+          ShmClient& operator=(const ShmClient&);
+
+     public:
+          ShmClient() : m_region(NULL) {}
+          ~ShmClient(){ close(); }
+
+          //------------------------------------------------------------------------------
+          bool open(const char *name = SHM_NAME)
+          {
+               close();
+               int fd = shm_open(name, O_RDWR, 0);
+               if( fd < 0 )
+               {
+                    return false;
+               }
+               void *p = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+               ::close(fd);
+               if( p == MAP_FAILED )
+               {
+                    return false;
+               }
+               ShmRegion *region = (ShmRegion *)p;
+               if( region->magic != SHM_MAGIC || region->version != SHM_VERSION )
+               {
+                    munmap(p, sizeof(ShmRegion));
+                    return false;
+               }
+               m_region = region;
+               return true;
+          }
+
+          //------------------------------------------------------------------------------
+          void close()
+          {
+               if( m_region )
+               {
+                    munmap(m_region, sizeof(ShmRegion));
+                    m_region = NULL;
+               }
+          }
+
+          //------------------------------------------------------------------------------
+          bool isOnline() const
+          {
+               return m_region && m_region->online.load(std::memory_order_acquire) != 0;
+          }
+
+          //------------------------------------------------------------------------------
+          //   状態を読む (書き込み中なら読み直す)
+          //   書き込みは数 µs で終わる。READ_SPIN 回を超えたら少しずつ休みながら読み直し，
+          //   READ_TIMEOUT_MS 過ぎても読めなければ false (サーバが書き込み中に止まった)
+          //------------------------------------------------------------------------------
+          bool readState(ShmArmState *state) const
+          {
+               if( !m_region )
+               {
+                    return false;
+               }
+               struct timespec start;
+               clock_gettime(CLOCK_MONOTONIC, &start);
+               for( int retry = 0 ; ; retry++ )
+               {
+                    if( retry >= READ_SPIN )
+                    {
+                         struct timespec now;
+                         clock_gettime(CLOCK_MONOTONIC, &now);
+                         if( (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 >= READ_TIMEOUT_MS )
+                         {
+                              return false;
+                         }
+                         usleep(READ_PAUSE_US);
+                    }
+                    uint32_t s1 = m_region->stateSeq.load(std::memory_order_acquire);
+                    if( s1 & 1 )
+                    {
+                         continue;
+                    }
+                    memcpy(state, (const void *)&m_region->state, sizeof(ShmArmState));
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if( m_region->stateSeq.load(std::memory_order_relaxed) == s1 )
+                    {
+                         return true;
+                    }
+               }
+          }
+
+          //------------------------------------------------------------------------------
+          //   コマンドをメールボックスに入れる
+          //   ticket には getResult() に渡す番号が入る。満杯なら false
+          //------------------------------------------------------------------------------
+          bool post(const ShmCommand& command, uint32_t *ticket)
+          {
+               if( !m_region )
+               {
+                    return false;
+               }
+               uint32_t pos = m_region->enqueuePos.load(std::memory_order_relaxed);
+               ShmRegion::Slot *slot;
+               while( true )
+               {
+                    slot = &m_region->slots[pos & (SHM_MAILBOX_SIZE - 1)];
+                    uint32_t seq = slot->sequence.load(std::memory_order_acquire);
+                    int32_t diff = (int32_t)(seq - pos);
+                    if( diff == 0 )
+                    {
+                         if( m_region->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                         {
+                              break;
+                         }
+                    }
+                    else if( diff < 0 )
+                    {
+                         return false;
+                    }
+                    else
+                    {
+                         pos = m_region->enqueuePos.load(std::memory_order_relaxed);
+                    }
+               }
+               slot->command = command;
+               slot->sequence.store(pos + 1, std::memory_order_release);
+               *ticket = pos;
+               return true;
+          }
+
+          //------------------------------------------------------------------------------
+          //   post() したコマンドの結果 (SHM_STS_xxx，SHM_PENDING，SHM_UNKNOWN)
+          //------------------------------------------------------------------------------
+          int getResult(uint32_t ticket) const
+          {
+               if( !m_region )
+               {
+                    return SHM_UNKNOWN;
+               }
+               const ShmRegion::Result& r = m_region->results[ticket & (SHM_MAILBOX_SIZE - 1)];
+               uint32_t done = r.ticket.load(std::memory_order_acquire);
+               if( done == ticket + 1 )
+               {
+                    int status = r.status;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if( r.ticket.load(std::memory_order_relaxed) == done )
+                    {
+                         return status;
+                    }
+                    return SHM_UNKNOWN;
+               }
+               return ((int32_t)(done - (ticket + 1)) < 0)? SHM_PENDING : SHM_UNKNOWN;
+          }
+};
+
+#endif
@@ -0,0 +1,206 @@
+//------------------------------------------------------------------------------
+//   shm_server.cpp
+//------------------------------------------------------------------------------
+#include <time.h>
+#include <new>
+#include <cstdio>
+#include <chrono>
+#include "shm_server.h"
+
+
+//==============================================================================
+//   ShmServer
+//==============================================================================
+//   コンストラクタ
+//   共有メモリを作り (既にあれば作り直さずに) 初期化する
+//------------------------------------------------------------------------------
+ShmServer::ShmServer(Robot *robot, const char *name)
+     : m_robot(robot), m_region(NULL), m_thread(NULL), m_terminated(false)
+{
+     m_state = INIT_FAILED;
+     int fd = shm_open(name, O_CREAT | O_RDWR, 0660);
+     if( fd < 0 )
+     {
+          perror("[ShmServer] shm_open() failed");
+          return;
+     }
+     if( ftruncate(fd, sizeof(ShmRegion)) < 0 )
+     {
+          perror("[ShmServer] ftruncate() failed");
+          close(fd);
+          return;
+     }
+     void *p = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+     close(fd);
+     if( p == MAP_FAILED )
+     {
+          perror("[ShmServer] mmap() failed");
+          return;
+     }
+
+     // 前回の内容は使わない (クライアントは magic を見てから読む)
+     memset(p, 0, sizeof(ShmRegion));
+     m_region = new (p) ShmRegion();
+     for( uint32_t n = 0 ; n < SHM_MAILBOX_SIZE ; n++ )
+     {
+          m_region->slots[n].sequence.store(n, std::memory_order_relaxed);
+          m_region->results[n].ticket.store(0, std::memory_order_relaxed);
+     }
+     m_region->enqueuePos.store(0, std::memory_order_relaxed);
+     m_region->dequeuePos = 0;
+     m_region->stateSeq.store(0, std::memory_order_relaxed);
+     publishState();
+     m_region->version = SHM_VERSION;
+     std::atomic_thread_fence(std::memory_order_release);
+     m_region->magic = SHM_MAGIC;
+     m_region->online.store(1, std::memory_order_release);
+
+     m_state = RUNNING;
+     m_thread = new std::thread([this](){ execute(); });
+     std::printf("[ShmServer] Shared memory %s (%d bytes) ready.\n", name, (int)sizeof(ShmRegion));
+}
+
+//------------------------------------------------------------------------------
+//   デストラクタ
+//   共有メモリは消さない (開いているクライアントは online が 0 になったことで分かる)
+//------------------------------------------------------------------------------
+ShmServer::~ShmServer()
+{
+     m_terminated = true;
+     if( m_thread )
+     {
+          m_thread->join();
+          delete m_thread;
+     }
+     if( m_region )
+     {
+          m_region->online.store(0, std::memory_order_release);
+          munmap(m_region, sizeof(ShmRegion));
+     }
+}
+
+//------------------------------------------------------------------------------
+//   処理スレッド
+//------------------------------------------------------------------------------
+void ShmServer::execute()
+{
+     std::printf("[ShmServer] thread started.\n");
+
+     std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+     while( !m_terminated )
+     {
+          next += std::chrono::milliseconds(TICK_MS);
+          std::this_thread::sleep_until(next);
+          processMailbox();
+          publishState();
+     }
+
+     std::printf("[ShmServer] thread terminated.\n");
+}
+
+//------------------------------------------------------------------------------
+//   メールボックスのコマンドを入れられた順にすべて実行する
+//------------------------------------------------------------------------------
+void ShmServer::processMailbox()
+{
+     while( true )
+     {
+          uint32_t pos = m_region->dequeuePos;
+          ShmRegion::Slot& slot = m_region->slots[pos & (SHM_MAILBOX_SIZE - 1)];
+          uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+          if( (int32_t)(seq - (pos + 1)) < 0 )
+          {
+               break;         // 空 (または書き込み中)
+          }
+          ShmCommand command = slot.command;
+          slot.sequence.store(pos + SHM_MAILBOX_SIZE, std::memory_order_release);
+          m_region->dequeuePos = pos + 1;
+
+          int status = executeCommand(command);
+          ShmRegion::Result& result = m_region->results[pos & (SHM_MAILBOX_SIZE - 1)];
+          result.ticket.store(0, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_release);
+          result.status = status;
+          result.ticket.store(pos + 1, std::memory_order_release);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   戻り値は SHM_STS_xxx
+//------------------------------------------------------------------------------
+int ShmServer::executeCommand(const ShmCommand& command)
+{
+     switch( command.kind )
+     {
+          case ShmCommand::MOVE_JOINT:
+               if( !m_robot->startMotion3D(command.value[0], command.value[1], command.value[2],
+                    command.speed / 100.0, command.accel / 100.0, Robot::UNIT_DEG) )
+               {
+                    return SHM_STS_UNABLE;
+               }
+               return SHM_STS_OK;
+
+          case ShmCommand::MOVE_XYZ:
+          {
+               int32_t b, s, e;
+               if( !Robot::coordToMotorPos(command.value[0] / 100.0, command.value[1] / 100.0, command.value[2] / 100.0, &b, &s, &e) )
+               {
+                    return SHM_STS_INVALID;      // 可動範囲外
+               }
+               if( !m_robot->startMotion3D(b, s, e, command.speed / 100.0, command.accel / 100.0, Robot::UNIT_MM) )
+               {
+                    return SHM_STS_UNABLE;
+               }
+               return SHM_STS_OK;
+          }
+
+          case ShmCommand::STOP:
+               m_robot->softStop();
+               return SHM_STS_OK;
+
+          case ShmCommand::GRIPPER:
+               if( command.value[0] < 0 || 100 < command.value[0] )
+               {
+                    return SHM_STS_INVALID;
+               }
+               m_robot->moveGripper((uint8_t)command.value[0]);
+               return SHM_STS_OK;
+     }
+     return SHM_STS_INVALID;
+}
+
+//------------------------------------------------------------------------------
+//   状態を読んでから，シーケンスロックの中で書き込む
+//------------------------------------------------------------------------------
+void ShmServer::publishState()
+{
+     ShmArmState state;
+     memset(&state, 0, sizeof(state));
+
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     state.timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+     state.updateCount = m_region->state.updateCount + 1;
+     state.feedOverride = (uint16_t)m_robot->getFeedOverride();
+     state.queueLength = (uint16_t)m_robot->getQueueLength();
+     state.gripper = m_robot->getGripperValue();
+     for( int n = 0 ; n < 3 ; n++ )
+     {
+          ShmAxisState& axis = state.axis[n];
+          axis.position = m_robot->getMotorPosition(n);
+          axis.speed = m_robot->getMotorSpeed(n);
+          axis.status = m_robot->getMotorStatus(n);
+          axis.halted = m_robot->isHalted(n);
+          axis.moving = m_robot->isInMotion(n);
+          axis.homed = m_robot->isHomeCompleted(n);
+          axis.alarm = m_robot->getAlarmFlag(n);
+          axis.limit[0] = m_robot->getLimitState(n, L6470::DIR_REVERSE)? 0 : 1;
+          axis.limit[1] = m_robot->getLimitState(n, L6470::DIR_FORWARD)? 0 : 1;
+     }
+
+     uint32_t seq = m_region->stateSeq.load(std::memory_order_relaxed);
+     m_region->stateSeq.store(seq + 1, std::memory_order_relaxed);
+     std::atomic_thread_fence(std::memory_order_release);
+     memcpy((void *)&m_region->state, &state, sizeof(state));
+     m_region->stateSeq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,41 @@
+//------------------------------------------------------------------------------
+//   shm_server.h
+//
+//   共有メモリ I/F (shm_interface.h) のサーバ側
+//   TICK_MS ごとにメールボックスのコマンドを実行し，ロボットの状態を書き込む
+//------------------------------------------------------------------------------
+#ifndef   SHM_SERVER_H
+#define   SHM_SERVER_H
+
+#include <cstdint>
+#include <thread>
+#include "robot.h"
+#include "shm_interface.h"
+
+//------------------------------------------------------------------------------
+class ShmServer
+{
+     public:
+          enum{ TICK_MS = 5 };
+          enum{ INIT_FAILED = -1, RUNNING };
+
+     private:
+          Robot       *m_robot;
+          ShmRegion   *m_region;
+          std::thread *m_thread;
+          int          m_state;
+          bool         m_terminated;
+
+          void execute();
+          void processMailbox();
+          int  executeCommand(const ShmCommand& command);
+          void publishState();
+
+     public:
+          ShmServer(Robot *robot, const char *name = SHM_NAME);
+          ~ShmServer();
+
+          int  getState(){ return m_state; }
+};
+
+#endif
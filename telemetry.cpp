@@ -0,0 +1,558 @@
+//------------------------------------------------------------------------------
+//   telemetry.cpp
+//------------------------------------------------------------------------------
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include "telemetry.h"
+
+
+//==============================================================================
+//   Telemetry
+//==============================================================================
+//   チャネル番号に対応するサンプル値を取り出す
+//------------------------------------------------------------------------------
+int64_t Telemetry::getChannelValue(const TelemetrySample& s, int ch)
+{
+     if( ch == CH_TIME ){ return (int64_t)s.time; }
+     if( ch < CH_SPEED ){ return s.position[ch - CH_POSITION]; }
+     if( ch < CH_STATUS ){ return s.speed[ch - CH_SPEED]; }
+     if( ch < CH_ALARM ){ return s.status[ch - CH_STATUS]; }
+     if( ch < CH_GRIPPER ){ return s.alarm[ch - CH_ALARM]; }
+     return s.gripper;
+}
+
+//------------------------------------------------------------------------------
+void Telemetry::setChannelValue(TelemetrySample& s, int ch, int64_t value)
+{
+     if( ch == CH_TIME ){ s.time = (uint64_t)value; }
+     else if( ch < CH_SPEED ){ s.position[ch - CH_POSITION] = (int32_t)value; }
+     else if( ch < CH_STATUS ){ s.speed[ch - CH_SPEED] = (int32_t)value; }
+     else if( ch < CH_ALARM ){ s.status[ch - CH_STATUS] = (uint16_t)value; }
+     else if( ch < CH_GRIPPER ){ s.alarm[ch - CH_ALARM] = (uint8_t)value; }
+     else { s.gripper = (uint8_t)value; }
+}
+
+//------------------------------------------------------------------------------
+//   可変長整数 (下位7bitずつ，MSB=1 で継続)
+//------------------------------------------------------------------------------
+void Telemetry::putVarint(std::vector<uint8_t>& buf, uint64_t v)
+{
+     while( v >= 0x80 )
+     {
+          buf.push_back((uint8_t)(v | 0x80));
+          v >>= 7;
+     }
+     buf.push_back((uint8_t)v);
+}
+
+//------------------------------------------------------------------------------
+//   戻り値は次の読み出し位置 (データが壊れている場合は nullptr)
+//------------------------------------------------------------------------------
+const uint8_t *Telemetry::getVarint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+     uint64_t value = 0;
+     for( int shift = 0 ; shift < 64 && p < end ; shift += 7 )
+     {
+          uint8_t c = *p++;
+          value |= (uint64_t)(c & 0x7F) << shift;
+          if( (c & 0x80) == 0 )
+          {
+               *v = value;
+               return p;
+          }
+     }
+     return nullptr;
+}
+
+
+//==============================================================================
+//   TelemetryWriter
+//==============================================================================
+TelemetryWriter::TelemetryWriter()
+     : m_fp(nullptr), m_offset(0), m_failed(false), m_closing(false), m_dropped(0), m_thread(nullptr)
+{
+}
+
+//------------------------------------------------------------------------------
+TelemetryWriter::~TelemetryWriter()
+{
+     close();
+}
+
+//------------------------------------------------------------------------------
+//   ファイルを作ってヘッダを書き，書き出しスレッドを開始する
+//------------------------------------------------------------------------------
+bool TelemetryWriter::open(const char *path)
+{
+     close();
+
+     m_fp = fopen(path, "wb");
+     if( !m_fp )
+     {
+          perror("[TelemetryWriter] fopen() failed");
+          return false;
+     }
+
+     struct timeval tv;
+     gettimeofday(&tv, NULL);
+
+     Telemetry::FileHeader header;
+     header.magic = Telemetry::FILE_MAGIC;
+     header.version = Telemetry::VERSION;
+     header.channels = Telemetry::NUM_CHANNELS;
+     header.startTime = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+     if( fwrite(&header, sizeof(header), 1, m_fp) != 1 )
+     {
+          perror("[TelemetryWriter] fwrite() failed");
+          fclose(m_fp);
+          m_fp = nullptr;
+          return false;
+     }
+
+     m_failed = false;
+     m_closing = false;
+     m_dropped = 0;
+     m_offset = sizeof(header);
+     m_index.clear();
+     m_pending.clear();
+     m_samples.clear();
+     m_samples.reserve(Telemetry::SAMPLES_PER_BLOCK);
+     // 追記側でメモリを確保しないように，入れ替え用のバッファを用意しておく
+     m_spare.resize(SPARE_BLOCKS);
+     for( size_t n = 0 ; n < m_spare.size() ; n++ )
+     {
+          m_spare[n].clear();
+          m_spare[n].reserve(Telemetry::SAMPLES_PER_BLOCK);
+     }
+     m_thread = new std::thread(&TelemetryWriter::writerLoop, this);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   サンプルを追加する (記録するスレッドからのみ呼ぶ)
+//   ブロック分たまったら書き出しスレッドへ渡すだけで，符号化とファイルへの書き込みは待たない
+//------------------------------------------------------------------------------
+bool TelemetryWriter::append(const TelemetrySample& sample)
+{
+     if( !m_thread || m_failed )
+     {
+          return false;
+     }
+     m_samples.push_back(sample);
+     if( m_samples.size() >= Telemetry::SAMPLES_PER_BLOCK )
+     {
+          submitBlock(false);
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   追記中のサンプルを書き出し待ちの列に移し，空いたバッファと入れ替える
+//   書き込みが追いつかず MAX_PENDING ブロックたまっていれば，そのブロックは捨てる
+//   (force のとき (閉じるとき) は捨てない)
+//------------------------------------------------------------------------------
+void TelemetryWriter::submitBlock(bool force)
+{
+     if( m_samples.empty() )
+     {
+          return;
+     }
+     std::lock_guard<std::mutex> lock(m_queueMutex);
+     if( !force && m_pending.size() >= MAX_PENDING )
+     {
+          m_dropped++;
+          m_samples.clear();
+          return;
+     }
+     m_pending.emplace_back();
+     m_pending.back().swap(m_samples);
+     if( !m_spare.empty() )
+     {
+          m_samples.swap(m_spare.back());
+          m_spare.pop_back();
+     }
+     m_queueCond.notify_one();
+}
+
+//------------------------------------------------------------------------------
+//   書き出しスレッド
+//   書き出したバッファは m_spare に戻して追記側で使い回す
+//------------------------------------------------------------------------------
+void TelemetryWriter::writerLoop()
+{
+     std::unique_lock<std::mutex> lock(m_queueMutex);
+     while( true )
+     {
+          m_queueCond.wait(lock, [this](){ return !m_pending.empty() || m_closing; });
+          if( m_pending.empty() )
+          {
+               break;    // m_closing
+          }
+          std::vector<TelemetrySample> samples;
+          samples.swap(m_pending.front());
+          m_pending.pop_front();
+          lock.unlock();
+
+          if( !m_failed )
+          {
+               writeBlock(samples);
+          }
+          samples.clear();
+
+          lock.lock();
+          m_spare.push_back(std::vector<TelemetrySample>());
+          m_spare.back().swap(samples);
+     }
+}
+
+//------------------------------------------------------------------------------
+//   サンプルを１ブロックとして書き出す (書き出しスレッド)
+//------------------------------------------------------------------------------
+bool TelemetryWriter::writeBlock(const std::vector<TelemetrySample>& samples)
+{
+     Telemetry::BlockHeader header;
+     header.magic = Telemetry::BLOCK_MAGIC;
+     header.count = (uint32_t)samples.size();
+     header.firstTime = samples.front().time;
+     header.lastTime = samples.back().time;
+
+     for( int ch = 0 ; ch < Telemetry::NUM_CHANNELS ; ch++ )
+     {
+          std::vector<uint8_t>& col = m_column[ch];
+          col.clear();
+          int64_t prev = 0;
+          for( size_t n = 0 ; n < samples.size() ; n++ )
+          {
+               int64_t value = Telemetry::getChannelValue(samples[n], ch);
+               Telemetry::putVarint(col, Telemetry::zigzag(value - prev));
+               prev = value;
+          }
+          header.length[ch] = (uint32_t)col.size();
+     }
+
+     Telemetry::BlockIndex index;
+     index.firstTime = header.firstTime;
+     index.lastTime = header.lastTime;
+     index.offset = m_offset;
+     index.count = header.count;
+     index.reserved = 0;
+
+     bool ok = (fwrite(&header, sizeof(header), 1, m_fp) == 1);
+     uint64_t bytes = sizeof(header);
+     for( int ch = 0 ; ch < Telemetry::NUM_CHANNELS && ok ; ch++ )
+     {
+          ok = (fwrite(m_column[ch].data(), 1, m_column[ch].size(), m_fp) == m_column[ch].size());
+          bytes += m_column[ch].size();
+     }
+     ok = ok && (fflush(m_fp) == 0);
+     if( !ok )
+     {
+          // 書けなかったブロックの後ろに続けると，以降のオフセットがファイルの中身と合わなくなる
+          // ここで記録をやめる (フッタは付けない。読み出し時に書けたブロックまでを再構築する)
+          perror("[TelemetryWriter] fwrite() failed, recording stopped");
+          fclose(m_fp);
+          m_fp = nullptr;
+          m_failed = true;
+          return false;
+     }
+
+     m_offset += bytes;
+     m_index.push_back(index);
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   残りのサンプルを書き出し，インデックスとフッタを付加して閉じる
+//------------------------------------------------------------------------------
+void TelemetryWriter::close()
+{
+     if( !m_thread )
+     {
+          return;
+     }
+     if( !m_failed )
+     {
+          submitBlock(true);
+     }
+     m_samples.clear();
+     {
+          std::lock_guard<std::mutex> lock(m_queueMutex);
+          m_closing = true;
+          m_queueCond.notify_one();
+     }
+     m_thread->join();
+     delete m_thread;
+     m_thread = nullptr;
+
+     if( m_dropped > 0 )
+     {
+          std::fprintf(stderr, "[TelemetryWriter] %u block(s) dropped (write too slow).\n", m_dropped);
+     }
+     if( !m_fp )
+     {
+          return;   // 書き込みに失敗して閉じている
+     }
+
+     Telemetry::FileFooter footer;
+     footer.indexOffset = m_offset;
+     footer.numBlocks = (uint32_t)m_index.size();
+     footer.magic = Telemetry::FOOTER_MAGIC;
+     if( !m_index.empty() )
+     {
+          fwrite(&m_index[0], sizeof(Telemetry::BlockIndex), m_index.size(), m_fp);
+     }
+     fwrite(&footer, sizeof(footer), 1, m_fp);
+     fclose(m_fp);
+     m_fp = nullptr;
+}
+
+
+//==============================================================================
+//   TelemetryReader
+//==============================================================================
+TelemetryReader::TelemetryReader() : m_data(nullptr), m_size(0)
+{
+     memset(&m_header, 0, sizeof(m_header));
+}
+
+//------------------------------------------------------------------------------
+TelemetryReader::~TelemetryReader()
+{
+     close();
+}
+
+//------------------------------------------------------------------------------
+bool TelemetryReader::open(const char *path)
+{
+     close();
+
+     int fd = ::open(path, O_RDONLY);
+     if( fd < 0 )
+     {
+          perror("[TelemetryReader] open() failed");
+          return false;
+     }
+     struct stat st;
+     if( fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Telemetry::FileHeader) )
+     {
+          ::close(fd);
+          return false;
+     }
+     void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+     ::close(fd);
+     if( p == MAP_FAILED )
+     {
+          perror("[TelemetryReader] mmap() failed");
+          return false;
+     }
+     m_data = (const uint8_t *)p;
+     m_size = st.st_size;
+     madvise(p, m_size, MADV_SEQUENTIAL);
+
+     memcpy(&m_header, m_data, sizeof(m_header));
+     if( m_header.magic != Telemetry::FILE_MAGIC || m_header.channels != Telemetry::NUM_CHANNELS )
+     {
+          std::fprintf(stderr, "[TelemetryReader] %s is not a telemetry file.\n", path);
+          close();
+          return false;
+     }
+     if( !loadIndex() && !rebuildIndex() )
+     {
+          close();
+          return false;
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+void TelemetryReader::close()
+{
+     if( m_data )
+     {
+          munmap((void *)m_data, m_size);
+     }
+     m_data = nullptr;
+     m_size = 0;
+     m_index.clear();
+}
+
+//------------------------------------------------------------------------------
+//   フッタからインデックスを読み込む
+//------------------------------------------------------------------------------
+bool TelemetryReader::loadIndex()
+{
+     Telemetry::FileFooter footer;
+     if( m_size < sizeof(Telemetry::FileHeader) + sizeof(footer) )
+     {
+          return false;
+     }
+     memcpy(&footer, m_data + m_size - sizeof(footer), sizeof(footer));
+     if( footer.magic != Telemetry::FOOTER_MAGIC )
+     {
+          return false;
+     }
+     uint64_t bytes = (uint64_t)footer.numBlocks * sizeof(Telemetry::BlockIndex);
+     if( footer.indexOffset > m_size || footer.indexOffset + bytes + sizeof(footer) != m_size )
+     {
+          return false;
+     }
+     m_index.resize(footer.numBlocks);
+     if( bytes > 0 )
+     {
+          memcpy(&m_index[0], m_data + footer.indexOffset, bytes);
+     }
+     // 壊れたインデックスで mmap の外を読まないように，すべてのブロックを確かめる
+     for( size_t n = 0 ; n < m_index.size() ; n++ )
+     {
+          Telemetry::BlockHeader header;
+          if( !readBlockHeader(m_index[n].offset, footer.indexOffset, &header) || header.count != m_index[n].count )
+          {
+               std::fprintf(stderr, "[TelemetryReader] index entry %d is broken.\n", (int)n);
+               m_index.clear();
+               return false;
+          }
+     }
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   offset のブロックヘッダを読み，ブロック全体が limit (ファイルの大きさ以下) に
+//   収まっていることを確かめる
+//------------------------------------------------------------------------------
+bool TelemetryReader::readBlockHeader(uint64_t offset, uint64_t limit, Telemetry::BlockHeader *header) const
+{
+     limit = std::min(limit, (uint64_t)m_size);
+     if( offset < sizeof(Telemetry::FileHeader) || offset > limit || limit - offset < sizeof(Telemetry::BlockHeader) )
+     {
+          return false;
+     }
+     memcpy(header, m_data + offset, sizeof(Telemetry::BlockHeader));
+     if( header->magic != Telemetry::BLOCK_MAGIC )
+     {
+          return false;
+     }
+     uint64_t bytes = 0;
+     for( int ch = 0 ; ch < Telemetry::NUM_CHANNELS ; ch++ )
+     {
+          if( header->length[ch] < header->count )
+          {
+               return false;        // 値は１つ１バイト以上
+          }
+          bytes += header->length[ch];
+     }
+     return bytes <= limit - offset - sizeof(Telemetry::BlockHeader);
+}
+
+//------------------------------------------------------------------------------
+//   フッタが無い(記録中に電源断した等)場合は，ブロックを順にたどって再構築する
+//------------------------------------------------------------------------------
+bool TelemetryReader::rebuildIndex()
+{
+     m_index.clear();
+     uint64_t offset = sizeof(Telemetry::FileHeader);
+     while( true )
+     {
+          Telemetry::BlockHeader header;
+          if( !readBlockHeader(offset, m_size, &header) )
+          {
+               break;    // 書き込み途中のブロック
+          }
+          uint64_t bytes = 0;
+          for( int ch = 0 ; ch < Telemetry::NUM_CHANNELS ; ch++ )
+          {
+               bytes += header.length[ch];
+          }
+          Telemetry::BlockIndex index;
+          index.firstTime = header.firstTime;
+          index.lastTime = header.lastTime;
+          index.offset = offset;
+          index.count = header.count;
+          index.reserved = 0;
+          m_index.push_back(index);
+          offset += sizeof(header) + bytes;
+     }
+     std::fprintf(stderr, "[TelemetryReader] index rebuilt (%d blocks).\n", (int)m_index.size());
+     return true;
+}
+
+//------------------------------------------------------------------------------
+uint64_t TelemetryReader::getNumSamples() const
+{
+     uint64_t n = 0;
+     for( size_t i = 0 ; i < m_index.size() ; i++ )
+     {
+          n += m_index[i].count;
+     }
+     return n;
+}
+
+//------------------------------------------------------------------------------
+//   time を含む(または time より後の最初の)ブロック番号を二分探索で求める
+//------------------------------------------------------------------------------
+int TelemetryReader::findBlock(uint64_t time) const
+{
+     int lo = 0;
+     int hi = (int)m_index.size();
+     while( lo < hi )
+     {
+          int mid = (lo + hi) / 2;
+          if( m_index[mid].lastTime < time )
+          {
+               lo = mid + 1;
+          }
+          else
+          {
+               hi = mid;
+          }
+     }
+     return lo;
+}
+
+//------------------------------------------------------------------------------
+//   ブロックを展開する
+//------------------------------------------------------------------------------
+bool TelemetryReader::readBlock(int n, std::vector<TelemetrySample>& samples) const
+{
+     if( n < 0 || n >= (int)m_index.size() )
+     {
+          return false;
+     }
+     const Telemetry::BlockIndex& index = m_index[n];
+     Telemetry::BlockHeader header;
+     if( !readBlockHeader(index.offset, m_size, &header) )
+     {
+          return false;
+     }
+
+     samples.resize(header.count);
+     const uint8_t *p = m_data + index.offset + sizeof(header);
+     const uint8_t *limit = m_data + m_size;
+     for( int ch = 0 ; ch < Telemetry::NUM_CHANNELS ; ch++ )
+     {
+          const uint8_t *end = p + header.length[ch];
+          if( end > limit )
+          {
+               return false;
+          }
+          int64_t value = 0;
+          for( uint32_t i = 0 ; i < header.count ; i++ )
+          {
+               uint64_t v;
+               p = Telemetry::getVarint(p, end, &v);
+               if( !p )
+               {
+                    return false;
+               }
+               value += Telemetry::unzigzag(v);
+               Telemetry::setChannelValue(samples[i], ch, value);
+          }
+          p = end;
+     }
+     return true;
+}
@@ -0,0 +1,203 @@
+//------------------------------------------------------------------------------
+//   telemetry.h
+//
+//   モータ状態の記録(テレメトリ)ファイル
+//
+//   ファイル構造 (数値はすべてリトルエンディアン)
+//
+//   +----------------+
+//   | FileHeader     |  マジック "UTLM", バージョン, チャネル数, 記録開始時刻
+//   +----------------+
+//   | Block 0        |  BlockHeader + チャネル毎の圧縮列 (列指向)
+//   | Block 1        |
+//   | ...            |
+//   +----------------+
+//   | BlockIndex[n]  |  各ブロックの時刻範囲とファイルオフセット
+//   +----------------+
+//   | FileFooter     |  インデックスの位置とブロック数
+//   +----------------+
+//
+//   各チャネルの列は「先頭値 + 前回値との差分」を zig-zag 変換した上で
+//   可変長整数(varint)で格納する。位置や状態は連続するサンプル間でほとんど
+//   変化しないため，大半の値は１バイトに収まる。
+//
+//   正常にクローズされなかったファイル(フッタなし)は，ブロックを先頭から
+//   順に走査してインデックスを再構築する。
+//------------------------------------------------------------------------------
+#ifndef   TELEMETRY_H
+#define   TELEMETRY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+//------------------------------------------------------------------------------
+//   １サンプル分のデータ
+//------------------------------------------------------------------------------
+struct TelemetrySample
+{
+     uint64_t time;           // 記録開始からの経過時間(usec)
+     int32_t  position[3];    // ABS_POS (pulse)
+     int32_t  speed[3];       // 速度 (pulse/sec)
+     uint16_t status[3];      // STATUS レジスタ
+     uint8_t  alarm[3];       // アラームフラグ
+     uint8_t  gripper;        // グリッパー開度(%)
+
+     bool isInMotion(int axis) const { return (status[axis] & 0x0060) != 0; }
+     bool isInMotion() const { return isInMotion(0) || isInMotion(1) || isInMotion(2); }
+};
+
+//------------------------------------------------------------------------------
+class Telemetry
+{
+     public:
+          enum{
+               CH_TIME       = 0,
+               CH_POSITION   = 1,     // 1～3
+               CH_SPEED      = 4,     // 4～6
+               CH_STATUS     = 7,     // 7～9
+               CH_ALARM      = 10,    // 10～12
+               CH_GRIPPER    = 13,
+               NUM_CHANNELS  = 14
+          };
+          enum{ VERSION = 1 };
+          enum{ SAMPLES_PER_BLOCK = 1024 };
+
+          static const uint32_t FILE_MAGIC   = 0x4D4C5455;  // "UTLM"
+          static const uint32_t BLOCK_MAGIC  = 0x4B4C4254;  // "TBLK"
+          static const uint32_t FOOTER_MAGIC = 0x58444954;  // "TIDX"
+
+          struct FileHeader
+          {
+               uint32_t magic;
+               uint16_t version;
+               uint16_t channels;
+               uint64_t startTime;      // 記録開始時刻(UNIX時刻, usec)
+          };
+          struct BlockHeader
+          {
+               uint32_t magic;
+               uint32_t count;          // ブロック内のサンプル数
+               uint64_t firstTime;
+               uint64_t lastTime;
+               uint32_t length[NUM_CHANNELS];     // 各チャネル列のバイト数
+          };
+          struct BlockIndex
+          {
+               uint64_t firstTime;
+               uint64_t lastTime;
+               uint64_t offset;         // BlockHeader のファイル先頭からの位置
+               uint32_t count;
+               uint32_t reserved;
+          };
+          struct FileFooter
+          {
+               uint64_t indexOffset;
+               uint32_t numBlocks;
+               uint32_t magic;
+          };
+
+          static int64_t  getChannelValue(const TelemetrySample& s, int ch);
+          static void     setChannelValue(TelemetrySample& s, int ch, int64_t value);
+          static uint64_t zigzag(int64_t v){ return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+          static int64_t  unzigzag(uint64_t v){ return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+          static void     putVarint(std::vector<uint8_t>& buf, uint64_t v);
+          static const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint64_t *v);
+};
+
+//------------------------------------------------------------------------------
+//   記録
+//------------------------------------------------------------------------------
+class TelemetryWriter
+{
+     public:
+          enum{ MAX_PENDING = 16 };     // 書き出し待ちにできるブロック数 (超えた分は捨てる)
+          enum{ SPARE_BLOCKS = 4 };     // 最初に用意しておく入れ替え用のバッファ
+
+     private:
+          FILE *m_fp;                   // (書き出しスレッドが動いている間は書き出しスレッドのみ)
+          uint64_t m_offset;
+          std::atomic<bool> m_failed;   // 書き込みに失敗して記録をやめた
+          std::vector<TelemetrySample>      m_samples;     // 追記中のブロック (記録するスレッドのみ)
+          std::vector<Telemetry::BlockIndex> m_index;
+          std::vector<uint8_t>              m_column[Telemetry::NUM_CHANNELS];
+
+          std::deque< std::vector<TelemetrySample> >  m_pending;   // 書き出し待ちのブロック
+          std::vector< std::vector<TelemetrySample> > m_spare;     // 書き出し済みのバッファ
+          std::mutex               m_queueMutex;
+          std::condition_variable  m_queueCond;
+          bool                     m_closing;
+          uint32_t                 m_dropped;
+          std::thread             *m_thread;
+
+          void submitBlock(bool force);
+          void writerLoop();
+          bool writeBlock(const std::vector<TelemetrySample>& samples);
+
+     public:
+          TelemetryWriter();
+          ~TelemetryWriter();
+
+          bool open(const char *path);
+          bool append(const TelemetrySample& sample);
+          void close();
+          bool isOpened() const { return m_thread != nullptr; }
+          bool isFailed() const { return m_failed; }
+};
+
+//------------------------------------------------------------------------------
+//   読み出し (ファイル全体を mmap して参照する)
+//------------------------------------------------------------------------------
+class TelemetryReader
+{
+     private:
+          const uint8_t *m_data;
+          size_t         m_size;
+          Telemetry::FileHeader m_header;
+          std::vector<Telemetry::BlockIndex> m_index;
+
+          bool loadIndex();
+          bool rebuildIndex();
+          bool readBlockHeader(uint64_t offset, uint64_t limit, Telemetry::BlockHeader *header) const;
+
+     public:
+          TelemetryReader();
+          ~TelemetryReader();
+
+          bool open(const char *path);
+          void close();
+
+          uint64_t getStartTime() const { return m_header.startTime; }
+          int      getNumBlocks() const { return (int)m_index.size(); }
+          const Telemetry::BlockIndex& getBlockIndex(int n) const { return m_index[n]; }
+          uint64_t getNumSamples() const;
+          int      findBlock(uint64_t time) const;
+          bool     readBlock(int n, std::vector<TelemetrySample>& samples) const;
+
+          template<typename F> bool scan(uint64_t from, uint64_t to, F proc) const
+          {
+               std::vector<TelemetrySample> samples;
+               for( int n = findBlock(from) ; n < getNumBlocks() && m_index[n].firstTime <= to ; n++ )
+               {
+                    if( !readBlock(n, samples) )
+                    {
+                         return false;
+                    }
+                    for( size_t i = 0 ; i < samples.size() ; i++ )
+                    {
+                         if( samples[i].time < from ){ continue; }
+                         if( samples[i].time > to ){ return true; }
+                         proc(samples[i]);
+                    }
+               }
+               return true;
+          }
+};
+
+#endif
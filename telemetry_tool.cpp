@@ -0,0 +1,218 @@
+//------------------------------------------------------------------------------
+//   telemetry_tool.cpp
+//
+//   テレメトリファイルの参照ツール
+//
+//   usage:
+//     telemetry_tool info    <file>
+//     telemetry_tool csv     <file> [from(sec) [to(sec)]]
+//     telemetry_tool extract <file> <from(sec)> <to(sec)> <output file>
+//     telemetry_tool moves   <file> [from(sec) [to(sec)]]
+//------------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <algorithm>
+#include "telemetry.h"
+
+//------------------------------------------------------------------------------
+static void usage()
+{
+     std::fprintf(stderr,
+          "usage:\n"
+          "  telemetry_tool info    <file>\n"
+          "  telemetry_tool csv     <file> [from(sec) [to(sec)]]\n"
+          "  telemetry_tool extract <file> <from(sec)> <to(sec)> <output file>\n"
+          "  telemetry_tool moves   <file> [from(sec) [to(sec)]]\n");
+}
+
+//------------------------------------------------------------------------------
+static uint64_t secToUsec(const char *s)
+{
+     return (uint64_t)(std::atof(s) * 1000000.0);
+}
+
+//------------------------------------------------------------------------------
+static int cmdInfo(TelemetryReader& reader)
+{
+     time_t t = (time_t)(reader.getStartTime() / 1000000);
+     char buf[64];
+     strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+     std::printf("started  : %s\n", buf);
+     std::printf("blocks   : %d\n", reader.getNumBlocks());
+     std::printf("samples  : %llu\n", (unsigned long long)reader.getNumSamples());
+     if( reader.getNumBlocks() > 0 )
+     {
+          const Telemetry::BlockIndex& last = reader.getBlockIndex(reader.getNumBlocks()-1);
+          uint64_t samples = reader.getNumSamples();
+          double duration = last.lastTime / 1000000.0;
+          std::printf("duration : %.3f sec\n", duration);
+          if( duration > 0 )
+          {
+               std::printf("rate     : %.1f samples/sec\n", samples / duration);
+          }
+     }
+     return 0;
+}
+
+//------------------------------------------------------------------------------
+static int cmdCsv(TelemetryReader& reader, uint64_t from, uint64_t to)
+{
+     std::printf("time,pos0,pos1,pos2,spd0,spd1,spd2,sts0,sts1,sts2,alm0,alm1,alm2,gripper\n");
+     bool ok = reader.scan(from, to, [](const TelemetrySample& s){
+          std::printf("%.6f,%d,%d,%d,%d,%d,%d,0x%04X,0x%04X,0x%04X,0x%02X,0x%02X,0x%02X,%d\n",
+               s.time / 1000000.0,
+               s.position[0], s.position[1], s.position[2],
+               s.speed[0], s.speed[1], s.speed[2],
+               s.status[0], s.status[1], s.status[2],
+               s.alarm[0], s.alarm[1], s.alarm[2],
+               s.gripper);
+     });
+     return ok? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+static int cmdExtract(TelemetryReader& reader, uint64_t from, uint64_t to, const char *path)
+{
+     TelemetryWriter writer;
+     if( !writer.open(path) )
+     {
+          return 1;
+     }
+     bool ok = reader.scan(from, to, [&writer, from](const TelemetrySample& s){
+          TelemetrySample t = s;
+          t.time -= from;
+          writer.append(t);
+     });
+     writer.close();
+     return ok? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+//   移動(いずれかの軸が動作中である区間)ごとの統計
+//
+//   cycle  : 移動開始から全軸停止までの時間
+//   peak   : 各軸の最大速度 (pulse/sec)
+//   settle : 全軸の速度がピークの5%を下回ってから，停止判定されるまでの時間
+//------------------------------------------------------------------------------
+class MoveAnalyzer
+{
+     private:
+          bool     m_moving;
+          int      m_count;
+          uint64_t m_start;
+          int32_t  m_peak[3];
+          std::vector<TelemetrySample> m_window;
+
+          void finish(uint64_t end)
+          {
+               // ピーク確定後に，ピークの5%を超えていた最後の時刻を求める
+               uint64_t lastFast = m_start;
+               for( size_t n = 0 ; n < m_window.size() ; n++ )
+               {
+                    for( int axis = 0 ; axis < 3 ; axis++ )
+                    {
+                         if( std::abs(m_window[n].speed[axis]) * 20 > m_peak[axis] && m_peak[axis] > 0 )
+                         {
+                              lastFast = m_window[n].time;
+                         }
+                    }
+               }
+               m_count++;
+               std::printf("%d,%.3f,%.1f,%d,%d,%d,%.1f\n", m_count,
+                    m_start / 1000000.0, (end - m_start) / 1000.0,
+                    m_peak[0], m_peak[1], m_peak[2],
+                    (end - lastFast) / 1000.0);
+          }
+
+     public:
+          MoveAnalyzer() : m_moving(false), m_count(0), m_start(0)
+          {
+               std::printf("move,start(sec),cycle(ms),peak0,peak1,peak2,settle(ms)\n");
+          }
+          int count() const { return m_count; }
+          void push(const TelemetrySample& s)
+          {
+               bool moving = s.isInMotion();
+               if( moving && !m_moving )
+               {
+                    m_start = s.time;
+                    m_peak[0] = m_peak[1] = m_peak[2] = 0;
+                    m_window.clear();
+               }
+               if( moving )
+               {
+                    for( int axis = 0 ; axis < 3 ; axis++ )
+                    {
+                         m_peak[axis] = std::max(m_peak[axis], std::abs(s.speed[axis]));
+                    }
+                    m_window.push_back(s);
+               }
+               if( !moving && m_moving )
+               {
+                    finish(s.time);
+               }
+               m_moving = moving;
+          }
+};
+
+//------------------------------------------------------------------------------
+static int cmdMoves(TelemetryReader& reader, uint64_t from, uint64_t to)
+{
+     MoveAnalyzer analyzer;
+     bool ok = reader.scan(from, to, [&analyzer](const TelemetrySample& s){
+          analyzer.push(s);
+     });
+     std::fprintf(stderr, "%d move(s)\n", analyzer.count());
+     return ok? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+     if( argc < 3 )
+     {
+          usage();
+          return 1;
+     }
+
+     TelemetryReader reader;
+     if( !reader.open(argv[2]) )
+     {
+          return 1;
+     }
+
+     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+     uint64_t from = (argc > 3)? secToUsec(argv[3]) : 0;
+     uint64_t to = (argc > 4)? secToUsec(argv[4]) : UINT64_MAX;
+     int ret;
+
+     if( strcmp(argv[1], "info") == 0 )
+     {
+          ret = cmdInfo(reader);
+     }
+     else if( strcmp(argv[1], "csv") == 0 )
+     {
+          ret = cmdCsv(reader, from, to);
+     }
+     else if( strcmp(argv[1], "extract") == 0 && argc >= 6 )
+     {
+          ret = cmdExtract(reader, from, to, argv[5]);
+     }
+     else if( strcmp(argv[1], "moves") == 0 )
+     {
+          ret = cmdMoves(reader, from, to);
+     }
+     else
+     {
+          usage();
+          return 1;
+     }
+
+     std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+     std::fprintf(stderr, "%.3f sec elapsed.\n", elapsed.count());
+     return ret;
+}
@@ -0,0 +1,165 @@
+//------------------------------------------------------------------------------
+//   virtual_robot.cpp
+//------------------------------------------------------------------------------
+#include <cstdlib>
+#include <algorithm>
+#include "virtual_robot.h"
+#include "robot.h"
+
+const double VirtualRobot::DETECT_DELAY = 0.015;
+
+//------------------------------------------------------------------------------
+VirtualRobot::VirtualRobot()
+     : m_time(0), m_onPath(false), m_motionStart(0), m_motionEnd(0), m_feedOverride(100),
+     m_gripperStart(Robot::SERVO_MAX_VALUE), m_gripperDest(Robot::SERVO_MAX_VALUE), m_gripperStartTime(0)
+{
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_acc[axis] = m_dec[axis] = 0x12;
+     }
+}
+
+//------------------------------------------------------------------------------
+//   実機の現在の状態から仮想時刻 0 を開始する
+//   position : 各軸の位置(pulse)
+//   gripper  : サーボ値
+//   feedOverride : 送り速度オーバーライド(%)
+//   acc, dec : 各軸の ACC / DEC の既定値
+//------------------------------------------------------------------------------
+void VirtualRobot::reset(const int32_t position[3], int gripper, int feedOverride, const uint32_t acc[3], const uint32_t dec[3])
+{
+     m_time = 0;
+     m_motionStart = m_motionEnd = 0;
+     m_onPath = false;
+     m_feedOverride = feedOverride;
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_acc[axis] = acc[axis];
+          m_dec[axis] = dec[axis];
+          m_plan[axis].planByRegister(position[axis], position[axis], Robot::MAX_SPEED_3D, acc[axis], dec[axis]);
+     }
+     m_gripperStart = m_gripperDest = gripper;
+     m_gripperStartTime = 0;
+}
+
+//------------------------------------------------------------------------------
+//   Robot::startMotion3D() と同じ規則で３軸を同時に動かす
+//   移動中であれば false (実機でも移動を開始できない)
+//------------------------------------------------------------------------------
+bool VirtualRobot::startMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed, double accel, int unit, double *duration)
+{
+     *duration = 0;
+     if( isInMotion() )
+     {
+          return false;
+     }
+
+     int32_t destpos[3] = { base, shoulder, elbow };
+     int32_t abspos[3];
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          abspos[axis] = getMotorPosition(axis);
+     }
+     MotionRegister reg[3];
+     if( Robot::computeMotion3D(abspos, destpos, speed, accel, unit, m_feedOverride, m_acc, m_dec, reg) == 0 )
+     {
+          return true;
+     }
+
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          m_plan[axis].planByRegister(abspos[axis], destpos[axis], reg[axis].maxSpeed, reg[axis].acc, reg[axis].dec);
+          *duration = std::max(*duration, m_plan[axis].getDuration());
+     }
+     m_onPath = false;
+     m_motionStart = m_time;
+     m_motionEnd = m_time + *duration;
+     return true;
+}
+
+//------------------------------------------------------------------------------
+//   Robot::queueMotion() と同じく，移動中であれば今の移動の完了 (の検出) 後に開始する
+//   仮想時刻は進めない。前の移動の終了までの getMotorPosition() は，前の移動の移動先を返す
+//   start : 移動を開始する仮想時刻
+//------------------------------------------------------------------------------
+bool VirtualRobot::queueMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed, double accel, int unit,
+     double *start, double *duration)
+{
+     double now = m_time;
+     if( isInMotion() )
+     {
+          m_time = m_motionEnd + DETECT_DELAY;
+     }
+     *start = m_time;
+     bool ok = startMotion3D(base, shoulder, elbow, speed, accel, unit, duration);
+     m_time = now;
+     return ok;
+}
+
+//------------------------------------------------------------------------------
+//   Robot::startPath() と同じ規則で連続軌道を動かす
+//   (実機の最後の停止と位置合わせの時間は含まない)
+//------------------------------------------------------------------------------
+bool VirtualRobot::startPath(const std::vector<MotionTarget>& path, double *duration)
+{
+     *duration = 0;
+     if( isInMotion() )
+     {
+          return false;
+     }
+
+     int32_t abspos[3];
+     for( int axis = 0 ; axis < 3 ; axis++ )
+     {
+          abspos[axis] = getMotorPosition(axis);
+     }
+     PathProfile plan;
+     if( !Robot::planPath(abspos, path, m_feedOverride, m_acc, m_dec, &plan) )
+     {
+          return true;
+     }
+     m_path = plan;
+     m_onPath = true;
+     *duration = m_path.getDuration();
+     m_motionStart = m_time;
+     m_motionEnd = m_time + *duration;
+     return true;
+}
+
+//------------------------------------------------------------------------------
+int32_t VirtualRobot::getMotorPosition(int axis) const
+{
+     if( m_onPath )
+     {
+          return m_path.getPosition(axis, m_time - m_motionStart);
+     }
+     return m_plan[axis].getPosition(m_time - m_motionStart);
+}
+
+//------------------------------------------------------------------------------
+//   Robot::moveGripper() と同じく，SERVO_STEP_MS ごとに１ずつ目標値へ近づける
+//------------------------------------------------------------------------------
+void VirtualRobot::moveGripper(uint8_t value)
+{
+     value = (value > 100)? 100 : value;
+     m_gripperStart = getGripperServoValue();
+     m_gripperStartTime = m_time;
+     m_gripperDest = Robot::SERVO_MIN_VALUE + (Robot::SERVO_MAX_VALUE - Robot::SERVO_MIN_VALUE)*value/100;
+}
+
+//------------------------------------------------------------------------------
+int VirtualRobot::getGripperServoValue() const
+{
+     int steps = (int)((m_time - m_gripperStartTime) * 1000 / Robot::SERVO_STEP_MS);
+     if( steps >= std::abs(m_gripperDest - m_gripperStart) )
+     {
+          return m_gripperDest;
+     }
+     return (m_gripperDest > m_gripperStart)? m_gripperStart + steps : m_gripperStart - steps;
+}
+
+//------------------------------------------------------------------------------
+double VirtualRobot::getGripperEndTime() const
+{
+     return m_gripperStartTime + std::abs(m_gripperDest - m_gripperStart) * Robot::SERVO_STEP_MS / 1000.0;
+}
@@ -0,0 +1,59 @@
+//------------------------------------------------------------------------------
+//   virtual_robot.h
+//
+//   スクリプトの試運転(dry-run)用の仮想ロボット
+//   実機と同じ速度プロファイル計算(ACC / DEC / MAX_SPEED，3軸同時到着，
+//   グリッパーのランプ)で，仮想時刻における各軸の位置を求める
+//------------------------------------------------------------------------------
+#ifndef   VIRTUAL_ROBOT_H
+#define   VIRTUAL_ROBOT_H
+
+#include <cstdint>
+#include <vector>
+#include "motion_profile.h"
+#include "path_profile.h"
+
+struct MotionTarget;
+
+//------------------------------------------------------------------------------
+class VirtualRobot
+{
+     public:
+          // 動作完了から isInMotion() が false になるまでの遅れ
+          // (実機ではモーション監視スレッドが 30ms 周期で状態を更新するので，その平均)
+          static const double DETECT_DELAY;
+
+     private:
+          double        m_time;             // 仮想時刻(sec)
+          MotionProfile m_plan[3];
+          PathProfile   m_path;
+          bool          m_onPath;           // 最後の移動が連続軌道 (m_plan ではなく m_path で動く)
+          double        m_motionStart;
+          double        m_motionEnd;
+          int           m_feedOverride;
+          uint32_t      m_acc[3];
+          uint32_t      m_dec[3];
+          int           m_gripperStart;     // ランプ開始時のサーボ値
+          int           m_gripperDest;
+          double        m_gripperStartTime;
+
+     public:
+          VirtualRobot();
+          void reset(const int32_t position[3], int gripper, int feedOverride, const uint32_t acc[3], const uint32_t dec[3]);
+
+          double getTime() const { return m_time; }
+          void   advance(double sec){ m_time += sec; }
+
+          bool    startMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed, double accel, int unit, double *duration);
+          bool    queueMotion3D(int32_t base, int32_t shoulder, int32_t elbow, double speed, double accel, int unit, double *start, double *duration);
+          bool    startPath(const std::vector<MotionTarget>& path, double *duration);
+          bool    isInMotion() const { return m_motionEnd > m_motionStart && m_time < m_motionEnd + DETECT_DELAY; }
+          double  getMotionEndTime() const { return m_motionEnd; }
+          int32_t getMotorPosition(int axis) const;
+
+          void   moveGripper(uint8_t value);
+          int    getGripperServoValue() const;
+          double getGripperEndTime() const;
+};
+
+#endif